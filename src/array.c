@@ -9,24 +9,74 @@
 #include "array.h"
 #include "buffer.h"
 
+/* up to this many entries the hashes are scanned, beyond an index is kept */
+#define ARRAY_LINEAR_MAX 8
+
 array *array_init(void) {
 	array *a;
 
 	a = calloc(1, sizeof(*a));
 	assert(a);
 
-	a->next_power_of_2 = 1;
-
 	return a;
 }
 
+/**
+ * the hash of a key, the same for all spellings of upper- and lowercase
+ *
+ * FNV-1a over the characters with the case-bit set
+ */
+unsigned int array_hash_key(const char *key, size_t keylen) {
+	unsigned int h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < keylen; i++) {
+		h ^= (unsigned char)key[i] | 0x20;
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+static void array_index_insert(array *a, size_t ndx) {
+	size_t mask = a->index_size - 1;
+	size_t slot;
+
+	for (slot = a->hashes[ndx] & mask; a->index[slot] != -1; slot = (slot + 1) & mask);
+
+	a->index[slot] = ndx;
+}
+
+/**
+ * (re)build the index for the used entries, keeping it at most half full
+ */
+static void array_index_build(array *a) {
+	size_t i;
+
+	if (a->used <= ARRAY_LINEAR_MAX && a->index_size == 0) return;
+
+	if (a->index_size < 2 * a->used) {
+		if (a->index_size == 0) a->index_size = 4 * ARRAY_LINEAR_MAX;
+		while (a->index_size < 2 * a->used) a->index_size <<= 1;
+
+		free(a->index);
+		a->index = malloc(sizeof(*a->index) * a->index_size);
+		assert(a->index);
+	}
+
+	memset(a->index, -1, sizeof(*a->index) * a->index_size);
+
+	for (i = 0; i < a->used; i++) {
+		array_index_insert(a, i);
+	}
+}
+
 array *array_init_array(array *src) {
 	size_t i;
 	array *a = array_init();
 
 	a->used = src->used;
 	a->size = src->size;
-	a->next_power_of_2 = src->next_power_of_2;
 	a->unique_ndx = src->unique_ndx;
 
 	a->data = malloc(sizeof(*src->data) * src->size);
@@ -35,8 +85,11 @@ array *array_init_array(array *src) {
 		else a->data[i] = NULL;
 	}
 
-	a->sorted = malloc(sizeof(*src->sorted)   * src->size);
-	memcpy(a->sorted, src->sorted, sizeof(*src->sorted)   * src->size);
+	a->hashes = malloc(sizeof(*src->hashes) * src->size);
+	memcpy(a->hashes, src->hashes, sizeof(*src->hashes) * src->size);
+
+	array_index_build(a);
+
 	return a;
 }
 
@@ -51,7 +104,8 @@ void array_free(array *a) {
 	}
 
 	if (a->data) free(a->data);
-	if (a->sorted) free(a->sorted);
+	if (a->hashes) free(a->hashes);
+	if (a->index) free(a->index);
 
 	free(a);
 }
@@ -66,6 +120,10 @@ void array_reset(array *a) {
 		}
 	}
 
+	if (a->index && a->used) {
+		memset(a->index, -1, sizeof(*a->index) * a->index_size);
+	}
+
 	a->used = 0;
 }
 
@@ -78,48 +136,55 @@ data_unset *array_pop(array *a) {
 	du = a->data[a->used];
 	a->data[a->used] = NULL;
 
+	if (a->index) array_index_build(a);
+
 	return du;
 }
 
-static int array_get_index(array *a, const char *key, size_t keylen, int *rndx) {
-	int ndx = -1;
-	int i, pos = 0;
+static int array_get_index(array *a, const char *key, size_t keylen, unsigned int hash) {
+	size_t i;
 
 	if (key == NULL) return -1;
 
-	/* try to find the string */
-	for (i = pos = a->next_power_of_2 / 2; ; i >>= 1) {
-		int cmp;
+	if (a->index_size == 0) {
+		for (i = 0; i < a->used; i++) {
+			buffer *k = a->data[i]->key;
 
-		if (pos < 0) {
-			pos += i;
-		} else if (pos >= (int)a->used) {
-			pos -= i;
-		} else {
-			cmp = buffer_caseless_compare(key, keylen, a->data[a->sorted[pos]]->key->ptr, a->data[a->sorted[pos]]->key->used);
+			if (a->hashes[i] == hash &&
+			    k->used == keylen + 1 &&
+			    0 == buffer_caseless_compare(key, keylen, k->ptr, keylen)) {
+				return i;
+			}
+		}
+	} else {
+		size_t mask = a->index_size - 1;
 
-			if (cmp == 0) {
-				/* found */
-				ndx = a->sorted[pos];
-				break;
-			} else if (cmp < 0) {
-				pos -= i;
-			} else {
-				pos += i;
+		for (i = hash & mask; a->index[i] != -1; i = (i + 1) & mask) {
+			int ndx = a->index[i];
+			buffer *k = a->data[ndx]->key;
+
+			if (a->hashes[ndx] == hash &&
+			    k->used == keylen + 1 &&
+			    0 == buffer_caseless_compare(key, keylen, k->ptr, keylen)) {
+				return ndx;
 			}
 		}
-		if (i == 0) break;
 	}
 
-	if (rndx) *rndx = pos;
-
-	return ndx;
+	return -1;
 }
 
 data_unset *array_get_element(array *a, const char *key, size_t keylen) {
+	return array_get_element_hashed(a, key, keylen, array_hash_key(key, keylen));
+}
+
+/**
+ * look up a key whose hash the caller has computed in advance
+ */
+data_unset *array_get_element_hashed(array *a, const char *key, size_t keylen, unsigned int hash) {
 	int ndx;
 
-	if (-1 != (ndx = array_get_index(a, key, keylen + 1, NULL))) {
+	if (-1 != (ndx = array_get_index(a, key, keylen, hash))) {
 		/* found, leave here */
 
 		return a->data[ndx];
@@ -128,6 +193,30 @@ data_unset *array_get_element(array *a, const char *key, size_t keylen) {
 	return NULL;
 }
 
+static int array_keycmp(const void *_a, const void *_b) {
+	const data_unset *a = *(data_unset * const *)_a;
+	const data_unset *b = *(data_unset * const *)_b;
+
+	return buffer_caseless_compare(CONST_BUF_LEN(a->key), CONST_BUF_LEN(b->key));
+}
+
+/**
+ * the entries ordered by their keys, for listing them
+ *
+ * the array itself is kept in insertion order, free() the result
+ */
+data_unset **array_get_sorted(array *a) {
+	data_unset **sorted;
+
+	sorted = malloc(sizeof(*sorted) * (a->used ? a->used : 1));
+	assert(sorted);
+
+	if (a->used) memcpy(sorted, a->data, sizeof(*sorted) * a->used);
+	qsort(sorted, a->used, sizeof(*sorted), array_keycmp);
+
+	return sorted;
+}
+
 data_unset *array_get_unused_element(array *a, data_type_t t) {
 	data_unset *ds = NULL;
 
@@ -179,7 +268,8 @@ void array_append_key_value(array *hdrs, const char *key, size_t key_len, const
 data_unset *array_replace(array *a, data_unset *du) {
 	int ndx;
 
-	if (-1 == (ndx = array_get_index(a, du->key->ptr, du->key->used, NULL))) {
+	if (du->key->used == 0 ||
+	    -1 == (ndx = array_get_index(a, du->key->ptr, du->key->used - 1, array_hash_key(CONST_BUF_LEN(du->key))))) {
 		array_insert_unique(a, du);
 		return NULL;
 	} else {
@@ -191,7 +281,7 @@ data_unset *array_replace(array *a, data_unset *du) {
 
 int array_insert_unique(array *a, data_unset *str) {
 	int ndx = -1;
-	int pos = 0;
+	unsigned int hash;
 	size_t j;
 
 	/* generate unique index if necessary */
@@ -200,8 +290,10 @@ int array_insert_unique(array *a, data_unset *str) {
 		str->is_index_key = 1;
 	}
 
+	hash = array_hash_key(CONST_BUF_LEN(str->key));
+
 	/* try to find the string */
-	if (-1 != (ndx = array_get_index(a, str->key->ptr, str->key->used, &pos))) {
+	if (-1 != (ndx = array_get_index(a, str->key->ptr, str->key->used - 1, hash))) {
 		/* found, leave here */
 		if (a->data[ndx]->type == str->type) {
 			str->insert_dup(a->data[ndx], str);
@@ -221,39 +313,34 @@ int array_insert_unique(array *a, data_unset *str) {
 	if (a->size == 0) {
 		a->size   = 16;
 		a->data   = malloc(sizeof(*a->data)     * a->size);
-		a->sorted = malloc(sizeof(*a->sorted)   * a->size);
+		a->hashes = malloc(sizeof(*a->hashes)   * a->size);
 		assert(a->data);
-		assert(a->sorted);
+		assert(a->hashes);
 		for (j = a->used; j < a->size; j++) a->data[j] = NULL;
 	} else if (a->size == a->used) {
 		a->size  += 16;
 		a->data   = realloc(a->data,   sizeof(*a->data)   * a->size);
-		a->sorted = realloc(a->sorted, sizeof(*a->sorted) * a->size);
+		a->hashes = realloc(a->hashes, sizeof(*a->hashes) * a->size);
 		assert(a->data);
-		assert(a->sorted);
+		assert(a->hashes);
 		for (j = a->used; j < a->size; j++) a->data[j] = NULL;
 	}
 
 	ndx = (int) a->used;
 
-	a->data[a->used++] = str;
-
-	if (pos != ndx &&
-	    ((pos < 0) ||
-	     buffer_caseless_compare(str->key->ptr, str->key->used, a->data[a->sorted[pos]]->key->ptr, a->data[a->sorted[pos]]->key->used) > 0)) {
-		pos++;
-	}
+	a->data[a->used] = str;
+	a->hashes[a->used] = hash;
+	a->used++;
 
-	/* move everything one step to the right */
-	if (pos != ndx) {
-		memmove(a->sorted + (pos + 1), a->sorted + (pos), (ndx - pos) * sizeof(*a->sorted));
+	if (a->index_size == 0) {
+		/* small arrays are scanned */
+		if (a->used > ARRAY_LINEAR_MAX) array_index_build(a);
+	} else if (2 * a->used > a->index_size) {
+		array_index_build(a);
+	} else {
+		array_index_insert(a, ndx);
 	}
 
-	/* insert */
-	a->sorted[pos] = ndx;
-
-	if (a->next_power_of_2 == (size_t)ndx) a->next_power_of_2 <<= 1;
-
 	return 0;
 }
 
@@ -32,14 +32,15 @@ typedef struct data_unset {
 typedef struct {
 	data_unset  **data;
 
-	size_t *sorted;
+	unsigned int *hashes; /* caseless hash of the key of each entry, see array_hash_key() */
+	int *index;           /* hash -> position in data, open addressing, -1 is empty */
+	size_t index_size;    /* 0 as long as the array is small enough to be scanned */
 
 	size_t used;
 	size_t size;
 
 	size_t unique_ndx;
 
-	size_t next_power_of_2;
 	int is_weakref; /* data is weakref, don't bother the data */
 } array;
 
@@ -55,6 +56,8 @@ typedef struct {
 	DATA_UNSET;
 
 	buffer *value;
+
+	int header_id; /* http_header_t of the key if it is a HTTP header, see http_header.h */
 } data_string;
 
 LI_API data_string* data_string_init(void);
@@ -150,6 +153,9 @@ LI_API data_unset* array_pop(array *a);
 LI_API int array_print(array *a, int depth);
 LI_API data_unset* array_get_unused_element(array *a, data_type_t t);
 LI_API data_unset* array_get_element(array *a, const char *key, size_t key_len);
+LI_API data_unset* array_get_element_hashed(array *a, const char *key, size_t key_len, unsigned int hash);
+LI_API unsigned int array_hash_key(const char *key, size_t key_len);
+LI_API data_unset** array_get_sorted(array *a);
 LI_API void array_set_key_value(array *hdrs, const char *key, size_t key_len, const char *value, size_t val_len);
 LI_API void array_append_key_value(array *hdrs, const char *key, size_t key_len, const char *value, size_t val_len);
 LI_API data_unset* array_replace(array *a, data_unset *du);
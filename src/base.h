@@ -34,6 +34,7 @@
 #include "sys-socket.h"
 #include "http_req.h"
 #include "etag.h"
+#include "mimetype.h"
 
 #if defined HAVE_LIBSSL && defined HAVE_OPENSSL_SSL_H
 # define USE_OPENSSL
@@ -209,6 +210,12 @@ typedef struct {
 	enum {
 		HTTP_TRANSFER_ENCODING_IDENTITY, HTTP_TRANSFER_ENCODING_CHUNKED
 	} transfer_encoding;
+
+	enum {
+		HTTP_CHUNKED_PASSTHROUGH_NONE,
+		HTTP_CHUNKED_PASSTHROUGH_OFFERED, /* the handler can forward the content chunk-encoded as the backend sent it */
+		HTTP_CHUNKED_PASSTHROUGH_ACTIVE   /* mod_chunked took the offer, the content is chunk-encoded already */
+	} chunked_passthrough;
 } response;
 
 typedef struct {
@@ -273,14 +280,30 @@ typedef struct {
 #endif
 } stat_cache;
 
+/**
+ * token-bucket of the traffic-shaper
+ *
+ * refilled with kbytes_per_second * 1024 bytes/s on each use, up to a
+ * burst of NETWORK_SHAPER_BURST_MS. Writes take their bytes out, the
+ * connection waits in srv->throttled while it is empty.
+ */
+typedef struct {
+	off_t tokens;
+
+	time_t refill_sec; /* time of the last refill, 0 if not used yet */
+	int refill_msec;
+} traffic_bucket;
+
 typedef struct {
 	array *mimetypes;
+	mimetype_table *mimetype_table;
 
 	/* virtual-servers */
 	buffer *document_root;
 	buffer *server_name;
 	buffer *error_handler;
 	buffer *server_tag;
+	buffer *server_tag_line; /* "\r\nServer: <server_tag>", built at config load */
 	buffer *dirlist_encoding;
 	buffer *errorfile_prefix;
 
@@ -292,6 +315,7 @@ typedef struct {
 	unsigned short use_xattr;
 	unsigned short follow_symlink;
 	unsigned short range_requests;
+	unsigned short stream_request_body;
 
 	/* debug */
 
@@ -310,6 +334,10 @@ typedef struct {
 	buffer *ssl_ca_file;
 	buffer *ssl_cipher_list;
 	unsigned short ssl_use_sslv2;
+	unsigned short ssl_use_ktls;
+	unsigned short ssl_session_cache_size;
+	unsigned short ssl_session_timeout;
+	unsigned short ssl_session_tickets;
 	unsigned short ssl_verifyclient;
 	unsigned short ssl_verifyclient_enforce;
 	unsigned short ssl_verifyclient_depth;
@@ -330,21 +358,14 @@ typedef struct {
 	/* configside */
 	unsigned short global_kbytes_per_second; /*  */
 
-	off_t  global_bytes_per_second_cnt;
+	traffic_bucket global_bucket;
 	/* server-wide traffic-shaper
 	 *
-	 * each context has the counter which is inited once
-	 * per second by the global_kbytes_per_second config-var
-	 *
-	 * as soon as global_kbytes_per_second gets below 0
-	 * the connected conns are "offline" a little bit
-	 *
-	 * the problem:
-	 * we somehow have to lose our "we are writable" signal
-	 * on the way.
-	 *
+	 * each context which sets server.kbytes-per-second has its own bucket,
+	 * the connections of a context share it. The bucket of the global
+	 * context limits all connections on top of that.
 	 */
-	off_t *global_bytes_per_second_cnt_ptr; /*  */
+	traffic_bucket *global_bucket_ptr;
 
 #ifdef USE_OPENSSL
 	SSL_CTX *ssl_ctx;
@@ -409,6 +430,7 @@ typedef struct {
 	int keep_alive_idle;         /* remember max_keep_alive_idle from config */
 
 	int file_started;
+	int stream_request_body;     /* the handler forwards the request-content while it arrives */
 
 	chunkqueue *send;            /* the response-content before filters are applied */
 	chunkqueue *recv;            /* the request-content, without encoding */
@@ -417,7 +439,8 @@ typedef struct {
 	chunkqueue *send_raw;        /* the full response (HTTP-Header + compression + chunking ) */
 	chunkqueue *recv_raw;        /* the full request (HTTP-Header + chunking ) */
 
-	int traffic_limit_reached;
+	int traffic_limit_reached;   /* waiting in srv->throttled */
+	traffic_bucket traffic_bucket; /* connection.kbytes-per-second */
 
 	off_t bytes_written;          /* used by mod_accesslog, mod_rrd */
 	off_t bytes_written_cur_second; /* used by mod_accesslog, mod_rrd */
@@ -427,7 +450,7 @@ typedef struct {
 	int http_status;
 
 	sock_addr dst_addr;
-	buffer *dst_addr_buf;
+	buffer *dst_addr_buf; /* filled on demand, use connection_get_dst_addr_buf() */
 
 	/* request */
 	buffer *parse_request;
@@ -541,13 +564,20 @@ typedef struct {
 	buffer *network_backend;
 	array *modules;
 	array *upload_tempdirs;
+	unsigned short upload_segment_size; /* in kbyte */
 
 	unsigned short use_noatime;
 
 	unsigned short max_worker;
+	unsigned short worker_reuseport;
+	unsigned short worker_cpu_affinity;
 	unsigned short max_fds;
 	unsigned short max_conns;
+	unsigned short max_accept;
+	unsigned short ssl_ticket_key_rotate;
+	unsigned short max_ssl_handshake_threads;
 	unsigned int max_request_size;
+	unsigned short zerocopy_min_size; /* in kbyte, 0 to never use MSG_ZEROCOPY */
 
 	unsigned short log_request_header_on_error;
 	unsigned short log_state_handling;
@@ -602,6 +632,8 @@ typedef struct {
 	unsigned short use_ipv6;
 	unsigned short is_ssl;
 
+	int worker_ndx;        /* server.worker-reuseport: the worker owning this socket, -1 if shared */
+
 	buffer *srv_token;
 
 #ifdef USE_OPENSSL
@@ -663,6 +695,8 @@ typedef struct server {
 	time_t last_generated_debug_ts;
 	time_t startup_ts;
 
+	uint64_t loop_busy_usec; /* wall-clock time the main-loop spent outside of fdevent_poll() */
+
 	char entropy[8]; /* from /dev/[u]random if possible, otherwise rand() */
 	char is_real_entropy; /* whether entropy is from /dev/[u]random */
 
@@ -685,6 +719,11 @@ typedef struct server {
 	connections *joblist;
 	connections *joblist_prev;
 	connections *fdwaitqueue;
+	connections *throttled;    /* connections waiting for tokens of the traffic-shaper */
+	size_t throttled_rr;       /* round-robin start in throttled */
+	size_t throttled_waking;   /* connections network_shaper_run() has still to wake up */
+	time_t throttled_sec;      /* last run of the traffic-shaper */
+	int throttled_msec;
 
 	stat_cache  *stat_cache;
 
@@ -715,12 +754,15 @@ typedef struct server {
 	GAsyncQueue *stat_queue; /* send a stat_job into this queue and joblist_queue will get a wakeup when the stat is finished */
 	GAsyncQueue *joblist_queue;
 	GAsyncQueue *aio_write_queue;
+	GAsyncQueue *ssl_handshake_queue; /* connections waiting for a ssl handshake step in a thread */
 
 	int did_wakeup;
 	int wakeup_pipe[2];
 	iosocket *wakeup_iosocket;
 #endif
 	network_backend_t network_backend;
+	int network_backend_msg_more; /* writev_mem() may flag MEM_CHUNKs followed by a FILE_CHUNK with MSG_MORE */
+	int worker_ndx;  /* slot of this process in server.max-worker, -1 if not forked */
 	int is_shutdown;
 } server;
 
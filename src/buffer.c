@@ -25,6 +25,7 @@ buffer* buffer_init(void) {
 	b->ptr = NULL;
 	b->size = 0;
 	b->used = 0;
+	b->block = NULL;
 
 	return b;
 }
@@ -40,16 +41,44 @@ buffer *buffer_init_buffer(buffer *src) {
  *
  */
 
+static void buffer_block_unref(buffer_block *blk) {
+	if (--blk->ref) return;
+
+	free(blk->ptr);
+	free(blk);
+}
+
+/**
+ * turn a shared view back into an empty buffer without touching the block
+ */
+static void buffer_drop_view(buffer *b) {
+	buffer_block_unref(b->block);
+
+	b->block = NULL;
+	b->ptr = NULL;
+	b->size = 0;
+	b->used = 0;
+}
+
 void buffer_free(buffer *b) {
 	if (!b) return;
 
-	free(b->ptr);
+	if (b->block) {
+		buffer_block_unref(b->block);
+	} else {
+		free(b->ptr);
+	}
 	free(b);
 }
 
 void buffer_reset(buffer *b) {
 	if (!b) return;
 
+	if (b->block) {
+		buffer_drop_view(b);
+		return;
+	}
+
 	/* limit don't reuse buffer larger than ... bytes */
 	if (b->size > BUFFER_MAX_REUSE_SIZE) {
 		free(b->ptr);
@@ -75,6 +104,9 @@ void buffer_reset(buffer *b) {
 int buffer_prepare_copy(buffer *b, size_t size) {
 	if (!b) return -1;
 
+	/* the old content is not needed, let the others keep the block */
+	if (b->block) buffer_drop_view(b);
+
 	if ((0 == b->size) ||
 	    (size >= b->size)) {
 		if (b->size) free(b->ptr);
@@ -102,6 +134,14 @@ int buffer_prepare_copy(buffer *b, size_t size) {
 int buffer_prepare_append(buffer *b, size_t size) {
 	if (!b) return -1;
 
+	if (b->block) {
+		if (b->used == 0) {
+			buffer_drop_view(b);
+		} else {
+			buffer_unshare(b);
+		}
+	}
+
 	if (0 == b->size) {
 		b->size = size;
 
@@ -123,6 +163,93 @@ int buffer_prepare_append(buffer *b, size_t size) {
 	return 0;
 }
 
+/**
+ * let @dst look at @len bytes of @src starting at @offset without copying
+ *
+ * the memory of @src is moved into a refcounted block on the first call, @src
+ * and @dst stay views into it until they are written to: every write goes
+ * through buffer_prepare_*() which copies the content out first (copy-on-write).
+ *
+ * a slice which doesn't reach the end of @src is NOT \0-terminated, use
+ * ->used - 1 as length, never treat it as a C-string.
+ */
+int buffer_share(buffer *dst, buffer *src, size_t offset, size_t len) {
+	buffer_block *blk;
+
+	if (!dst || !src || dst == src) return -1;
+	if (src->used == 0 || offset + len > src->used - 1) return -1;
+
+	if (NULL == (blk = src->block)) {
+		blk = malloc(sizeof(*blk));
+		assert(blk);
+
+		blk->ptr = src->ptr;
+		blk->size = src->size;
+		blk->ref = 1;
+
+		src->block = blk;
+		src->size = 0;
+	}
+
+	if (dst->block) {
+		buffer_block_unref(dst->block);
+	} else {
+		free(dst->ptr);
+	}
+
+	blk->ref++;
+
+	dst->block = blk;
+	dst->ptr = src->ptr + offset;
+	dst->size = 0;
+	dst->used = len + 1;
+
+	return 0;
+}
+
+/**
+ * give a shared buffer its own copy of the content
+ */
+int buffer_unshare(buffer *b) {
+	buffer_block *blk;
+	char *p;
+	size_t size;
+
+	if (!b) return -1;
+	if (NULL == (blk = b->block)) return 0;
+
+	size = b->used + 1;
+	size += BUFFER_PIECE_SIZE - (size % BUFFER_PIECE_SIZE);
+
+	p = malloc(size);
+	assert(p);
+
+	if (b->used) {
+		memcpy(p, b->ptr, b->used - 1);
+		p[b->used - 1] = '\0';
+	}
+
+	buffer_block_unref(blk);
+
+	b->block = NULL;
+	b->ptr = p;
+	b->size = size;
+
+	return 0;
+}
+
+/**
+ * bytes kept alive by this buffer
+ *
+ * for a shared buffer that is the whole block, it is freed when the last
+ * view is gone.
+ */
+size_t buffer_memory(buffer *b) {
+	if (!b) return 0;
+
+	return b->block ? b->block->size : b->size;
+}
+
 int buffer_copy_string(buffer *b, const char *s) {
 	size_t s_len;
 
@@ -600,6 +727,7 @@ int buffer_is_equal_string(buffer *a, const char *s, size_t b_len) {
 
 	b.ptr = (char *)s;
 	b.used = b_len + 1;
+	b.block = NULL;
 
 	return buffer_is_equal(a, &b);
 }
@@ -922,6 +1050,8 @@ static int buffer_urldecode_internal(buffer *url, int is_query) {
 
 	if (!url || !url->ptr) return -1;
 
+	buffer_unshare(url);
+
 	src = (const char*) url->ptr;
 	dst = (char*) url->ptr;
 
@@ -1105,6 +1235,8 @@ int buffer_to_lower(buffer *b) {
 
 	if (b->used == 0) return 0;
 
+	buffer_unshare(b);
+
 	for (c = b->ptr; *c; c++) {
 		if (*c >= 'A' && *c <= 'Z') {
 			*c |= 32;
@@ -1120,6 +1252,8 @@ int buffer_to_upper(buffer *b) {
 
 	if (b->used == 0) return 0;
 
+	buffer_unshare(b);
+
 	for (c = b->ptr; *c; c++) {
 		if (*c >= 'a' && *c <= 'z') {
 			*c &= ~32;
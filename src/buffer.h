@@ -8,11 +8,25 @@
 
 #include "array-static.h"
 
+/**
+ * a refcounted allocation that several buffers can look into
+ *
+ * see buffer_share()
+ */
+typedef struct {
+	char *ptr;
+	size_t size;
+
+	size_t ref;
+} buffer_block;
+
 typedef struct {
 	char *ptr;
 
 	size_t used;
 	size_t size;
+
+	buffer_block *block; /* if set, ptr points into a shared block and size is 0 */
 } buffer;
 
 typedef void (*buffer_ptr_free_t)(void *p);
@@ -61,6 +75,12 @@ LI_API void buffer_reset(buffer *b);
 LI_API int buffer_prepare_copy(buffer *b, size_t size);
 LI_API int buffer_prepare_append(buffer *b, size_t size);
 
+LI_API int buffer_share(buffer *dst, buffer *src, size_t offset, size_t len);
+LI_API int buffer_unshare(buffer *b);
+LI_API size_t buffer_memory(buffer *b);
+
+#define buffer_is_shared(b) ((b)->block != NULL)
+
 LI_API int buffer_copy_string(buffer *b, const char *s);
 LI_API int buffer_copy_string_len(buffer *b, const char *s, size_t s_len);
 LI_API int buffer_copy_string_buffer(buffer *b, const buffer *src);
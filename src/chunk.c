@@ -9,6 +9,8 @@
 
 #include <stdlib.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
 
 #include <stdio.h>
 #include <errno.h>
@@ -23,18 +25,52 @@
 #include "log.h"
 
 /**
- * create a global pool for unused chunks
+ * create a pool for unused chunks
  *
  * the chunk is moved from queue to queue (by stealing)
- * and moved back into the unused pool. 
+ * and moved back into the unused pool.
  *
  * Instead of having a local pool of unused chunks per queue
- * we use a global pool
+ * we use one pool per event loop. The chunks are sorted by the memory
+ * their ->mem buffer keeps, so a small string doesn't take a chunk
+ * with 4k and a FILE_CHUNK doesn't take any.
  *
  */
 
-static chunk *chunkpool        = NULL;
-static size_t chunkpool_chunks = 0;
+typedef enum {
+	CHUNKPOOL_BARE,  /* ->mem has no memory */
+	CHUNKPOOL_SMALL, /* ->mem has up to CHUNKPOOL_SMALL_SIZE bytes */
+	CHUNKPOOL_LARGE, /* ->mem has up to BUFFER_MAX_REUSE_SIZE bytes */
+
+	CHUNKPOOL_CLASSES
+} chunk_pool_class_t;
+
+#define CHUNKPOOL_SMALL_SIZE 512
+
+typedef struct {
+	chunk *unused[CHUNKPOOL_CLASSES];
+	size_t chunks;
+	size_t bytes;  /* memory kept by the buffers of the unused chunks */
+
+	/**
+	 * page-sized read buffers
+	 *
+	 * the network read-backends borrow them for the chunks of the incoming
+	 * queue and chunk_reset() gives them back as soon as the chunk is consumed.
+	 * An idle keep-alive connection doesn't keep any read memory.
+	 */
+	char  *readbuf[READ_BUFFER_POOL_MAX];
+	size_t readbuf_used;
+	size_t readbuf_hits;
+	size_t readbuf_misses;
+} chunk_pool;
+
+/* a second event loop would get its own pool, chunks are not locked */
+static chunk_pool chunkpool_main;
+
+static chunk_pool *chunkpool_get(void) {
+	return &chunkpool_main;
+}
 
 chunkqueue *chunkqueue_init(void) {
 	chunkqueue *cq;
@@ -53,8 +89,9 @@ static chunk *chunk_init(void) {
 	c = calloc(1, sizeof(*c));
 
 	c->mem = buffer_init();
-	c->file.name = buffer_init();
+	c->file.name = NULL; /* only FILE_CHUNKs need it, see chunk_file_init() */
 	c->file.fd = -1;
+	c->file.tmp = NULL;
 	c->file.copy.fd = -1;
 	c->file.mmap.start = MAP_FAILED;
 	c->next = NULL;
@@ -64,12 +101,71 @@ static chunk *chunk_init(void) {
 	return c;
 }
 
+static void chunk_file_init(chunk *c) {
+	c->type = FILE_CHUNK;
+
+	if (NULL == c->file.name) c->file.name = buffer_init();
+}
+
+static void read_buffer_release(buffer *b) {
+	chunk_pool *pool = chunkpool_get();
+
+	if (buffer_is_shared(b) || b->size != READ_BUFFER_SIZE) return;
+
+	if (pool->readbuf_used == READ_BUFFER_POOL_MAX) {
+		free(b->ptr);
+	} else {
+		pool->readbuf[pool->readbuf_used++] = b->ptr;
+	}
+
+	b->ptr = NULL;
+	b->size = 0;
+	b->used = 0;
+}
+
+static void read_buffer_borrow(buffer *b) {
+	chunk_pool *pool = chunkpool_get();
+
+	buffer_reset(b);
+	free(b->ptr);
+
+	if (pool->readbuf_used) {
+		b->ptr = pool->readbuf[--pool->readbuf_used];
+		pool->readbuf_hits++;
+	} else {
+		b->ptr = malloc(READ_BUFFER_SIZE);
+		assert(b->ptr);
+		pool->readbuf_misses++;
+	}
+
+	b->size = READ_BUFFER_SIZE;
+	b->used = 0;
+}
+
+static chunk_tempfile *chunk_tempfile_ref(chunk_tempfile *t) {
+	t->refcount++;
+
+	return t;
+}
+
+static void chunk_tempfile_release(chunk_tempfile *t) {
+	if (--t->refcount > 0) return;
+
+	/* the O_TMPFILE has no name to unlink */
+	close(t->fd);
+	free(t);
+}
+
 static void chunk_reset(chunk *c) {
 	if (!c) return;
 
+	read_buffer_release(c->mem);
 	buffer_reset(c->mem);
 
-	if (c->file.is_temp && !buffer_is_empty(c->file.name)) {
+	if (c->file.tmp) {
+		chunk_tempfile_release(c->file.tmp);
+		c->file.tmp = NULL;
+	} else if (c->file.is_temp && !buffer_is_empty(c->file.name)) {
 		unlink(c->file.name->ptr);
 	}
 	c->file.is_temp = 0;
@@ -103,6 +199,9 @@ static void chunk_reset(chunk *c) {
 	c->async.written = -1;
 	c->async.ret_val = 0;
 
+	c->zerocopy.used = 0;
+	c->zerocopy.seq = 0;
+
 	c->offset = 0;
 	c->next = NULL;
 }
@@ -172,32 +271,81 @@ off_t chunk_length(chunk *c) {
 }
 
 void chunkpool_free(void) {
-	if (!chunkpool) return;
+	chunk_pool *pool = chunkpool_get();
+	size_t i;
 
 	/* free the pool */
-	while(chunkpool) {
-		chunk *c = chunkpool->next;
-		chunk_free(chunkpool);
-		chunkpool = c;
+	for (i = 0; i < CHUNKPOOL_CLASSES; i++) {
+		while (pool->unused[i]) {
+			chunk *c = pool->unused[i]->next;
+			chunk_free(pool->unused[i]);
+			pool->unused[i] = c;
+		}
+	}
+	pool->chunks = 0;
+	pool->bytes = 0;
+
+	while (pool->readbuf_used) {
+		free(pool->readbuf[--pool->readbuf_used]);
 	}
-	chunkpool_chunks = 0;
 }
 
-static chunk *chunkpool_get_unused_chunk(void) {
+void chunkpool_get_stats(size_t *chunks, size_t *bytes) {
+	chunk_pool *pool = chunkpool_get();
+
+	*chunks = pool->chunks;
+	*bytes = pool->bytes + pool->readbuf_used * READ_BUFFER_SIZE;
+}
+
+void chunkpool_get_read_buffer_stats(size_t *pooled, size_t *hits, size_t *misses) {
+	chunk_pool *pool = chunkpool_get();
+
+	*pooled = pool->readbuf_used;
+	*hits = pool->readbuf_hits;
+	*misses = pool->readbuf_misses;
+}
+
+static chunk_pool_class_t chunkpool_class(size_t size) {
+	if (size == 0) return CHUNKPOOL_BARE;
+	if (size <= CHUNKPOOL_SMALL_SIZE) return CHUNKPOOL_SMALL;
+
+	return CHUNKPOOL_LARGE;
+}
+
+static size_t chunk_memory(chunk *c) {
+	return c->mem->size + (c->file.name ? c->file.name->size : 0);
+}
+
+/**
+ * get a chunk whose ->mem fits @size bytes
+ *
+ * use 0 if the chunk will not need memory in ->mem
+ */
+static chunk *chunkpool_get_unused_chunk(size_t size) {
+	chunk_pool *pool = chunkpool_get();
+	chunk_pool_class_t want = chunkpool_class(size);
 	chunk *c;
-	
-	/* check if we have an unused chunk */
-	if (!chunkpool) {
-		c = chunk_init();
-	} else {
-		/* take the first element from the list (a stack) */
-		c = chunkpool;
-		chunkpool = c->next;
-		c->next = NULL;
+	int i;
+
+	/* the class that fits, then the larger ones, then the smaller ones */
+	for (i = want; i < CHUNKPOOL_CLASSES && !pool->unused[i]; i++);
+	if (i == CHUNKPOOL_CLASSES) {
+		for (i = want - 1; i >= 0 && !pool->unused[i]; i--);
+	}
 
-		chunkpool_chunks--;
+	/* check if we have an unused chunk */
+	if (i < 0) {
+		return chunk_init();
 	}
 
+	/* take the first element from the list (a stack) */
+	c = pool->unused[i];
+	pool->unused[i] = c->next;
+	c->next = NULL;
+
+	pool->chunks--;
+	pool->bytes -= chunk_memory(c);
+
 	return c;
 }
 
@@ -205,21 +353,39 @@ static chunk *chunkpool_get_unused_chunk(void) {
  * keep unused chunks alive and store them in the chunkpool
  *
  * we only want to keep a small set of chunks alive to balance between
- * memory-usage and mallocs
+ * memory-usage and mallocs, the pool is limited by CHUNKPOOL_MAX_CHUNKS
+ * and CHUNKPOOL_MAX_BYTES
  *
  * each filter will ask for a chunk
  */
 static void chunkpool_add_unused_chunk(chunk *c) {
-	if (chunkpool_chunks > 128) {
+	chunk_pool *pool = chunkpool_get();
+	chunk_pool_class_t k;
+
+	if (pool->chunks >= CHUNKPOOL_MAX_CHUNKS) {
 		chunk_free(c);
-	} else {
-		chunk_reset(c);
-		
-		/* prepend the chunk to the chunkpool */
-		c->next = chunkpool;
-		chunkpool = c;
-		chunkpool_chunks++;
+		return;
+	}
+
+	/* trims the buffers to BUFFER_MAX_REUSE_SIZE */
+	chunk_reset(c);
+
+	if (pool->bytes + chunk_memory(c) > CHUNKPOOL_MAX_BYTES) {
+		/* keep the chunk, but not its memory */
+		buffer_free(c->mem);
+		c->mem = buffer_init();
+		buffer_free(c->file.name);
+		c->file.name = NULL;
 	}
+
+	k = chunkpool_class(c->mem->size);
+
+	/* prepend the chunk to the chunkpool */
+	c->next = pool->unused[k];
+	pool->unused[k] = c;
+
+	pool->chunks++;
+	pool->bytes += chunk_memory(c);
 }
 
 
@@ -234,6 +400,8 @@ void chunkqueue_free(chunkqueue *cq) {
 		chunk_free(pc);
 	}
 
+	if (cq->tempfile) chunk_tempfile_release(cq->tempfile);
+
 	free(cq);
 }
 
@@ -274,6 +442,11 @@ void chunkqueue_reset(chunkqueue *cq) {
 
 	chunkqueue_remove_finished_chunks(cq);
 
+	if (cq->tempfile) {
+		chunk_tempfile_release(cq->tempfile);
+		cq->tempfile = NULL;
+	}
+
 	cq->bytes_in = 0;
 	cq->bytes_out = 0;
 	cq->is_closed = 0;
@@ -284,9 +457,9 @@ int chunkqueue_append_file(chunkqueue *cq, buffer *fn, off_t offset, off_t len)
 
 	if (len == 0) return 0;
 
-	c = chunkpool_get_unused_chunk();
+	c = chunkpool_get_unused_chunk(0);
 
-	c->type = FILE_CHUNK;
+	chunk_file_init(c);
 
 	buffer_copy_string_buffer(c->file.name, fn);
 	c->file.start = offset;
@@ -304,15 +477,17 @@ int chunkqueue_steal_tempfile(chunkqueue *cq, chunk *in) {
 	assert(in->type == FILE_CHUNK);
 	assert(in->file.is_temp == 1);
 
-	c = chunkpool_get_unused_chunk();
+	c = chunkpool_get_unused_chunk(0);
 
-	c->type = FILE_CHUNK;
+	chunk_file_init(c);
 	buffer_copy_string_buffer(c->file.name, in->file.name);
 	c->file.start = in->file.start + in->offset;
 	c->file.length = in->file.length - in->offset;
 	c->offset = 0;
 	c->file.is_temp = 1;
 	in->file.is_temp = 0;
+	c->file.tmp = in->file.tmp;
+	in->file.tmp = NULL;
 
 	chunkqueue_append_chunk(cq, c);
 
@@ -337,7 +512,7 @@ off_t chunkqueue_steal_chunk(chunkqueue *cq, chunk *c) {
 			b = chunkqueue_get_append_buffer(cq);
 			btmp = *b; *b = *(c->mem); *(c->mem) = btmp;
 		} else {
-			chunkqueue_append_mem(cq, c->mem->ptr + c->offset, total);
+			chunkqueue_append_shared_buffer(cq, c->mem, c->offset, total);
 			chunk_set_done(c);
 		}
 		break;
@@ -383,7 +558,6 @@ off_t chunkqueue_steal_all_chunks(chunkqueue *cq, chunkqueue *in) {
 off_t chunkqueue_steal_chunks_len(chunkqueue *out, chunk *c, off_t max_len) {
 	off_t total = 0;
 	off_t we_have = 0, we_want = 0;
-	buffer *b;
 
 	if (!out || !c) return 0;
 
@@ -397,7 +571,7 @@ off_t chunkqueue_steal_chunks_len(chunkqueue *out, chunk *c, off_t max_len) {
 
 			if (we_have > max_len) we_have = max_len;
 
-			chunkqueue_append_file(out, c->file.name, c->offset, we_have);
+			chunkqueue_append_file(out, c->file.name, c->file.start + c->offset, we_have);
 
 			c->offset += we_have;
 			max_len -= we_have;
@@ -427,6 +601,8 @@ off_t chunkqueue_steal_chunks_len(chunkqueue *out, chunk *c, off_t max_len) {
 
 				out_c->file.is_temp = 1;
 				c->file.is_temp = 0;
+				out_c->file.tmp = c->file.tmp;
+				c->file.tmp = NULL;
 			}
 
 			break;
@@ -443,9 +619,8 @@ off_t chunkqueue_steal_chunks_len(chunkqueue *out, chunk *c, off_t max_len) {
 				/* steal whole chunk */
 				chunkqueue_steal_chunk(out, c);
 			} else {
-				/* copy unused data from chunk */
-				b = chunkqueue_get_append_buffer(out);
-				buffer_copy_string_len(b, c->mem->ptr + c->offset, we_want);
+				/* reference the unused data of the chunk */
+				chunkqueue_append_shared_buffer(out, c->mem, c->offset, we_want);
 				c->offset += we_want;
 			}
 			total += we_want;
@@ -495,7 +670,7 @@ int chunkqueue_append_buffer(chunkqueue *cq, buffer *mem) {
 
 	if (mem->used == 0) return 0;
 
-	c = chunkpool_get_unused_chunk();
+	c = chunkpool_get_unused_chunk(mem->used);
 	c->type = MEM_CHUNK;
 	c->offset = 0;
 	buffer_copy_string_buffer(c->mem, mem);
@@ -510,7 +685,7 @@ int chunkqueue_prepend_buffer(chunkqueue *cq, buffer *mem) {
 
 	if (mem->used == 0) return 0;
 
-	c = chunkpool_get_unused_chunk();
+	c = chunkpool_get_unused_chunk(mem->used);
 	c->type = MEM_CHUNK;
 	c->offset = 0;
 	buffer_copy_string_buffer(c->mem, mem);
@@ -525,7 +700,7 @@ int chunkqueue_append_mem(chunkqueue *cq, const char * mem, size_t len) {
 
 	if (len == 0) return 0;
 
-	c = chunkpool_get_unused_chunk();
+	c = chunkpool_get_unused_chunk(len + 1);
 	c->type = MEM_CHUNK;
 	c->offset = 0;
 	buffer_copy_string_len(c->mem, mem, len);
@@ -535,10 +710,59 @@ int chunkqueue_append_mem(chunkqueue *cq, const char * mem, size_t len) {
 	return 0;
 }
 
+/**
+ * get a buffer with free space for the network read-backends
+ *
+ * the last chunk is filled up while it has >= 1kb free, otherwise a chunk
+ * with a buffer from the read-pool is appended. Read straight into
+ * ->ptr + ->used - 1 up to ->size - 1, no need to ask the socket how much
+ * is pending.
+ */
+buffer *chunkqueue_get_read_buffer(chunkqueue *cq) {
+	chunk *c = cq->last;
+
+	if (c && c->type == MEM_CHUNK &&
+	    !buffer_is_shared(c->mem) &&
+	    c->mem->size >= c->mem->used + 1024) {
+		return c->mem;
+	}
+
+	c = chunkpool_get_unused_chunk(0);
+	c->type = MEM_CHUNK;
+	c->offset = 0;
+	read_buffer_borrow(c->mem);
+
+	chunkqueue_append_chunk(cq, c);
+
+	return c->mem;
+}
+
+/**
+ * append a slice of @mem without copying it
+ *
+ * the new MEM_CHUNK shares the memory of @mem (see buffer_share()), @mem can
+ * be reset or freed at any time.
+ */
+int chunkqueue_append_shared_buffer(chunkqueue *cq, buffer *mem, size_t offset, size_t len) {
+	chunk *c;
+
+	if (len == 0) return 0;
+
+	c = chunkpool_get_unused_chunk(0);
+	c->type = MEM_CHUNK;
+	c->offset = 0;
+	buffer_share(c->mem, mem, offset, len);
+
+	chunkqueue_append_chunk(cq, c);
+
+	return 0;
+}
+
 buffer * chunkqueue_get_prepend_buffer(chunkqueue *cq) {
 	chunk *c;
 
-	c = chunkpool_get_unused_chunk();
+	/* the caller generates content, take a chunk with memory */
+	c = chunkpool_get_unused_chunk(BUFFER_MAX_REUSE_SIZE);
 
 	c->type = MEM_CHUNK;
 	c->offset = 0;
@@ -552,7 +776,8 @@ buffer * chunkqueue_get_prepend_buffer(chunkqueue *cq) {
 buffer *chunkqueue_get_append_buffer(chunkqueue *cq) {
 	chunk *c;
 
-	c = chunkpool_get_unused_chunk();
+	/* the caller generates content, take a chunk with memory */
+	c = chunkpool_get_unused_chunk(BUFFER_MAX_REUSE_SIZE);
 
 	c->type = MEM_CHUNK;
 	c->offset = 0;
@@ -571,16 +796,76 @@ int chunkqueue_set_tempdirs(chunkqueue *cq, array *tempdirs) {
 	return 0;
 }
 
+/**
+ * create a tempfile in @dir for the queue
+ *
+ * On Linux it is an O_TMPFILE: it never has a name in @dir, nothing has to
+ * be unlinked and a crash leaves nothing behind. All segments of the queue
+ * are cut from it and share its fd, everyone else reaches it by the name
+ * /proc/self/fd/<fd>.
+ *
+ * Without O_TMPFILE the chunk gets a file of its own.
+ */
+static int chunk_tempfile_open(chunkqueue *cq, chunk *c, buffer *dir) {
+#ifdef O_TMPFILE
+	static int no_proc_fd = 0; /* /proc isn't mounted (chroot), we can't reopen the files */
+	int fd;
+
+	if (!no_proc_fd &&
+	    -1 != (fd = open(dir->ptr, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600))) {
+		buffer_copy_string_len(c->file.name, CONST_STR_LEN("/proc/self/fd/"));
+		buffer_append_long(c->file.name, fd);
+
+		if (0 == access(c->file.name->ptr, R_OK)) {
+			cq->tempfile = calloc(1, sizeof(*cq->tempfile));
+			cq->tempfile->fd = fd;
+			cq->tempfile->refcount = 1;
+
+			return 0;
+		}
+
+		close(fd);
+		no_proc_fd = 1;
+	}
+#else
+	UNUSED(cq);
+#endif
+
+	buffer_copy_string_buffer(c->file.name, dir);
+	PATHNAME_APPEND_SLASH(c->file.name);
+	buffer_append_string_len(c->file.name, CONST_STR_LEN("lighttpd-upload-XXXXXX"));
+
+	if (-1 == (c->file.fd = mkstemp(c->file.name->ptr))) return -1;
+
+	/* only trigger the unlink if we created the temp-file successfully */
+	c->file.is_temp = 1;
+#ifdef FD_CLOEXEC
+	fcntl(c->file.fd, F_SETFD, FD_CLOEXEC);
+#endif
+
+	return 0;
+}
+
+/**
+ * append a tempfile chunk to the queue
+ *
+ * the chunk is the next segment of the queue's O_TMPFILE and starts where
+ * the content written so far ends. Write to it through ->file.tmp->fd, if
+ * there is no ->file.tmp it has its own file in ->file.fd (-1 if it
+ * couldn't be created).
+ */
 chunk *chunkqueue_get_append_tempfile(chunkqueue *cq) {
 	chunk *c;
-	buffer *template = buffer_init_string("/var/tmp/lighttpd-upload-XXXXXX");
 
-	c = chunkpool_get_unused_chunk();
+	c = chunkpool_get_unused_chunk(0);
 
-	c->type = FILE_CHUNK;
+	chunk_file_init(c);
 	c->offset = 0;
+	c->file.start = 0;
 
-	if (cq->tempdirs && cq->tempdirs->used) {
+	if (cq->tempfile) {
+		/* the segments share the fd */
+	} else if (cq->tempdirs && cq->tempdirs->used) {
 		size_t i;
 
 		/* we have several tempdirs, only if all of them fail we jump out */
@@ -588,30 +873,33 @@ chunk *chunkqueue_get_append_tempfile(chunkqueue *cq) {
 		for (i = 0; i < cq->tempdirs->used; i++) {
 			data_string *ds = (data_string *)cq->tempdirs->data[i];
 
-			buffer_copy_string_buffer(template, ds->value);
-			PATHNAME_APPEND_SLASH(template);
-			buffer_append_string_len(template, CONST_STR_LEN("lighttpd-upload-XXXXXX"));
-
-			if (-1 != (c->file.fd = mkstemp(template->ptr))) {
-				/* only trigger the unlink if we created the temp-file successfully */
-				c->file.is_temp = 1;
-				break;
-			}
+			if (0 == chunk_tempfile_open(cq, c, ds->value)) break;
 		}
 	} else {
-		if (-1 != (c->file.fd = mkstemp(template->ptr))) {
-			/* only trigger the unlink if we created the temp-file successfully */
-			c->file.is_temp = 1;
-		}
+		buffer *dir = buffer_init_string("/var/tmp");
+
+		chunk_tempfile_open(cq, c, dir);
+
+		buffer_free(dir);
+	}
+
+	if (cq->tempfile) {
+		struct stat st;
+
+		c->file.tmp = chunk_tempfile_ref(cq->tempfile);
+		c->file.is_temp = 1;
+
+		buffer_copy_string_len(c->file.name, CONST_STR_LEN("/proc/self/fd/"));
+		buffer_append_long(c->file.name, c->file.tmp->fd);
+
+		/* the space is reserved with FALLOC_FL_KEEP_SIZE, the size is the content */
+		if (0 == fstat(c->file.tmp->fd, &st)) c->file.start = st.st_size;
 	}
 
-	buffer_copy_string_buffer(c->file.name, template);
 	c->file.length = 0;
 
 	chunkqueue_append_chunk(cq, c);
 
-	buffer_free(template);
-
 	return c;
 }
 
@@ -699,14 +987,14 @@ void chunkqueue_remove_empty_last_chunk(chunkqueue *cq) {
 	if (cq->first == cq->last) {
 		c = cq->first;
 
-		chunk_free(c);
+		chunkpool_add_unused_chunk(c);
 		cq->first = cq->last = NULL;
 	} else {
 		for (c = cq->first; c->next; c = c->next) {
 			if (c->next == cq->last) {
 				cq->last = c;
 
-				chunk_free(c->next);
+				chunkpool_add_unused_chunk(c->next);
 				c->next = NULL;
 
 				return;
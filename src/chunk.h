@@ -5,6 +5,17 @@
 #include "array.h"
 #include "sys-mmap.h"
 
+/**
+ * the O_TMPFILE a request body is spooled to
+ *
+ * it has no name, each segment of it keeps a reference and the last one
+ * closes the fd which deletes the file
+ */
+typedef struct {
+	int fd;
+	int refcount;
+} chunk_tempfile;
+
 typedef struct chunk {
 	enum { UNUSED_CHUNK, MEM_CHUNK, FILE_CHUNK } type;
 
@@ -24,6 +35,7 @@ typedef struct chunk {
 		} mmap;
 
 		int is_temp; /* file is temporary and will be deleted on cleanup */
+		chunk_tempfile *tmp; /* the O_TMPFILE behind ->name (/proc/self/fd/<tmp->fd>), shared by its segments */
 
 		struct {
 			int fd;
@@ -43,6 +55,11 @@ typedef struct chunk {
 		int ret_val;
 	} async;
 
+	struct {
+		int used;         /* mem was (partly) sent with MSG_ZEROCOPY and has to stay untouched */
+		unsigned int seq; /* the last of these sends */
+	} zerocopy;
+
 	struct chunk *next;
 } chunk;
 
@@ -51,6 +68,7 @@ typedef struct {
 	chunk *last;
 
 	array *tempdirs;
+	chunk_tempfile *tempfile; /* the O_TMPFILE chunkqueue_get_append_tempfile() cuts the segments from */
 
 	int is_closed;   /* the input to this CQ is closed */
 
@@ -58,15 +76,19 @@ typedef struct {
 } chunkqueue;
 
 LI_API void chunkpool_free(void);
+LI_API void chunkpool_get_stats(size_t *chunks, size_t *bytes);
+LI_API void chunkpool_get_read_buffer_stats(size_t *pooled, size_t *hits, size_t *misses);
 
 LI_API chunkqueue* chunkqueue_init(void);
 LI_API int chunkqueue_set_tempdirs(chunkqueue *c, array *tempdirs);
 LI_API int chunkqueue_append_file(chunkqueue *c, buffer *fn, off_t offset, off_t len);
 LI_API int chunkqueue_append_mem(chunkqueue *c, const char *mem, size_t len);
 LI_API int chunkqueue_append_buffer(chunkqueue *c, buffer *mem);
+LI_API int chunkqueue_append_shared_buffer(chunkqueue *c, buffer *mem, size_t offset, size_t len);
 LI_API int chunkqueue_prepend_buffer(chunkqueue *c, buffer *mem);
 
 LI_API buffer * chunkqueue_get_append_buffer(chunkqueue *c);
+LI_API buffer * chunkqueue_get_read_buffer(chunkqueue *c);
 LI_API buffer * chunkqueue_get_prepend_buffer(chunkqueue *c);
 LI_API chunk * chunkqueue_get_append_tempfile(chunkqueue *cq);
 LI_API int chunkqueue_steal_tempfile(chunkqueue *cq, chunk *in);
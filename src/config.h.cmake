@@ -22,6 +22,8 @@
 #cmakedefine HAVE_TIME_H
 #cmakedefine HAVE_UNISTD_H
 #cmakedefine HAVE_PTHREAD_H
+#cmakedefine HAVE_LINUX_FILTER_H
+#cmakedefine HAVE_LINUX_ERRQUEUE_H
 #cmakedefine HAVE_INET_ATON
 #cmakedefine HAVE_IPV6
 #cmakedefine HAVE_ISSETUGID
@@ -49,6 +51,14 @@
 #cmakedefine  HAVE_BZLIB_H
 #cmakedefine  HAVE_LIBBZ2
 
+/* Brotli */
+#cmakedefine  HAVE_BROTLI_ENCODE_H
+#cmakedefine  HAVE_LIBBROTLIENC
+
+/* Zstandard */
+#cmakedefine  HAVE_ZSTD_H
+#cmakedefine  HAVE_LIBZSTD
+
 /* FAM */
 #cmakedefine  HAVE_FAM_H
 
@@ -110,9 +120,11 @@
 #cmakedefine  SIZEOF_OFF_T ${SIZEOF_OFF_T}
 
 /* Functions */
+#cmakedefine  HAVE_ACCEPT4
 #cmakedefine  HAVE_CHROOT
 #cmakedefine  HAVE_CRYPT
 #cmakedefine  HAVE_EPOLL_CTL
+#cmakedefine  HAVE_FALLOCATE
 #cmakedefine  HAVE_FORK
 #cmakedefine  HAVE_GETRLIMIT
 #cmakedefine  HAVE_GETUID
@@ -130,12 +142,14 @@
 #cmakedefine  HAVE_PORT_CREATE
 #cmakedefine  HAVE_PRCTL
 #cmakedefine  HAVE_PREAD
+#cmakedefine  HAVE_SCHED_SETAFFINITY
 #cmakedefine  HAVE_POSIX_FADVISE
 #cmakedefine  HAVE_SELECT
 #cmakedefine  HAVE_SENDFILE
 #cmakedefine  HAVE_SENDFILE64
 #cmakedefine  HAVE_SENDFILEV
 #cmakedefine  HAVE_SIGACTION
+#cmakedefine  HAVE_SPLICE
 #cmakedefine  HAVE_SIGNAL
 #cmakedefine  HAVE_SIGTIMEDWAIT
 #cmakedefine  HAVE_STRPTIME
@@ -7,6 +7,8 @@
 #include "log.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "connections.h"
+#include "http_header.h"
 
 /**
  * like all glue code this file contains functions which
@@ -381,7 +383,7 @@ static cond_result_t config_check_cond_nocache(server *srv, connection *con, dat
 				return (dc->cond == CONFIG_COND_EQ) ? COND_RESULT_FALSE : COND_RESULT_TRUE;
 			}
 		} else {
-			l = con->dst_addr_buf;
+			l = connection_get_dst_addr_buf(srv, con);
 		}
 		break;
 	}
@@ -404,7 +406,7 @@ static cond_result_t config_check_cond_nocache(server *srv, connection *con, dat
 	case COMP_HTTP_REFERER: {
 		data_string *ds;
 
-		if (NULL != (ds = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("Referer")))) {
+		if (NULL != (ds = (data_string *)http_header_get(con->request.headers, HTTP_HEADER_REFERER))) {
 			l = ds->value;
 		} else {
 			l = srv->empty_string;
@@ -413,7 +415,7 @@ static cond_result_t config_check_cond_nocache(server *srv, connection *con, dat
 	}
 	case COMP_HTTP_COOKIE: {
 		data_string *ds;
-		if (NULL != (ds = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("Cookie")))) {
+		if (NULL != (ds = (data_string *)http_header_get(con->request.headers, HTTP_HEADER_COOKIE))) {
 			l = ds->value;
 		} else {
 			l = srv->empty_string;
@@ -422,7 +424,7 @@ static cond_result_t config_check_cond_nocache(server *srv, connection *con, dat
 	}
 	case COMP_HTTP_USER_AGENT: {
 		data_string *ds;
-		if (NULL != (ds = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("User-Agent")))) {
+		if (NULL != (ds = (data_string *)http_header_get(con->request.headers, HTTP_HEADER_USER_AGENT))) {
 			l = ds->value;
 		} else {
 			l = srv->empty_string;
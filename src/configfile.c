@@ -27,7 +27,7 @@
 #endif
 
 static int config_insert(server *srv) {
-	size_t i;
+	size_t i, j;
 	int ret = 0;
 	buffer *stat_cache_string;
 
@@ -110,6 +110,18 @@ static int config_insert(server *srv) {
 		{ "ssl.verifyclient.depth",      NULL, T_CONFIG_SHORT,   T_CONFIG_SCOPE_SERVER },     /* 62 */
 		{ "ssl.verifyclient.username",   NULL, T_CONFIG_STRING,  T_CONFIG_SCOPE_SERVER },     /* 63 */
 		{ "ssl.verifyclient.exportcert", NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_SERVER },     /* 64 */
+		{ "server.max-accept-per-wakeup", NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_SERVER },      /* 65 */
+		{ "ssl.use-ktls",                NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_SERVER },     /* 66 */
+		{ "ssl.session-cache-size",      NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_SERVER },       /* 67 */
+		{ "ssl.session-timeout",         NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_SERVER },       /* 68 */
+		{ "ssl.session-tickets",         NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_SERVER },     /* 69 */
+		{ "ssl.ticket-key-rotate",       NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_SERVER },       /* 70 */
+		{ "ssl.handshake-threads",       NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_SERVER },       /* 71 */
+		{ "server.worker-reuseport",     NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_SERVER },     /* 72 */
+		{ "server.worker-cpu-affinity",  NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_SERVER },     /* 73 */
+		{ "server.zerocopy-min-size",    NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_SERVER },       /* 74 */
+		{ "server.upload-segment-size",  NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_SERVER },       /* 75 */
+		{ "server.stream-request-body",  NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION }, /* 76 */
 
 		{ "server.host",                 "use server.bind instead", T_CONFIG_DEPRECATED, T_CONFIG_SCOPE_UNSET },
 		{ "server.docroot",              "use server.document-root instead", T_CONFIG_DEPRECATED, T_CONFIG_SCOPE_UNSET },
@@ -151,6 +163,13 @@ static int config_insert(server *srv) {
 	cv[45].destination = &(srv->srvconf.enable_cores);
 
 	cv[42].destination = &(srv->srvconf.max_conns);
+	cv[65].destination = &(srv->srvconf.max_accept);
+	cv[70].destination = &(srv->srvconf.ssl_ticket_key_rotate);
+	cv[71].destination = &(srv->srvconf.max_ssl_handshake_threads);
+	cv[72].destination = &(srv->srvconf.worker_reuseport);
+	cv[73].destination = &(srv->srvconf.worker_cpu_affinity);
+	cv[74].destination = &(srv->srvconf.zerocopy_min_size);
+	cv[75].destination = &(srv->srvconf.upload_segment_size);
 	cv[12].destination = &(srv->srvconf.max_request_size);
 	cv[47].destination = &(srv->srvconf.use_noatime);
 	cv[48].destination = &(srv->srvconf.max_stat_threads);
@@ -175,9 +194,14 @@ static int config_insert(server *srv) {
 		s->ssl_ca_file   = buffer_init();
 		s->error_handler = buffer_init();
 		s->server_tag    = buffer_init();
+		s->server_tag_line = buffer_init();
 		s->errorfile_prefix = buffer_init();
 		s->ssl_cipher_list = buffer_init();
 		s->ssl_use_sslv2 = 1;
+		s->ssl_use_ktls = 0;
+		s->ssl_session_cache_size = 20480;
+		s->ssl_session_timeout = 300;
+		s->ssl_session_tickets = 1;
 		s->ssl_verifyclient = 0;
 		s->ssl_verifyclient_enforce = 1;
 		s->ssl_verifyclient_username = buffer_init();
@@ -197,13 +221,14 @@ static int config_insert(server *srv) {
 		s->kbytes_per_second = 0;
 		s->allow_http11  = 1;
 		s->range_requests = 1;
+		s->stream_request_body = 0;
 		s->etag_use_inode = 1;
 		s->etag_use_mtime = 1;
 		s->etag_use_size  = 1;
 		s->force_lowercase_filenames = 0;
 		s->global_kbytes_per_second = 0;
-		s->global_bytes_per_second_cnt = 0;
-		s->global_bytes_per_second_cnt_ptr = &s->global_bytes_per_second_cnt;
+		memset(&(s->global_bucket), 0, sizeof(s->global_bucket));
+		s->global_bucket_ptr = &s->global_bucket;
 
 		cv[2].destination = s->errorfile_prefix;
 
@@ -258,12 +283,30 @@ static int config_insert(server *srv) {
 		cv[62].destination = &(s->ssl_verifyclient_depth);
 		cv[63].destination = s->ssl_verifyclient_username;
 		cv[64].destination = &(s->ssl_verifyclient_export_cert);
+		cv[66].destination = &(s->ssl_use_ktls);
+		cv[67].destination = &(s->ssl_session_cache_size);
+		cv[68].destination = &(s->ssl_session_timeout);
+		cv[69].destination = &(s->ssl_session_tickets);
+		cv[76].destination = &(s->stream_request_body);
 
 		srv->config_storage[i] = s;
 
 		if (0 != (ret = config_insert_values_global(srv, ((data_config *)srv->config_context->data[i])->value, cv))) {
 			break;
 		}
+
+		for (j = 0; j < i && !s->mimetype_table; j++) {
+			s->mimetype_table = mimetype_table_share(srv->config_storage[j]->mimetype_table, s->mimetypes);
+		}
+		if (!s->mimetype_table) s->mimetype_table = mimetype_table_init(s->mimetypes);
+
+		/* the Server: line of the response header */
+		buffer_copy_string_len(s->server_tag_line, CONST_STR_LEN("\r\nServer: "));
+		if (buffer_is_empty(s->server_tag)) {
+			buffer_append_string_len(s->server_tag_line, CONST_STR_LEN(PACKAGE_NAME "/" PACKAGE_VERSION));
+		} else {
+			buffer_append_string_buffer(s->server_tag_line, s->server_tag);
+		}
 	}
 
 	if (buffer_is_empty(stat_cache_string)) {
@@ -306,6 +349,7 @@ int config_setup_connection(server *srv, connection *con) {
 
 	PATCH(allow_http11);
 	PATCH(mimetypes);
+	PATCH(mimetype_table);
 	PATCH(document_root);
 	PATCH(max_keep_alive_requests);
 	PATCH(max_keep_alive_idle);
@@ -319,11 +363,11 @@ int config_setup_connection(server *srv, connection *con) {
 	PATCH(follow_symlink);
 #endif
 	PATCH(server_tag);
+	PATCH(server_tag_line);
 	PATCH(kbytes_per_second);
 	PATCH(global_kbytes_per_second);
-	PATCH(global_bytes_per_second_cnt);
 
-	con->conf.global_bytes_per_second_cnt_ptr = &s->global_bytes_per_second_cnt;
+	con->conf.global_bucket_ptr = &s->global_bucket;
 	buffer_copy_string_buffer(con->server_name, s->server_name);
 
 	PATCH(log_request_header);
@@ -336,6 +380,7 @@ int config_setup_connection(server *srv, connection *con) {
 	PATCH(log_timeouts);
 
 	PATCH(range_requests);
+	PATCH(stream_request_body);
 	PATCH(force_lowercase_filenames);
 	PATCH(is_ssl);
 
@@ -380,12 +425,15 @@ int config_patch_connection(server *srv, connection *con, comp_key_t comp) {
 				PATCH(document_root);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("server.range-requests"))) {
 				PATCH(range_requests);
+			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("server.stream-request-body"))) {
+				PATCH(stream_request_body);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("server.error-handler-404"))) {
 				PATCH(error_handler);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("server.errorfile-prefix"))) {
 				PATCH(errorfile_prefix);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("mimetype.assign"))) {
 				PATCH(mimetypes);
+				PATCH(mimetype_table);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("server.max-keep-alive-requests"))) {
 				PATCH(max_keep_alive_requests);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("server.max-keep-alive-idle"))) {
@@ -425,6 +473,7 @@ int config_patch_connection(server *srv, connection *con, comp_key_t comp) {
 				buffer_copy_string_buffer(con->server_name, s->server_name);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("server.tag"))) {
 				PATCH(server_tag);
+				PATCH(server_tag_line);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("connection.kbytes-per-second"))) {
 				PATCH(kbytes_per_second);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("debug.log-request-handling"))) {
@@ -449,8 +498,7 @@ int config_patch_connection(server *srv, connection *con, comp_key_t comp) {
 				PATCH(force_lowercase_filenames);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("server.kbytes-per-second"))) {
 				PATCH(global_kbytes_per_second);
-				PATCH(global_bytes_per_second_cnt);
-				con->conf.global_bytes_per_second_cnt_ptr = &s->global_bytes_per_second_cnt;
+				con->conf.global_bucket_ptr = &s->global_bucket;
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("ssl.verifyclient.activate"))) {
 				PATCH(ssl_verifyclient);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("ssl.verifyclient.enforce"))) {
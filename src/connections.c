@@ -1,3 +1,10 @@
+/**
+ * make sure _GNU_SOURCE is defined
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <sys/stat.h>
 
 #include <stdlib.h>
@@ -37,6 +44,20 @@
 
 #include "sys-socket.h"
 #include "sys-files.h"
+#include "http_header.h"
+
+#if defined(HAVE_ACCEPT4) && defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+# define USE_ACCEPT4
+/* cleared if the kernel doesn't know about accept4() */
+static int have_accept4 = 1;
+#endif
+
+#ifdef HAVE_SPLICE
+/* moves request content from the sockets into the upload files, it is empty between two calls */
+static int upload_pipe[2] = { -1, -1 };
+/* cleared if the sockets can't be spliced */
+static int have_splice = 1;
+#endif
 
 typedef struct {
 	PLUGIN_DATA;
@@ -144,9 +165,17 @@ int connection_close(server *srv, connection *con) {
 		SSL_free(con->sock->ssl);
 		ERR_clear_error();
 		con->sock->ssl = NULL;
+
+		/* drop what wasn't sent */
+		buffer_free(con->sock->ssl_staging);
+		con->sock->ssl_staging = NULL;
 	}
 #endif
 
+#ifdef USE_MSG_ZEROCOPY
+	network_zerocopy_release(srv, con->sock, con->send_raw);
+#endif
+
 	fdevent_event_del(srv->ev, con->sock);
 	fdevent_unregister(srv->ev, con->sock);
 
@@ -517,10 +546,12 @@ int connection_reset(server *srv, connection *con) {
 	con->is_writable = 1;
 	con->http_status = 0;
 	con->file_started = 0;
+	con->stream_request_body = 0;
 	con->got_response = 0;
 
 	con->bytes_written = 0;
 	con->bytes_written_cur_second = 0;
+	con->traffic_limit_reached = 0; /* network_shaper_run() skips us */
 	con->bytes_read = 0;
 	con->bytes_header = 0;
 	con->loops_per_request = 0;
@@ -532,6 +563,7 @@ int connection_reset(server *srv, connection *con) {
 	con->response.keep_alive = 0;
 	con->response.content_length = -1;
 	con->response.transfer_encoding = 0;
+	con->response.chunked_passthrough = HTTP_CHUNKED_PASSTHROUGH_NONE;
 
 	con->mode = DIRECT;
 
@@ -626,6 +658,9 @@ static handler_t connection_handle_read_request_header(server *srv, connection *
 	case NETWORK_STATUS_WAIT_FOR_EVENT:
 		fdevent_event_add(srv->ev, con->sock, FDEVENT_IN);
 		return HANDLER_WAIT_FOR_EVENT;
+	case NETWORK_STATUS_WAIT_FOR_AIO_EVENT:
+		/* the ssl handshake runs in a thread, the joblist brings us back */
+		return HANDLER_WAIT_FOR_EVENT;
 	case NETWORK_STATUS_CONNECTION_CLOSE:
 		/* the connection went away before we got something back */
 		con->close_timeout_ts = srv->cur_ts - 2;
@@ -662,6 +697,231 @@ static handler_t connection_handle_read_request_header(server *srv, connection *
 	return HANDLER_GO_ON;
 }
 
+/**
+ * the handler forwards the request content while it arrives
+ *
+ * the content stays in memory then and is only read as long as the handler
+ * keeps up with it, see REQUEST_CONTENT_STREAM_MAX
+ */
+static int connection_is_streaming_request_content(connection *con) {
+	return con->stream_request_body && con->mode != DIRECT;
+}
+
+static int connection_request_content_throttled(connection *con) {
+	return connection_is_streaming_request_content(con) &&
+		con->recv->bytes_in - con->recv->bytes_out >= REQUEST_CONTENT_STREAM_MAX;
+}
+
+/**
+ * the fd the request content is written to
+ *
+ * the segments of the O_TMPFILE share its fd, see chunkqueue_get_append_tempfile()
+ */
+static int connection_upload_fd(chunk *c) {
+	return c->file.tmp ? c->file.tmp->fd : c->file.fd;
+}
+
+/**
+ * get the tempfile chunk the request content is appended to
+ *
+ * a new segment of server.upload-segment-size is started when the last one
+ * is full or a backend started to read it already. On Linux all segments
+ * are ranges of one O_TMPFILE.
+ */
+static chunk *connection_get_upload_chunk(server *srv, connection *con) {
+	chunkqueue *out = con->recv;
+	off_t segment_size = (srv->srvconf.upload_segment_size ? srv->srvconf.upload_segment_size : 1024) * 1024;
+	chunk *dst_c;
+
+	if (out->last &&
+	    out->last->type == FILE_CHUNK &&
+	    out->last->file.is_temp &&
+	    out->last->offset == 0) {
+		/* ok, take the last chunk for our job */
+		dst_c = out->last;
+
+		if (dst_c->file.length < segment_size) {
+			if (dst_c->file.tmp) return dst_c;
+
+			if (dst_c->file.fd == -1) {
+				/* this should not happen as we cache the fd, but you never know */
+				dst_c->file.fd = open(dst_c->file.name->ptr, O_WRONLY);
+			}
+
+			if (dst_c->file.fd != -1) return dst_c;
+		} else if (dst_c->file.fd != -1) {
+			/* the chunk is too large now, close it */
+			close(dst_c->file.fd);
+			dst_c->file.fd = -1;
+		}
+	}
+
+	dst_c = chunkqueue_get_append_tempfile(out);
+
+	if (-1 == connection_upload_fd(dst_c)) {
+		/* we don't have file to write to,
+		 * EACCES might be one reason.
+		 *
+		 * Instead of sending 500 we send 413 and say the request is too large
+		 *  */
+
+		ERROR("denying upload as opening to temp-file for upload failed: '%s': %s",
+			SAFE_BUF_STR(dst_c->file.name), strerror(errno));
+
+		con->http_status = 413; /* Request-Entity too large */
+		con->keep_alive = 0;
+		return NULL;
+	}
+
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+	if (dst_c->file.start == 0) {
+		/* reserve the extents in one go, the file size grows with the content:
+		 * the O_TMPFILE takes the whole body, a file of its own one segment */
+		off_t len = con->request.content_length - out->bytes_in;
+
+		if (!dst_c->file.tmp && len > segment_size) len = segment_size;
+
+		fallocate(connection_upload_fd(dst_c), FALLOC_FL_KEEP_SIZE, 0, len);
+	}
+#endif
+
+	return dst_c;
+}
+
+#ifdef HAVE_SPLICE
+/**
+ * move the request content from the socket into the upload files with
+ * splice(), it doesn't pass through userspace
+ *
+ * returns HANDLER_UNSET if the caller has to read() the content instead
+ */
+static handler_t connection_splice_request_content(server *srv, connection *con) {
+	server_socket *srv_socket = con->srv_socket;
+	chunkqueue *out = con->recv;
+	off_t segment_size = (srv->srvconf.upload_segment_size ? srv->srvconf.upload_segment_size : 1024) * 1024;
+	off_t max_read = 256 * 1024, moved = 0;
+
+	if (!have_splice ||
+	    srv_socket->is_ssl ||
+	    connection_is_streaming_request_content(con) ||
+	    con->request.content_length <= 64 * 1024) return HANDLER_UNSET;
+
+	if (upload_pipe[0] == -1) {
+		if (-1 == pipe(upload_pipe)) {
+			ERROR("pipe() failed, reading the uploads instead: %s", strerror(errno));
+			have_splice = 0;
+			return HANDLER_UNSET;
+		}
+#ifdef FD_CLOEXEC
+		fcntl(upload_pipe[0], F_SETFD, FD_CLOEXEC);
+		fcntl(upload_pipe[1], F_SETFD, FD_CLOEXEC);
+#endif
+	}
+
+	while (moved < max_read && out->bytes_in < con->request.content_length) {
+		chunk *dst_c;
+		off_t toRead, offset;
+		ssize_t r;
+
+		if (NULL == (dst_c = connection_get_upload_chunk(srv, con))) return HANDLER_FINISHED;
+
+		toRead = con->request.content_length - out->bytes_in;
+		if (toRead > max_read - moved) toRead = max_read - moved;
+		if (dst_c->file.length < segment_size && toRead > segment_size - dst_c->file.length) {
+			toRead = segment_size - dst_c->file.length;
+		}
+
+		if (-1 == (r = splice(con->sock->fd, NULL, upload_pipe[1], NULL, toRead, SPLICE_F_MOVE | SPLICE_F_NONBLOCK))) {
+			switch (errno) {
+			case EAGAIN:
+				fdevent_event_drained(srv->ev, con->sock, FDEVENT_IN);
+
+				if (moved) break;
+
+				fdevent_event_add(srv->ev, con->sock, FDEVENT_IN);
+				return HANDLER_WAIT_FOR_EVENT;
+			case EINTR:
+				continue;
+			case EINVAL:
+			case ENOSYS:
+				if (moved == 0) {
+					/* the socket can't be spliced, fall back to read() */
+					have_splice = 0;
+					return HANDLER_UNSET;
+				}
+				/* fall through */
+			default:
+				if (errno != ECONNRESET) {
+					ERROR("splice() from fd=%d failed: %s (%d)", con->sock->fd, strerror(errno), errno);
+				}
+
+				con->close_timeout_ts = srv->cur_ts - 2;
+				connection_set_state(srv, con, CON_STATE_CLOSE);
+
+				return HANDLER_GO_ON;
+			}
+
+			break;
+		}
+
+		if (r == 0) {
+			/* the connection went away before we got everything */
+			con->close_timeout_ts = srv->cur_ts - 2;
+			connection_set_state(srv, con, CON_STATE_CLOSE);
+
+			return HANDLER_GO_ON;
+		}
+
+		offset = dst_c->file.start + dst_c->file.length;
+
+		/* empty the pipe into the file */
+		for (toRead = r; toRead > 0; ) {
+			ssize_t w;
+
+			if (-1 == (w = splice(upload_pipe[0], NULL, connection_upload_fd(dst_c), &offset, toRead, SPLICE_F_MOVE))) {
+				if (errno == EINTR) continue;
+
+				ERROR("denying upload as writing to file failed: '%s': %s",
+					SAFE_BUF_STR(dst_c->file.name), strerror(errno));
+
+				/* throw away what is left in the pipe */
+				close(upload_pipe[0]);
+				close(upload_pipe[1]);
+				upload_pipe[0] = upload_pipe[1] = -1;
+
+				con->http_status = 413; /* Request-Entity too large */
+				con->keep_alive = 0;
+
+				close(dst_c->file.fd);
+				dst_c->file.fd = -1;
+
+				return HANDLER_FINISHED;
+			}
+
+			toRead -= w;
+		}
+
+		dst_c->file.length += r;
+		out->bytes_in += r;
+		con->bytes_read += r;
+		moved += r;
+
+		if (out->bytes_in == con->request.content_length) {
+			/* we read everything, close the chunk */
+			close(dst_c->file.fd);
+			dst_c->file.fd = -1;
+		}
+	}
+
+	if (out->bytes_in < con->request.content_length) {
+		/* we have to read more content */
+		fdevent_event_add(srv->ev, con->sock, FDEVENT_IN);
+	}
+
+	return HANDLER_GO_ON;
+}
+#endif
+
 /* decode the HTTP/1.1 chunk encoding */
 
 static handler_t connection_handle_read_request_content(server *srv, connection *con)  {
@@ -678,6 +938,9 @@ static handler_t connection_handle_read_request_content(server *srv, connection
 
 	if (con->request.content_length == -1) return HANDLER_GO_ON;
 
+	/* the handler has enough to do, it wakes us up when it made room */
+	if (connection_request_content_throttled(con)) return HANDLER_WAIT_FOR_EVENT;
+
 	/* if the content was short enough, it might be read already */
 	if (in->first &&
 	    chunkqueue_length(in) - in->first->offset > 0) {
@@ -687,6 +950,11 @@ static handler_t connection_handle_read_request_content(server *srv, connection
 		 */
 
 	} else {
+#ifdef HAVE_SPLICE
+		handler_t r;
+
+		if (HANDLER_UNSET != (r = connection_splice_request_content(srv, con))) return r;
+#endif
 		/* read from the network */
 		switch (network_read(srv, con, con->sock, in)) {
 		case NETWORK_STATUS_SUCCESS:
@@ -719,66 +987,30 @@ static handler_t connection_handle_read_request_content(server *srv, connection
 
 		toRead = weHave > weWant ? weWant : weHave;
 
-		/* the new way, copy everything into a chunkqueue whcih might use tempfiles */
-		if (con->request.content_length > 64 * 1024) {
-			chunk *dst_c = NULL;
-			/* copy everything to max 1Mb sized tempfiles */
-
-			/*
-			 * if the last chunk is
-			 * - smaller than 1Mb (size < 1Mb)
-			 * - not read yet (offset == 0)
-			 * -> append to it
-			 * otherwise
-			 * -> create a new chunk
-			 *
-			 * */
-
-			if (out->last &&
-			    out->last->type == FILE_CHUNK &&
-			    out->last->file.is_temp &&
-			    out->last->offset == 0) {
-				/* ok, take the last chunk for our job */
-
-		 		if (out->last->file.length < 1 * 1024 * 1024) {
-					dst_c = out->last;
-
-					if (dst_c->file.fd == -1) {
-						/* this should not happen as we cache the fd, but you never know */
-						dst_c->file.fd = open(dst_c->file.name->ptr, O_WRONLY | O_APPEND);
-					}
-				} else {
-					/* the chunk is too large now, close it */
-					dst_c = out->last;
-
-					if (dst_c->file.fd != -1) {
-						close(dst_c->file.fd);
-						dst_c->file.fd = -1;
-					}
-					dst_c = chunkqueue_get_append_tempfile(out);
-				}
+		if (connection_is_streaming_request_content(con)) {
+			/* hand the read-buffers over to the handler, nothing is copied */
+			if (toRead == weHave) {
+				chunkqueue_steal_chunk(out, c);
 			} else {
-				dst_c = chunkqueue_get_append_tempfile(out);
+				chunkqueue_append_shared_buffer(out, c->mem, c->offset, toRead);
+				c->offset += toRead;
 			}
 
-			/* we have a chunk, let's write to it */
+			out->bytes_in += toRead;
+			in->bytes_out += toRead;
 
-			if (dst_c->file.fd == -1) {
-				/* we don't have file to write to,
-				 * EACCES might be one reason.
-				 *
-				 * Instead of sending 500 we send 413 and say the request is too large
-				 *  */
+			continue;
+		}
 
-				ERROR("denying upload as opening to temp-file for upload failed: '%s': %s",
-					SAFE_BUF_STR(dst_c->file.name), strerror(errno));
+		/* the new way, copy everything into a chunkqueue whcih might use tempfiles */
+		if (con->request.content_length > 64 * 1024) {
+			chunk *dst_c;
 
-				con->http_status = 413; /* Request-Entity too large */
-				con->keep_alive = 0;
-				return HANDLER_FINISHED;
-			}
+			if (NULL == (dst_c = connection_get_upload_chunk(srv, con))) return HANDLER_FINISHED;
 
-			if (toRead != write(dst_c->file.fd, c->mem->ptr + c->offset, toRead)) {
+			/* we have a chunk, let's write to it */
+
+			if (toRead != pwrite(connection_upload_fd(dst_c), c->mem->ptr + c->offset, toRead, dst_c->file.start + dst_c->file.length)) {
 				/* write failed for some reason ... disk full ? */
 				ERROR("denying upload as writing to file failed: '%s': %s",
 					SAFE_BUF_STR(dst_c->file.name), strerror(errno));
@@ -830,6 +1062,14 @@ static handler_t connection_handle_fdevent(void *s, void *context, int revents)
 	server     *srv = (server *)s;
 	connection *con = context;
 
+#ifdef USE_MSG_ZEROCOPY
+	/* MSG_ZEROCOPY completions are reported as an error of the socket */
+	if ((revents & FDEVENT_ERR) && con->sock->zerocopy != 0 &&
+	    0 == network_zerocopy_reap(srv, con->sock)) {
+		revents &= ~FDEVENT_ERR;
+	}
+#endif
+
 	if (revents & FDEVENT_IN) {
 		switch (con->state) {
 		case CON_STATE_READ_REQUEST_HEADER:
@@ -897,14 +1137,33 @@ connection *connection_accept(server *srv, server_socket *srv_socket) {
 	/* accept everything */
 
 	/* search an empty place */
-	int cnt;
+	int cnt = -1;
+	int is_fcntl_set = 0;
 	sock_addr cnt_addr;
 	socklen_t cnt_len;
 	/* accept it and register the fd */
 
 	cnt_len = sizeof(cnt_addr);
 
-	if (-1 == (cnt = accept(srv_socket->sock->fd, (struct sockaddr *) &cnt_addr, &cnt_len))) {
+#ifdef USE_ACCEPT4
+	if (have_accept4) {
+		/* get the fd non-blocking and close-on-exec in one syscall */
+		if (-1 == (cnt = accept4(srv_socket->sock->fd, (struct sockaddr *) &cnt_addr, &cnt_len, SOCK_NONBLOCK | SOCK_CLOEXEC))) {
+			if (errno == ENOSYS) {
+				have_accept4 = 0;
+				cnt_len = sizeof(cnt_addr);
+			}
+		} else {
+			/* some event-handlers want to set their own flags */
+			is_fcntl_set = (NULL == srv->ev->fcntl_set);
+		}
+	}
+
+	if (!have_accept4)
+#endif
+	cnt = accept(srv_socket->sock->fd, (struct sockaddr *) &cnt_addr, &cnt_len);
+
+	if (-1 == cnt) {
 #ifdef _WIN32
 		errno = WSAGetLastError();
 #endif
@@ -939,6 +1198,8 @@ connection *connection_accept(server *srv, server_socket *srv_socket) {
 		con = connections_get_new_connection(srv);
 		con->sock->fd = cnt;
 		con->sock->fde_ndx = -1;
+		con->sock->fde_edge_triggered = 1; /* network_read() and network_write_chunkqueue() report the EAGAIN */
+		memset(&(con->traffic_bucket), 0, sizeof(con->traffic_bucket));
 #if 0
 		gettimeofday(&(con->start_tv), NULL);
 #endif
@@ -948,10 +1209,11 @@ connection *connection_accept(server *srv, server_socket *srv_socket) {
 
 		con->connection_start = srv->cur_ts;
 		con->dst_addr = cnt_addr;
-		buffer_copy_string(con->dst_addr_buf, inet_ntop_cache_get_ip(srv, &(con->dst_addr)));
+		/* stringified on demand by connection_get_dst_addr_buf() */
+		buffer_reset(con->dst_addr_buf);
 		con->srv_socket = srv_socket;
 
-		if (-1 == (fdevent_fcntl_set(srv->ev, con->sock))) {
+		if (!is_fcntl_set && -1 == (fdevent_fcntl_set(srv->ev, con->sock))) {
 			ERROR("fcntl failed: %s", strerror(errno));
 			connection_close(srv, con);
 			return NULL;
@@ -967,9 +1229,11 @@ connection *connection_accept(server *srv, server_socket *srv_socket) {
 				return NULL;
 			}
 
-#ifndef OPENSSL_NO_TLSEXT
 			SSL_set_app_data(con->sock->ssl, con);
-#endif
+			con->sock->ssl_handshake_done = SSL_HANDSHAKE_DONE_NO;
+			con->sock->ssl_handshake_job = SSL_HANDSHAKE_JOB_NONE;
+			con->sock->ssl_records_out = 0;
+			con->sock->ssl_last_write = 0;
 			SSL_set_accept_state(con->sock->ssl);
 			con->conf.is_ssl=1;
 
@@ -985,6 +1249,19 @@ connection *connection_accept(server *srv, server_socket *srv_socket) {
 	}
 }
 
+/**
+ * get the remote address of the connection as string
+ *
+ * the address is only converted the first time it is asked for
+ */
+buffer *connection_get_dst_addr_buf(server *srv, connection *con) {
+	if (buffer_is_empty(con->dst_addr_buf)) {
+		buffer_copy_string(con->dst_addr_buf, inet_ntop_cache_get_ip(srv, &(con->dst_addr)));
+	}
+
+	return con->dst_addr_buf;
+}
+
 void connection_state_machine(server *srv, connection *con) {
 	int done = 0, r;
 	off_t bytes_moved = 0;
@@ -1095,7 +1372,7 @@ void connection_state_machine(server *srv, connection *con) {
 				con->send->is_closed = 1; /* there is no content */
 
 				connection_set_state(srv, con, CON_STATE_HANDLE_RESPONSE_HEADER);
-			} else if (array_get_element(con->request.headers, CONST_STR_LEN("Expect"))) {
+			} else if (http_header_get(con->request.headers, HTTP_HEADER_EXPECT)) {
 				/* write */
 				con->http_status = 100;
 				con->send->is_closed = 1;
@@ -1217,6 +1494,9 @@ void connection_state_machine(server *srv, connection *con) {
 					ERROR("%s", "oops, unknown return value: ...");
 				}
 
+				/* the client went away, don't ask the handler for more */
+				if (con->state != CON_STATE_READ_REQUEST_CONTENT) break;
+
 				if (con->recv->bytes_in == con->request.content_length) {
 					/* we read everything */
 					fdevent_event_del(srv->ev, con->sock);
@@ -1232,7 +1512,17 @@ void connection_state_machine(server *srv, connection *con) {
 			 * they might build the connection now or stream the content to the upstream server
 			 * */
 
-			switch(r = plugins_call_handle_send_request_content(srv, con)) {
+			r = plugins_call_handle_send_request_content(srv, con);
+
+			if (!con->recv->is_closed &&
+			    con->recv->bytes_in < con->request.content_length &&
+			    connection_is_streaming_request_content(con) &&
+			    !connection_request_content_throttled(con)) {
+				/* the handler made room, continue reading */
+				fdevent_event_add(srv->ev, con->sock, FDEVENT_IN);
+			}
+
+			switch (r) {
 			case HANDLER_GO_ON:
 				/* everything was forwarded */
 				break;
@@ -1263,6 +1553,13 @@ void connection_state_machine(server *srv, connection *con) {
 			if (con->recv->is_closed &&
 			    con->recv->bytes_in == con->recv->bytes_out) {
 				/* everything we read is sent */
+
+				if (con->recv->bytes_in < con->request.content_length) {
+					/* the handler didn't want the rest, it is still in the socket */
+					fdevent_event_del(srv->ev, con->sock);
+					con->keep_alive = 0;
+				}
+
 				connection_set_state(srv, con, CON_STATE_HANDLE_RESPONSE_HEADER);
 			}
 
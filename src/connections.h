@@ -10,6 +10,7 @@ LI_API int connection_reset(server *srv, connection *con);
 LI_API void connections_free(server *srv);
 
 LI_API connection* connection_accept(server *srv, server_socket *srv_sock);
+LI_API buffer* connection_get_dst_addr_buf(server *srv, connection *con);
 LI_API int connection_close(server *srv, connection *con);
 
 LI_API int connection_set_state(server *srv, connection *con, connection_state_t state);
@@ -4,6 +4,7 @@
 #include <assert.h>
 
 #include "array.h"
+#include "http_header.h"
 
 static data_unset *data_string_copy(const data_unset *s) {
 	data_string *src = (data_string *)s;
@@ -12,6 +13,7 @@ static data_unset *data_string_copy(const data_unset *s) {
 	buffer_copy_string_buffer(ds->key, src->key);
 	buffer_copy_string_buffer(ds->value, src->value);
 	ds->is_index_key = src->is_index_key;
+	ds->header_id = src->header_id;
 	return (data_unset *)ds;
 }
 
@@ -30,6 +32,7 @@ static void data_string_reset(data_unset *d) {
 	/* reused array elements */
 	buffer_reset(ds->key);
 	buffer_reset(ds->value);
+	ds->header_id = HTTP_HEADER_UNSET;
 }
 
 static int data_string_insert_dup(data_unset *dst, data_unset *src) {
@@ -28,6 +28,16 @@ static fdevent_handler_info_t fdevent_handlers[] = {
 		fdevent_linux_sysepoll_init
 #else
 		NULL
+#endif
+	},
+	{
+		FDEVENT_HANDLER_LINUX_SYSEPOLL_ET,
+		"linux-sysepoll-et",
+		"epoll, edge-triggered (Linux 2.6)",
+#ifdef USE_LINUX_EPOLL
+		fdevent_linux_sysepoll_et_init
+#else
+		NULL
 #endif
 	},
 	{
@@ -318,6 +328,8 @@ int fdevent_unregister(fdevents *ev, iosocket *sock) {
 	if (!ev) return 0;
 	fda_ndx = fdevent_find_slot(ev, sock->fd);
 
+	if (ev->unregister) ev->unregister(ev, sock);
+
 	fdn = ev->fdarray[fda_ndx];
 
 	fdnode_free(fdn);
@@ -339,6 +351,12 @@ int fdevent_event_add(fdevents *ev, iosocket *sock, int events) {
 	return 0;
 }
 
+int fdevent_event_drained(fdevents *ev, iosocket *sock, int events) {
+	if (ev->event_drained) ev->event_drained(ev, sock, events);
+
+	return 0;
+}
+
 int fdevent_poll(fdevents *ev, int timeout_ms) {
 	if (ev->poll == NULL) SEGFAULT("ev->poll is %p", (void*) (intptr_t) ev->poll);
 	return ev->poll(ev, timeout_ms);
@@ -86,7 +86,8 @@ typedef enum { FDEVENT_HANDLER_UNSET,
 		FDEVENT_HANDLER_LINUX_SYSEPOLL,
 		FDEVENT_HANDLER_SOLARIS_DEVPOLL,
 		FDEVENT_HANDLER_FREEBSD_KQUEUE,
-		FDEVENT_HANDLER_SOLARIS_PORT
+		FDEVENT_HANDLER_SOLARIS_PORT,
+		FDEVENT_HANDLER_LINUX_SYSEPOLL_ET
 } fdevent_handler_t;
 
 /**
@@ -136,6 +137,25 @@ typedef struct {
 	size_t size;
 } buffer_int;
 
+#ifdef USE_LINUX_EPOLL
+/**
+ * the interest set of a fd in epoll
+ *
+ * event_add() and event_del() only change wanted, the epoll_ctl() is done
+ * once per loop right before the epoll_wait(). A del() followed by an add()
+ * of the same events doesn't cost a syscall at all.
+ */
+typedef struct {
+	int registered;              /**< FDEVENT_* the kernel watches, -1 if the fd isn't added */
+	int wanted;                  /**< FDEVENT_* the caller asked for, -1 after a event_del() */
+	int ready;                   /**< edge-triggered: events seen, but not reported drained yet */
+
+	unsigned short edge_triggered;
+	unsigned short in_changes;   /**< in the epoll_changes list */
+	unsigned short in_replay;    /**< in the epoll_replay list */
+} fdevent_epoll_fd;
+#endif
+
 /**
  * fd-event handler for select(), poll() and rt-signals on Linux 2.4
  *
@@ -156,6 +176,12 @@ typedef struct fdevents {
 #ifdef USE_LINUX_EPOLL
 	int epoll_fd;
 	struct epoll_event *epoll_events;
+	int epoll_nevents;            /**< result of the last epoll_wait() */
+
+	fdevent_epoll_fd *epoll_fds;  /**< indexed by fd */
+	buffer_int epoll_changes;     /**< fds with a pending epoll_ctl() */
+	buffer_int epoll_replay;      /**< edge-triggered: fds which are still ready for the events they just asked for */
+	int epoll_edge_triggered;
 #endif
 #ifdef USE_POLL
 	struct pollfd *pollfds;
@@ -206,6 +232,8 @@ typedef struct fdevents {
 
 	int (*event_add)(struct fdevents *ev, iosocket *sock, int events);
 	int (*event_del)(struct fdevents *ev, iosocket *sock);
+	int (*event_drained)(struct fdevents *ev, iosocket *sock, int events);
+	int (*unregister)(struct fdevents *ev, iosocket *sock);
 	int (*get_revents)(struct fdevents *ev, size_t event_count, fdevent_revents *revents);
 
 	int (*poll)(struct fdevents *ev, int timeout_ms);
@@ -250,6 +278,15 @@ LI_API int fdevent_unregister(fdevents *ev, iosocket *sock);
 LI_API int fdevent_event_add(fdevents *ev, iosocket *sock, int events);
 LI_API int fdevent_event_del(fdevents *ev, iosocket *sock);
 
+/**
+ * the owner of the socket saw a EAGAIN for the events
+ *
+ * only needed for sockets with fde_edge_triggered set: the edge-triggered
+ * handler reports the events again on the next event_add() until they are
+ * drained
+ */
+LI_API int fdevent_event_drained(fdevents *ev, iosocket *sock, int events);
+
 /**
  * set non-blocking
  */
@@ -271,6 +308,7 @@ LI_API int fdevent_select_init(fdevents *ev);
 LI_API int fdevent_poll_init(fdevents *ev);
 LI_API int fdevent_linux_rtsig_init(fdevents *ev);
 LI_API int fdevent_linux_sysepoll_init(fdevents *ev);
+LI_API int fdevent_linux_sysepoll_et_init(fdevents *ev);
 LI_API int fdevent_solaris_devpoll_init(fdevents *ev);
 LI_API int fdevent_freebsd_kqueue_init(fdevents *ev);
 
@@ -18,23 +18,54 @@
 static void fdevent_linux_sysepoll_free(fdevents *ev) {
 	close(ev->epoll_fd);
 	free(ev->epoll_events);
+	free(ev->epoll_fds);
+	if (ev->epoll_changes.ptr) free(ev->epoll_changes.ptr);
+	if (ev->epoll_replay.ptr) free(ev->epoll_replay.ptr);
+}
+
+static void buffer_int_append(buffer_int *b, int i) {
+	if (b->used == b->size) {
+		b->size += 64;
+		b->ptr = realloc(b->ptr, b->size * sizeof(*b->ptr));
+	}
+
+	b->ptr[b->used++] = i;
+}
+
+static void fdevent_linux_sysepoll_change(fdevents *ev, int fd) {
+	fdevent_epoll_fd *f = &(ev->epoll_fds[fd]);
+
+	if (f->in_changes) return;
+
+	f->in_changes = 1;
+	buffer_int_append(&(ev->epoll_changes), fd);
+}
+
+/**
+ * edge-triggered: the fd won't get a new edge for events it is still
+ * ready for, report them in the next round by ourself
+ */
+static void fdevent_linux_sysepoll_replay(fdevents *ev, int fd) {
+	fdevent_epoll_fd *f = &(ev->epoll_fds[fd]);
+
+	if (f->in_replay) return;
+	if (0 == (f->ready & (f->wanted | FDEVENT_ERR | FDEVENT_HUP))) return;
+
+	f->in_replay = 1;
+	buffer_int_append(&(ev->epoll_replay), fd);
 }
 
 static int fdevent_linux_sysepoll_event_del(fdevents *ev, iosocket *sock) {
-	struct epoll_event ep;
+	fdevent_epoll_fd *f;
 
 	if (sock->fde_ndx < 0) return -1;
 
-	memset(&ep, 0, sizeof(ep));
-
-	ep.data.fd = sock->fd;
-	ep.data.ptr = NULL;
+	f = &(ev->epoll_fds[sock->fd]);
 
-	if (0 != epoll_ctl(ev->epoll_fd, EPOLL_CTL_DEL, sock->fd, &ep)) {
-		SEGFAULT("epoll_ctl (del) failed on fd=%d: %s", sock->fd, strerror(errno));
+	/* edge-triggered fds stay in the epoll-set until they are unregistered */
+	f->wanted = f->edge_triggered ? 0 : -1;
 
-		return 0;
-	}
+	if (!f->edge_triggered) fdevent_linux_sysepoll_change(ev, sock->fd);
 
 	sock->fde_ndx = -1;
 
@@ -42,51 +73,157 @@ static int fdevent_linux_sysepoll_event_del(fdevents *ev, iosocket *sock) {
 }
 
 static int fdevent_linux_sysepoll_event_add(fdevents *ev, iosocket *sock, int events) {
-	struct epoll_event ep;
-	int add = 0;
+	fdevent_epoll_fd *f = &(ev->epoll_fds[sock->fd]);
 
 	/* a new fd */
-	if (sock->fde_ndx == -1) add = 1;
+	if (f->registered == -1) {
+		f->edge_triggered = ev->epoll_edge_triggered && sock->fde_edge_triggered;
+		f->ready = 0;
+	}
+
+	f->wanted = events & (FDEVENT_IN | FDEVENT_OUT);
+
+	if (f->edge_triggered) {
+		if (f->registered == -1) fdevent_linux_sysepoll_change(ev, sock->fd);
+
+		fdevent_linux_sysepoll_replay(ev, sock->fd);
+	} else {
+		fdevent_linux_sysepoll_change(ev, sock->fd);
+	}
 
-	memset(&ep, 0, sizeof(ep));
+	sock->fde_ndx = sock->fd;
 
-	ep.events = 0;
+	return 0;
+}
 
-	if (events & FDEVENT_IN)  ep.events |= EPOLLIN;
-	if (events & FDEVENT_OUT) ep.events |= EPOLLOUT;
+static int fdevent_linux_sysepoll_event_drained(fdevents *ev, iosocket *sock, int events) {
+	if (sock->fd < 0) return 0;
 
-	/**
-	 *
-	 * with EPOLLET we don't get a FDEVENT_HUP
-	 * if the close is delay after everything has
-	 * sent.
-	 *
-	 */
+	ev->epoll_fds[sock->fd].ready &= ~events;
 
-	ep.events |= EPOLLERR | EPOLLHUP /* | EPOLLET */;
+	return 0;
+}
 
-	ep.data.ptr = NULL;
-	ep.data.fd = sock->fd;
+static int fdevent_linux_sysepoll_unregister(fdevents *ev, iosocket *sock) {
+	fdevent_epoll_fd *f = &(ev->epoll_fds[sock->fd]);
+	struct epoll_event ep;
 
-	if (0 != epoll_ctl(ev->epoll_fd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, sock->fd, &ep)) {
-		SEGFAULT("epoll_ctl (add/mod) failed on fd=%d: %s", sock->fd, strerror(errno));
+	if (f->registered != -1) {
+		memset(&ep, 0, sizeof(ep));
 
-		return 0;
+		/* the fd might be closed already, the kernel removed it then */
+		epoll_ctl(ev->epoll_fd, EPOLL_CTL_DEL, sock->fd, &ep);
 	}
 
-	sock->fde_ndx = sock->fd;
+	/* drop the pending changes and replays, the lists skip the fd */
+	f->registered = -1;
+	f->wanted = -1;
+	f->ready = 0;
+	f->in_changes = 0;
+	f->in_replay = 0;
 
 	return 0;
 }
 
+/**
+ * apply the interest changes of this round
+ */
+static void fdevent_linux_sysepoll_apply_changes(fdevents *ev) {
+	size_t i;
+
+	for (i = 0; i < ev->epoll_changes.used; i++) {
+		int fd = ev->epoll_changes.ptr[i];
+		fdevent_epoll_fd *f = &(ev->epoll_fds[fd]);
+		struct epoll_event ep;
+		int events, op;
+
+		if (!f->in_changes) continue;
+		f->in_changes = 0;
+
+		if (f->wanted == -1) {
+			events = -1;
+		} else if (f->edge_triggered) {
+			events = FDEVENT_IN | FDEVENT_OUT;
+		} else {
+			events = f->wanted;
+		}
+
+		if (events == f->registered) continue;
+
+		memset(&ep, 0, sizeof(ep));
+
+		if (events == -1) {
+			op = EPOLL_CTL_DEL;
+		} else {
+			op = (f->registered == -1) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+
+			if (events & FDEVENT_IN)  ep.events |= EPOLLIN;
+			if (events & FDEVENT_OUT) ep.events |= EPOLLOUT;
+
+			/**
+			 *
+			 * with EPOLLET we don't get a FDEVENT_HUP
+			 * if the close is delay after everything has
+			 * sent. The edge-triggered fds keep the HUP in ->ready
+			 * until they ask for events again.
+			 *
+			 */
+			ep.events |= EPOLLERR | EPOLLHUP;
+			if (f->edge_triggered) ep.events |= EPOLLET;
+		}
+
+		ep.data.fd = fd;
+
+		if (0 != epoll_ctl(ev->epoll_fd, op, fd, &ep)) {
+			if (op == EPOLL_CTL_MOD && errno == ENOENT) {
+				/* the fd was closed and reused since the last round */
+				op = EPOLL_CTL_ADD;
+				if (0 == epoll_ctl(ev->epoll_fd, op, fd, &ep)) errno = 0;
+			} else if (op == EPOLL_CTL_DEL && (errno == ENOENT || errno == EBADF)) {
+				/* closed in the meantime, the kernel already removed it */
+				errno = 0;
+			}
+
+			if (errno) {
+				SEGFAULT("epoll_ctl (%s) failed on fd=%d: %s",
+					op == EPOLL_CTL_DEL ? "del" : "add/mod", fd, strerror(errno));
+			}
+		}
+
+		f->registered = events;
+	}
+
+	ev->epoll_changes.used = 0;
+}
+
 static int fdevent_linux_sysepoll_poll(fdevents *ev, int timeout_ms) {
-	return epoll_wait(ev->epoll_fd, ev->epoll_events, ev->maxfds, timeout_ms);
+	int n;
+
+	fdevent_linux_sysepoll_apply_changes(ev);
+
+	/* we still have events to report, don't block */
+	if (ev->epoll_replay.used) timeout_ms = 0;
+
+	if (-1 == (n = epoll_wait(ev->epoll_fd, ev->epoll_events, ev->maxfds, timeout_ms))) {
+		ev->epoll_nevents = 0;
+
+		return ev->epoll_replay.used ? (int)ev->epoll_replay.used : -1;
+	}
+
+	ev->epoll_nevents = n;
+
+	return n + ev->epoll_replay.used;
 }
 
 static int fdevent_linux_sysepoll_get_revents(fdevents *ev, size_t event_count, fdevent_revents *revents) {
-	size_t ndx;
+	int ndx;
+	size_t i;
+
+	UNUSED(event_count);
 
-	for (ndx = 0; ndx < event_count; ndx++) {
+	for (ndx = 0; ndx < ev->epoll_nevents; ndx++) {
+		int fd = ev->epoll_events[ndx].data.fd;
+		fdevent_epoll_fd *f = &(ev->epoll_fds[fd]);
 		int events = 0, e;
 
 		e = ev->epoll_events[ndx].events;
@@ -96,14 +233,45 @@ static int fdevent_linux_sysepoll_get_revents(fdevents *ev, size_t event_count,
 		if (e & EPOLLHUP) events |= FDEVENT_HUP;
 		if (e & EPOLLPRI) events |= FDEVENT_PRI;
 
-		fdevent_revents_add(revents, ev->epoll_events[ndx].data.fd, events);
+		if (f->edge_triggered) {
+			/* remember it, we get the edge only once */
+			f->ready |= events;
+
+			/* only report what was asked for, the rest is replayed on event_add() */
+			if (f->wanted <= 0) continue;
+			events &= f->wanted | FDEVENT_ERR | FDEVENT_HUP | FDEVENT_PRI;
+			if (0 == events) continue;
+
+			/* reported now, no need to replay it */
+			f->in_replay = 0;
+		}
+
+		fdevent_revents_add(revents, fd, events);
+	}
+
+	for (i = 0; i < ev->epoll_replay.used; i++) {
+		int fd = ev->epoll_replay.ptr[i];
+		fdevent_epoll_fd *f = &(ev->epoll_fds[fd]);
+		int events;
+
+		if (!f->in_replay) continue;
+		f->in_replay = 0;
+
+		if (f->wanted <= 0) continue;
+		events = f->ready & (f->wanted | FDEVENT_ERR | FDEVENT_HUP);
+		if (0 == events) continue;
+
+		fdevent_revents_add(revents, fd, events);
 	}
 
+	ev->epoll_replay.used = 0;
+
 	return 0;
 }
 
-int fdevent_linux_sysepoll_init(fdevents *ev) {
-	ev->type = FDEVENT_HANDLER_LINUX_SYSEPOLL;
+static int fdevent_linux_sysepoll_setup(fdevents *ev) {
+	size_t i;
+
 #define SET(x) \
 	ev->x = fdevent_linux_sysepoll_##x;
 
@@ -112,6 +280,8 @@ int fdevent_linux_sysepoll_init(fdevents *ev) {
 
 	SET(event_del);
 	SET(event_add);
+	SET(event_drained);
+	SET(unregister);
 
 	SET(get_revents);
 
@@ -133,9 +303,32 @@ int fdevent_linux_sysepoll_init(fdevents *ev) {
 
 	ev->epoll_events = malloc(ev->maxfds * sizeof(*ev->epoll_events));
 
+	ev->epoll_fds = calloc(ev->maxfds, sizeof(*ev->epoll_fds));
+	for (i = 0; i < ev->maxfds; i++) {
+		ev->epoll_fds[i].registered = -1;
+		ev->epoll_fds[i].wanted = -1;
+	}
+
 	return 0;
 }
 
+int fdevent_linux_sysepoll_init(fdevents *ev) {
+	ev->type = FDEVENT_HANDLER_LINUX_SYSEPOLL;
+
+	return fdevent_linux_sysepoll_setup(ev);
+}
+
+/**
+ * the client connections are registered once with EPOLLIN | EPOLLOUT | EPOLLET,
+ * all other fds are level-triggered as before
+ */
+int fdevent_linux_sysepoll_et_init(fdevents *ev) {
+	ev->type = FDEVENT_HANDLER_LINUX_SYSEPOLL_ET;
+	ev->epoll_edge_triggered = 1;
+
+	return fdevent_linux_sysepoll_setup(ev);
+}
+
 #else
 int fdevent_linux_sysepoll_init(fdevents *ev) {
 	UNUSED(ev);
@@ -144,4 +337,8 @@ int fdevent_linux_sysepoll_init(fdevents *ev) {
 
 	return -1;
 }
+
+int fdevent_linux_sysepoll_et_init(fdevents *ev) {
+	return fdevent_linux_sysepoll_init(ev);
+}
 #endif
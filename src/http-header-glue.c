@@ -5,7 +5,10 @@
 #define _GNU_SOURCE
 #endif
 
+#include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
+#include <assert.h>
 #include <errno.h>
 #include <time.h>
 
@@ -15,6 +18,8 @@
 #include "log.h"
 #include "etag.h"
 #include "response.h"
+#include "http_req_range.h"
+#include "http_header.h"
 
 /*
  * This was 'borrowed' from tcpdump.
@@ -88,19 +93,31 @@ int response_header_insert(server *srv, connection *con, const char *key, size_t
 	}
 	buffer_copy_string_len(ds->key, key, keylen);
 	buffer_copy_string_len(ds->value, value, vallen);
+	ds->header_id = http_header_lookup(key, keylen);
 
 	array_insert_unique(con->response.headers, (data_unset *)ds);
 
 	return 0;
 }
 
+/**
+ * find a response header, by its id if it is a well-known one
+ */
+static data_string *response_header_find(connection *con, const char *key, size_t keylen) {
+	http_header_t h = http_header_lookup(key, keylen);
+
+	if (h != HTTP_HEADER_OTHER) return (data_string *)http_header_get(con->response.headers, h);
+
+	return (data_string *)array_get_element(con->response.headers, key, keylen);
+}
+
 int response_header_overwrite(server *srv, connection *con, const char *key, size_t keylen, const char *value, size_t vallen) {
 	data_string *ds;
 
 	UNUSED(srv);
 
 	/* if there already is a key by this name overwrite the value */
-	if (NULL != (ds = (data_string *)array_get_element(con->response.headers, key, keylen))) {
+	if (NULL != (ds = response_header_find(con, key, keylen))) {
 		buffer_copy_string(ds->value, value);
 
 		return 0;
@@ -116,7 +133,7 @@ int response_header_append(server *srv, connection *con, const char *key, size_t
 	UNUSED(srv);
 
 	/* if there already is a key by this name append the value */
-	if (NULL != (ds = (data_string *)array_get_element(con->response.headers, key, keylen))) {
+	if (NULL != (ds = response_header_find(con, key, keylen))) {
 		buffer_append_string_len(ds->value, CONST_STR_LEN(", "));
 		buffer_append_string_len(ds->value, value, vallen);
 		return 0;
@@ -264,8 +281,8 @@ int http_response_handle_cachable(server *srv, connection *con, buffer *mtime, b
 	 *    return a 304 (Not Modified) response.
 	 */
 
-	http_if_none_match = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("if-none-match"));
-	http_if_modified_since = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("if-modified-since"));
+	http_if_none_match = (data_string *)http_header_get(con->request.headers, HTTP_HEADER_IF_NONE_MATCH);
+	http_if_modified_since = (data_string *)http_header_get(con->request.headers, HTTP_HEADER_IF_MODIFIED_SINCE);
 
 	/* last-modified handling */
 	if (http_if_none_match) {
@@ -382,3 +399,250 @@ int http_response_handle_cachable(server *srv, connection *con, buffer *mtime, b
 
 	return HANDLER_GO_ON;
 }
+
+/**
+ * parse a qvalue (RFC 2616 3.9) into 1/1000
+ */
+static int http_qvalue_parse(const char **s) {
+	const char *c = *s;
+	int q = 0, mult = 100;
+
+	if (*c == '1') {
+		q = 1000;
+		c++;
+		if (*c == '.') for (c++; *c == '0'; c++);
+	} else if (*c == '0') {
+		c++;
+		if (*c == '.') {
+			for (c++; light_isdigit(*c); c++) {
+				q += (*c - '0') * mult;
+				mult /= 10;
+			}
+		}
+	} else {
+		/* broken qvalue, take it as 'not acceptable' */
+		q = 0;
+	}
+
+	*s = c;
+
+	return q;
+}
+
+/**
+ * get the qvalues of the content-codings from the Accept-Encoding header
+ *
+ * names is a NULL terminated list of the content-codings we know,
+ * qvalues[i] gets the qvalue of names[i] in 1/1000 or -1 if the client
+ * didn't mention it. "*" is applied to all codings which are not mentioned
+ * and "x-gzip" is handled as "gzip" (RFC 2616 3.5).
+ */
+void http_accept_encoding_get_qvalues(const char *value, const char * const names[], int qvalues[]) {
+	const char *c = value;
+	int star = -1;
+	size_t i;
+
+	for (i = 0; names[i]; i++) qvalues[i] = -1;
+
+	if (!c) return;
+
+	while (*c) {
+		const char *name;
+		size_t name_len;
+		int q = 1000;
+
+		/* skip the separators */
+		while (*c == ',' || *c == ' ' || *c == '\t') c++;
+		if (*c == '\0') break;
+
+		name = c;
+		while (*c && *c != ';' && *c != ',' && *c != ' ' && *c != '\t') c++;
+		name_len = c - name;
+
+		/* parameters, we only care about q */
+		while (*c && *c != ',') {
+			if (*c == ';') {
+				c++;
+				while (*c == ' ' || *c == '\t') c++;
+
+				if ((*c == 'q' || *c == 'Q') && c[1] == '=') {
+					c += 2;
+					q = http_qvalue_parse(&c);
+					continue;
+				}
+			}
+			c++;
+		}
+
+		if (name_len == 1 && *name == '*') {
+			star = q;
+			continue;
+		}
+
+		if (name_len == sizeof("x-gzip") - 1 && 0 == strncasecmp(name, "x-gzip", name_len)) {
+			name += 2;
+			name_len -= 2;
+		}
+
+		for (i = 0; names[i]; i++) {
+			if (name_len == strlen(names[i]) && 0 == strncasecmp(name, names[i], name_len)) {
+				qvalues[i] = q;
+				break;
+			}
+		}
+	}
+
+	if (star != -1) {
+		for (i = 0; names[i]; i++) {
+			if (qvalues[i] == -1) qvalues[i] = star;
+		}
+	}
+}
+
+static void http_response_range_append(connection *con, buffer *path, buffer *mem, off_t start, off_t len) {
+	if (path) {
+		chunkqueue_append_file(con->send, path, start, len);
+	} else {
+		chunkqueue_append_shared_buffer(con->send, mem, start, len);
+	}
+	con->send->bytes_in += len;
+}
+
+/**
+ * answer the Range header of the request from a entity we have completely
+ *
+ * the content is taken from the file @path or, if path is NULL, from @mem.
+ * The Content-Length is known in advance, keep-alive keeps working.
+ *
+ * @return 0 if the parts are in con->send and the status is 206,
+ *         -1 if the full entity has to be sent (or 416 is set in con->http_status)
+ */
+int http_response_range(server *srv, connection *con, buffer *path, buffer *mem, off_t size) {
+	data_string *ds;
+	buffer *content_type = NULL;
+	http_req_range *ranges, *r;
+	off_t content_length = 0;
+
+	if (NULL == (ds = (data_string *)http_header_get(con->request.headers, HTTP_HEADER_RANGE))) {
+		return -1;
+	}
+
+	ranges = http_request_range_init();
+
+	if (PARSE_SUCCESS != http_request_range_parse(ds->value, ranges)) {
+		/* no valid Range header */
+		http_request_range_free(ranges);
+		return -1;
+	}
+
+	switch (http_request_range_normalize(ranges, size)) {
+	case 0:
+		break;
+	case -2:
+		con->http_status = 416;
+
+		buffer_copy_string_len(srv->tmp_buf, CONST_STR_LEN("bytes */"));
+		buffer_append_off_t(srv->tmp_buf, size);
+		response_header_overwrite(srv, con, CONST_STR_LEN("Content-Range"), CONST_BUF_LEN(srv->tmp_buf));
+		/* fall through */
+	default:
+		http_request_range_free(ranges);
+		return -1;
+	}
+
+	if (NULL != (ds = (data_string *)http_header_get(con->response.headers, HTTP_HEADER_CONTENT_TYPE))) {
+		content_type = ds->value;
+	}
+
+	if (ranges->next) {
+		char boundary[16 + 1];
+		size_t boundary_len, nparts = 0, *part_end, i;
+		buffer *parts;
+
+		/* a new boundary for each response, the content can't contain it on purpose */
+		boundary_len = snprintf(boundary, sizeof(boundary), "%08x%08x", (unsigned int)rand(), (unsigned int)rand());
+
+		/* the end of each part-header is the same for all parts */
+		buffer_copy_string_len(srv->tmp_buf, CONST_STR_LEN("/"));
+		buffer_append_off_t(srv->tmp_buf, size);
+		if (content_type) {
+			buffer_append_string_len(srv->tmp_buf, CONST_STR_LEN("\r\nContent-Type: "));
+			buffer_append_string_buffer(srv->tmp_buf, content_type);
+		}
+		buffer_append_string_len(srv->tmp_buf, CONST_STR_LEN("\r\n\r\n"));
+
+		for (r = ranges; r; r = r->next) nparts++;
+
+		/* all the part-headers and the closing boundary go into one buffer,
+		 * the parts are slices of it between the data. buffer_append_off_t()
+		 * wants room for 32 digits. */
+		parts = buffer_init();
+		buffer_prepare_copy(parts,
+			nparts * (sizeof("\r\n--\r\nContent-Range: bytes -") - 1 + boundary_len + 2 * 32 + srv->tmp_buf->used - 1) +
+			sizeof("\r\n----\r\n") - 1 + boundary_len + 1);
+		part_end = malloc(nparts * sizeof(*part_end));
+		assert(part_end);
+
+		for (r = ranges, i = 0; r; r = r->next, i++) {
+			buffer_append_string_len(parts, CONST_STR_LEN("\r\n--"));
+			buffer_append_string_len(parts, boundary, boundary_len);
+			buffer_append_string_len(parts, CONST_STR_LEN("\r\nContent-Range: bytes "));
+			buffer_append_off_t(parts, r->start);
+			buffer_append_string_len(parts, CONST_STR_LEN("-"));
+			buffer_append_off_t(parts, r->end);
+			buffer_append_string_buffer(parts, srv->tmp_buf);
+
+			part_end[i] = parts->used - 1;
+		}
+
+		/* add boundary end */
+		buffer_append_string_len(parts, CONST_STR_LEN("\r\n--"));
+		buffer_append_string_len(parts, boundary, boundary_len);
+		buffer_append_string_len(parts, CONST_STR_LEN("--\r\n"));
+
+		for (r = ranges, i = 0; r; r = r->next, i++) {
+			size_t part_start = i ? part_end[i - 1] : 0;
+
+			chunkqueue_append_shared_buffer(con->send, parts, part_start, part_end[i] - part_start);
+
+			http_response_range_append(con, path, mem, r->start, r->end - r->start + 1);
+			content_length += r->end - r->start + 1;
+		}
+
+		chunkqueue_append_shared_buffer(con->send, parts, part_end[nparts - 1], parts->used - 1 - part_end[nparts - 1]);
+
+		con->send->bytes_in += parts->used - 1;
+		content_length += parts->used - 1;
+
+		free(part_end);
+		buffer_free(parts);
+
+		buffer_copy_string_len(srv->tmp_buf, CONST_STR_LEN("multipart/byteranges; boundary="));
+		buffer_append_string_len(srv->tmp_buf, boundary, boundary_len);
+
+		/* overwrite content-type */
+		response_header_overwrite(srv, con, CONST_STR_LEN("Content-Type"), CONST_BUF_LEN(srv->tmp_buf));
+	} else {
+		/* a single range, perhaps after merging */
+		r = ranges;
+
+		http_response_range_append(con, path, mem, r->start, r->end - r->start + 1);
+		content_length = r->end - r->start + 1;
+
+		buffer_copy_string_len(srv->tmp_buf, CONST_STR_LEN("bytes "));
+		buffer_append_off_t(srv->tmp_buf, r->start);
+		buffer_append_string_len(srv->tmp_buf, CONST_STR_LEN("-"));
+		buffer_append_off_t(srv->tmp_buf, r->end);
+		buffer_append_string_len(srv->tmp_buf, CONST_STR_LEN("/"));
+		buffer_append_off_t(srv->tmp_buf, size);
+
+		response_header_overwrite(srv, con, CONST_STR_LEN("Content-Range"), CONST_BUF_LEN(srv->tmp_buf));
+	}
+
+	con->response.content_length = content_length;
+	con->http_status = 206;
+
+	http_request_range_free(ranges);
+
+	return 0;
+}
@@ -0,0 +1,229 @@
+/**
+ * the HTTP/1.1 chunked transfer-encoding
+ *
+ */
+
+#include <string.h>
+
+#include "http_chunk.h"
+
+/* 15 hex-digits still fit into a signed 64bit off_t */
+#define HTTP_CHUNK_LEN_MAX_DIGITS (int)(2 * sizeof(off_t) - 1)
+
+static const char hex_chars[] = "0123456789abcdef";
+
+static const signed char hex_values[256] = {
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1, /* 0 - 9 */
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* A - F */
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* a - f */
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+void http_chunk_decoder_reset(http_chunk_decoder *dec) {
+	dec->state = HTTP_CHUNK_LEN;
+	dec->chunk_len = 0;
+	dec->len_digits = 0;
+	dec->line_len = 0;
+}
+
+/**
+ * decode the chunked stream in @in into @out
+ *
+ * the chunk-data is moved into @out without copying (whole chunks are
+ * stolen, parts become shared slices). With @passthrough the stream is
+ * forwarded as is and only parsed to find its end.
+ *
+ * the chunk-sizes are taken apart in place, the chunk-data is skipped by its
+ * length and the line-ends are searched with memchr(); nothing is collected
+ * byte by byte.
+ *
+ * @return -1 on a protocol error, 1 if the last-chunk and the trailer were
+ *         seen, 0 if more data is needed
+ */
+int http_chunk_decode(http_chunk_decoder *dec, chunkqueue *in, chunkqueue *out, int passthrough) {
+	chunk *c;
+
+	for (c = in->first; c && dec->state != HTTP_CHUNK_FINISHED; c = c->next) {
+		const char *start, *p, *end, *nl;
+		off_t we_have, we_want;
+		int stolen = 0;
+
+		if (c->type != MEM_CHUNK || chunk_is_done(c)) continue;
+
+		start = p = c->mem->ptr + c->offset;
+		end = c->mem->ptr + c->mem->used - 1;
+
+		while (p < end && !stolen && dec->state != HTTP_CHUNK_FINISHED) {
+			switch (dec->state) {
+			case HTTP_CHUNK_LEN:
+				for (; p < end; p++) {
+					int d = hex_values[(unsigned char)*p];
+
+					if (d < 0) break;
+					if (++dec->len_digits > HTTP_CHUNK_LEN_MAX_DIGITS) return -1;
+
+					dec->chunk_len = (dec->chunk_len << 4) | d;
+				}
+				if (p == end) break;
+
+				/* the chunk-size is followed by the extensions or the CRLF */
+				if (dec->len_digits == 0) return -1;
+				if (*p != ';' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') return -1;
+
+				dec->state = HTTP_CHUNK_EXTENSION;
+				/* fall through */
+			case HTTP_CHUNK_EXTENSION:
+				/* the chunk-extensions are ignored */
+				if (NULL == (nl = memchr(p, '\n', end - p))) {
+					p = end;
+					break;
+				}
+				p = nl + 1;
+
+				dec->state = (dec->chunk_len > 0) ? HTTP_CHUNK_DATA : HTTP_CHUNK_TRAILER;
+				break;
+			case HTTP_CHUNK_DATA:
+				we_have = end - p;
+				we_want = dec->chunk_len < we_have ? dec->chunk_len : we_have;
+
+				if (!passthrough) {
+					if (we_want == we_have) {
+						/* the rest of the chunk is data, just steal it */
+						c->offset = p - c->mem->ptr;
+						chunkqueue_steal_chunk(out, c);
+						stolen = 1;
+					} else {
+						chunkqueue_append_shared_buffer(out, c->mem, p - c->mem->ptr, we_want);
+					}
+					out->bytes_in += we_want;
+				}
+
+				p += we_want;
+				dec->chunk_len -= we_want;
+
+				if (dec->chunk_len == 0) dec->state = HTTP_CHUNK_DATA_END;
+				break;
+			case HTTP_CHUNK_DATA_END:
+				/* the chunk-data is followed by a CRLF (or a bare LF), nothing else */
+				if (*p == '\r' && dec->line_len == 0) {
+					dec->line_len = 1;
+					p++;
+					break;
+				}
+				if (*p != '\n') return -1;
+				p++;
+
+				dec->line_len = 0;
+				dec->len_digits = 0;
+				dec->state = HTTP_CHUNK_LEN;
+				break;
+			case HTTP_CHUNK_TRAILER:
+				/* the trailer ends with an empty line */
+				for (; p < end && *p != '\n'; p++) {
+					if (*p != '\r') dec->line_len++;
+				}
+				if (p == end) break;
+				p++;
+
+				if (dec->line_len == 0) dec->state = HTTP_CHUNK_FINISHED;
+				dec->line_len = 0;
+				break;
+			case HTTP_CHUNK_FINISHED:
+				break;
+			}
+		}
+
+		if (!stolen) {
+			if (passthrough && p > start) {
+				if (p == end) {
+					chunkqueue_steal_chunk(out, c);
+				} else {
+					chunkqueue_append_shared_buffer(out, c->mem, start - c->mem->ptr, p - start);
+					c->offset = p - c->mem->ptr;
+				}
+				out->bytes_in += p - start;
+			} else {
+				c->offset = p - c->mem->ptr;
+			}
+		}
+
+		in->bytes_out += p - start;
+	}
+
+	return (dec->state == HTTP_CHUNK_FINISHED) ? 1 : 0;
+}
+
+/**
+ * move all of @in into @out as one HTTP chunk
+ *
+ * the chunk-size line, the CRLF behind the data and the last-chunk (if @in is
+ * closed) are written into @arena and referenced by shared MEM_CHUNKs, so a
+ * pass costs one allocation and adds two iovecs around the data.
+ *
+ * @return octets appended to @out
+ */
+off_t http_chunk_encode(chunkqueue *in, chunkqueue *out, buffer *arena) {
+	off_t len = 0, moved = 0, l;
+	size_t prefix_len;
+	char hex[2 * sizeof(off_t)];
+	char *p;
+	int i;
+	chunk *c;
+
+	for (c = in->first; c; c = c->next) {
+		len += chunk_length(c);
+	}
+
+	buffer_prepare_copy(arena, sizeof(hex) + sizeof("\r\n\r\n0\r\n\r\n"));
+	p = arena->ptr;
+
+	if (len > 0) {
+		for (i = sizeof(hex), l = len; l; l >>= 4) {
+			hex[--i] = hex_chars[l & 0x0f];
+		}
+		memcpy(p, hex + i, sizeof(hex) - i);
+		p += sizeof(hex) - i;
+		*p++ = '\r';
+		*p++ = '\n';
+	}
+	prefix_len = p - arena->ptr;
+
+	if (len > 0) {
+		*p++ = '\r';
+		*p++ = '\n';
+	}
+
+	if (in->is_closed) {
+		memcpy(p, "0\r\n\r\n", 5);
+		p += 5;
+	}
+	*p = '\0';
+	arena->used = p - arena->ptr + 1;
+
+	if (arena->used == 1) return 0;
+
+	chunkqueue_append_shared_buffer(out, arena, 0, prefix_len);
+
+	for (c = in->first; c; c = c->next) {
+		moved += chunkqueue_steal_chunk(out, c);
+	}
+
+	chunkqueue_append_shared_buffer(out, arena, prefix_len, arena->used - 1 - prefix_len);
+
+	in->bytes_out += moved;
+	out->bytes_in += moved + arena->used - 1;
+
+	return moved + arena->used - 1;
+}
@@ -0,0 +1,36 @@
+#ifndef _HTTP_CHUNK_H_
+#define _HTTP_CHUNK_H_
+
+#include "buffer.h"
+#include "chunk.h"
+
+/**
+ * HTTP/1.1 chunked transfer-encoding
+ *
+ * the decoder is used by the proxy-backends to read chunked responses,
+ * the encoder by mod_chunked
+ */
+
+typedef enum {
+	HTTP_CHUNK_LEN,       /* the hex-digits of the chunk-size */
+	HTTP_CHUNK_EXTENSION, /* chunk-extensions up to the LF */
+	HTTP_CHUNK_DATA,
+	HTTP_CHUNK_DATA_END,  /* the CRLF behind the chunk-data */
+	HTTP_CHUNK_TRAILER,   /* trailer lines after the last-chunk */
+	HTTP_CHUNK_FINISHED
+} http_chunk_state_t;
+
+typedef struct {
+	http_chunk_state_t state;
+
+	off_t chunk_len;  /* octets left in the current chunk */
+	int   len_digits; /* hex-digits of the chunk-size seen so far */
+	int   line_len;   /* non-CR octets in the current trailer line, 1 if the CR behind the chunk-data was seen */
+} http_chunk_decoder;
+
+LI_API void http_chunk_decoder_reset(http_chunk_decoder *dec);
+LI_API int http_chunk_decode(http_chunk_decoder *dec, chunkqueue *in, chunkqueue *out, int passthrough);
+
+LI_API off_t http_chunk_encode(chunkqueue *in, chunkqueue *out, buffer *arena);
+
+#endif
@@ -0,0 +1,178 @@
+/**
+ * lookup of the well-known HTTP header fields
+ *
+ */
+
+#include <string.h>
+
+#include "http_header.h"
+#include "buffer.h"
+
+#include "sys-strings.h"
+
+static const struct {
+	const char *name;
+	size_t len;
+} http_headers[HTTP_HEADER_COUNT] = {
+	{ NULL, 0 }, /* HTTP_HEADER_UNSET */
+	{ NULL, 0 }, /* HTTP_HEADER_OTHER */
+	{ CONST_STR_LEN("Accept") },
+	{ CONST_STR_LEN("Accept-Charset") },
+	{ CONST_STR_LEN("Accept-Encoding") },
+	{ CONST_STR_LEN("Accept-Language") },
+	{ CONST_STR_LEN("Accept-Ranges") },
+	{ CONST_STR_LEN("Age") },
+	{ CONST_STR_LEN("Allow") },
+	{ CONST_STR_LEN("Authorization") },
+	{ CONST_STR_LEN("Cache-Control") },
+	{ CONST_STR_LEN("Connection") },
+	{ CONST_STR_LEN("Content-Encoding") },
+	{ CONST_STR_LEN("Content-Language") },
+	{ CONST_STR_LEN("Content-Length") },
+	{ CONST_STR_LEN("Content-Location") },
+	{ CONST_STR_LEN("Content-Range") },
+	{ CONST_STR_LEN("Content-Type") },
+	{ CONST_STR_LEN("Cookie") },
+	{ CONST_STR_LEN("Date") },
+	{ CONST_STR_LEN("Depth") },
+	{ CONST_STR_LEN("Destination") },
+	{ CONST_STR_LEN("ETag") },
+	{ CONST_STR_LEN("Expect") },
+	{ CONST_STR_LEN("Expires") },
+	{ CONST_STR_LEN("Host") },
+	{ CONST_STR_LEN("If") },
+	{ CONST_STR_LEN("If-Match") },
+	{ CONST_STR_LEN("If-Modified-Since") },
+	{ CONST_STR_LEN("If-None-Match") },
+	{ CONST_STR_LEN("If-Range") },
+	{ CONST_STR_LEN("If-Unmodified-Since") },
+	{ CONST_STR_LEN("Keep-Alive") },
+	{ CONST_STR_LEN("Last-Modified") },
+	{ CONST_STR_LEN("Location") },
+	{ CONST_STR_LEN("Lock-Token") },
+	{ CONST_STR_LEN("Overwrite") },
+	{ CONST_STR_LEN("Pragma") },
+	{ CONST_STR_LEN("Proxy-Authorization") },
+	{ CONST_STR_LEN("Range") },
+	{ CONST_STR_LEN("Referer") },
+	{ CONST_STR_LEN("Server") },
+	{ CONST_STR_LEN("Set-Cookie") },
+	{ CONST_STR_LEN("Status") },
+	{ CONST_STR_LEN("TE") },
+	{ CONST_STR_LEN("Trailer") },
+	{ CONST_STR_LEN("Transfer-Encoding") },
+	{ CONST_STR_LEN("Upgrade") },
+	{ CONST_STR_LEN("User-Agent") },
+	{ CONST_STR_LEN("Vary") },
+	{ CONST_STR_LEN("Via") },
+	{ CONST_STR_LEN("WWW-Authenticate") },
+	{ CONST_STR_LEN("X-Forwarded-For") },
+	{ CONST_STR_LEN("X-Forwarded-Proto") },
+	{ CONST_STR_LEN("X-Host") },
+	{ CONST_STR_LEN("X-LIGHTTPD-send-file") },
+	{ CONST_STR_LEN("X-LIGHTTPD-send-tempfile") },
+	{ CONST_STR_LEN("X-Rewrite-Backend") },
+	{ CONST_STR_LEN("X-Rewrite-Host") },
+	{ CONST_STR_LEN("X-Rewrite-URI") },
+	{ CONST_STR_LEN("X-Sendfile") }
+};
+
+static unsigned int http_header_hashes[HTTP_HEADER_COUNT]; /* array_hash_key() of the names, 0 until first use */
+
+/**
+ * a perfect hash over the names above, the way gperf builds them:
+ *
+ *   (len + asso[name[0]] + asso[name[1]] + asso[name[len - 1]]) & 127
+ *
+ * doesn't collide for any two of them. asso[] ignores the case of the
+ * letters, the slot holds the id of the field or 0.
+ *
+ * a new name needs new asso[] values if it collides with an old one.
+ */
+static const unsigned char http_header_asso[256] = {
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,  98,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0, 107,   7, 113,   9, 103,  66, 114,  17,  55,   0,  31, 120,  74,   9,  23,
+	 86,   0, 115, 108,  70,  30, 111,  25,  90,  39,  11,   0,   0,   0,   0,   0,
+	  0, 107,   7, 113,   9, 103,  66, 114,  17,  55,   0,  31, 120,  74,   9,  23,
+	 86,   0, 115, 108,  70,  30, 111,  25,  90,  39,  11,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0
+};
+
+static const unsigned char http_header_slots[128] = {
+	59,  8,  0,  0, 21, 49, 20,  0, 54,  0, 12,  0,  0, 23,  0,  0,
+	58,  0, 27,  0, 50,  0, 44, 29,  0,  0,  0, 11,  0,  0,  0,  9,
+	34, 15, 35, 22, 43,  0,  0, 14,  2, 51,  0,  0,  0, 60,  0,  0,
+	 3,  0,  0, 45, 24,  0,  0, 55,  0,  0, 37, 56, 46, 26, 52,  0,
+	 0,  0,  0,  0, 42,  0,  0,  7,  0,  0, 39,  0, 41,  0,  0,  0,
+	 0,  0,  5,  0, 40,  6, 57,  0,  0,  0, 48,  0,  0,  4,  0, 19,
+	 0, 10, 47,  0, 53, 38,  0,  0, 30,  0,  0,  0,  0,  0,  0,  0,
+	 0, 28, 25, 31,  0, 18, 36, 32,  0, 33,  0, 17, 16,  0,  0, 13
+};
+
+/**
+ * map a field-name to its id
+ *
+ * one hash over three characters and a single string compare
+ *
+ * @return HTTP_HEADER_OTHER if the name isn't a well-known one
+ */
+http_header_t http_header_lookup(const char *name, size_t len) {
+	http_header_t h;
+
+	if (len < 2) return HTTP_HEADER_OTHER;
+
+	h = http_header_slots[(len +
+			http_header_asso[(unsigned char)name[0]] +
+			http_header_asso[(unsigned char)name[1]] +
+			http_header_asso[(unsigned char)name[len - 1]]) & 127];
+
+	if (h == HTTP_HEADER_UNSET ||
+	    http_headers[h].len != len ||
+	    0 != strncasecmp(name, http_headers[h].name, len)) {
+		return HTTP_HEADER_OTHER;
+	}
+
+	return h;
+}
+
+/**
+ * the id of the field @ds
+ *
+ * fields which were inserted without one are looked up now
+ */
+http_header_t http_header_id(data_string *ds) {
+	if (ds->header_id == HTTP_HEADER_UNSET) {
+		ds->header_id = http_header_lookup(CONST_BUF_LEN(ds->key));
+	}
+
+	return ds->header_id;
+}
+
+/**
+ * get the header @h from the header array @hdrs
+ *
+ * the same as array_get_element() with the name, without hashing it again
+ */
+data_unset *http_header_get(array *hdrs, http_header_t h) {
+	data_string *ds;
+
+	if (http_header_hashes[h] == 0) {
+		http_header_hashes[h] = array_hash_key(http_headers[h].name, http_headers[h].len);
+	}
+
+	ds = (data_string *)array_get_element_hashed(hdrs, http_headers[h].name, http_headers[h].len, http_header_hashes[h]);
+
+	if (ds) ds->header_id = h;
+
+	return (data_unset *)ds;
+}
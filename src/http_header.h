@@ -0,0 +1,86 @@
+#ifndef _HTTP_HEADER_H_
+#define _HTTP_HEADER_H_
+
+#include "array.h"
+
+/**
+ * the well-known HTTP header fields
+ *
+ * the parsers and the response builders store the id of a field in the
+ * data_string of the header (->header_id), lookups and dispatching on the
+ * name compare the ids instead of the strings. http_header_id() looks up
+ * the id of fields which were inserted without one.
+ */
+
+typedef enum {
+	HTTP_HEADER_UNSET,  /* the key wasn't looked up yet */
+	HTTP_HEADER_OTHER,  /* not a well-known field */
+
+	HTTP_HEADER_ACCEPT,
+	HTTP_HEADER_ACCEPT_CHARSET,
+	HTTP_HEADER_ACCEPT_ENCODING,
+	HTTP_HEADER_ACCEPT_LANGUAGE,
+	HTTP_HEADER_ACCEPT_RANGES,
+	HTTP_HEADER_AGE,
+	HTTP_HEADER_ALLOW,
+	HTTP_HEADER_AUTHORIZATION,
+	HTTP_HEADER_CACHE_CONTROL,
+	HTTP_HEADER_CONNECTION,
+	HTTP_HEADER_CONTENT_ENCODING,
+	HTTP_HEADER_CONTENT_LANGUAGE,
+	HTTP_HEADER_CONTENT_LENGTH,
+	HTTP_HEADER_CONTENT_LOCATION,
+	HTTP_HEADER_CONTENT_RANGE,
+	HTTP_HEADER_CONTENT_TYPE,
+	HTTP_HEADER_COOKIE,
+	HTTP_HEADER_DATE,
+	HTTP_HEADER_DEPTH,
+	HTTP_HEADER_DESTINATION,
+	HTTP_HEADER_ETAG,
+	HTTP_HEADER_EXPECT,
+	HTTP_HEADER_EXPIRES,
+	HTTP_HEADER_HOST,
+	HTTP_HEADER_IF,
+	HTTP_HEADER_IF_MATCH,
+	HTTP_HEADER_IF_MODIFIED_SINCE,
+	HTTP_HEADER_IF_NONE_MATCH,
+	HTTP_HEADER_IF_RANGE,
+	HTTP_HEADER_IF_UNMODIFIED_SINCE,
+	HTTP_HEADER_KEEP_ALIVE,
+	HTTP_HEADER_LAST_MODIFIED,
+	HTTP_HEADER_LOCATION,
+	HTTP_HEADER_LOCK_TOKEN,
+	HTTP_HEADER_OVERWRITE,
+	HTTP_HEADER_PRAGMA,
+	HTTP_HEADER_PROXY_AUTHORIZATION,
+	HTTP_HEADER_RANGE,
+	HTTP_HEADER_REFERER,
+	HTTP_HEADER_SERVER,
+	HTTP_HEADER_SET_COOKIE,
+	HTTP_HEADER_STATUS,
+	HTTP_HEADER_TE,
+	HTTP_HEADER_TRAILER,
+	HTTP_HEADER_TRANSFER_ENCODING,
+	HTTP_HEADER_UPGRADE,
+	HTTP_HEADER_USER_AGENT,
+	HTTP_HEADER_VARY,
+	HTTP_HEADER_VIA,
+	HTTP_HEADER_WWW_AUTHENTICATE,
+	HTTP_HEADER_X_FORWARDED_FOR,
+	HTTP_HEADER_X_FORWARDED_PROTO,
+	HTTP_HEADER_X_HOST,
+	HTTP_HEADER_X_LIGHTTPD_SEND_FILE,
+	HTTP_HEADER_X_LIGHTTPD_SEND_TEMPFILE,
+	HTTP_HEADER_X_REWRITE_BACKEND,
+	HTTP_HEADER_X_REWRITE_HOST,
+	HTTP_HEADER_X_REWRITE_URI,
+	HTTP_HEADER_X_SENDFILE,
+
+	HTTP_HEADER_COUNT
+} http_header_t;
+
+LI_API http_header_t http_header_lookup(const char *name, size_t len);
+LI_API http_header_t http_header_id(data_string *ds);
+LI_API data_unset *http_header_get(array *hdrs, http_header_t h);
+
+#endif
@@ -9,6 +9,7 @@
 #include "http_req.h"
 #include "keyvalue.h"
 #include "array.h"
+#include "http_header.h"
 #include "log.h"
 }
 
@@ -127,6 +128,7 @@ headers ::= header.
 
 header(HDR) ::= STRING(A) COLON multiline(B). {
     http_req *req = ctx->req;
+    data_string *old;
 
     if (NULL == (HDR = (data_string *)array_get_unused_element(req->headers, TYPE_STRING))) {
         HDR = data_string_init();
@@ -134,10 +136,26 @@ header(HDR) ::= STRING(A) COLON multiline(B). {
    
     buffer_copy_string_buffer(HDR->key, A);
     buffer_copy_string_buffer(HDR->value, B);    
+    HDR->header_id = http_header_lookup(CONST_BUF_LEN(A));
     buffer_pool_append(ctx->unused_buffers, A); 
     buffer_pool_append(ctx->unused_buffers, B); 
-      
-    array_insert_unique(req->headers, (data_unset *)HDR);
+
+    /* duplicates are merged into a list, these two can't be one */
+    if ((HDR->header_id == HTTP_HEADER_RANGE ||
+         HDR->header_id == HTTP_HEADER_IF_MODIFIED_SINCE) &&
+        NULL != (old = (data_string *)http_header_get(req->headers, HDR->header_id))) {
+        if (HDR->header_id == HTTP_HEADER_RANGE ||
+            0 != buffer_caseless_compare(CONST_BUF_LEN(old->value), CONST_BUF_LEN(HDR->value))) {
+            buffer_copy_string(ctx->errmsg, "duplicate header: ");
+            buffer_append_string_buffer(ctx->errmsg, HDR->key);
+            ctx->ok = 0;
+        }
+
+        /* the same timestamp twice is fine, keep the first */
+        HDR->free((data_unset *)HDR);
+    } else {
+        array_insert_unique(req->headers, (data_unset *)HDR);
+    }
 }
 
 header ::= STRING COLON CRLF . 
@@ -186,3 +186,101 @@ parse_status_t http_request_range_parse(buffer *hdr, http_req_range *ranges) {
 	return ret;
 }
 
+
+static int http_request_range_cmp(const void *_a, const void *_b) {
+	const http_req_range *a = _a, *b = _b;
+
+	if (a->start < b->start) return -1;
+	if (a->start > b->start) return 1;
+	return 0;
+}
+
+/**
+ * resolve the ranges against the size of the entity
+ *
+ * - "-<n>" and "<n>-" get their real start and end
+ * - ranges starting behind the entity are dropped
+ * - the rest is sorted and overlapping or adjacent ranges are merged
+ *
+ * @return 0 on success, -1 if the header is invalid and has to be ignored,
+ *         -2 if none of the ranges is satisfiable (416)
+ */
+int http_request_range_normalize(http_req_range *ranges, off_t size) {
+	http_req_range *r, *sorted;
+	size_t n = 0, used = 0, i;
+
+	for (r = ranges; r; r = r->next) n++;
+
+	sorted = malloc(n * sizeof(*sorted));
+
+	for (r = ranges; r; r = r->next) {
+		off_t start = r->start, end = r->end;
+
+		if (start != -1 && end != -1 && start > end) {
+			/* RFC 2616 - 14.35.1
+			 *
+			 * if last-byte-pos is present, it has to be >= first-byte-pos
+			 *
+			 * invalid ranges have to be handle as no Range specified
+			 *  */
+			free(sorted);
+			return -1;
+		}
+
+		if (start == -1) {
+			/* -<end>
+			 *
+			 * the last <end> bytes  */
+			if (end <= 0) continue;
+
+			start = size - end;
+			if (start < 0) start = 0;
+			end = size - 1;
+		} else if (end == -1 || end > size - 1) {
+			/* RFC 2616 - 14.35.1
+			 *
+			 * if last-byte-pos not present or > size-of-file
+			 * take the size-of-file
+			 *
+			 *  */
+			end = size - 1;
+		}
+
+		/* first-byte-pos > file-size, not satisfiable */
+		if (start > size - 1) continue;
+
+		sorted[used].start = start;
+		sorted[used].end = end;
+		used++;
+	}
+
+	if (used == 0) {
+		free(sorted);
+		return -2;
+	}
+
+	qsort(sorted, used, sizeof(*sorted), http_request_range_cmp);
+
+	for (i = 1, n = 0; i < used; i++) {
+		if (sorted[i].start <= sorted[n].end + 1) {
+			if (sorted[i].end > sorted[n].end) sorted[n].end = sorted[i].end;
+		} else {
+			sorted[++n] = sorted[i];
+		}
+	}
+	used = n + 1;
+
+	/* write them back, the first node belongs to the caller */
+	for (i = 0, r = ranges; i < used; i++) {
+		r->start = sorted[i].start;
+		r->end = sorted[i].end;
+
+		if (i + 1 < used) r = r->next;
+	}
+	http_request_range_free(r->next);
+	r->next = NULL;
+
+	free(sorted);
+
+	return 0;
+}
@@ -27,6 +27,7 @@ LI_API void http_request_range_free(http_req_range *range);
 LI_API void http_request_range_reset(http_req_range *range);
 
 LI_API parse_status_t http_request_range_parse(buffer *range_hdr, http_req_range *ranges);
+LI_API int http_request_range_normalize(http_req_range *ranges, off_t size);
 
 /* declare prototypes for the parser */
 void *http_req_range_parserAlloc(void *(*mallocProc)(size_t));
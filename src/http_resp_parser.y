@@ -9,6 +9,7 @@
 #include "http_resp.h"
 #include "keyvalue.h"
 #include "array.h"
+#include "http_header.h"
 #include "log.h"
 }
 
@@ -33,7 +34,7 @@ response_hdr ::= header headers CRLF . {
 
     buffer_copy_string(resp->reason, ""); /* no reason */
 
-    if (NULL == (ds = (data_string *)array_get_element(resp->headers, CONST_STR_LEN("Status")))) {
+    if (NULL == (ds = (data_string *)http_header_get(resp->headers, HTTP_HEADER_STATUS))) {
         resp->status = 0;
     } else {
         char *err;
@@ -120,6 +121,7 @@ header(HDR) ::= STRING(A) COLON STRING(B) CRLF. {
 
     buffer_copy_string_buffer(HDR->key, A);
     buffer_copy_string_buffer(HDR->value, B);
+    HDR->header_id = http_header_lookup(CONST_BUF_LEN(A));
     buffer_pool_append(ctx->unused_buffers, A);
     buffer_pool_append(ctx->unused_buffers, B);
 
@@ -136,6 +138,7 @@ header(HDR) ::= STRING(A) COLON CRLF. {
 
     buffer_copy_string_buffer(HDR->key, A);
     buffer_copy_string(HDR->value, "");
+    HDR->header_id = http_header_lookup(CONST_BUF_LEN(A));
     buffer_pool_append(ctx->unused_buffers, A);
 
     array_insert_unique(resp->headers, (data_unset *)HDR);
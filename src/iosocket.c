@@ -36,8 +36,20 @@ void iosocket_free(iosocket *sock) {
 		}
 	}
 
-#if defined USE_OPENSSL && ! defined OPENSSL_NO_TLSEXT
+	if (sock->zerocopy_held) {
+		size_t i;
+
+		for (i = 0; i < sock->zerocopy_held_used; i++) {
+			buffer_free(sock->zerocopy_held[i].mem);
+		}
+		free(sock->zerocopy_held);
+	}
+
+#ifdef USE_OPENSSL
+	buffer_free(sock->ssl_staging);
+#ifndef OPENSSL_NO_TLSEXT
 	buffer_free(sock->tlsext_server_name);
+#endif
 #endif
 
 	free(sock);
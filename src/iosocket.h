@@ -27,21 +27,57 @@ typedef enum {
 	IOSOCKET_TYPE_PIPE
 } iosocket_t;
 
+/**
+ * a buffer the kernel may still send from (MSG_ZEROCOPY)
+ */
+typedef struct {
+	buffer *mem;
+	unsigned int seq; /**< the last send which used it */
+} iosocket_zerocopy_hold;
+
 /**
  * a non-blocking fd
  */
 typedef struct {
 	int fd;
 	int fde_ndx;
+	unsigned short fde_edge_triggered; /**< EAGAIN is reported with fdevent_event_drained() */
 
 #ifdef USE_OPENSSL
 	SSL *ssl;
+	enum {
+		SSL_HANDSHAKE_DONE_NO,
+		SSL_HANDSHAKE_DONE_UNCOUNTED, /* finished in a ssl.handshake-threads thread */
+		SSL_HANDSHAKE_DONE_COUNTED    /* counted in the status counters */
+	} ssl_handshake_done;
+
+	enum {
+		SSL_HANDSHAKE_JOB_NONE,
+		SSL_HANDSHAKE_JOB_RUNNING, /* a ssl.handshake-threads thread owns the SSL */
+		SSL_HANDSHAKE_JOB_DONE
+	} ssl_handshake_job;
+	int ssl_handshake_err;               /* SSL_get_error() of the step */
+	unsigned long ssl_handshake_errcode; /* first entry of the thread's error-queue */
+
+	buffer *ssl_staging;     /* plain-text for the next SSL_write(), b->used is the length */
+	size_t ssl_records_out;  /* records since the last pause, see network_openssl.c */
+	time_t ssl_last_write;
 #ifndef OPENSSL_NO_TLSEXT
 	buffer *tlsext_server_name;
 #endif
 #endif
 
 	iosocket_t type; /**< sendfile on solaris doesn't work on pipes */
+
+	off_t write_max_out;         /**< traffic-shaper: stop writing when cq->bytes_out reaches it, 0 for no limit */
+
+	unsigned int write_syscalls; /**< write()s, sendfile()s, ... issued by the backends, see network.write-syscalls */
+
+	int zerocopy;                /**< MSG_ZEROCOPY: 0 unused, 1 SO_ZEROCOPY is set, -1 not supported or the kernel copies anyway */
+	unsigned int zerocopy_seq;   /**< MSG_ZEROCOPY sends so far, the completions are counted the same way */
+	iosocket_zerocopy_hold *zerocopy_held; /**< buffers of finished chunks waiting for their completion */
+	size_t zerocopy_held_used;
+	size_t zerocopy_held_size;
 } iosocket;
 
 LI_API iosocket * iosocket_init(void);
@@ -0,0 +1,143 @@
+/**
+ * lookup of the content-type of a filename
+ *
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <ctype.h>
+
+#include "mimetype.h"
+#include "buffer.h"
+
+static size_t mimetype_edge_slot(mimetype_table *t, int parent, unsigned char c) {
+	size_t h = ((size_t)parent * 31 + c) & t->edges_mask;
+
+	while (t->edges[h].child &&
+	       (t->edges[h].parent != parent || t->edges[h].c != c)) {
+		h = (h + 1) & t->edges_mask;
+	}
+
+	return h;
+}
+
+/**
+ * build the reversed-suffix trie of @types
+ *
+ * the suffixes are compared case-insensitive. If several suffixes match a
+ * filename the one listed first wins, as with the linear scan before.
+ */
+mimetype_table *mimetype_table_init(array *types) {
+	mimetype_table *t;
+	size_t i, max_nodes = 1, edges_size;
+
+	t = calloc(1, sizeof(*t));
+	assert(t);
+
+	t->types = types;
+	t->refcount = 1;
+
+	for (i = 0; i < types->used; i++) {
+		data_string *ds = (data_string *)types->data[i];
+
+		if (ds->key->used) max_nodes += ds->key->used - 1;
+	}
+
+	/* keep the edges at most half full */
+	for (edges_size = 16; edges_size < 2 * max_nodes; edges_size <<= 1);
+
+	t->node_type = malloc(max_nodes * sizeof(*t->node_type));
+	t->edges = calloc(edges_size, sizeof(*t->edges));
+	t->edges_mask = edges_size - 1;
+	assert(t->node_type && t->edges);
+
+	t->node_type[0] = -1;
+	t->nodes_used = 1;
+
+	for (i = 0; i < types->used; i++) {
+		data_string *ds = (data_string *)types->data[i];
+		int node = 0;
+		size_t k;
+
+		if (ds->key->used == 0) continue;
+
+		for (k = ds->key->used - 1; k > 0; k--) {
+			unsigned char c = tolower((unsigned char)ds->key->ptr[k - 1]);
+			size_t h = mimetype_edge_slot(t, node, c);
+
+			if (t->edges[h].child == 0) {
+				t->edges[h].parent = node;
+				t->edges[h].c = c;
+				t->edges[h].child = t->nodes_used;
+				t->node_type[t->nodes_used++] = -1;
+			}
+			node = t->edges[h].child;
+		}
+
+		if (t->node_type[node] == -1) t->node_type[node] = i;
+	}
+
+	return t;
+}
+
+static int mimetype_array_is_equal(array *a, array *b) {
+	size_t i;
+
+	if (a->used != b->used) return 0;
+
+	for (i = 0; i < a->used; i++) {
+		data_string *da = (data_string *)a->data[i];
+		data_string *db = (data_string *)b->data[i];
+
+		if (!buffer_is_equal(da->key, db->key)) return 0;
+		if (!buffer_is_equal(da->value, db->value)) return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * take a reference to @t if it was built from the same mimetypes as @types
+ *
+ * @return @t or NULL if the mimetypes differ
+ */
+mimetype_table *mimetype_table_share(mimetype_table *t, array *types) {
+	if (!t || !mimetype_array_is_equal(t->types, types)) return NULL;
+
+	t->refcount++;
+
+	return t;
+}
+
+void mimetype_table_free(mimetype_table *t) {
+	if (!t) return;
+
+	if (--t->refcount > 0) return;
+
+	free(t->node_type);
+	free(t->edges);
+	free(t);
+}
+
+/**
+ * @return the entry of mimetype.assign whose suffix matches @name, NULL if none
+ */
+data_string *mimetype_table_get(mimetype_table *t, const char *name, size_t len) {
+	int node = 0, found = t->node_type[0];
+
+	while (len > 0) {
+		unsigned char c = tolower((unsigned char)name[--len]);
+		size_t h = mimetype_edge_slot(t, node, c);
+
+		if (t->edges[h].child == 0) break;
+
+		node = t->edges[h].child;
+
+		if (t->node_type[node] != -1 &&
+		    (found == -1 || t->node_type[node] < found)) {
+			found = t->node_type[node];
+		}
+	}
+
+	return found == -1 ? NULL : (data_string *)t->types->data[found];
+}
@@ -0,0 +1,40 @@
+#ifndef _MIMETYPE_H_
+#define _MIMETYPE_H_
+
+#include "array.h"
+
+/**
+ * lookup of the content-type of a filename in mimetype.assign
+ *
+ * the suffixes are stored reversed in a trie which is built when the config
+ * is loaded. A lookup walks the filename from the end, its cost depends on
+ * the length of the matching suffix, not on the number of entries.
+ *
+ * contexts with the same mimetype.assign share one table.
+ */
+
+typedef struct {
+	int parent;
+	int child;     /* 0 if the slot is empty, the root is never a child */
+	unsigned char c;
+} mimetype_edge;
+
+typedef struct {
+	array *types; /* the mimetype.assign of the config, not owned */
+
+	int *node_type; /* index into types of the first suffix ending at the node, -1 if none */
+	size_t nodes_used;
+
+	mimetype_edge *edges; /* (parent, char) -> child, open addressing */
+	size_t edges_mask;
+
+	int refcount;
+} mimetype_table;
+
+LI_API mimetype_table *mimetype_table_init(array *types);
+LI_API mimetype_table *mimetype_table_share(mimetype_table *t, array *types);
+LI_API void mimetype_table_free(mimetype_table *t);
+
+LI_API data_string *mimetype_table_get(mimetype_table *t, const char *name, size_t len);
+
+#endif
@@ -23,7 +23,7 @@
 
 #include "plugin.h"
 
-#include "inet_ntop_cache.h"
+#include "connections.h"
 
 #include "sys-socket.h"
 #include "sys-files.h"
@@ -737,9 +737,7 @@ REQUESTDONE_FUNC(log_access_write) {
 				break;
 			case FORMAT_REMOTE_HOST:
 
-				/* handle inet_ntop cache */
-
-				buffer_append_string(b, inet_ntop_cache_get_ip(srv, &(con->dst_addr)));
+				buffer_append_string_buffer(b, connection_get_dst_addr_buf(srv, con));
 
 				break;
 			case FORMAT_REMOTE_IDENT:
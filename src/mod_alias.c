@@ -94,23 +94,21 @@ SETDEFAULTS_FUNC(mod_alias_set_defaults) {
 			size_t j, k;
 
 			for (j = 0; j < a->used; j ++) {
-				const buffer *prefix = a->data[a->sorted[j]]->key;
+				const buffer *prefix = a->data[j]->key;
 				for (k = j + 1; k < a->used; k ++) {
-					const buffer *key = a->data[a->sorted[k]]->key;
+					const buffer *key = a->data[k]->key;
 
 					if (key->used < prefix->used) {
-						break;
+						continue;
 					}
 					if (memcmp(key->ptr, prefix->ptr, prefix->used - 1) != 0) {
-						break;
-					}
-					/* ok, they have same prefix. check position */
-					if (a->sorted[j] < a->sorted[k]) {
-						fprintf(stderr, "url.alias: `%s' will never match as `%s' matched first\n",
-								key->ptr,
-								prefix->ptr);
-						return HANDLER_ERROR;
+						continue;
 					}
+					/* ok, they have same prefix and the shorter one comes first */
+					fprintf(stderr, "url.alias: `%s' will never match as `%s' matched first\n",
+							key->ptr,
+							prefix->ptr);
+					return HANDLER_ERROR;
 				}
 			}
 		}
@@ -14,6 +14,7 @@
 
 #include "sys-strings.h"
 #include "sys-files.h"
+#include "http_header.h"
 
 handler_t auth_ldap_init(server *srv, mod_auth_plugin_config *s);
 #ifdef USE_LDAP
@@ -236,7 +237,7 @@ static handler_t mod_auth_uri_handler(server *srv, connection *con, void *p_d) {
 
 	/* try to get Authorization-header */
 
-	if (NULL != (ds = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("Authorization")))) {
+	if (NULL != (ds = (data_string *)http_header_get(con->request.headers, HTTP_HEADER_AUTHORIZATION))) {
 		http_authorization = ds->value->ptr;
 	}
 
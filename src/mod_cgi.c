@@ -29,6 +29,7 @@
 #include "sys-process.h"
 
 #include "network_backends.h"
+#include "http_header.h"
 
 #ifdef HAVE_SYS_FILIO_H
 # include <sys/filio.h>
@@ -341,23 +342,24 @@ static int cgi_demux_response(server *srv, connection *con, plugin_data *p) {
 
 			/* copy the http-headers */
 			for (i = 0; i < p->resp->headers->used; i++) {
-				const char *ign[] = { "Status", "Connection", NULL };
-				size_t j;
 				data_string *ds;
 
 				data_string *header = (data_string *)p->resp->headers->data[i];
 
-				/* some headers are ignored by default */
-				for (j = 0; ign[j]; j++) {
-					if (0 == strcasecmp(ign[j], header->key->ptr)) break;
-				}
-				if (ign[j]) continue;
-
-				if (0 == buffer_caseless_compare(CONST_BUF_LEN(header->key), CONST_STR_LEN("Location"))) {
+				switch (http_header_id(header)) {
+				case HTTP_HEADER_STATUS:
+				case HTTP_HEADER_CONNECTION:
+					/* some headers are ignored by default */
+					continue;
+				case HTTP_HEADER_LOCATION:
 					/* CGI/1.1 rev 03 - 7.2.1.2 */
 					if (con->http_status == 0) con->http_status = 302;
-				} else if (0 == buffer_caseless_compare(CONST_BUF_LEN(header->key), CONST_STR_LEN("Content-Length"))) {
+					break;
+				case HTTP_HEADER_CONTENT_LENGTH:
 					have_content_length = 1;
+					break;
+				default:
+					break;
 				}
 
 				if (NULL == (ds = (data_string *)array_get_unused_element(con->response.headers, TYPE_STRING))) {
@@ -365,6 +367,7 @@ static int cgi_demux_response(server *srv, connection *con, plugin_data *p) {
 				}
 				buffer_copy_string_buffer(ds->key, header->key);
 				buffer_copy_string_buffer(ds->value, header->value);
+				ds->header_id = header->header_id;
 
 				array_insert_unique(con->response.headers, (data_unset *)ds);
 			}
@@ -397,6 +400,19 @@ static int cgi_demux_response(server *srv, connection *con, plugin_data *p) {
 	return 0;
 }
 
+/**
+ * close the stdin of the cgi-script
+ */
+static void cgi_close_wb_sock(server *srv, cgi_session *sess) {
+	if (sess->wb_sock->fd == -1) return;
+
+	fdevent_event_del(srv->ev, sess->wb_sock);
+	fdevent_unregister(srv->ev, sess->wb_sock);
+
+	close(sess->wb_sock->fd);
+	sess->wb_sock->fd = -1;
+}
+
 static handler_t cgi_connection_close(server *srv, connection *con, plugin_data *p) {
 	cgi_session *sess = con->plugin_ctx[p->id];
 	int status;
@@ -425,10 +441,7 @@ static handler_t cgi_connection_close(server *srv, connection *con, plugin_data
 		fdevent_unregister(srv->ev, sess->sock_err);
 	}
 
-	if (sess->wb_sock->fd != -1) {
-		close(sess->wb_sock->fd);
-		sess->wb_sock->fd = -1;
-	}
+	cgi_close_wb_sock(srv, sess);
 
 	pid = sess->pid;
 
@@ -616,6 +629,22 @@ static void cgi_copy_err(chunkqueue *cq) {
 	chunkqueue_remove_finished_chunks(cq);
 }
 
+/**
+ * the cgi-script can take more of the request content
+ */
+static handler_t cgi_handle_wb_fdevent(void *s, void *ctx, int revents) {
+	server      *srv  = (server *)s;
+	cgi_session *sess = ctx;
+
+	if (revents & (FDEVENT_OUT | FDEVENT_HUP | FDEVENT_ERR)) {
+		fdevent_event_del(srv->ev, sess->wb_sock);
+
+		joblist_append(srv, sess->remote_con);
+	}
+
+	return HANDLER_FINISHED;
+}
+
 static handler_t cgi_handle_err_fdevent(void *s, void *ctx, int revents) {
 	server      *srv  = (server *)s;
 	cgi_session *sess = ctx;
@@ -970,6 +999,7 @@ static int cgi_create_env(server *srv, connection *con, plugin_data *p, buffer *
 
 		/* register PID and wait for them asyncronously */
 		con->mode = p->id;
+		con->stream_request_body = con->conf.stream_request_body;
 		buffer_reset(con->physical.path);
 
 		sess = cgi_session_init();
@@ -1002,6 +1032,17 @@ static int cgi_create_env(server *srv, connection *con, plugin_data *p, buffer *
 			return -1;
 		}
 
+		/* the streamed content is written as the script reads it,
+		 * the spooled content still goes in one blocking write */
+		if (con->stream_request_body &&
+		    -1 == fdevent_fcntl_set(srv->ev, sess->wb_sock)) {
+			log_error_write(srv, __FILE__, __LINE__, "ss", "fcntl failed: ", strerror(errno));
+
+			cgi_session_free(sess);
+
+			return -1;
+		}
+
 		con->plugin_ctx[p->id] = sess;
 
 		fdevent_register(srv->ev, sess->sock, cgi_handle_fdevent, sess);
@@ -1010,6 +1051,8 @@ static int cgi_create_env(server *srv, connection *con, plugin_data *p, buffer *
 		fdevent_register(srv->ev, sess->sock_err, cgi_handle_err_fdevent, sess);
 		fdevent_event_add(srv->ev, sess->sock_err, FDEVENT_IN);
 
+		fdevent_register(srv->ev, sess->wb_sock, cgi_handle_wb_fdevent, sess);
+
 		sess->state = CGI_STATE_READ_RESPONSE_HEADER;
 
 		break;
@@ -1215,6 +1258,8 @@ SUBREQUEST_FUNC(mod_cgi_read_response_content) {
 		fdevent_event_del(srv->ev, sess->sock_err);
 		fdevent_unregister(srv->ev, sess->sock_err);
 
+		cgi_close_wb_sock(srv, sess);
+
 		cgi_session_free(sess);
 		sess = NULL;
 
@@ -1242,6 +1287,8 @@ SUBREQUEST_FUNC(mod_cgi_read_response_content) {
 		fdevent_event_del(srv->ev, sess->sock_err);
 		fdevent_unregister(srv->ev, sess->sock_err);
 
+		cgi_close_wb_sock(srv, sess);
+
 		cgi_session_free(sess);
 		sess = NULL;
 
@@ -1264,12 +1311,18 @@ URIHANDLER_FUNC(mod_cgi_send_request_content) {
 		switch (network_write_chunkqueue_write(srv, con, sess->wb_sock, con->recv)) {
 		case NETWORK_STATUS_SUCCESS:
 			/** fall through, still have data to write. */
-		case NETWORK_STATUS_WAIT_FOR_EVENT:
-			/** fall through */
 		case NETWORK_STATUS_WAIT_FOR_AIO_EVENT:
 			break;
+		case NETWORK_STATUS_WAIT_FOR_EVENT:
+		case NETWORK_STATUS_INTERRUPTED:
+			/* the pipe is full, come back when the script read some of it */
+			fdevent_event_add(srv->ev, sess->wb_sock, FDEVENT_OUT);
+			break;
 		case NETWORK_STATUS_CONNECTION_CLOSE:
-			/* the script might have written a response already. */
+			/* the script might have written a response already,
+			 * it doesn't want the rest of the content */
+			con->recv->bytes_out += chunkqueue_skip(con->recv, con->recv->bytes_in - con->recv->bytes_out);
+			con->recv->is_closed = 1;
 			break;
 		default:
 			TRACE("%s", "(error)");
@@ -1280,8 +1333,7 @@ URIHANDLER_FUNC(mod_cgi_send_request_content) {
 	/* we have to close the pipe to finish the request. */
 	if ((con->recv->is_closed && con->recv->bytes_in == con->recv->bytes_out) ||
 			con->request.content_length <= 0) {
-		close(sess->wb_sock->fd);
-		sess->wb_sock->fd = -1;
+		cgi_close_wb_sock(srv, sess);
 	} else {
 		/* there is more data to write. */
 		return HANDLER_GO_ON;
@@ -7,6 +7,7 @@
 #include "buffer.h"
 #include "response.h"
 #include "filter.h"
+#include "http_chunk.h"
 
 #include "plugin.h"
 
@@ -41,6 +42,7 @@ typedef struct {
 typedef struct {
 	unsigned short debug;
 	filter *fl;
+	buffer *arena; /* chunk-size lines, see http_chunk_encode() */
 } handler_ctx;
 
 static handler_ctx * handler_ctx_init() {
@@ -49,11 +51,13 @@ static handler_ctx * handler_ctx_init() {
 	hctx = calloc(1, sizeof(*hctx));
 	hctx->debug = 0;
 	hctx->fl = NULL;
+	hctx->arena = buffer_init();
 
 	return hctx;
 }
 
 static void handler_ctx_free(handler_ctx *hctx) {
+	buffer_free(hctx->arena);
 
 	free(hctx);
 }
@@ -233,6 +237,17 @@ URIHANDLER_FUNC(mod_chunked_response_header) {
 
 	/* enable chunked encoding */
 	con->response.transfer_encoding |= HTTP_TRANSFER_ENCODING_CHUNKED;
+
+	/* the backend sends chunked already and no other filter wants the decoded content */
+	if (con->response.chunked_passthrough == HTTP_CHUNKED_PASSTHROUGH_OFFERED &&
+	    fl->prev == con->send_filters->first) {
+		if (p->conf.debug > 0) TRACE("%s", "passing through the chunked content of the backend");
+
+		con->response.chunked_passthrough = HTTP_CHUNKED_PASSTHROUGH_ACTIVE;
+		filter_chain_remove_filter(con->send_filters, fl);
+		return HANDLER_GO_ON;
+	}
+
 	hctx = handler_ctx_init();
 	hctx->debug = p->conf.debug;
 	con->plugin_ctx[p->id] = hctx;
@@ -244,39 +259,6 @@ URIHANDLER_FUNC(mod_chunked_response_header) {
 	return HANDLER_GO_ON;
 }
 
-static int http_chunk_append_len(chunkqueue *cq, size_t len) {
-	size_t i, olen = len, j;
-	buffer *b;
-
-	b = buffer_init();
-
-	if (len == 0) {
-		buffer_copy_string_len(b, CONST_STR_LEN("0"));
-	} else {
-		for (i = 0; i < 8 && len; i++) {
-			len >>= 4;
-		}
-
-		/* i is the number of hex digits we have */
-		buffer_prepare_copy(b, i + 1);
-
-		for (j = i-1, len = olen; j+1 > 0; j--) {
-			b->ptr[j] = (len & 0xf) + (((len & 0xf) <= 9) ? '0' : 'a' - 10);
-			len >>= 4;
-		}
-		b->used = i;
-		b->ptr[b->used++] = '\0';
-	}
-
-	buffer_append_string_len(b, CONST_STR_LEN("\r\n"));
-	chunkqueue_append_buffer(cq, b);
-	len = b->used - 1;
-
-	buffer_free(b);
-
-	return len;
-}
-
 /**
  * apply HTTP/1.1 chunked encoding if necessary
  */
@@ -285,8 +267,6 @@ URIHANDLER_FUNC(mod_chunked_encode_response_content) {
 	handler_ctx *hctx = con->plugin_ctx[p->id];
 	chunkqueue *in;
 	chunkqueue *out;
-	int we_have = 0;
-	chunk *c;
 
 	UNUSED(srv);
 
@@ -301,52 +281,10 @@ URIHANDLER_FUNC(mod_chunked_encode_response_content) {
 	/* we are all done already (see the end of the function) */
 	if (out->is_closed) return HANDLER_GO_ON;
 
-	/* move all chunks to the out queue
-	 * and append a HTTP/1.1 chunked header to each chunk 
+	/* move all chunks to the out queue as one HTTP/1.1 chunk
+	 * and terminate the content if the input is finished
 	 */
-	for (c = in->first; c; c = c->next) {
-		switch (c->type) {
-		case MEM_CHUNK:
-			if (c->mem->used == 0) continue;
-
-			we_have = c->mem->used - c->offset - 1;
-			in->bytes_out += we_have;
-			if(we_have == 0) continue;
-			we_have += http_chunk_append_len(out, we_have);
-			chunkqueue_append_buffer(out, c->mem);
-
-			chunk_set_done(c);
-			
-			break;
-		case FILE_CHUNK:
-			if (c->file.length == 0) continue;
-
-			we_have = c->file.length;
-			in->bytes_out += we_have;
-			we_have += http_chunk_append_len(out, c->file.length);
-
-			if(c->file.is_temp) {
-				chunkqueue_steal_tempfile(out, c);
-			} else {
-				chunkqueue_append_file(out, c->file.name, c->file.start, c->file.length);
-			}
-
-			chunk_set_done(c);
-
-			break;
-		case UNUSED_CHUNK:
-			break;
-		}
-		chunkqueue_append_mem(out, CONST_STR_LEN("\r\n"));
-		we_have += 2;
-		out->bytes_in += we_have;
-	}
-
-	/* terminate the last chunk */
-	if (in->is_closed) {
-		chunkqueue_append_mem(out, CONST_STR_LEN("0\r\n\r\n"));
-		out->bytes_in += 5;
-	}
+	http_chunk_encode(in, out, hctx->arena);
 
 	if (hctx->debug > 1) TRACE("chunk encoded: in=%jd, out=%jd", (intmax_t) in->bytes_out, (intmax_t) out->bytes_in);
 
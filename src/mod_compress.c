@@ -15,6 +15,7 @@
 #include "stat_cache.h"
 
 #include "plugin.h"
+#include "status_counter.h"
 
 #include "crc32.h"
 #include "etag.h"
@@ -31,8 +32,19 @@
 # include <bzlib.h>
 #endif
 
+#if defined HAVE_BROTLI_ENCODE_H && defined HAVE_LIBBROTLIENC
+# define USE_BROTLI
+# include <brotli/encode.h>
+#endif
+
+#if defined HAVE_ZSTD_H && defined HAVE_LIBZSTD
+# define USE_ZSTD
+# include <zstd.h>
+#endif
+
 #include "sys-mmap.h"
 #include "sys-files.h"
+#include "http_header.h"
 
 /* request: accept-encoding */
 #define HTTP_ACCEPT_ENCODING_IDENTITY BV(0)
@@ -40,16 +52,111 @@
 #define HTTP_ACCEPT_ENCODING_DEFLATE  BV(2)
 #define HTTP_ACCEPT_ENCODING_COMPRESS BV(3)
 #define HTTP_ACCEPT_ENCODING_BZIP2    BV(4)
+#define HTTP_ACCEPT_ENCODING_BROTLI   BV(5)
+#define HTTP_ACCEPT_ENCODING_ZSTD     BV(6)
+
+/* indexed by the bit of the HTTP_ACCEPT_ENCODING_* value */
+static const char * const encoding_names[] = {
+	"identity",
+	"gzip",
+	"deflate",
+	"compress",
+	"bzip2",
+	"br",
+	"zstd",
+	NULL
+};
+
+/* if the client likes several encodings equally well, take the first */
+static const int encoding_preference[] = {
+	HTTP_ACCEPT_ENCODING_BROTLI,
+	HTTP_ACCEPT_ENCODING_ZSTD,
+	HTTP_ACCEPT_ENCODING_BZIP2,
+	HTTP_ACCEPT_ENCODING_GZIP,
+	HTTP_ACCEPT_ENCODING_DEFLATE,
+	0
+};
 
 #ifdef __WIN32
 #define mkdir(x,y) mkdir(x)
 #endif
 
+/* directory entries the incremental scan reads per trigger if we have no threads */
+#define COMPRESS_CACHE_SCAN_BUDGET 1000
+
+/* the type markers in the names of the cache-files, "<file><marker><etag>" */
+static const char * const cache_markers[] = {
+	"-gzip-",
+	"-deflate-",
+	"-bzip2-",
+	"-br-",
+	"-zstd-",
+	NULL
+};
+
+/**
+ * a compressed file in the compress.cache-dir
+ *
+ * only one etag per file and encoding is kept, the older ones are obsolete
+ */
+typedef struct compress_cache_entry {
+	buffer *base;        /* name of the cache-file up to the etag */
+	buffer *etag;
+	off_t   size;
+	time_t  mtime;
+	time_t  last_served;
+
+	int refcount; /* responses which send the file */
+	int evicted;  /* out of the index, the file is removed when the last response is done */
+
+	struct compress_cache_entry *prev, *next; /* lru, the head was served last */
+	struct compress_cache_entry *hnext;       /* hash-chain */
+} compress_cache_entry;
+
+typedef struct {
+	compress_cache_entry **table;
+	size_t size;
+	size_t used;
+
+	compress_cache_entry *head, *tail;
+	compress_cache_entry *evicted; /* evicted entries still referenced, chained by ->next */
+
+	off_t total_size;
+} compress_cache;
+
+/**
+ * the state of the scan of the cache-dirs
+ *
+ * the directories are walked with a stack instead of recursion, this
+ * allows us to interrupt the scan after each entry
+ */
+typedef struct {
+	buffer **dirs;
+	size_t used;
+	size_t size;
+
+	DIR *d;
+	buffer *cur;
+	buffer *fn;
+} compress_cache_scan;
+
+#ifdef USE_GTHREAD
+/* a file found by the scan-thread, handed over to the main-loop */
+typedef struct {
+	buffer *fn;
+	off_t   size;
+	time_t  mtime;
+} compress_cache_scan_item;
+#endif
+
 typedef struct {
 	buffer *compress_cache_dir;
 	array  *compress;
 	off_t   compress_max_filesize; /** max filesize in kb */
 	int     allowed_encodings;
+	unsigned short cache_max_size; /** max size of all cache-dirs in mb, server-wide only */
+	short   brotli_quality;
+	short   zstd_level;
 } plugin_config;
 
 typedef struct {
@@ -57,10 +164,554 @@ typedef struct {
 	buffer *ofn;
 	buffer *b;
 
+	compress_cache cache;
+	buffer *cache_fn;
+
+	compress_cache_scan *scan;
+	int scan_started;
+#ifdef USE_GTHREAD
+	GThread *scan_thread;
+	GAsyncQueue *scan_queue;
+	gint scan_abort;
+#endif
+
+	data_integer *cnt_files;
+	data_integer *cnt_size;
+	data_integer *cnt_hits;
+	data_integer *cnt_misses;
+	data_integer *cnt_evicted;
+	data_integer *cnt_obsoleted;
+
 	plugin_config **config_storage;
 	plugin_config conf;
 } plugin_data;
 
+/* the famous DJB hash function for strings from stat_cache.c */
+static uint32_t compress_cache_hash(const char *s, size_t len) {
+	uint32_t hash = 5381;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash = ((hash << 5) + hash) + s[i];
+	}
+
+	return hash;
+}
+
+static void compress_cache_entry_free(compress_cache_entry *e) {
+	buffer_free(e->base);
+	buffer_free(e->etag);
+	free(e);
+}
+
+static compress_cache_entry *compress_cache_get(compress_cache *cache, const char *base, size_t base_len) {
+	compress_cache_entry *e;
+
+	if (cache->size == 0) return NULL;
+
+	for (e = cache->table[compress_cache_hash(base, base_len) % cache->size]; e; e = e->hnext) {
+		if (buffer_is_equal_string(e->base, base, base_len)) return e;
+	}
+
+	return NULL;
+}
+
+static void compress_cache_grow(compress_cache *cache) {
+	compress_cache_entry **table;
+	size_t size, i;
+
+	size = cache->size ? cache->size * 2 : 1024;
+	table = calloc(size, sizeof(*table));
+
+	for (i = 0; i < cache->size; i++) {
+		compress_cache_entry *e, *next;
+
+		for (e = cache->table[i]; e; e = next) {
+			uint32_t ndx = compress_cache_hash(BUF_STR(e->base), e->base->used - 1) % size;
+
+			next = e->hnext;
+			e->hnext = table[ndx];
+			table[ndx] = e;
+		}
+	}
+
+	free(cache->table);
+	cache->table = table;
+	cache->size = size;
+}
+
+static void compress_cache_lru_unlink(compress_cache *cache, compress_cache_entry *e) {
+	if (e->prev) e->prev->next = e->next; else cache->head = e->next;
+	if (e->next) e->next->prev = e->prev; else cache->tail = e->prev;
+	e->prev = e->next = NULL;
+}
+
+static void compress_cache_lru_push(compress_cache *cache, compress_cache_entry *e, int at_tail) {
+	if (at_tail) {
+		e->prev = cache->tail;
+		e->next = NULL;
+		if (cache->tail) cache->tail->next = e; else cache->head = e;
+		cache->tail = e;
+	} else {
+		e->prev = NULL;
+		e->next = cache->head;
+		if (cache->head) cache->head->prev = e; else cache->tail = e;
+		cache->head = e;
+	}
+}
+
+static void compress_cache_touch(compress_cache *cache, compress_cache_entry *e, time_t now) {
+	e->last_served = now;
+
+	if (cache->head == e) return;
+
+	compress_cache_lru_unlink(cache, e);
+	compress_cache_lru_push(cache, e, 0);
+}
+
+static void compress_cache_update_counters(plugin_data *p) {
+	COUNTER_SET(p->cnt_files, p->cache.used);
+	COUNTER_SET(p->cnt_size, p->cache.total_size >> 10);
+}
+
+static void compress_cache_unlink(server *srv, buffer *fn) {
+	if (-1 == unlink(fn->ptr) && errno != ENOENT) {
+		ERROR("removing cache-file '%s' failed: %s", SAFE_BUF_STR(fn), strerror(errno));
+	}
+
+	stat_cache_invalidate_entry(srv, fn);
+}
+
+/**
+ * remove the cache-file of a entry which isn't in the index anymore
+ */
+static void compress_cache_unlink_entry(server *srv, plugin_data *p, compress_cache_entry *e) {
+	compress_cache_entry *cur;
+
+	/* the file was found again after the entry was evicted, it is in use */
+	if (NULL != (cur = compress_cache_get(&(p->cache), CONST_BUF_LEN(e->base))) &&
+	    buffer_is_equal(cur->etag, e->etag)) {
+		return;
+	}
+
+	buffer_copy_string_buffer(p->cache_fn, e->base);
+	buffer_append_string_buffer(p->cache_fn, e->etag);
+
+	compress_cache_unlink(srv, p->cache_fn);
+}
+
+/**
+ * drop a entry from the index
+ *
+ * if a response still sends the file it is removed when the response is
+ * done, see compress_cache_release()
+ *
+ * @param unlink_file remove the cache-file too
+ */
+static void compress_cache_remove(server *srv, plugin_data *p, compress_cache_entry *e, int unlink_file) {
+	compress_cache *cache = &(p->cache);
+	compress_cache_entry **pe;
+
+	for (pe = &(cache->table[compress_cache_hash(BUF_STR(e->base), e->base->used - 1) % cache->size]); *pe; pe = &((*pe)->hnext)) {
+		if (*pe == e) {
+			*pe = e->hnext;
+			break;
+		}
+	}
+
+	compress_cache_lru_unlink(cache, e);
+
+	cache->total_size -= e->size;
+	cache->used--;
+
+	if (unlink_file && e->refcount > 0) {
+		e->evicted = 1;
+		e->next = cache->evicted;
+		if (cache->evicted) cache->evicted->prev = e;
+		cache->evicted = e;
+		return;
+	}
+
+	if (unlink_file) compress_cache_unlink_entry(srv, p, e);
+
+	compress_cache_entry_free(e);
+}
+
+/**
+ * the response which sends the file of @e is done
+ */
+static void compress_cache_release(server *srv, plugin_data *p, compress_cache_entry *e) {
+	compress_cache *cache = &(p->cache);
+
+	if (--e->refcount > 0 || !e->evicted) return;
+
+	if (e->prev) e->prev->next = e->next; else cache->evicted = e->next;
+	if (e->next) e->next->prev = e->prev;
+
+	compress_cache_unlink_entry(srv, p, e);
+	compress_cache_entry_free(e);
+}
+
+/**
+ * the cache-file of @e is queued for @con, keep it until the response is done
+ */
+static void compress_cache_hold(server *srv, connection *con, plugin_data *p, compress_cache_entry *e) {
+	if (con->plugin_ctx[p->id]) compress_cache_release(srv, p, con->plugin_ctx[p->id]);
+
+	e->refcount++;
+	con->plugin_ctx[p->id] = e;
+}
+
+/**
+ * add a cache-file to the index
+ *
+ * a older etag of the same file and encoding is obsolete and gets removed.
+ * Files found by the scan go to the end of the lru, they haven't been served yet.
+ *
+ * @param base_len length of the filename up to the etag
+ * @return the entry, NULL if the file itself was obsolete
+ */
+static compress_cache_entry *compress_cache_insert(server *srv, plugin_data *p, buffer *fn, size_t base_len, off_t size, time_t mtime, int scanned) {
+	compress_cache *cache = &(p->cache);
+	compress_cache_entry *e;
+	uint32_t ndx;
+
+	if (NULL != (e = compress_cache_get(cache, BUF_STR(fn), base_len))) {
+		if (buffer_is_equal_string(e->etag, BUF_STR(fn) + base_len, fn->used - 1 - base_len)) {
+			cache->total_size += size - e->size;
+			e->size = size;
+			if (!scanned) compress_cache_touch(cache, e, mtime);
+
+			compress_cache_update_counters(p);
+			return e;
+		}
+
+		COUNTER_INC(p->cnt_obsoleted);
+
+		if (scanned && e->mtime >= mtime) {
+			/* we already know a newer one */
+			compress_cache_unlink(srv, fn);
+			return NULL;
+		}
+
+		compress_cache_remove(srv, p, e, 1);
+	}
+
+	if (cache->used >= cache->size) compress_cache_grow(cache);
+
+	e = calloc(1, sizeof(*e));
+	e->base = buffer_init();
+	buffer_copy_string_len(e->base, BUF_STR(fn), base_len);
+	e->etag = buffer_init();
+	buffer_copy_string_len(e->etag, BUF_STR(fn) + base_len, fn->used - 1 - base_len);
+	e->size = size;
+	e->mtime = mtime;
+	e->last_served = mtime;
+
+	ndx = compress_cache_hash(BUF_STR(e->base), base_len) % cache->size;
+	e->hnext = cache->table[ndx];
+	cache->table[ndx] = e;
+
+	compress_cache_lru_push(cache, e, scanned);
+
+	cache->total_size += size;
+	cache->used++;
+
+	compress_cache_update_counters(p);
+
+	return e;
+}
+
+/**
+ * remove the least recently served files until we are below compress.cache-max-size
+ */
+static void compress_cache_evict(server *srv, plugin_data *p) {
+	compress_cache *cache = &(p->cache);
+	off_t max_size = (off_t)p->config_storage[0]->cache_max_size << 20;
+
+	if (max_size == 0) return;
+
+	/* keep the last served file, even if it is larger than the limit */
+	while (cache->total_size > max_size && cache->tail && cache->tail != cache->head) {
+		compress_cache_remove(srv, p, cache->tail, 1);
+		COUNTER_INC(p->cnt_evicted);
+	}
+
+	compress_cache_update_counters(p);
+}
+
+static void compress_cache_free(compress_cache *cache) {
+	compress_cache_entry *e, *next;
+
+	for (e = cache->head; e; e = next) {
+		next = e->next;
+		compress_cache_entry_free(e);
+	}
+
+	/* the files stay, the next scan evicts them again */
+	for (e = cache->evicted; e; e = next) {
+		next = e->next;
+		compress_cache_entry_free(e);
+	}
+
+	free(cache->table);
+	memset(cache, 0, sizeof(*cache));
+}
+
+/**
+ * find the end of the file-part in the name of a cache-file
+ *
+ * @return length up to the etag, 0 if it isn't a cache-file
+ */
+static size_t compress_cache_base_len(buffer *fn) {
+	size_t base_len = 0;
+	size_t i;
+
+	for (i = 0; cache_markers[i]; i++) {
+		const char *m = BUF_STR(fn);
+
+		/* the etag doesn't contain a marker, take the last one */
+		while (NULL != (m = strstr(m, cache_markers[i]))) {
+			size_t len = m - BUF_STR(fn) + strlen(cache_markers[i]);
+
+			if (len > base_len) base_len = len;
+			m++;
+		}
+	}
+
+	/* no etag */
+	if (base_len >= fn->used - 1) return 0;
+
+	return base_len;
+}
+
+static compress_cache_scan *compress_cache_scan_init(void) {
+	compress_cache_scan *scan;
+
+	scan = calloc(1, sizeof(*scan));
+	scan->fn = buffer_init();
+
+	return scan;
+}
+
+static void compress_cache_scan_free(compress_cache_scan *scan) {
+	size_t i;
+
+	if (scan->d) closedir(scan->d);
+
+	for (i = 0; i < scan->used; i++) {
+		buffer_free(scan->dirs[i]);
+	}
+	free(scan->dirs);
+
+	buffer_free(scan->cur);
+	buffer_free(scan->fn);
+
+	free(scan);
+}
+
+static void compress_cache_scan_push(compress_cache_scan *scan, const char *dir, size_t len) {
+	buffer *b;
+
+	/* the children get a slash appended */
+	while (len > 1 && dir[len - 1] == '/') len--;
+
+	if (scan->used == scan->size) {
+		scan->size += 16;
+		scan->dirs = realloc(scan->dirs, scan->size * sizeof(*scan->dirs));
+	}
+
+	b = buffer_init();
+	buffer_copy_string_len(b, dir, len);
+	scan->dirs[scan->used++] = b;
+}
+
+/**
+ * walk the cache-dirs
+ *
+ * @return 1 if a regular file was found (name in scan->fn), 0 if the scan is finished
+ */
+static int compress_cache_scan_next(compress_cache_scan *scan, struct stat *st) {
+	struct dirent *de;
+
+	for (;;) {
+		if (!scan->d) {
+			if (scan->used == 0) return 0;
+
+			buffer_free(scan->cur);
+			scan->cur = scan->dirs[--scan->used];
+
+			if (NULL == (scan->d = opendir(scan->cur->ptr))) {
+				if (errno != ENOENT) {
+					ERROR("opening cache-dir '%s' failed: %s", SAFE_BUF_STR(scan->cur), strerror(errno));
+				}
+				continue;
+			}
+		}
+
+		if (NULL == (de = readdir(scan->d))) {
+			closedir(scan->d);
+			scan->d = NULL;
+			continue;
+		}
+
+		if (de->d_name[0] == '.' &&
+		    (de->d_name[1] == '\0' || (de->d_name[1] == '.' && de->d_name[2] == '\0'))) continue;
+
+		buffer_copy_string_buffer(scan->fn, scan->cur);
+		buffer_append_string_len(scan->fn, CONST_STR_LEN("/"));
+		buffer_append_string(scan->fn, de->d_name);
+
+		if (-1 == lstat(scan->fn->ptr, st)) continue;
+
+		if (S_ISDIR(st->st_mode)) {
+			compress_cache_scan_push(scan, CONST_BUF_LEN(scan->fn));
+			continue;
+		}
+
+		if (S_ISREG(st->st_mode)) return 1;
+	}
+}
+
+static void compress_cache_add_scanned(server *srv, plugin_data *p, buffer *fn, off_t size, time_t mtime) {
+	size_t base_len;
+
+	if (0 == (base_len = compress_cache_base_len(fn))) return;
+
+	compress_cache_insert(srv, p, fn, base_len, size, mtime, 1);
+}
+
+#ifdef USE_GTHREAD
+static gpointer compress_cache_scan_thread(gpointer _p) {
+	plugin_data *p = _p;
+	struct stat st;
+
+	while (!g_atomic_int_get(&(p->scan_abort)) && compress_cache_scan_next(p->scan, &st)) {
+		compress_cache_scan_item *item = malloc(sizeof(*item));
+
+		item->fn = buffer_init_buffer(p->scan->fn);
+		item->size = st.st_size;
+		item->mtime = st.st_mtime;
+
+		g_async_queue_push(p->scan_queue, item);
+	}
+
+	/* we are done */
+	g_async_queue_push(p->scan_queue, (void *) 1);
+
+	return NULL;
+}
+#endif
+
+/**
+ * start the scan of the cache-dirs
+ *
+ * called from the first trigger as we might have forked since set-defaults
+ */
+static void compress_cache_scan_start(server *srv, plugin_data *p) {
+	size_t i;
+
+	p->scan_started = 1;
+
+	for (i = 0; i < srv->config_context->used; i++) {
+		plugin_config *s = p->config_storage[i];
+
+		if (buffer_is_empty(s->compress_cache_dir)) continue;
+
+		if (!p->scan) p->scan = compress_cache_scan_init();
+
+		compress_cache_scan_push(p->scan, CONST_BUF_LEN(s->compress_cache_dir));
+	}
+
+	if (!p->scan) return;
+
+#ifdef USE_GTHREAD
+	{
+		GError *gerr = NULL;
+
+		p->scan_queue = g_async_queue_new();
+		p->scan_thread = g_thread_create(compress_cache_scan_thread, p, 1, &gerr);
+		if (gerr) {
+			ERROR("g_thread_create failed: %s, scanning the compress.cache-dir in the main-loop", gerr->message);
+			g_error_free(gerr);
+			p->scan_thread = NULL;
+		}
+	}
+#endif
+}
+
+/**
+ * move the results of the scan into the index
+ */
+static void compress_cache_scan_collect(server *srv, plugin_data *p) {
+	struct stat st;
+	size_t i;
+
+#ifdef USE_GTHREAD
+	if (p->scan_thread) {
+		compress_cache_scan_item *item;
+
+		while (NULL != (item = g_async_queue_try_pop(p->scan_queue))) {
+			if (item == (compress_cache_scan_item *) 1) {
+				g_thread_join(p->scan_thread);
+				p->scan_thread = NULL;
+
+				compress_cache_scan_free(p->scan);
+				p->scan = NULL;
+				break;
+			}
+
+			compress_cache_add_scanned(srv, p, item->fn, item->size, item->mtime);
+
+			buffer_free(item->fn);
+			free(item);
+		}
+
+		return;
+	}
+#endif
+
+	/* no threads, scan a slice per trigger */
+	for (i = 0; i < COMPRESS_CACHE_SCAN_BUDGET; i++) {
+		if (!compress_cache_scan_next(p->scan, &st)) {
+			compress_cache_scan_free(p->scan);
+			p->scan = NULL;
+			break;
+		}
+
+		compress_cache_add_scanned(srv, p, p->scan->fn, st.st_size, st.st_mtime);
+	}
+}
+
+static void compress_cache_scan_stop(plugin_data *p) {
+#ifdef USE_GTHREAD
+	if (p->scan_thread) {
+		compress_cache_scan_item *item;
+
+		g_atomic_int_set(&(p->scan_abort), 1);
+		g_thread_join(p->scan_thread);
+		p->scan_thread = NULL;
+
+		while (NULL != (item = g_async_queue_try_pop(p->scan_queue))) {
+			if (item == (compress_cache_scan_item *) 1) continue;
+
+			buffer_free(item->fn);
+			free(item);
+		}
+	}
+
+	if (p->scan_queue) {
+		g_async_queue_unref(p->scan_queue);
+		p->scan_queue = NULL;
+	}
+#endif
+
+	if (p->scan) {
+		compress_cache_scan_free(p->scan);
+		p->scan = NULL;
+	}
+}
+
 INIT_FUNC(mod_compress_init) {
 	plugin_data *p;
 
@@ -70,6 +721,14 @@ INIT_FUNC(mod_compress_init) {
 
 	p->ofn = buffer_init();
 	p->b = buffer_init();
+	p->cache_fn = buffer_init();
+
+	p->cnt_files = status_counter_get_counter(CONST_STR_LEN("compress.cache-files"));
+	p->cnt_size = status_counter_get_counter(CONST_STR_LEN("compress.cache-size-kbytes"));
+	p->cnt_hits = status_counter_get_counter(CONST_STR_LEN("compress.cache-hits"));
+	p->cnt_misses = status_counter_get_counter(CONST_STR_LEN("compress.cache-misses"));
+	p->cnt_evicted = status_counter_get_counter(CONST_STR_LEN("compress.cache-evicted"));
+	p->cnt_obsoleted = status_counter_get_counter(CONST_STR_LEN("compress.cache-obsoleted"));
 
 	return p;
 }
@@ -81,8 +740,12 @@ FREE_FUNC(mod_compress_free) {
 
 	if (!p) return HANDLER_GO_ON;
 
+	compress_cache_scan_stop(p);
+	compress_cache_free(&(p->cache));
+
 	buffer_free(p->ofn);
 	buffer_free(p->b);
+	buffer_free(p->cache_fn);
 
 	if (p->config_storage) {
 		size_t i;
@@ -162,6 +825,9 @@ SETDEFAULTS_FUNC(mod_compress_setdefaults) {
 		{ "compress.filetype",              NULL, T_CONFIG_ARRAY, T_CONFIG_SCOPE_CONNECTION },
 		{ "compress.max-filesize",          NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },
 		{ "compress.allowed-encodings",     NULL, T_CONFIG_ARRAY, T_CONFIG_SCOPE_CONNECTION },
+		{ "compress.brotli-quality",        NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },
+		{ "compress.zstd-level",            NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },
+		{ "compress.cache-max-size",        NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_SERVER },
 		{ NULL,                             NULL, T_CONFIG_UNSET, T_CONFIG_SCOPE_UNSET }
 	};
 
@@ -176,11 +842,17 @@ SETDEFAULTS_FUNC(mod_compress_setdefaults) {
 		s->compress = array_init();
 		s->compress_max_filesize = 0;
 		s->allowed_encodings = 0;
+		s->brotli_quality = 9;
+		s->zstd_level = 15;
+		s->cache_max_size = 0;
 
 		cv[0].destination = s->compress_cache_dir;
 		cv[1].destination = s->compress;
 		cv[2].destination = &(s->compress_max_filesize);
 		cv[3].destination = encodings_arr; /* temp array for allowed encodings list */
+		cv[4].destination = &(s->brotli_quality);
+		cv[5].destination = &(s->zstd_level);
+		cv[6].destination = &(s->cache_max_size);
 
 		p->config_storage[i] = s;
 
@@ -205,6 +877,14 @@ SETDEFAULTS_FUNC(mod_compress_setdefaults) {
 #ifdef USE_BZ2LIB
 				if (NULL != strstr(ds->value->ptr, "bzip2"))
 					s->allowed_encodings |= HTTP_ACCEPT_ENCODING_BZIP2;
+#endif
+#ifdef USE_BROTLI
+				if (NULL != strstr(ds->value->ptr, "br"))
+					s->allowed_encodings |= HTTP_ACCEPT_ENCODING_BROTLI;
+#endif
+#ifdef USE_ZSTD
+				if (NULL != strstr(ds->value->ptr, "zstd"))
+					s->allowed_encodings |= HTTP_ACCEPT_ENCODING_ZSTD;
 #endif
 			}
 		} else {
@@ -215,12 +895,28 @@ SETDEFAULTS_FUNC(mod_compress_setdefaults) {
 #endif
 #ifdef USE_BZ2LIB
 				| HTTP_ACCEPT_ENCODING_BZIP2
+#endif
+#ifdef USE_BROTLI
+				| HTTP_ACCEPT_ENCODING_BROTLI
+#endif
+#ifdef USE_ZSTD
+				| HTTP_ACCEPT_ENCODING_ZSTD
 #endif
 				;
 		}
 
 		array_free(encodings_arr);
 
+		if (s->brotli_quality < 0 || s->brotli_quality > 11) {
+			ERROR("compress.brotli-quality must be between 0 and 11: %i", s->brotli_quality);
+			return HANDLER_ERROR;
+		}
+
+		if (s->zstd_level < 1 || s->zstd_level > 22) {
+			ERROR("compress.zstd-level must be between 1 and 22: %i", s->zstd_level);
+			return HANDLER_ERROR;
+		}
+
 		if (!buffer_is_empty(s->compress_cache_dir)) {
 			struct stat st;
 			if (0 != stat(s->compress_cache_dir->ptr, &st)) {
@@ -412,13 +1108,61 @@ static int deflate_file_to_buffer_bzip2(server *srv, connection *con, plugin_dat
 }
 #endif
 
+#ifdef USE_BROTLI
+static int deflate_file_to_buffer_brotli(server *srv, connection *con, plugin_data *p, unsigned char *start, off_t st_size) {
+	size_t out_size;
+
+	UNUSED(srv);
+	UNUSED(con);
+
+	if (0 == (out_size = BrotliEncoderMaxCompressedSize(st_size))) return -1;
+
+	buffer_prepare_copy(p->b, out_size + 1);
+
+	if (!BrotliEncoderCompress(p->conf.brotli_quality,
+				   BROTLI_DEFAULT_WINDOW,
+				   BROTLI_MODE_GENERIC,
+				   st_size, start,
+				   &out_size, (uint8_t *)p->b->ptr)) {
+		return -1;
+	}
+
+	p->b->used = out_size;
+
+	return 0;
+}
+#endif
+
+#ifdef USE_ZSTD
+static int deflate_file_to_buffer_zstd(server *srv, connection *con, plugin_data *p, unsigned char *start, off_t st_size) {
+	size_t r;
+
+	UNUSED(srv);
+	UNUSED(con);
+
+	buffer_prepare_copy(p->b, ZSTD_compressBound(st_size) + 1);
+
+	r = ZSTD_compress(p->b->ptr, p->b->size, start, st_size, p->conf.zstd_level);
+	if (ZSTD_isError(r)) {
+		ERROR("ZSTD_compress failed: %s", ZSTD_getErrorName(r));
+		return -1;
+	}
+
+	p->b->used = r;
+
+	return 0;
+}
+#endif
+
 static int deflate_file_to_file(server *srv, connection *con, plugin_data *p, buffer *fn, stat_cache_entry *sce, int type) {
 	int ifd, ofd;
 	int ret = -1;
 	void *start;
 	const char *filename = fn->ptr;
 	ssize_t r;
+	size_t base_len;
 	stat_cache_entry *compressed_sce = NULL;
+	compress_cache_entry *e;
 
 	if (buffer_is_empty(p->conf.compress_cache_dir)) return -1;
 
@@ -436,11 +1180,16 @@ static int deflate_file_to_file(server *srv, connection *con, plugin_data *p, bu
 	buffer_copy_string_buffer(p->ofn, p->conf.compress_cache_dir);
 	PATHNAME_APPEND_SLASH(p->ofn);
 
+	/* skip the leading slashes, the names have to match the ones the cache-dir scan finds */
 	if (0 == strncmp(con->physical.path->ptr, con->physical.doc_root->ptr, con->physical.doc_root->used-1)) {
-		buffer_append_string(p->ofn, con->physical.path->ptr + con->physical.doc_root->used - 1);
+		const char *rel = con->physical.path->ptr + con->physical.doc_root->used - 1;
+		while (*rel == '/') rel++;
+		buffer_append_string(p->ofn, rel);
 		buffer_copy_string_buffer(p->b, p->ofn);
 	} else {
-		buffer_append_string_buffer(p->ofn, con->uri.path);
+		const char *rel = con->uri.path->ptr;
+		while (*rel == '/') rel++;
+		buffer_append_string(p->ofn, rel);
 	}
 
 	switch(type) {
@@ -453,11 +1202,18 @@ static int deflate_file_to_file(server *srv, connection *con, plugin_data *p, bu
 	case HTTP_ACCEPT_ENCODING_BZIP2:
 		buffer_append_string_len(p->ofn, CONST_STR_LEN("-bzip2-"));
 		break;
+	case HTTP_ACCEPT_ENCODING_BROTLI:
+		buffer_append_string_len(p->ofn, CONST_STR_LEN("-br-"));
+		break;
+	case HTTP_ACCEPT_ENCODING_ZSTD:
+		buffer_append_string_len(p->ofn, CONST_STR_LEN("-zstd-"));
+		break;
 	default:
 		ERROR("unknown compression type %d", type);
 		return -1;
 	}
 
+	base_len = p->ofn->used - 1;
 	buffer_append_string_buffer(p->ofn, sce->etag);
 
 
@@ -465,6 +1221,17 @@ static int deflate_file_to_file(server *srv, connection *con, plugin_data *p, bu
 		/* file exists */
 		if (con->conf.log_request_handling) TRACE("file exists in the cache (%s), sending it", SAFE_BUF_STR(p->ofn));
 
+		COUNTER_INC(p->cnt_hits);
+
+		if (NULL != (e = compress_cache_get(&(p->cache), BUF_STR(p->ofn), base_len)) &&
+		    buffer_is_equal(e->etag, sce->etag)) {
+			compress_cache_touch(&(p->cache), e, srv->cur_ts);
+		} else {
+			/* not seen by the scan yet */
+			e = compress_cache_insert(srv, p, p->ofn, base_len, compressed_sce->st.st_size, srv->cur_ts, 0);
+		}
+		compress_cache_hold(srv, con, p, e);
+
 		chunkqueue_reset(con->send);
 		chunkqueue_append_file(con->send, p->ofn, 0, compressed_sce->st.st_size);
 		con->send->is_closed = 1;
@@ -508,6 +1275,16 @@ static int deflate_file_to_file(server *srv, connection *con, plugin_data *p, bu
 	case HTTP_ACCEPT_ENCODING_BZIP2:
 		ret = deflate_file_to_buffer_bzip2(srv, con, p, start, sce->st.st_size);
 		break;
+#endif
+#ifdef USE_BROTLI
+	case HTTP_ACCEPT_ENCODING_BROTLI:
+		ret = deflate_file_to_buffer_brotli(srv, con, p, start, sce->st.st_size);
+		break;
+#endif
+#ifdef USE_ZSTD
+	case HTTP_ACCEPT_ENCODING_ZSTD:
+		ret = deflate_file_to_buffer_zstd(srv, con, p, start, sce->st.st_size);
+		break;
 #endif
 	default:
 		ret = -1;
@@ -518,6 +1295,7 @@ static int deflate_file_to_file(server *srv, connection *con, plugin_data *p, bu
 		munmap(start, sce->st.st_size);
 		close(ofd);
 		close(ifd);
+		unlink(p->ofn->ptr);
 		return -1;
 	}
 
@@ -529,7 +1307,17 @@ static int deflate_file_to_file(server *srv, connection *con, plugin_data *p, bu
 	close(ofd);
 	close(ifd);
 
-	if (ret != 0) return -1;
+	if (ret != 0) {
+		/* don't leave a broken file in the cache */
+		unlink(p->ofn->ptr);
+		return -1;
+	}
+
+	COUNTER_INC(p->cnt_misses);
+
+	e = compress_cache_insert(srv, p, p->ofn, base_len, r, srv->cur_ts, 0);
+	compress_cache_hold(srv, con, p, e);
+	compress_cache_evict(srv, p);
 
 	chunkqueue_reset(con->send);
 	chunkqueue_append_file(con->send, p->ofn, 0, r);
@@ -583,6 +1371,16 @@ static int deflate_file_to_buffer(server *srv, connection *con, plugin_data *p,
 	case HTTP_ACCEPT_ENCODING_BZIP2:
 		ret = deflate_file_to_buffer_bzip2(srv, con, p, start, sce->st.st_size);
 		break;
+#endif
+#ifdef USE_BROTLI
+	case HTTP_ACCEPT_ENCODING_BROTLI:
+		ret = deflate_file_to_buffer_brotli(srv, con, p, start, sce->st.st_size);
+		break;
+#endif
+#ifdef USE_ZSTD
+	case HTTP_ACCEPT_ENCODING_ZSTD:
+		ret = deflate_file_to_buffer_zstd(srv, con, p, start, sce->st.st_size);
+		break;
 #endif
 	default:
 		ret = -1;
@@ -614,6 +1412,8 @@ static int mod_compress_patch_connection(server *srv, connection *con, plugin_da
 	PATCH_OPTION(compress);
 	PATCH_OPTION(compress_max_filesize);
 	PATCH_OPTION(allowed_encodings);
+	PATCH_OPTION(brotli_quality);
+	PATCH_OPTION(zstd_level);
 
 	/* skip the first, the global context */
 	for (i = 1; i < srv->config_context->used; i++) {
@@ -635,6 +1435,10 @@ static int mod_compress_patch_connection(server *srv, connection *con, plugin_da
 				PATCH_OPTION(compress_max_filesize);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("compress.allowed-encodings"))) {
 				PATCH_OPTION(allowed_encodings);
+			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("compress.brotli-quality"))) {
+				PATCH_OPTION(brotli_quality);
+			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("compress.zstd-level"))) {
+				PATCH_OPTION(zstd_level);
 			}
 		}
 	}
@@ -649,11 +1453,10 @@ PHYSICALPATH_FUNC(mod_compress_physical) {
 	stat_cache_entry *sce = NULL;
 	data_string *ds;
 	int accept_encoding = 0;
+	int qvalues[sizeof(encoding_names) / sizeof(encoding_names[0])];
+	int best_q = 0;
 	char *value;
 	int matched_encodings = 0;
-	const char *dflt_gzip = "gzip";
-	const char *dflt_deflate = "deflate";
-	const char *dflt_bzip2 = "bzip2";
 
 	const char *compression_name = NULL;
 	int compression_type = 0;
@@ -754,23 +1557,30 @@ PHYSICALPATH_FUNC(mod_compress_physical) {
 	/* the response might change according to Accept-Encoding */
 	response_header_insert(srv, con, CONST_STR_LEN("Vary"), CONST_STR_LEN("Accept-Encoding"));
 
-	if (NULL == (ds = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("Accept-Encoding")))) {
+	if (NULL == (ds = (data_string *)http_header_get(con->request.headers, HTTP_HEADER_ACCEPT_ENCODING))) {
 		if (con->conf.log_request_handling) TRACE("couldn't find a Accept-Encoding header: %s", "");
 		return HANDLER_GO_ON;
 	}
 
 	value = ds->value->ptr;
 
-	/* get client side support encodings */
+	/* get client side support encodings, q=0 means "not acceptable" */
+	http_accept_encoding_get_qvalues(value, encoding_names, qvalues);
 #ifdef USE_ZLIB
-	if (NULL != strstr(value, "gzip")) accept_encoding |= HTTP_ACCEPT_ENCODING_GZIP;
-	if (NULL != strstr(value, "deflate")) accept_encoding |= HTTP_ACCEPT_ENCODING_DEFLATE;
-	if (NULL != strstr(value, "compress")) accept_encoding |= HTTP_ACCEPT_ENCODING_COMPRESS;
+	if (qvalues[1] > 0) accept_encoding |= HTTP_ACCEPT_ENCODING_GZIP;
+	if (qvalues[2] > 0) accept_encoding |= HTTP_ACCEPT_ENCODING_DEFLATE;
+	if (qvalues[3] > 0) accept_encoding |= HTTP_ACCEPT_ENCODING_COMPRESS;
 #endif
 #ifdef USE_BZ2LIB
-	if (NULL != strstr(value, "bzip2")) accept_encoding |= HTTP_ACCEPT_ENCODING_BZIP2;
+	if (qvalues[4] > 0) accept_encoding |= HTTP_ACCEPT_ENCODING_BZIP2;
+#endif
+#ifdef USE_BROTLI
+	if (qvalues[5] > 0) accept_encoding |= HTTP_ACCEPT_ENCODING_BROTLI;
 #endif
-	if (NULL != strstr(value, "identity")) accept_encoding |= HTTP_ACCEPT_ENCODING_IDENTITY;
+#ifdef USE_ZSTD
+	if (qvalues[6] > 0) accept_encoding |= HTTP_ACCEPT_ENCODING_ZSTD;
+#endif
+	if (qvalues[0] > 0) accept_encoding |= HTTP_ACCEPT_ENCODING_IDENTITY;
 
 	/* find matching entries */
 	matched_encodings = accept_encoding & p->conf.allowed_encodings;
@@ -792,16 +1602,25 @@ PHYSICALPATH_FUNC(mod_compress_physical) {
 		return HANDLER_FINISHED;
 	}
 
-	/* select best matching encoding */
-	if (matched_encodings & HTTP_ACCEPT_ENCODING_BZIP2) {
-		compression_type = HTTP_ACCEPT_ENCODING_BZIP2;
-		compression_name = dflt_bzip2;
-	} else if (matched_encodings & HTTP_ACCEPT_ENCODING_GZIP) {
-		compression_type = HTTP_ACCEPT_ENCODING_GZIP;
-		compression_name = dflt_gzip;
-	} else if (matched_encodings & HTTP_ACCEPT_ENCODING_DEFLATE) {
-		compression_type = HTTP_ACCEPT_ENCODING_DEFLATE;
-		compression_name = dflt_deflate;
+	/* select the encoding with the highest qvalue, ties are broken by our preference */
+	for (m = 0; encoding_preference[m]; m++) {
+		int enc = encoding_preference[m];
+		int bit;
+
+		if (!(matched_encodings & enc)) continue;
+
+		for (bit = 0; !(enc & BV(bit)); bit++);
+
+		if (qvalues[bit] > best_q) {
+			best_q = qvalues[bit];
+			compression_type = enc;
+			compression_name = encoding_names[bit];
+		}
+	}
+
+	if (0 == compression_type) {
+		if (con->conf.log_request_handling) TRACE("client only accepts identity: %s", value);
+		return HANDLER_GO_ON;
 	}
 
 	if (con->conf.log_request_handling) TRACE("we are fine, let's compress: %s", "");
@@ -829,6 +1648,30 @@ PHYSICALPATH_FUNC(mod_compress_physical) {
 	return HANDLER_GO_ON;
 }
 
+CONNECTION_FUNC(mod_compress_connection_reset) {
+	plugin_data *p = p_d;
+	compress_cache_entry *e = con->plugin_ctx[p->id];
+
+	if (!e) return HANDLER_GO_ON;
+
+	con->plugin_ctx[p->id] = NULL;
+	compress_cache_release(srv, p, e);
+
+	return HANDLER_GO_ON;
+}
+
+TRIGGER_FUNC(mod_compress_trigger) {
+	plugin_data *p = p_d;
+
+	if (!p->scan_started) compress_cache_scan_start(srv, p);
+
+	if (p->scan) compress_cache_scan_collect(srv, p);
+
+	compress_cache_evict(srv, p);
+
+	return HANDLER_GO_ON;
+}
+
 LI_EXPORT int mod_compress_plugin_init(plugin *p);
 LI_EXPORT int mod_compress_plugin_init(plugin *p) {
 	p->version     = LIGHTTPD_VERSION_ID;
@@ -839,6 +1682,9 @@ LI_EXPORT int mod_compress_plugin_init(plugin *p) {
 
 	/* we have to hook into the response-header settings */
 	p->handle_response_header  = mod_compress_physical;
+	p->handle_trigger = mod_compress_trigger;
+	p->connection_reset = mod_compress_connection_reset;
+	p->handle_connection_close = mod_compress_connection_reset;
 
 	p->cleanup     = mod_compress_free;
 
@@ -6,6 +6,7 @@
  */
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 
 #include <fcntl.h>
 #ifdef HAVE_UNISTD_H
@@ -31,6 +32,7 @@
 #include "crc32.h"
 #include "etag.h"
 #include "inet_ntop_cache.h"
+#include "status_counter.h"
 
 #if defined HAVE_ZLIB_H && defined HAVE_LIBZ
 # define USE_ZLIB
@@ -44,7 +46,18 @@
 # include <bzlib.h>
 #endif
 
+#if defined HAVE_BROTLI_ENCODE_H && defined HAVE_LIBBROTLIENC
+# define USE_BROTLI
+# include <brotli/encode.h>
+#endif
+
+#if defined HAVE_ZSTD_H && defined HAVE_LIBZSTD
+# define USE_ZSTD
+# include <zstd.h>
+#endif
+
 #include "sys-mmap.h"
+#include "http_header.h"
 
 /* request: accept-encoding */
 #define HTTP_ACCEPT_ENCODING_IDENTITY BV(0)
@@ -52,6 +65,8 @@
 #define HTTP_ACCEPT_ENCODING_DEFLATE  BV(2)
 #define HTTP_ACCEPT_ENCODING_COMPRESS BV(3)
 #define HTTP_ACCEPT_ENCODING_BZIP2    BV(4)
+#define HTTP_ACCEPT_ENCODING_BROTLI   BV(5)
+#define HTTP_ACCEPT_ENCODING_ZSTD     BV(6)
 
 /* encoding names */
 #define ENCODING_NAME_IDENTITY   "identity"
@@ -59,6 +74,30 @@
 #define ENCODING_NAME_DEFLATE    "deflate"
 #define ENCODING_NAME_COMPRESS   "compress"
 #define ENCODING_NAME_BZIP2      "bzip2"
+#define ENCODING_NAME_BROTLI     "br"
+#define ENCODING_NAME_ZSTD       "zstd"
+
+/* indexed by the bit of the HTTP_ACCEPT_ENCODING_* value */
+static const char * const encoding_names[] = {
+	ENCODING_NAME_IDENTITY,
+	ENCODING_NAME_GZIP,
+	ENCODING_NAME_DEFLATE,
+	ENCODING_NAME_COMPRESS,
+	ENCODING_NAME_BZIP2,
+	ENCODING_NAME_BROTLI,
+	ENCODING_NAME_ZSTD,
+	NULL
+};
+
+/* if the client likes several encodings equally well, take the first */
+static const int encoding_preference[] = {
+	HTTP_ACCEPT_ENCODING_BROTLI,
+	HTTP_ACCEPT_ENCODING_ZSTD,
+	HTTP_ACCEPT_ENCODING_BZIP2,
+	HTTP_ACCEPT_ENCODING_GZIP,
+	HTTP_ACCEPT_ENCODING_DEFLATE,
+	0
+};
 
 
 #define CONFIG_DEFLATE_OUTPUT_BUFFER_SIZE "deflate.output-buffer-size"
@@ -72,11 +111,29 @@
 #define CONFIG_DEFLATE_DEBUG "deflate.debug"
 #define CONFIG_DEFLATE_ALLOWED_ENCODINGS "deflate.allowed_encodings"
 #define CONFIG_DEFLATE_SYNC_FLUSH "deflate.sync-flush"
+#define CONFIG_DEFLATE_THREADS "deflate.threads"
+#define CONFIG_DEFLATE_MAX_QUEUE_LENGTH "deflate.max-queue-length"
+#define CONFIG_DEFLATE_BROTLI_QUALITY "deflate.brotli-quality"
+#define CONFIG_DEFLATE_ZSTD_LEVEL "deflate.zstd-level"
+#define CONFIG_DEFLATE_AUTO_TUNE "deflate.auto-tune"
+#define CONFIG_DEFLATE_AUTO_TUNE_MIN_LEVEL "deflate.auto-tune-min-level"
+#define CONFIG_DEFLATE_AUTO_TUNE_MAX_MIN_COMPRESS_SIZE "deflate.auto-tune-max-min-compress-size"
+#define CONFIG_DEFLATE_AUTO_TUNE_CPU_HIGH "deflate.auto-tune-cpu-high"
+#define CONFIG_DEFLATE_AUTO_TUNE_CPU_LOW "deflate.auto-tune-cpu-low"
 	
 #define KByte * 1024
 #define MByte * 1024 KByte
 #define GByte * 1024 MByte
 
+/* responses smaller than this are compressed in the main-loop even if
+ * we have worker threads, the hand-over would cost more than it saves */
+#define DEFLATE_INLINE_COMPRESS_SIZE (8 KByte)
+
+/* the auto-tuning lowers the compression-level by at most this many steps */
+#define DEFLATE_AUTO_TUNE_MAX_STEP 8
+/* what zlib uses for compression-level -1 */
+#define DEFLATE_DEFAULT_LEVEL 6
+
 typedef struct {
 	unsigned short	debug;
 	unsigned short	enabled;
@@ -88,18 +145,69 @@ typedef struct {
 	short		mem_level;
 	short		compression_level;
 	short		window_size;
+	short		brotli_quality;
+	short		zstd_level;
 	array		*mimetypes;
+
+	/* server-wide only */
+	unsigned short	threads;
+	unsigned short	max_queue_length;
+	unsigned short	auto_tune;
+	unsigned short	auto_tune_min_level;
+	unsigned short	auto_tune_max_min_compress_size;
+	unsigned short	auto_tune_cpu_high;
+	unsigned short	auto_tune_cpu_low;
 } plugin_config;
 
 typedef struct {
 	PLUGIN_DATA;
 	buffer *tmp_buf;
 	array  *encodings_arr;
+
+#ifdef USE_GTHREAD
+	server *srv;
+
+	GAsyncQueue *job_queue;  /* blocks waiting for a worker */
+	GAsyncQueue *done_queue; /* compressed blocks waiting for the main-loop */
+
+	GThread **threads;
+	unsigned short threads_used;
+
+	int jobs_in_flight;      /* only touched by the main-loop */
+#endif
+
+	/* auto-tuning, sampled in the trigger */
+	int tune_step;           /* levels we are below the configured compression-level */
+	uint64_t tune_wall_usec;
+	uint64_t tune_busy_usec;
+
+	uint64_t stat_bytes_in;  /* compressed since the last trigger */
+	uint64_t stat_bytes_out;
+	uint64_t stat_cpu_usec;
+
+	data_integer *cnt_level;
+	data_integer *cnt_min_size;
+	data_integer *cnt_cpu_load;
+	data_integer *cnt_saved_per_cpu_ms;
 	
 	plugin_config **config_storage;
 	plugin_config conf; 
 } plugin_data;
 
+/**
+ * a part of the in-queue which is compressed in one go
+ *
+ * the chunks are only advanced after the segments are compressed
+ * as the compression might run in a worker thread
+ */
+typedef struct {
+	chunk *c;
+	unsigned char *start;
+	off_t len;
+} deflate_segment;
+
+struct deflate_job;
+
 typedef struct {
 	off_t bytes_in;
 	filter *fl;
@@ -117,9 +225,86 @@ typedef struct {
 #ifdef USE_BZ2LIB
 	bz_stream bz;
 #endif
+#ifdef USE_BROTLI
+	BrotliEncoderState *br;
+#endif
+#ifdef USE_ZSTD
+	ZSTD_CCtx *zstd;
+#endif
+	/* the segments of the next block to compress */
+	deflate_segment *seg;
+	size_t seg_used;
+	size_t seg_size;
+	int seg_end;         /* the block is the last one, finish the stream */
+
+	int use_threads;
+	struct deflate_job *job; /* the block is compressed by a worker thread right now */
+	int job_failed;
+
+	uint64_t cpu_usec;   /* spent compressing the current block */
+	off_t out_seen;      /* hctx->out->bytes_in at the end of the last block */
+
+	plugin_config conf;  /* the config of the connection as the filter is called without patching */
 	plugin_data *plugin_data;
 } handler_ctx;
 
+#ifdef USE_GTHREAD
+/**
+ * a block in the hands of a worker thread
+ *
+ * the worker only reads memory the job holds a reference to: the MEM
+ * segments are shared views of the chunk buffers (the main-loop copies a
+ * buffer before it writes to it again) and the mmap()s of the FILE segments
+ * are taken over if the connection goes away.
+ */
+typedef struct deflate_job {
+	connection *con;
+	handler_ctx *hctx;
+
+	buffer *out;   /* the compressed output, the chunkpool is not thread-safe */
+
+	buffer **views; /* the MEM segments */
+	size_t views_used;
+
+	struct {
+		char *start;
+		size_t length;
+	} *maps;        /* the mmap()s of the FILE segments, once orphaned */
+	size_t maps_used;
+
+	int ret;
+	int orphaned;  /* the connection went away, the job owns the handler-ctx; main-loop only */
+} deflate_job;
+
+static deflate_job *deflate_job_init(void) {
+	deflate_job *job;
+
+	job = calloc(1, sizeof(*job));
+	job->out = buffer_init();
+
+	return job;
+}
+
+static void deflate_job_free(deflate_job *job) {
+	size_t i;
+
+	if (!job) return;
+
+	for (i = 0; i < job->views_used; i++) {
+		buffer_free(job->views[i]);
+	}
+	free(job->views);
+
+	for (i = 0; i < job->maps_used; i++) {
+		munmap(job->maps[i].start, job->maps[i].length);
+	}
+	free(job->maps);
+
+	buffer_free(job->out);
+	free(job);
+}
+#endif
+
 static handler_ctx *handler_ctx_init() {
 	handler_ctx *hctx;
 
@@ -131,6 +316,7 @@ static handler_ctx *handler_ctx_init() {
 }
 
 static void handler_ctx_free(handler_ctx *hctx) {
+	free(hctx->seg);
 	free(hctx);
 }
 
@@ -143,16 +329,32 @@ INIT_FUNC(mod_deflate_init) {
 
 	p->tmp_buf = buffer_init();
 	p->encodings_arr = array_init();
+
+	p->cnt_level = status_counter_get_counter(CONST_STR_LEN("deflate.compression-level"));
+	p->cnt_min_size = status_counter_get_counter(CONST_STR_LEN("deflate.min-compress-size"));
+	p->cnt_cpu_load = status_counter_get_counter(CONST_STR_LEN("deflate.cpu-load-percent"));
+	p->cnt_saved_per_cpu_ms = status_counter_get_counter(CONST_STR_LEN("deflate.bytes-saved-per-cpu-ms"));
+#ifdef USE_GTHREAD
+	p->srv = srv;
+#endif
 	
 	return p;
 }
 
+#ifdef USE_GTHREAD
+static void deflate_workers_stop(server *srv, plugin_data *p);
+#endif
+
 FREE_FUNC(mod_deflate_free) {
 	plugin_data *p = p_d;
 	
 	UNUSED(srv);
 
 	if (!p) return HANDLER_GO_ON;
+
+#ifdef USE_GTHREAD
+	deflate_workers_stop(srv, p);
+#endif
 	
 	if (p->config_storage) {
 		size_t i;
@@ -191,6 +393,15 @@ SETDEFAULTS_FUNC(mod_deflate_setdefaults) {
 		{ CONFIG_DEFLATE_DEBUG,                 NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION },
 		{ CONFIG_DEFLATE_SYNC_FLUSH,            NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION },
 		{ CONFIG_DEFLATE_ALLOWED_ENCODINGS,     NULL, T_CONFIG_ARRAY, T_CONFIG_SCOPE_CONNECTION },
+		{ CONFIG_DEFLATE_THREADS,               NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_SERVER },
+		{ CONFIG_DEFLATE_MAX_QUEUE_LENGTH,      NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_SERVER },
+		{ CONFIG_DEFLATE_BROTLI_QUALITY,        NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },
+		{ CONFIG_DEFLATE_ZSTD_LEVEL,            NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },
+		{ CONFIG_DEFLATE_AUTO_TUNE,             NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_SERVER },
+		{ CONFIG_DEFLATE_AUTO_TUNE_MIN_LEVEL,   NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_SERVER },
+		{ CONFIG_DEFLATE_AUTO_TUNE_MAX_MIN_COMPRESS_SIZE, NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_SERVER },
+		{ CONFIG_DEFLATE_AUTO_TUNE_CPU_HIGH,    NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_SERVER },
+		{ CONFIG_DEFLATE_AUTO_TUNE_CPU_LOW,     NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_SERVER },
 		{ NULL,                                 NULL, T_CONFIG_UNSET, T_CONFIG_SCOPE_UNSET }
 	};
 	
@@ -212,7 +423,16 @@ SETDEFAULTS_FUNC(mod_deflate_setdefaults) {
 		s->min_compress_size = 0;
 		s->work_block_size = 2048;
 		s->compression_level = -1;
+		s->brotli_quality = 5;
+		s->zstd_level = 3;
+		s->auto_tune = 0;
+		s->auto_tune_min_level = 1;
+		s->auto_tune_max_min_compress_size = 4096;
+		s->auto_tune_cpu_high = 80;
+		s->auto_tune_cpu_low = 40;
 		s->mimetypes = array_init();
+		s->threads = 0;
+		s->max_queue_length = 64;
 
 		cv[0].destination = &(s->output_buffer_size);
 		cv[1].destination = s->mimetypes;
@@ -225,6 +445,15 @@ SETDEFAULTS_FUNC(mod_deflate_setdefaults) {
 		cv[8].destination = &(s->debug);
 		cv[9].destination = &(s->sync_flush);
 		cv[10].destination = p->encodings_arr; /* temp array for allowed encodings list */
+		cv[11].destination = &(s->threads);
+		cv[12].destination = &(s->max_queue_length);
+		cv[13].destination = &(s->brotli_quality);
+		cv[14].destination = &(s->zstd_level);
+		cv[15].destination = &(s->auto_tune);
+		cv[16].destination = &(s->auto_tune_min_level);
+		cv[17].destination = &(s->auto_tune_max_min_compress_size);
+		cv[18].destination = &(s->auto_tune_cpu_high);
+		cv[19].destination = &(s->auto_tune_cpu_low);
 		
 		p->config_storage[i] = s;
 	
@@ -249,12 +478,21 @@ SETDEFAULTS_FUNC(mod_deflate_setdefaults) {
 #ifdef USE_BZ2LIB
 				if (NULL != strstr(BUF_STR(ds->value), ENCODING_NAME_BZIP2))
 					s->allowed_encodings |= HTTP_ACCEPT_ENCODING_BZIP2;
+#endif
+#ifdef USE_BROTLI
+				if (NULL != strstr(BUF_STR(ds->value), ENCODING_NAME_BROTLI))
+					s->allowed_encodings |= HTTP_ACCEPT_ENCODING_BROTLI;
+#endif
+#ifdef USE_ZSTD
+				if (NULL != strstr(BUF_STR(ds->value), ENCODING_NAME_ZSTD))
+					s->allowed_encodings |= HTTP_ACCEPT_ENCODING_ZSTD;
 #endif
 			}
 		} else {
 			/* default encodings */
 			s->allowed_encodings = HTTP_ACCEPT_ENCODING_IDENTITY | HTTP_ACCEPT_ENCODING_GZIP |
-				HTTP_ACCEPT_ENCODING_DEFLATE | HTTP_ACCEPT_ENCODING_COMPRESS | HTTP_ACCEPT_ENCODING_BZIP2;
+				HTTP_ACCEPT_ENCODING_DEFLATE | HTTP_ACCEPT_ENCODING_COMPRESS | HTTP_ACCEPT_ENCODING_BZIP2 |
+				HTTP_ACCEPT_ENCODING_BROTLI | HTTP_ACCEPT_ENCODING_ZSTD;
 		}
 
 		if((s->compression_level < 1 || s->compression_level > 9) &&
@@ -263,6 +501,16 @@ SETDEFAULTS_FUNC(mod_deflate_setdefaults) {
 			return HANDLER_ERROR;
 		}
 
+		if(s->brotli_quality < 0 || s->brotli_quality > 11) {
+			ERROR("brotli-quality must be between 0 and 11: %i", s->brotli_quality);
+			return HANDLER_ERROR;
+		}
+
+		if(s->zstd_level < 1 || s->zstd_level > 22) {
+			ERROR("zstd-level must be between 1 and 22: %i", s->zstd_level);
+			return HANDLER_ERROR;
+		}
+
 		if(s->mem_level < 1 || s->mem_level > 9) {
 			ERROR("mem-level must be between 1 and 9: %i", s->mem_level);
 			return HANDLER_ERROR;
@@ -278,11 +526,52 @@ SETDEFAULTS_FUNC(mod_deflate_setdefaults) {
 			s->output_buffer_size = 0;
 		}
 	}
+
+	if (p->config_storage[0]->auto_tune) {
+		plugin_config *s = p->config_storage[0];
+
+		if (s->auto_tune_min_level < 1 || s->auto_tune_min_level > 9) {
+			ERROR("%s must be between 1 and 9: %i", CONFIG_DEFLATE_AUTO_TUNE_MIN_LEVEL, s->auto_tune_min_level);
+			return HANDLER_ERROR;
+		}
+
+		if (s->auto_tune_cpu_low >= s->auto_tune_cpu_high || s->auto_tune_cpu_high > 100) {
+			ERROR("%s (%i) has to be below %s (%i) and both at most 100", 
+					CONFIG_DEFLATE_AUTO_TUNE_CPU_LOW, s->auto_tune_cpu_low,
+					CONFIG_DEFLATE_AUTO_TUNE_CPU_HIGH, s->auto_tune_cpu_high);
+			return HANDLER_ERROR;
+		}
+	}
+
+#ifndef USE_GTHREAD
+	if (p->config_storage[0]->threads) {
+		ERROR("%s is set, but lighttpd was compiled without thread-support: compressing in the main-loop",
+				CONFIG_DEFLATE_THREADS);
+		p->config_storage[0]->threads = 0;
+	}
+#endif
 	
 	return HANDLER_GO_ON;
 	
 }
 
+/**
+ * append compressed data to the out-queue
+ *
+ * while a worker thread compresses a block the output is collected
+ * in the job as the chunkpool is not thread-safe
+ */
+static void deflate_output_append(handler_ctx *hctx, const char *ptr, size_t len) {
+#ifdef USE_GTHREAD
+	if (hctx->job) {
+		buffer_append_string_len(hctx->job->out, ptr, len);
+		return;
+	}
+#endif
+	chunkqueue_append_mem(hctx->out, ptr, len);
+	hctx->out->bytes_in += len;
+}
+
 #ifdef USE_ZLIB
 /* Copied gzip_header from apache 2.2's mod_deflate.c */
 /* RFC 1952 Section 2.3 defines the gzip header:
@@ -297,7 +586,6 @@ static const char gzip_header[10] =
   0, 0x03 /* Unix OS_CODE */
 };
 static int stream_deflate_init(server *srv, connection *con, handler_ctx *hctx) {
-	plugin_data *p = hctx->plugin_data;
 	z_stream *z;
 	int r, compression_level;
 
@@ -313,23 +601,23 @@ static int stream_deflate_init(server *srv, connection *con, handler_ctx *hctx)
 	z->next_out = NULL;
 	z->avail_out = 0;
 
-	compression_level = p->conf.compression_level;
+	compression_level = hctx->conf.compression_level;
 	if(compression_level == -1)
 		compression_level = Z_DEFAULT_COMPRESSION;
 
-	if(p->conf.debug) {
-		TRACE("output-buffer-size: %i", p->conf.output_buffer_size);
+	if(hctx->conf.debug) {
+		TRACE("output-buffer-size: %i", hctx->conf.output_buffer_size);
 		TRACE("compression-level: %i", compression_level);
-		TRACE("mem-level: %i", p->conf.mem_level);
-		TRACE("window-size: %i", p->conf.window_size);
-		TRACE("min-compress-size: %i", p->conf.min_compress_size);
-		TRACE("work-block-size: %i", p->conf.work_block_size);
+		TRACE("mem-level: %i", hctx->conf.mem_level);
+		TRACE("window-size: %i", hctx->conf.window_size);
+		TRACE("min-compress-size: %i", hctx->conf.min_compress_size);
+		TRACE("work-block-size: %i", hctx->conf.work_block_size);
 	}
 	if (Z_OK != (r = deflateInit2(z, 
 				 compression_level,
 				 Z_DEFLATED, 
-				 p->conf.window_size,  /* supress zlib-header */
-				 p->conf.mem_level,
+				 hctx->conf.window_size,  /* supress zlib-header */
+				 hctx->conf.mem_level,
 				 Z_DEFAULT_STRATEGY))) {
 		ERROR("deflateInit2() failed with %d", r);
 		return -1;
@@ -340,7 +628,6 @@ static int stream_deflate_init(server *srv, connection *con, handler_ctx *hctx)
 }
 
 static int stream_deflate_compress(server *srv, connection *con, handler_ctx *hctx, unsigned char *start, off_t st_size) {
-	plugin_data *p = hctx->plugin_data;
 	z_stream *z;
 	int len;
 	int in = 0, out = 0;
@@ -360,7 +647,7 @@ static int stream_deflate_compress(server *srv, connection *con, handler_ctx *hc
 			hctx->gzip_header = 1;
 			/* copy gzip header into output buffer */
 			buffer_copy_memory(hctx->output, gzip_header, sizeof(gzip_header));
-			if(p->conf.debug) {
+			if(hctx->conf.debug) {
 				TRACE("gzip_header len=%zu", sizeof(gzip_header));
 			}
 			/* initialize crc32 */
@@ -387,21 +674,19 @@ static int stream_deflate_compress(server *srv, connection *con, handler_ctx *hc
 		if(z->avail_out == 0 || z->avail_in > 0) {
 			len = hctx->output->size - z->avail_out;
 			out += len;
-			chunkqueue_append_mem(hctx->out, hctx->output->ptr, len);
-			hctx->out->bytes_in += len;
+			deflate_output_append(hctx, hctx->output->ptr, len);
 			z->next_out = (unsigned char *)hctx->output->ptr;
 			z->avail_out = hctx->output->size;
 		}
 	} while (z->avail_in > 0);
 
-	if(p->conf.debug) {
+	if(hctx->conf.debug) {
 		TRACE("compress: in=%i, out=%i", in, out);
 	}
 	return st_size;
 }
 
 static int stream_deflate_flush(server *srv, connection *con, handler_ctx *hctx, int end) {
-	plugin_data *p = hctx->plugin_data;
 	z_stream *z;
 	int len;
 	int rc = 0;
@@ -432,13 +717,13 @@ static int stream_deflate_flush(server *srv, connection *con, handler_ctx *hctx,
 				return -1;
 			}
 		} else {
-			if(p->conf.sync_flush) {
+			if(hctx->conf.sync_flush) {
 				rc = deflate(z, Z_SYNC_FLUSH);
 			} else if(z->avail_in > 0) {
-				if(p->conf.output_buffer_size > 0) flush = 0;
+				if(hctx->conf.output_buffer_size > 0) flush = 0;
 				rc = deflate(z, Z_NO_FLUSH);
 			} else {
-				if(p->conf.output_buffer_size > 0) flush = 0;
+				if(hctx->conf.output_buffer_size > 0) flush = 0;
 				rc = Z_OK;
 			}
 			if (rc != Z_OK) {
@@ -451,18 +736,17 @@ static int stream_deflate_flush(server *srv, connection *con, handler_ctx *hctx,
 		len = hctx->output->size - z->avail_out;
 		if(z->avail_out == 0 || (flush && len > 0)) {
 			out += len;
-			chunkqueue_append_mem(hctx->out, hctx->output->ptr, len);
-			hctx->out->bytes_in += len;
+			deflate_output_append(hctx, hctx->output->ptr, len);
 			z->next_out = (unsigned char *)hctx->output->ptr;
 			z->avail_out = hctx->output->size;
 		}
 	} while (z->avail_in != 0 || !done);
 
 
-	if(p->conf.debug) {
+	if(hctx->conf.debug) {
 		TRACE("flush: in=%i, out=%i", in, out);
 	}
-	if(p->conf.sync_flush) {
+	if(hctx->conf.sync_flush) {
 		z->next_out = NULL;
 		z->avail_out = 0;
 	}
@@ -470,7 +754,6 @@ static int stream_deflate_flush(server *srv, connection *con, handler_ctx *hctx,
 }
 
 static int stream_deflate_end(server *srv, connection *con, handler_ctx *hctx) {
-	plugin_data *p = hctx->plugin_data;
 	z_stream *z;
 	int rc;
 
@@ -494,9 +777,8 @@ static int stream_deflate_end(server *srv, connection *con, handler_ctx *hctx) {
 		c[6] = (z->total_in >> 16) & 0xff;
 		c[7] = (z->total_in >> 24) & 0xff;
 		/* append footer to write_queue */
-		chunkqueue_append_mem(hctx->out, (char *)c, 8);
-		hctx->out->bytes_in += 8;
-		if(p->conf.debug) {
+		deflate_output_append(hctx, (char *)c, 8);
+		if(hctx->conf.debug) {
 			TRACE("gzip_footer len=%i", 8);
 		}
 	}
@@ -517,7 +799,6 @@ static int stream_deflate_end(server *srv, connection *con, handler_ctx *hctx) {
 
 #ifdef USE_BZ2LIB
 static int stream_bzip2_init(server *srv, connection *con, handler_ctx *hctx) {
-	plugin_data *p = hctx->plugin_data;
 	bz_stream *bz;
 	int compression_level;
 
@@ -533,17 +814,17 @@ static int stream_bzip2_init(server *srv, connection *con, handler_ctx *hctx) {
 	bz->total_out_lo32 = 0;
 	bz->total_out_hi32 = 0;
 
-	compression_level = p->conf.compression_level;
+	compression_level = hctx->conf.compression_level;
 	if(compression_level == -1)
 		compression_level = 9;
 
-	if(p->conf.debug) {
-		TRACE("output-buffer-size: %i", p->conf.output_buffer_size);
+	if(hctx->conf.debug) {
+		TRACE("output-buffer-size: %i", hctx->conf.output_buffer_size);
 		TRACE("compression-level: %i", compression_level);
-		TRACE("mem-level: %i", p->conf.mem_level);
-		TRACE("window-size: %i", p->conf.window_size);
-		TRACE("min-compress-size: %i", p->conf.min_compress_size);
-		TRACE("work-block-size: %i", p->conf.work_block_size);
+		TRACE("mem-level: %i", hctx->conf.mem_level);
+		TRACE("window-size: %i", hctx->conf.window_size);
+		TRACE("min-compress-size: %i", hctx->conf.min_compress_size);
+		TRACE("work-block-size: %i", hctx->conf.work_block_size);
 	}
 	if (BZ_OK != BZ2_bzCompressInit(bz, 
 					compression_level, /* blocksize */
@@ -557,7 +838,6 @@ static int stream_bzip2_init(server *srv, connection *con, handler_ctx *hctx) {
 }
 
 static int stream_bzip2_compress(server *srv, connection *con, handler_ctx *hctx, unsigned char *start, off_t st_size) {
-	plugin_data *p = hctx->plugin_data;
 	bz_stream *bz;
 	int len;
 	int rc;
@@ -590,20 +870,18 @@ static int stream_bzip2_compress(server *srv, connection *con, handler_ctx *hctx
 		if(bz->avail_out == 0 || bz->avail_in > 0) {
 			len = hctx->output->size - bz->avail_out;
 			out += len;
-			chunkqueue_append_mem(hctx->out, hctx->output->ptr, len);
-			hctx->out->bytes_in += len;
+			deflate_output_append(hctx, hctx->output->ptr, len);
 			bz->next_out = hctx->output->ptr;
 			bz->avail_out = hctx->output->size;
 		}
 	} while (bz->avail_in > 0);
-	if(p->conf.debug) {
+	if(hctx->conf.debug) {
 		TRACE("compress: in=%i, out=%i", in, out);
 	}
 	return st_size;
 }
 
 static int stream_bzip2_flush(server *srv, connection *con, handler_ctx *hctx, int end) {
-	plugin_data *p = hctx->plugin_data;
 	bz_stream *bz;
 	int len;
 	int rc;
@@ -640,22 +918,21 @@ static int stream_bzip2_flush(server *srv, connection *con, handler_ctx *hctx, i
 				hctx->stream_open = 0;
 				return -1;
 			}
-			if(p->conf.output_buffer_size > 0) flush = 0;
+			if(hctx->conf.output_buffer_size > 0) flush = 0;
 		}
 
 		len = hctx->output->size - bz->avail_out;
 		if(bz->avail_out == 0 || (flush && len > 0)) {
 			out += len;
-			chunkqueue_append_mem(hctx->out, hctx->output->ptr, len);
-			hctx->out->bytes_in += len;
+			deflate_output_append(hctx, hctx->output->ptr, len);
 			bz->next_out = hctx->output->ptr;
 			bz->avail_out = hctx->output->size;
 		}
 	} while (bz->avail_in != 0 || !done);
-	if(p->conf.debug) {
+	if(hctx->conf.debug) {
 		TRACE("flush: in=%i, out=%i", in, out);
 	}
-	if(p->conf.sync_flush) {
+	if(hctx->conf.sync_flush) {
 		bz->next_out = NULL;
 		bz->avail_out = 0;
 	}
@@ -685,6 +962,235 @@ static int stream_bzip2_end(server *srv, connection *con, handler_ctx *hctx) {
 
 #endif
 
+#ifdef USE_BROTLI
+static int stream_brotli_init(server *srv, connection *con, handler_ctx *hctx) {
+	UNUSED(srv);
+	UNUSED(con);
+
+	if (NULL == (hctx->br = BrotliEncoderCreateInstance(NULL, NULL, NULL))) {
+		return -1;
+	}
+
+	if(hctx->conf.debug) {
+		TRACE("brotli-quality: %i", hctx->conf.brotli_quality);
+		TRACE("min-compress-size: %i", hctx->conf.min_compress_size);
+		TRACE("work-block-size: %i", hctx->conf.work_block_size);
+	}
+
+	BrotliEncoderSetParameter(hctx->br, BROTLI_PARAM_QUALITY, hctx->conf.brotli_quality);
+	hctx->stream_open = 1;
+
+	return 0;
+}
+
+/**
+ * run the encoder and move everything it produced to the out-queue
+ *
+ * the encoder keeps its own output buffer, no need to use hctx->output
+ */
+static int stream_brotli_run(handler_ctx *hctx, BrotliEncoderOperation op, const unsigned char *start, size_t st_size, int *out) {
+	BrotliEncoderState *br = hctx->br;
+	const uint8_t *next_in = start;
+	size_t avail_in = st_size;
+	size_t avail_out = 0;
+	const uint8_t *o;
+	size_t len;
+
+	do {
+		if (!BrotliEncoderCompressStream(br, op, &avail_in, &next_in, &avail_out, NULL, NULL)) {
+			return -1;
+		}
+
+		while (BrotliEncoderHasMoreOutput(br)) {
+			len = 0;
+			o = BrotliEncoderTakeOutput(br, &len);
+			*out += len;
+			deflate_output_append(hctx, (const char *)o, len);
+		}
+	} while (avail_in > 0 ||
+		(op == BROTLI_OPERATION_FINISH && !BrotliEncoderIsFinished(br)));
+
+	return 0;
+}
+
+static int stream_brotli_compress(server *srv, connection *con, handler_ctx *hctx, unsigned char *start, off_t st_size) {
+	int out = 0;
+
+	UNUSED(srv);
+	UNUSED(con);
+
+	hctx->bytes_in += st_size;
+
+	if (0 != stream_brotli_run(hctx, BROTLI_OPERATION_PROCESS, start, st_size, &out)) {
+		BrotliEncoderDestroyInstance(hctx->br);
+		hctx->br = NULL;
+		hctx->stream_open = 0;
+		return -1;
+	}
+
+	if(hctx->conf.debug) {
+		TRACE("compress: in=%i, out=%i", (int)st_size, out);
+	}
+	return st_size;
+}
+
+static int stream_brotli_flush(server *srv, connection *con, handler_ctx *hctx, int end) {
+	int out = 0;
+
+	UNUSED(srv);
+	UNUSED(con);
+
+	if (!end && !hctx->conf.sync_flush) return 0;
+
+	if (0 != stream_brotli_run(hctx, end ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_FLUSH, NULL, 0, &out)) {
+		BrotliEncoderDestroyInstance(hctx->br);
+		hctx->br = NULL;
+		hctx->stream_open = 0;
+		return -1;
+	}
+
+	if(hctx->conf.debug) {
+		TRACE("flush: out=%i", out);
+	}
+	return 0;
+}
+
+static int stream_brotli_end(server *srv, connection *con, handler_ctx *hctx) {
+	UNUSED(srv);
+	UNUSED(con);
+
+	if(!hctx->stream_open) return 0;
+	hctx->stream_open = 0;
+
+	BrotliEncoderDestroyInstance(hctx->br);
+	hctx->br = NULL;
+
+	return 0;
+}
+
+#endif
+
+#ifdef USE_ZSTD
+static int stream_zstd_init(server *srv, connection *con, handler_ctx *hctx) {
+	size_t rc;
+
+	UNUSED(srv);
+	UNUSED(con);
+
+	if (NULL == (hctx->zstd = ZSTD_createCCtx())) {
+		return -1;
+	}
+
+	if(hctx->conf.debug) {
+		TRACE("output-buffer-size: %i", hctx->conf.output_buffer_size);
+		TRACE("zstd-level: %i", hctx->conf.zstd_level);
+		TRACE("min-compress-size: %i", hctx->conf.min_compress_size);
+		TRACE("work-block-size: %i", hctx->conf.work_block_size);
+	}
+
+	rc = ZSTD_CCtx_setParameter(hctx->zstd, ZSTD_c_compressionLevel, hctx->conf.zstd_level);
+	if (ZSTD_isError(rc)) {
+		ERROR("ZSTD_CCtx_setParameter failed: %s", ZSTD_getErrorName(rc));
+		ZSTD_freeCCtx(hctx->zstd);
+		hctx->zstd = NULL;
+		return -1;
+	}
+	hctx->stream_open = 1;
+
+	return 0;
+}
+
+/**
+ * feed the input to the encoder and append the output to the out-queue
+ *
+ * for ZSTD_e_flush and ZSTD_e_end we loop until zstd has nothing left
+ */
+static int stream_zstd_run(handler_ctx *hctx, ZSTD_EndDirective mode, unsigned char *start, size_t st_size, int *out) {
+	ZSTD_inBuffer zin;
+	ZSTD_outBuffer zout;
+	size_t rc;
+
+	zin.src = start;
+	zin.size = st_size;
+	zin.pos = 0;
+
+	do {
+		zout.dst = hctx->output->ptr;
+		zout.size = hctx->output->size;
+		zout.pos = 0;
+
+		rc = ZSTD_compressStream2(hctx->zstd, &zout, &zin, mode);
+		if (ZSTD_isError(rc)) {
+			ERROR("ZSTD_compressStream2 failed: %s", ZSTD_getErrorName(rc));
+			return -1;
+		}
+
+		if (zout.pos > 0) {
+			*out += zout.pos;
+			deflate_output_append(hctx, hctx->output->ptr, zout.pos);
+		}
+	} while (zin.pos < zin.size || (mode != ZSTD_e_continue && rc != 0));
+
+	return 0;
+}
+
+static int stream_zstd_compress(server *srv, connection *con, handler_ctx *hctx, unsigned char *start, off_t st_size) {
+	int out = 0;
+
+	UNUSED(srv);
+	UNUSED(con);
+
+	hctx->bytes_in += st_size;
+
+	if (0 != stream_zstd_run(hctx, ZSTD_e_continue, start, st_size, &out)) {
+		ZSTD_freeCCtx(hctx->zstd);
+		hctx->zstd = NULL;
+		hctx->stream_open = 0;
+		return -1;
+	}
+
+	if(hctx->conf.debug) {
+		TRACE("compress: in=%i, out=%i", (int)st_size, out);
+	}
+	return st_size;
+}
+
+static int stream_zstd_flush(server *srv, connection *con, handler_ctx *hctx, int end) {
+	int out = 0;
+
+	UNUSED(srv);
+	UNUSED(con);
+
+	if (!end && !hctx->conf.sync_flush) return 0;
+
+	if (0 != stream_zstd_run(hctx, end ? ZSTD_e_end : ZSTD_e_flush, NULL, 0, &out)) {
+		ZSTD_freeCCtx(hctx->zstd);
+		hctx->zstd = NULL;
+		hctx->stream_open = 0;
+		return -1;
+	}
+
+	if(hctx->conf.debug) {
+		TRACE("flush: out=%i", out);
+	}
+	return 0;
+}
+
+static int stream_zstd_end(server *srv, connection *con, handler_ctx *hctx) {
+	UNUSED(srv);
+	UNUSED(con);
+
+	if(!hctx->stream_open) return 0;
+	hctx->stream_open = 0;
+
+	ZSTD_freeCCtx(hctx->zstd);
+	hctx->zstd = NULL;
+
+	return 0;
+}
+
+#endif
+
 static int mod_deflate_compress(server *srv, connection *con, handler_ctx *hctx, unsigned char *start, off_t st_size) {
 	int ret = -1;
 	if(st_size == 0) return 0;
@@ -699,6 +1205,16 @@ static int mod_deflate_compress(server *srv, connection *con, handler_ctx *hctx,
 	case HTTP_ACCEPT_ENCODING_BZIP2: 
 		ret = stream_bzip2_compress(srv, con, hctx, start, st_size);
 		break;
+#endif
+#ifdef USE_BROTLI
+	case HTTP_ACCEPT_ENCODING_BROTLI:
+		ret = stream_brotli_compress(srv, con, hctx, start, st_size);
+		break;
+#endif
+#ifdef USE_ZSTD
+	case HTTP_ACCEPT_ENCODING_ZSTD:
+		ret = stream_zstd_compress(srv, con, hctx, start, st_size);
+		break;
 #endif
 	default:
 		ret = -1;
@@ -723,6 +1239,16 @@ static int mod_deflate_stream_flush(server *srv, connection *con, handler_ctx *h
 	case HTTP_ACCEPT_ENCODING_BZIP2: 
 		ret = stream_bzip2_flush(srv, con, hctx, end);
 		break;
+#endif
+#ifdef USE_BROTLI
+	case HTTP_ACCEPT_ENCODING_BROTLI:
+		ret = stream_brotli_flush(srv, con, hctx, end);
+		break;
+#endif
+#ifdef USE_ZSTD
+	case HTTP_ACCEPT_ENCODING_ZSTD:
+		ret = stream_zstd_flush(srv, con, hctx, end);
+		break;
 #endif
 	default:
 		ret = -1;
@@ -745,6 +1271,16 @@ static int mod_deflate_stream_end(server *srv, connection *con, handler_ctx *hct
 	case HTTP_ACCEPT_ENCODING_BZIP2: 
 		ret = stream_bzip2_end(srv, con, hctx);
 		break;
+#endif
+#ifdef USE_BROTLI
+	case HTTP_ACCEPT_ENCODING_BROTLI:
+		ret = stream_brotli_end(srv, con, hctx);
+		break;
+#endif
+#ifdef USE_ZSTD
+	case HTTP_ACCEPT_ENCODING_ZSTD:
+		ret = stream_zstd_end(srv, con, hctx);
+		break;
 #endif
 	default:
 		ret = -1;
@@ -754,14 +1290,18 @@ static int mod_deflate_stream_end(server *srv, connection *con, handler_ctx *hct
 	return ret;
 }
 
-static int mod_deflate_file_chunk(server *srv, connection *con, handler_ctx *hctx, chunk *c, off_t st_size) {
-	plugin_data *p = hctx->plugin_data;
+/**
+ * mmap() the next part of the file-chunk
+ *
+ * @param start is set to the start of the data to compress
+ * @return bytes available at start, -1 on error
+ */
+static off_t mod_deflate_file_chunk(server *srv, connection *con, handler_ctx *hctx, chunk *c, off_t st_size, unsigned char **start) {
 	off_t abs_offset;
 	off_t toSend;
 	stat_cache_entry *sce = NULL;
 	size_t we_want_to_mmap = 2 MByte; 
 	size_t we_want_to_send = st_size;
-	char *start = NULL;
 
 	if (HANDLER_ERROR == stat_cache_get_entry(srv, con, c->file.name, &sce)) {
 		ERROR("stat_cache_get_entry('%s') failed: %s",
@@ -876,35 +1416,351 @@ static int mod_deflate_file_chunk(server *srv, connection *con, handler_ctx *hct
 	}
 
 #ifdef LOCAL_BUFFERING
-	start = c->mem->ptr;
+	*start = (unsigned char *)c->mem->ptr + (abs_offset - c->file.mmap.offset);
 #else
-	start = c->file.mmap.start;
+	*start = (unsigned char *)c->file.mmap.start + (abs_offset - c->file.mmap.offset);
 #endif
 
-	if(p->conf.debug) {
+	if(hctx->conf.debug) {
 		TRACE("compress file chunk: offset=%i, toSend=%i", (int)c->offset, (int)toSend);
 	}
-	if (mod_deflate_compress(srv, con, hctx,
-				(unsigned char *)start + (abs_offset - c->file.mmap.offset), toSend) < 0) {
-		ERROR("%s", "compress failed.");
-		return -1;
-	}
 
 	return toSend;
 }
 
-static int deflate_compress_cleanup(server *srv, connection *con, handler_ctx *hctx) {
-	plugin_data *p = hctx->plugin_data;
-	int rc;
+/**
+ * cpu-time of the calling thread in usec, 0 if we can't tell
+ *
+ * the compression runs in the main-loop or a worker
+ */
+static uint64_t deflate_thread_cpu_usec(void) {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
 
-	rc = mod_deflate_stream_end(srv, con, hctx);
-	if(rc < 0) {
-		TRACE("error closing compressed stream for '%s', compressing with %d: %d", 
-			SAFE_BUF_STR(con->uri.path_raw), hctx->compression_type, rc);
+	if (0 == clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)) {
+		return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 	}
+#endif
+	return 0;
+}
 
-	if(p->conf.debug && hctx->bytes_in < hctx->out->bytes_in) {
-		TRACE("compressing uri '%s' increased the sent content-size from %jd to %jd",
+/**
+ * compress the collected segments and flush the stream
+ *
+ * runs in the main-loop or in a worker thread, it may only touch the
+ * compression state of the handler-ctx
+ */
+static int deflate_compress_segments(server *srv, connection *con, handler_ctx *hctx) {
+	size_t i;
+	uint64_t cpu_start = deflate_thread_cpu_usec();
+
+	for (i = 0; i < hctx->seg_used; i++) {
+		deflate_segment *seg = &(hctx->seg[i]);
+
+		if (mod_deflate_compress(srv, con, hctx, seg->start, seg->len) < 0) {
+			ERROR("%s", "compress failed.");
+			return -1;
+		}
+	}
+
+	/* flush the output buffer to make room for more data. */
+	if (mod_deflate_stream_flush(srv, con, hctx, hctx->seg_end) < 0) {
+		ERROR("%s", "flush error");
+	}
+
+	hctx->cpu_usec = deflate_thread_cpu_usec() - cpu_start;
+
+	return 0;
+}
+
+/**
+ * mark the compressed segments as done and move on
+ */
+static void deflate_compress_done(server *srv, connection *con, handler_ctx *hctx) {
+	size_t i;
+	off_t out = 0;
+
+	for (i = 0; i < hctx->seg_used; i++) {
+		deflate_segment *seg = &(hctx->seg[i]);
+		chunk *c = seg->c;
+
+		hctx->in->bytes_out += seg->len;
+		c->offset += seg->len;
+		out += seg->len;
+
+		if (c->type == FILE_CHUNK && 
+		    c->offset == c->file.length &&
+		    c->file.mmap.start != MAP_FAILED) {
+			/* we don't need the mmaping anymore */
+			munmap(c->file.mmap.start, c->file.mmap.length);
+			c->file.mmap.start = MAP_FAILED;
+		}
+	}
+
+	if (hctx->conf.debug) {
+		TRACE("compressed bytes: %jd", (intmax_t) out);
+	}
+
+	/* for the bytes-saved-per-cpu-ms */
+	hctx->plugin_data->stat_bytes_in += out;
+	hctx->plugin_data->stat_bytes_out += hctx->out->bytes_in - hctx->out_seen;
+	hctx->plugin_data->stat_cpu_usec += hctx->cpu_usec;
+	hctx->out_seen = hctx->out->bytes_in;
+	hctx->cpu_usec = 0;
+
+	if (hctx->seg_used > 0) {
+		chunkqueue_remove_finished_chunks(hctx->in);
+	}
+	hctx->seg_used = 0;
+
+	if (hctx->seg_end) {
+		hctx->out->is_closed = 1;
+		if(hctx->conf.debug) {
+			TRACE("finished uri: '%s', query: '%s'", SAFE_BUF_STR(con->uri.path_raw), SAFE_BUF_STR(con->uri.query));
+		}
+	} else if (hctx->in->first) {
+		/* We have more data to compress. */
+		joblist_append(srv, con);
+	}
+}
+
+static void deflate_segment_append(handler_ctx *hctx, chunk *c, unsigned char *start, off_t len) {
+	deflate_segment *seg;
+
+	if (hctx->seg_size == 0) {
+		hctx->seg_size = 16;
+		hctx->seg = malloc(hctx->seg_size * sizeof(*hctx->seg));
+	} else if (hctx->seg_used == hctx->seg_size) {
+		hctx->seg_size += 16;
+		hctx->seg = realloc(hctx->seg, hctx->seg_size * sizeof(*hctx->seg));
+	}
+
+	seg = &(hctx->seg[hctx->seg_used++]);
+	seg->c = c;
+	seg->start = start;
+	seg->len = len;
+}
+
+#ifdef USE_GTHREAD
+static gpointer deflate_worker_thread(gpointer _p) {
+	plugin_data *p = _p;
+	server *srv = p->srv;
+	deflate_job *job;
+
+	g_async_queue_ref(p->job_queue);
+
+	while (NULL != (job = g_async_queue_pop(p->job_queue))) {
+		connection *con;
+
+		if (job == (deflate_job *) 1) break; /* shutdown */
+
+		con = job->con;
+
+		job->ret = deflate_compress_segments(srv, con, job->hctx);
+
+		/* the main-loop owns the job from here on */
+		g_async_queue_push(p->done_queue, job);
+		joblist_async_append(srv, con);
+	}
+
+	g_async_queue_unref(p->job_queue);
+
+	return NULL;
+}
+
+/**
+ * start the worker threads on the first use
+ *
+ * we can't start them in set-defaults as we might fork() afterwards
+ */
+static int deflate_workers_start(server *srv, plugin_data *p) {
+	plugin_config *s = p->config_storage[0];
+	GError *gerr = NULL;
+
+	if (p->threads) return 0;
+
+	p->job_queue = g_async_queue_new();
+	p->done_queue = g_async_queue_new();
+	p->threads = calloc(s->threads, sizeof(*p->threads));
+
+	for (p->threads_used = 0; p->threads_used < s->threads; p->threads_used++) {
+		p->threads[p->threads_used] = g_thread_create(deflate_worker_thread, p, 1, &gerr);
+		if (gerr) {
+			ERROR("g_thread_create failed: %s", gerr->message);
+			g_error_free(gerr);
+			break;
+		}
+	}
+
+	if (p->threads_used == 0) {
+		ERROR("%s", "no deflate worker-thread could be started, compressing in the main-loop");
+		s->threads = 0;
+		return -1;
+	}
+
+	UNUSED(srv);
+
+	return 0;
+}
+
+static void deflate_job_finish(server *srv, deflate_job *job) {
+	handler_ctx *hctx = job->hctx;
+	buffer *b, btmp;
+
+	hctx->job = NULL;
+
+	if (job->ret < 0) {
+		hctx->job_failed = 1;
+		return;
+	}
+
+	if (job->out->used) {
+		/* steal the buffer, the job doesn't need it anymore */
+		hctx->out->bytes_in += job->out->used - 1;
+
+		b = chunkqueue_get_append_buffer(hctx->out);
+		btmp = *b; *b = *(job->out); *(job->out) = btmp;
+	}
+
+	deflate_compress_done(srv, job->con, hctx);
+}
+
+static void deflate_handler_ctx_free(server *srv, connection *con, handler_ctx *hctx);
+
+/**
+ * pick up the blocks the workers have finished
+ */
+static void deflate_jobs_collect(server *srv, plugin_data *p) {
+	deflate_job *job;
+
+	if (!p->done_queue) return;
+
+	while (NULL != (job = g_async_queue_try_pop(p->done_queue))) {
+		p->jobs_in_flight--;
+
+		if (job->orphaned) {
+			/* the output of the stream-end goes into the job and is dropped */
+			deflate_handler_ctx_free(srv, job->con, job->hctx);
+		} else {
+			deflate_job_finish(srv, job);
+		}
+
+		deflate_job_free(job);
+	}
+}
+
+/**
+ * the connection goes away while a worker compresses its block
+ *
+ * the job takes over the handler-ctx and the mmap()s the worker reads
+ * from, deflate_jobs_collect() frees them when the block is done.
+ */
+static void deflate_job_orphan(handler_ctx *hctx) {
+	deflate_job *job = hctx->job;
+	size_t i;
+
+	job->maps = malloc(hctx->seg_used * sizeof(*job->maps));
+	assert(job->maps);
+
+	for (i = 0; i < hctx->seg_used; i++) {
+		chunk *c = hctx->seg[i].c;
+
+		if (c->type != FILE_CHUNK || c->file.mmap.start == MAP_FAILED) continue;
+
+		job->maps[job->maps_used].start = c->file.mmap.start;
+		job->maps[job->maps_used].length = c->file.mmap.length;
+		job->maps_used++;
+
+		c->file.mmap.start = MAP_FAILED;
+	}
+
+	job->orphaned = 1;
+}
+
+/**
+ * hand the collected segments over to a worker thread
+ *
+ * @return 0 if a worker took it, -1 if we have to compress in the main-loop
+ */
+static int deflate_job_dispatch(server *srv, connection *con, handler_ctx *hctx) {
+	plugin_data *p = hctx->plugin_data;
+	deflate_job *job;
+	size_t i;
+
+	if (p->jobs_in_flight >= p->config_storage[0]->max_queue_length) {
+		/* backpressure: the workers are saturated */
+		return -1;
+	}
+
+	if (0 != deflate_workers_start(srv, p)) return -1;
+
+	job = deflate_job_init();
+	job->con = con;
+	job->hctx = hctx;
+
+	/* the main-loop may append to the last chunk while the worker reads it */
+	job->views = malloc(hctx->seg_used * sizeof(*job->views));
+	assert(job->views);
+
+	for (i = 0; i < hctx->seg_used; i++) {
+		deflate_segment *seg = &(hctx->seg[i]);
+		chunk *c = seg->c;
+		buffer *view;
+
+		if (c->type != MEM_CHUNK) continue;
+
+		view = buffer_init();
+		buffer_share(view, c->mem, (char *)seg->start - c->mem->ptr, seg->len);
+		job->views[job->views_used++] = view;
+
+		seg->start = (unsigned char *)view->ptr;
+	}
+
+	hctx->job = job;
+	p->jobs_in_flight++;
+
+	g_async_queue_push(p->job_queue, job);
+
+	return 0;
+}
+
+static void deflate_workers_stop(server *srv, plugin_data *p) {
+	size_t i;
+
+	if (!p->threads) return;
+
+	for (i = 0; i < p->threads_used; i++) {
+		g_async_queue_push(p->job_queue, (void *) 1);
+	}
+
+	for (i = 0; i < p->threads_used; i++) {
+		g_thread_join(p->threads[i]);
+	}
+	free(p->threads);
+	p->threads = NULL;
+
+	deflate_jobs_collect(srv, p);
+
+	g_async_queue_unref(p->job_queue);
+	g_async_queue_unref(p->done_queue);
+}
+#endif
+
+/**
+ * end the compression stream and free the handler-ctx
+ */
+static void deflate_handler_ctx_free(server *srv, connection *con, handler_ctx *hctx) {
+	plugin_data *p = hctx->plugin_data;
+	int rc;
+
+	rc = mod_deflate_stream_end(srv, con, hctx);
+	if(rc < 0) {
+		TRACE("error closing compressed stream for '%s', compressing with %d: %d", 
+			SAFE_BUF_STR(con->uri.path_raw), hctx->compression_type, rc);
+	}
+
+	if(hctx->conf.debug && hctx->bytes_in < hctx->out->bytes_in) {
+		TRACE("compressing uri '%s' increased the sent content-size from %jd to %jd",
 			SAFE_BUF_STR(con->uri.path_raw), (intmax_t) hctx->bytes_in, (intmax_t) hctx->out->bytes_in);
 	}
 
@@ -913,39 +1769,54 @@ static int deflate_compress_cleanup(server *srv, connection *con, handler_ctx *h
 		buffer_free(hctx->output);
 	}
 	handler_ctx_free(hctx);
+}
+
+static int deflate_compress_cleanup(server *srv, connection *con, handler_ctx *hctx) {
+	plugin_data *p = hctx->plugin_data;
+
 	con->plugin_ctx[p->id] = NULL;
 
+#ifdef USE_GTHREAD
+	if (hctx->job) {
+		/* don't wait for the worker, the job frees the handler-ctx */
+		deflate_job_orphan(hctx);
+		return 0;
+	}
+#endif
+
+	deflate_handler_ctx_free(srv, con, hctx);
+
 	return 0;
 }
 
 /**
  * compress the in queue and move the content to the out queue
  *
+ * with worker threads the block is compressed in the background and
+ * the connection is woken up through the joblist when it is done
  */
 static handler_t deflate_compress_response(server *srv, connection *con, handler_ctx *hctx, int end) { 
-	plugin_data *p = hctx->plugin_data;
 	chunk *c;
-	size_t chunks_written = 0;
-	int chunk_finished = 0;
-	int rc=-1;
-	int we_want = 0, we_have = 0;
-	int out = 0, max = 0;
+	off_t we_want = 0, we_have = 0;
+	off_t out = 0, max = 0;
+	unsigned char *start;
 	
 	we_have = chunkqueue_length(hctx->in);
-	if (p->conf.debug) {
-		TRACE("compress: in_queue len=%i", we_have);
+	if (hctx->conf.debug) {
+		TRACE("compress: in_queue len=%jd", (intmax_t) we_have);
 	}
 	/* calculate max bytes to compress for this call. */
 	if (!end) {
-		max = p->conf.work_block_size * 1024;
+		max = hctx->conf.work_block_size * 1024;
 		if(max == 0 || max > we_have) max = we_have;
 	} else {
 		max = we_have;
 	}
 
-	/* Compress chunks from in queue into chunks for out queue */
+	hctx->seg_used = 0;
+
+	/* collect the chunks from in queue which make up the next block */
 	for (c = hctx->in->first; c && max > 0; c = c->next) {
-		chunk_finished = 0;
 		we_have = 0;
 		we_want = 0;
 		
@@ -957,11 +1828,7 @@ static handler_t deflate_compress_response(server *srv, connection *con, handler
 			if (we_have == 0) continue;
 			
 			we_want = we_have < max ? we_have : max;
-
-			if (mod_deflate_compress(srv, con, hctx, (unsigned char *)(c->mem->ptr + c->offset), we_want) < 0) {
-				ERROR("%s", "compress failed.");
-				return HANDLER_ERROR;
-			}
+			start = (unsigned char *)(c->mem->ptr + c->offset);
 
 			break;
 		case FILE_CHUNK:
@@ -972,7 +1839,7 @@ static handler_t deflate_compress_response(server *srv, connection *con, handler
 			
 			we_want = we_have < max ? we_have : max;
 			
-			if ((we_want = mod_deflate_file_chunk(srv, con, hctx, c, we_want)) < 0) {
+			if ((we_want = mod_deflate_file_chunk(srv, con, hctx, c, we_want, &start)) < 0) {
 				ERROR("%s", "compress file chunk failed.");
 				return HANDLER_ERROR;
 			}
@@ -984,60 +1851,39 @@ static handler_t deflate_compress_response(server *srv, connection *con, handler
 			return HANDLER_ERROR;
 		}
 
-		hctx->in->bytes_out += we_want;
-		c->offset += we_want;
+		deflate_segment_append(hctx, c, start, we_want);
 		out += we_want;
 		max -= we_want;
 	
-		if (c->type == FILE_CHUNK && 
-		    c->offset == c->file.length &&
-		    c->file.mmap.start != MAP_FAILED) {
-			/* we don't need the mmaping anymore */
-			munmap(c->file.mmap.start, c->file.mmap.length);
-			c->file.mmap.start = MAP_FAILED;
-		}
-
-		if (we_have == we_want) {
-			/* chunk finished */
-			chunk_finished = 1;
-			chunks_written++;
-		}
 		/* make sure we finished compressing the chunk before going to the next chunk */
-		if(!chunk_finished) break;
+		if (we_have != we_want) break;
 	}
 
-	if (p->conf.debug) {
-		TRACE("compressed bytes: %i", out);
-	}
+	/* check if this block finishes the content. */
+	hctx->seg_end = (hctx->in->is_closed && hctx->in->bytes_in == hctx->in->bytes_out + out);
 
-	if (chunks_written > 0) {
-		chunkqueue_remove_finished_chunks(hctx->in);
+	if (hctx->conf.debug) {
+		TRACE("end: %d - %jd - %jd", hctx->in->is_closed, (intmax_t) hctx->in->bytes_in, (intmax_t) hctx->in->bytes_out + out);
 	}
 
-	/* check if we finished compressing all the content. */
-	end = (hctx->in->is_closed && hctx->in->bytes_in == hctx->in->bytes_out);
+#ifdef USE_GTHREAD
+	if (hctx->use_threads && (hctx->seg_used > 0 || hctx->seg_end)) {
+		if (0 == deflate_job_dispatch(srv, con, hctx)) {
+			return HANDLER_GO_ON;
+		}
 
-	if (p->conf.debug) {
-		TRACE("end: %d - %jd - %jd", hctx->in->is_closed, (intmax_t) hctx->in->bytes_in, (intmax_t) hctx->in->bytes_out);
+		if (hctx->conf.debug) {
+			TRACE("deflate workers are busy, compressing %jd bytes in the main-loop", (intmax_t) out);
+		}
 	}
+#endif
 
-	/* flush the output buffer to make room for more data. */
-	rc = mod_deflate_stream_flush(srv, con, hctx, end);
-
-	if (rc < 0) {
-		ERROR("%s", "flush error");
-	}
-	
-	if (end) {
-		hctx->out->is_closed = 1;
-		if(p->conf.debug) {
-			TRACE("finished uri: '%s', query: '%s'", SAFE_BUF_STR(con->uri.path_raw), SAFE_BUF_STR(con->uri.query));
-		}
-	} else if (hctx->in->first) {
-		/* We have more data to compress. */
-		joblist_append(srv, con);
+	if (0 != deflate_compress_segments(srv, con, hctx)) {
+		return HANDLER_ERROR;
 	}
 
+	deflate_compress_done(srv, con, hctx);
+
 	return HANDLER_GO_ON;
 }
 
@@ -1056,6 +1902,8 @@ static int mod_deflate_patch_connection(server *srv, connection *con, plugin_dat
 	PATCH_OPTION(debug);
 	PATCH_OPTION(allowed_encodings);
 	PATCH_OPTION(sync_flush);
+	PATCH_OPTION(brotli_quality);
+	PATCH_OPTION(zstd_level);
 	
 	/* skip the first, the global context */
 	for (i = 1; i < srv->config_context->used; i++) {
@@ -1091,6 +1939,10 @@ static int mod_deflate_patch_connection(server *srv, connection *con, plugin_dat
 				PATCH_OPTION(allowed_encodings);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_DEFLATE_SYNC_FLUSH))) {
 				PATCH_OPTION(sync_flush);
+			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_DEFLATE_BROTLI_QUALITY))) {
+				PATCH_OPTION(brotli_quality);
+			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_DEFLATE_ZSTD_LEVEL))) {
+				PATCH_OPTION(zstd_level);
 			}
 		}
 	}
@@ -1098,6 +1950,43 @@ static int mod_deflate_patch_connection(server *srv, connection *con, plugin_dat
 	return 0;
 }
 
+/**
+ * lower the levels of the patched config by the current auto-tune step
+ */
+static void mod_deflate_auto_tune_apply(plugin_data *p) {
+	plugin_config *s = p->config_storage[0];
+	int level;
+
+	if (p->tune_step == 0) return;
+
+	level = p->conf.compression_level == -1 ? DEFLATE_DEFAULT_LEVEL : p->conf.compression_level;
+	if (level > s->auto_tune_min_level) {
+		level -= p->tune_step;
+		if (level < s->auto_tune_min_level) level = s->auto_tune_min_level;
+		p->conf.compression_level = level;
+	}
+
+	level = p->conf.brotli_quality;
+	if (level > s->auto_tune_min_level) {
+		level -= p->tune_step;
+		if (level < s->auto_tune_min_level) level = s->auto_tune_min_level;
+		p->conf.brotli_quality = level;
+	}
+
+	level = p->conf.zstd_level;
+	if (level > s->auto_tune_min_level) {
+		level -= p->tune_step;
+		if (level < s->auto_tune_min_level) level = s->auto_tune_min_level;
+		p->conf.zstd_level = level;
+	}
+
+	/* small responses don't save much, skip them first */
+	if (s->auto_tune_max_min_compress_size > p->conf.min_compress_size) {
+		p->conf.min_compress_size += (s->auto_tune_max_min_compress_size - p->conf.min_compress_size) *
+			p->tune_step / DEFLATE_AUTO_TUNE_MAX_STEP;
+	}
+}
+
 PHYSICALPATH_FUNC(mod_deflate_handle_response_header) {
 	plugin_data *p = p_d;
 	handler_ctx *hctx;
@@ -1105,6 +1994,8 @@ PHYSICALPATH_FUNC(mod_deflate_handle_response_header) {
 	chunkqueue *in;
 	data_string *ds;
 	int accept_encoding = 0;
+	int qvalues[sizeof(encoding_names) / sizeof(encoding_names[0])];
+	int best_q = 0, best_encoding = 0;
 	char *value;
 	int matched_encodings = 0;
 	const char *compression_name = NULL;
@@ -1128,6 +2019,10 @@ PHYSICALPATH_FUNC(mod_deflate_handle_response_header) {
 
 	mod_deflate_patch_connection(srv, con, p);
 
+	if (p->config_storage[0]->auto_tune) {
+		mod_deflate_auto_tune_apply(p);
+	}
+
 	/* is compression allowed */
 	if(!p->conf.enabled) {
 		if(p->conf.debug) {
@@ -1137,26 +2032,35 @@ PHYSICALPATH_FUNC(mod_deflate_handle_response_header) {
 	}
 
 	/* Check if response has a Content-Encoding. */
-	if (NULL != (ds = (data_string *)array_get_element(con->response.headers, CONST_STR_LEN("Content-Encoding")))) {
+	if (NULL != (ds = (data_string *)http_header_get(con->response.headers, HTTP_HEADER_CONTENT_ENCODING))) {
 		return HANDLER_GO_ON;
 	}
 
 	/* Check Accept-Encoding for supported encoding. */
-	if (NULL == (ds = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("Accept-Encoding")))) {
+	if (NULL == (ds = (data_string *)http_header_get(con->request.headers, HTTP_HEADER_ACCEPT_ENCODING))) {
 		return HANDLER_GO_ON;
 	}
 		
 	/* get client side support encodings */
 	value = ds->value->ptr;
+	http_accept_encoding_get_qvalues(value, encoding_names, qvalues);
+
+	/* q=0 means "not acceptable" */
 #ifdef USE_ZLIB
-	if (NULL != strstr(value, ENCODING_NAME_GZIP)) accept_encoding |= HTTP_ACCEPT_ENCODING_GZIP;
-	if (NULL != strstr(value, ENCODING_NAME_DEFLATE)) accept_encoding |= HTTP_ACCEPT_ENCODING_DEFLATE;
+	if (qvalues[1] > 0) accept_encoding |= HTTP_ACCEPT_ENCODING_GZIP;
+	if (qvalues[2] > 0) accept_encoding |= HTTP_ACCEPT_ENCODING_DEFLATE;
 #endif
-	/* if (NULL != strstr(value, ENCODING_NAME_COMPRESS)) accept_encoding |= HTTP_ACCEPT_ENCODING_COMPRESS; */
+	/* if (qvalues[3] > 0) accept_encoding |= HTTP_ACCEPT_ENCODING_COMPRESS; */
 #ifdef USE_BZ2LIB
-	if (NULL != strstr(value, ENCODING_NAME_BZIP2)) accept_encoding |= HTTP_ACCEPT_ENCODING_BZIP2;
+	if (qvalues[4] > 0) accept_encoding |= HTTP_ACCEPT_ENCODING_BZIP2;
 #endif
-	if (NULL != strstr(value, ENCODING_NAME_IDENTITY)) accept_encoding |= HTTP_ACCEPT_ENCODING_IDENTITY;
+#ifdef USE_BROTLI
+	if (qvalues[5] > 0) accept_encoding |= HTTP_ACCEPT_ENCODING_BROTLI;
+#endif
+#ifdef USE_ZSTD
+	if (qvalues[6] > 0) accept_encoding |= HTTP_ACCEPT_ENCODING_ZSTD;
+#endif
+	if (qvalues[0] > 0) accept_encoding |= HTTP_ACCEPT_ENCODING_IDENTITY;
 		
 	/* find matching encodings */
 	matched_encodings = accept_encoding & p->conf.allowed_encodings;
@@ -1210,7 +2114,7 @@ PHYSICALPATH_FUNC(mod_deflate_handle_response_header) {
 	}
 
 	/* Check mimetype in response header "Content-Type" */
-	if (NULL != (ds = (data_string *)array_get_element(con->response.headers, CONST_STR_LEN("Content-Type")))) {
+	if (NULL != (ds = (data_string *)http_header_get(con->response.headers, HTTP_HEADER_CONTENT_TYPE))) {
 		int found = 0;
 		if(p->conf.debug) {
 			TRACE("Content-Type: %s", SAFE_BUF_STR(ds->value));
@@ -1245,7 +2149,7 @@ PHYSICALPATH_FUNC(mod_deflate_handle_response_header) {
 	}
 	
 	/* the response might change according to Accept-Encoding */
-	if (NULL != (ds = (data_string *)array_get_element(con->response.headers, CONST_STR_LEN("Vary")))) {
+	if (NULL != (ds = (data_string *)http_header_get(con->response.headers, HTTP_HEADER_VARY))) {
 		/* append Accept-Encoding to Vary header */
 		if (NULL == strstr(ds->value->ptr, "Accept-Encoding")) {
 			buffer_append_string_len(ds->value, CONST_STR_LEN(",Accept-Encoding"));
@@ -1267,11 +2171,61 @@ PHYSICALPATH_FUNC(mod_deflate_handle_response_header) {
 	hctx->fl = fl;
 	hctx->in = fl->prev->cq;
 	hctx->out = fl->cq;
+	hctx->conf = p->conf;
+
+#ifdef USE_GTHREAD
+	if (p->config_storage[0]->threads > 0 &&
+	    !(in->is_closed && file_len < DEFLATE_INLINE_COMPRESS_SIZE)) {
+		hctx->use_threads = 1;
+
+		if (p->jobs_in_flight >= p->config_storage[0]->max_queue_length) {
+			/* the workers are saturated, don't start another expensive stream */
+			matched_encodings &= ~HTTP_ACCEPT_ENCODING_BZIP2;
+			hctx->conf.compression_level = 1;
+			hctx->conf.brotli_quality = 1;
+			hctx->conf.zstd_level = 1;
+
+			if (p->conf.debug) {
+				TRACE("deflate workers are busy (%d jobs), using compression-level 1 for '%s'",
+						p->jobs_in_flight, SAFE_BUF_STR(con->uri.path));
+			}
+		}
+	}
+#endif
     
 	rc = -1;
 
-	/* select best matching encoding */
-	if (matched_encodings & HTTP_ACCEPT_ENCODING_BZIP2) {
+	/* select the encoding with the highest qvalue, ties are broken by our preference */
+	for (m = 0; encoding_preference[m]; m++) {
+		int enc = encoding_preference[m];
+		int bit;
+
+		if (!(matched_encodings & enc)) continue;
+
+		for (bit = 0; !(enc & BV(bit)); bit++);
+
+		if (qvalues[bit] > best_q) {
+			best_q = qvalues[bit];
+			best_encoding = enc;
+		}
+	}
+	if (best_encoding) {
+		matched_encodings &= (best_encoding | HTTP_ACCEPT_ENCODING_IDENTITY);
+	}
+
+	if (matched_encodings & HTTP_ACCEPT_ENCODING_BROTLI) {
+#ifdef USE_BROTLI
+		hctx->compression_type = HTTP_ACCEPT_ENCODING_BROTLI;
+		compression_name = ENCODING_NAME_BROTLI;
+		rc = stream_brotli_init(srv, con, hctx);
+#endif
+	} else if (matched_encodings & HTTP_ACCEPT_ENCODING_ZSTD) {
+#ifdef USE_ZSTD
+		hctx->compression_type = HTTP_ACCEPT_ENCODING_ZSTD;
+		compression_name = ENCODING_NAME_ZSTD;
+		rc = stream_zstd_init(srv, con, hctx);
+#endif
+	} else if (matched_encodings & HTTP_ACCEPT_ENCODING_BZIP2) {
 #ifdef USE_BZ2LIB
 		hctx->compression_type = HTTP_ACCEPT_ENCODING_BZIP2;
 		compression_name = ENCODING_NAME_BZIP2;
@@ -1313,13 +2267,13 @@ PHYSICALPATH_FUNC(mod_deflate_handle_response_header) {
 				compression_name);
 	}
 
-	/* setup output buffer. */
-	if(p->conf.sync_flush || p->conf.output_buffer_size == 0) {
+	/* setup output buffer, the shared one can't be used by the workers */
+	if(!hctx->use_threads && (p->conf.sync_flush || p->conf.output_buffer_size == 0)) {
 		buffer_prepare_copy(p->tmp_buf, 32 * 1024);
 		hctx->output = p->tmp_buf;
 	} else {
 		hctx->output = buffer_init();
-		buffer_prepare_copy(hctx->output, p->conf.output_buffer_size);
+		buffer_prepare_copy(hctx->output, p->conf.output_buffer_size ? p->conf.output_buffer_size : 32 * 1024);
 	}
 	con->plugin_ctx[p->id] = hctx;
 
@@ -1357,7 +2311,23 @@ CONNECTION_FUNC(mod_deflate_handle_filter_response_content) {
 	handler_ctx *hctx = con->plugin_ctx[p->id];
 	handler_t ret;
 
+#ifdef USE_GTHREAD
+	/* we might finish the blocks of other connections too, they are in the joblist already */
+	deflate_jobs_collect(srv, p);
+#endif
+
 	if (hctx == NULL) return HANDLER_GO_ON;
+
+	/* the worker wakes us up when it is done with the block */
+	if (hctx->job) return HANDLER_GO_ON;
+	if (hctx->job_failed) return HANDLER_ERROR;
+
+	if (hctx->out->is_closed) {
+		/* the last block was compressed by a worker */
+		deflate_compress_cleanup(srv, con, hctx);
+		return HANDLER_GO_ON;
+	}
+
 	if (!hctx->stream_open) return HANDLER_GO_ON;
 
 	/**
@@ -1374,6 +2344,88 @@ CONNECTION_FUNC(mod_deflate_handle_filter_response_content) {
 	return ret;
 }
 
+/**
+ * sample the load and move the auto-tune step
+ *
+ * the load is the time the main-loop spent outside of fdevent_poll() relative
+ * to the wall-clock time. With deflate.threads the compression time of the
+ * workers counts too if they are busier than the main-loop.
+ */
+static void mod_deflate_auto_tune(server *srv, plugin_data *p) {
+	plugin_config *s = p->config_storage[0];
+	struct timeval tv;
+	uint64_t wall_usec, busy_usec;
+	int load;
+	int level;
+
+	gettimeofday(&tv, NULL);
+
+	wall_usec = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+	busy_usec = srv->loop_busy_usec;
+
+	if (p->tune_wall_usec && wall_usec > p->tune_wall_usec) {
+		load = (busy_usec - p->tune_busy_usec) * 100 / (wall_usec - p->tune_wall_usec);
+
+		if (s->threads) {
+			int workers = p->stat_cpu_usec * 100 / (wall_usec - p->tune_wall_usec) / s->threads;
+
+			if (workers > load) load = workers;
+		}
+		if (load > 100) load = 100;
+
+		COUNTER_SET(p->cnt_cpu_load, load);
+
+		if (s->auto_tune) {
+			if (load > s->auto_tune_cpu_high && p->tune_step < DEFLATE_AUTO_TUNE_MAX_STEP) {
+				p->tune_step++;
+			} else if (load < s->auto_tune_cpu_low && p->tune_step > 0) {
+				p->tune_step--;
+			}
+		}
+	}
+
+	p->tune_wall_usec = wall_usec;
+	p->tune_busy_usec = busy_usec;
+
+	/* the values of the global context */
+	level = s->compression_level == -1 ? DEFLATE_DEFAULT_LEVEL : s->compression_level;
+	if (p->tune_step && level > s->auto_tune_min_level) {
+		level -= p->tune_step;
+		if (level < s->auto_tune_min_level) level = s->auto_tune_min_level;
+	}
+	COUNTER_SET(p->cnt_level, level);
+
+	if (p->tune_step && s->auto_tune_max_min_compress_size > s->min_compress_size) {
+		COUNTER_SET(p->cnt_min_size, s->min_compress_size +
+			(s->auto_tune_max_min_compress_size - s->min_compress_size) * p->tune_step / DEFLATE_AUTO_TUNE_MAX_STEP);
+	} else {
+		COUNTER_SET(p->cnt_min_size, s->min_compress_size);
+	}
+
+	/* keep the last value if nothing was compressed */
+	if (p->stat_cpu_usec >= 1000) {
+		int64_t saved = (int64_t)p->stat_bytes_in - (int64_t)p->stat_bytes_out;
+
+		COUNTER_SET(p->cnt_saved_per_cpu_ms, saved * 1000 / (int64_t)p->stat_cpu_usec);
+	}
+	p->stat_bytes_in = 0;
+	p->stat_bytes_out = 0;
+	p->stat_cpu_usec = 0;
+}
+
+TRIGGER_FUNC(mod_deflate_trigger) {
+	plugin_data *p = p_d;
+
+#ifdef USE_GTHREAD
+	/* free the jobs of connections which went away */
+	deflate_jobs_collect(srv, p);
+#endif
+
+	mod_deflate_auto_tune(srv, p);
+
+	return HANDLER_GO_ON;
+}
+
 static handler_t mod_deflate_cleanup(server *srv, connection *con, void *p_d) {
 	plugin_data *p = p_d;
 	handler_ctx *hctx = con->plugin_ctx[p->id];
@@ -1401,6 +2453,7 @@ LI_EXPORT int mod_deflate_plugin_init(plugin *p) {
 	p->handle_connection_close	= mod_deflate_cleanup;
 	p->handle_response_header	= mod_deflate_handle_response_header;
 	p->handle_filter_response_content	= mod_deflate_handle_filter_response_content;
+	p->handle_trigger	= mod_deflate_trigger;
 	
 	p->data        = NULL;
 	
@@ -34,6 +34,7 @@
 
 #include "sys-files.h"
 #include "sys-strings.h"
+#include "http_header.h"
 
 /* plugin config for all request/connections */
 
@@ -608,7 +609,6 @@ static int http_list_directory(server *srv, connection *con, plugin_data *p, buf
 	dirls_entry_t *tmp;
 	char sizebuf[sizeof("999.9K")];
 	char datebuf[sizeof("2005-Jan-01 22:23:24")];
-	size_t k;
 	const char *content_type;
 	long name_max;
 
@@ -808,23 +808,9 @@ static int http_list_directory(server *srv, connection *con, plugin_data *p, buf
 #endif
 
 		if (content_type == NULL) {
-			content_type = "application/octet-stream";
-			for (k = 0; k < con->conf.mimetypes->used; k++) {
-				data_string *ds = (data_string *)con->conf.mimetypes->data[k];
-				size_t ct_len;
+			data_string *ds = mimetype_table_get(con->conf.mimetype_table, DIRLIST_ENT_NAME(tmp), tmp->namelen);
 
-				if (ds->key->used == 0)
-					continue;
-
-				ct_len = ds->key->used - 1;
-				if (tmp->namelen < ct_len)
-					continue;
-
-				if (0 == strncasecmp(DIRLIST_ENT_NAME(tmp) + tmp->namelen - ct_len, ds->key->ptr, ct_len)) {
-					content_type = ds->value->ptr;
-					break;
-				}
-			}
+			content_type = ds ? ds->value->ptr : "application/octet-stream";
 		}
 
 #ifdef HAVE_LOCALTIME_R
@@ -917,7 +903,7 @@ URIHANDLER_FUNC(mod_dirlisting_subrequest) {
 	response_header_overwrite(srv, con, CONST_STR_LEN("ETag"), CONST_BUF_LEN(con->physical.etag));
 
 	/* prepare header */
-	if (NULL == (ds = (data_string *)array_get_element(con->response.headers, CONST_STR_LEN("Last-Modified")))) {
+	if (NULL == (ds = (data_string *)http_header_get(con->response.headers, HTTP_HEADER_LAST_MODIFIED))) {
 		mtime = strftime_cache_get(srv, sce->st.st_mtime);
 		response_header_overwrite(srv, con, CONST_STR_LEN("Last-Modified"), CONST_BUF_LEN(mtime));
 	} else {
@@ -20,6 +20,7 @@
 #include "status_counter.h"
 #include "etag.h"
 #include "configfile.h"
+#include "connections.h"
 
 #ifdef HAVE_LUA_H
 #include <lua.h>
@@ -219,6 +220,7 @@ static int magnet_stat(lua_State *L) {
 
 	sb.ptr = (char *)s;
 	sb.used = sb.size = strlen(s) + 1;
+	sb.block = NULL;
 	
 	if (HANDLER_GO_ON != stat_cache_get_entry(srv, con, &sb, &sce)) {
 		lua_pushnil(L);
@@ -449,7 +451,7 @@ static buffer *magnet_env_get_buffer(server *srv, connection *con, const char *k
 		break;
 	case MAGNET_ENV_REQUEST_URI:      dest = con->request.uri; break;
 	case MAGNET_ENV_REQUEST_ORIG_URI: dest = con->request.orig_uri; break;
-	case MAGNET_ENV_REQUEST_REMOTE_IP: dest = con->dst_addr_buf; break;
+	case MAGNET_ENV_REQUEST_REMOTE_IP: dest = connection_get_dst_addr_buf(srv, con); break;
 	case MAGNET_ENV_REQUEST_PROTOCOL:
 		buffer_copy_string(srv->tmp_buf, get_http_version_name(con->request.http_version));
 		dest = srv->tmp_buf;
@@ -18,6 +18,7 @@
 #include "response.h"
 #include "status_counter.h"
 #include "splaytree.h"
+#include "http_header.h"
 
 #define CONFIG_MEM_CACHE_ENABLE "mem-cache.enable"
 #define CONFIG_MEM_CACHE_MAX_MEMORY "mem-cache.max-memory"
@@ -107,7 +108,7 @@ static struct cache_entry *cache_entry_init(void) {
 static void cache_entry_free(struct cache_entry *cache) {
 	if (cache == NULL) return;
 	cachenumber --;
-	if (cache->content) usedmemory -= cache->content->size;
+	if (cache->content) usedmemory -= buffer_memory(cache->content);
 	buffer_free(cache->content);
 	buffer_free(cache->content_type);
 	buffer_free(cache->etag);
@@ -500,7 +501,7 @@ handler_t mod_mem_cache_subrequest(server *srv, connection *con, void *p_d) {
 	int i = 0, success = 0;
 	size_t m;
 	stat_cache_entry *sce = NULL;
-	buffer *mtime, *b;
+	buffer *mtime;
 	data_string *ds;
 	struct cache_entry *cache;
 	
@@ -523,9 +524,6 @@ handler_t mod_mem_cache_subrequest(server *srv, connection *con, void *p_d) {
 		return HANDLER_GO_ON;
 	}
 	
-	if (con->conf.range_requests && NULL != array_get_element(con->request.headers, CONST_STR_LEN("Range")))
-		return HANDLER_GO_ON;
-
 	mod_mem_cache_patch_connection(srv, con, p);
 	
 	if (p->conf.enable == 0|| p->conf.maxfilesize == 0) return HANDLER_GO_ON;
@@ -580,10 +578,12 @@ handler_t mod_mem_cache_subrequest(server *srv, connection *con, void *p_d) {
 		if (cache->inuse == 0 || buffer_is_equal(con->physical.etag, cache->etag) == 0) {
 			/* initialze cache's buffer if needed */
 			cache_entry_reset(cache);
-			if (cache->content->size <= sce->st.st_size) {
-				usedmemory -= cache->content->size;
+			/* responses still in flight keep the old content alive, the
+			 * refresh gets a fresh allocation */
+			if (buffer_is_shared(cache->content) || cache->content->size <= sce->st.st_size) {
+				usedmemory -= buffer_memory(cache->content);
 				buffer_prepare_copy(cache->content, sce->st.st_size);
-				usedmemory += cache->content->size;
+				usedmemory += buffer_memory(cache->content);
 			}
 			if (readfile_into_buffer(srv, con, sce->st.st_size, cache->content)) {
 				return HANDLER_GO_ON;
@@ -622,16 +622,20 @@ handler_t mod_mem_cache_subrequest(server *srv, connection *con, void *p_d) {
 #endif
 	}
 
-	if (NULL == array_get_element(con->response.headers, CONST_STR_LEN("Content-Type"))) {
+	if (NULL == http_header_get(con->response.headers, HTTP_HEADER_CONTENT_TYPE)) {
 		response_header_overwrite(srv, con, CONST_STR_LEN("Content-Type"), CONST_BUF_LEN(cache->content_type));
 	}
 	
-	if (NULL == array_get_element(con->response.headers, CONST_STR_LEN("ETag"))) {
+	if (NULL == http_header_get(con->response.headers, HTTP_HEADER_ETAG)) {
 	       	response_header_overwrite(srv, con, CONST_STR_LEN("ETag"), CONST_BUF_LEN(cache->etag));
 	}
 
+	if (con->conf.range_requests) {
+		response_header_overwrite(srv, con, CONST_STR_LEN("Accept-Ranges"), CONST_STR_LEN("bytes"));
+	}
+
 	/* prepare header */
-	if (NULL == (ds = (data_string *)array_get_element(con->response.headers, CONST_STR_LEN("Last-Modified")))) {
+	if (NULL == (ds = (data_string *)http_header_get(con->response.headers, HTTP_HEADER_LAST_MODIFIED))) {
 		mtime = cache->mtime;
 		response_header_overwrite(srv, con, CONST_STR_LEN("Last-Modified"), CONST_BUF_LEN(mtime));
 	} else mtime = ds->value;
@@ -640,8 +644,16 @@ handler_t mod_mem_cache_subrequest(server *srv, connection *con, void *p_d) {
 	if (HANDLER_FINISHED == http_response_handle_cachable(srv, con, mtime, cache->etag))
 		return HANDLER_FINISHED;
 
-	b = chunkqueue_get_append_buffer(con->send);
-	buffer_append_string_buffer(b, cache->content);
+	if (con->conf.range_requests &&
+	    NULL != http_header_get(con->request.headers, HTTP_HEADER_RANGE) &&
+	    (NULL == (ds = (data_string *)http_header_get(con->request.headers, HTTP_HEADER_IF_RANGE)) ||
+	     buffer_is_equal(ds->value, cache->etag)) &&
+	    (0 == http_response_range(srv, con, NULL, cache->content, cache->content->used - 1) ||
+	     con->http_status == 416)) {
+		/* the parts are copied from the cache */
+	} else {
+		chunkqueue_append_shared_buffer(con->send, cache->content, 0, cache->content->used - 1);
+	}
 	buffer_reset(con->physical.path);
 	update_lru(srv, i);
 	if ((usedmemory >> 20) > p->conf.maxmemory) {
@@ -12,6 +12,7 @@
 #include "array.h"
 #include "keyvalue.h"
 #include "ajp13.h"
+#include "http_header.h"
 
 #define CORE_PLUGIN "mod_proxy_core"
 
@@ -364,6 +365,7 @@ static int ajp13_decode_response_headers(http_resp *resp, ajp13_state_data *data
 
 			buffer_copy_string_len(HDR->key, key->ptr, key_len);
 			buffer_copy_string_len(HDR->value, value->ptr, value_len);
+			HDR->header_id = http_header_lookup(key->ptr, key_len);
 
 			array_insert_unique(resp->headers, (data_unset *)HDR);
 #ifdef AJP13_DEBUG
@@ -5,8 +5,10 @@
 #include "mod_proxy_core_protocol.h"
 #include "configfile.h"
 #include "buffer.h"
+#include "http_chunk.h"
 #include "log.h"
 #include "sys-strings.h"
+#include "http_header.h"
 
 #define CORE_PLUGIN "mod_proxy_core"
 
@@ -16,44 +18,27 @@ typedef struct {
 	proxy_protocol *protocol;
 } protocol_plugin_data;
 
-typedef enum {
-	HTTP_CHUNK_LEN,
-	HTTP_CHUNK_EXTENSION,
-	HTTP_CHUNK_DATA,
-	HTTP_CHUNK_END
-} http_chunk_state_t;
-
 /**
  * The protocol will use this struct for storing state variables
  * used in decoding the stream
  */
 typedef struct {
-	http_chunk_state_t chunk_parse_state;
-	off_t chunk_len;
-	off_t chunk_offset;
-	buffer *buf;
+	http_chunk_decoder chunked;
 } protocol_state_data;
 
 static protocol_state_data *protocol_state_data_init(void) {
 	protocol_state_data *data;
 
 	data = calloc(1, sizeof(*data));
-	data->chunk_parse_state = HTTP_CHUNK_LEN;
-	data->buf = buffer_init();
+	http_chunk_decoder_reset(&(data->chunked));
 
 	return data;
 }
 
 static void protocol_state_data_free(protocol_state_data *data) {
-	buffer_free(data->buf);
 	free(data);
 }
 
-static void protocol_state_data_reset(protocol_state_data *data) {
-	buffer_reset(data->buf);
-	data->chunk_parse_state = HTTP_CHUNK_LEN;
-}
-
 PROXY_CONNECTION_FUNC(proxy_http_init) {
 
 	UNUSED(srv);
@@ -98,11 +83,23 @@ static handler_t proxy_http_parse_response_headers(proxy_session *sess, chunkque
 		break;
 	}
 	/* check for Transfer-Encoding header. */
-	if (NULL != (ds = (data_string *)array_get_element(sess->resp->headers, CONST_STR_LEN("Transfer-Encoding")))) {
+	if (NULL != (ds = (data_string *)http_header_get(sess->resp->headers, HTTP_HEADER_TRANSFER_ENCODING))) {
 		if (strstr(ds->value->ptr, "chunked")) {
 			sess->is_chunked = 1;
 		}
 	}
+	if (sess->is_chunked) {
+		protocol_state_data *data = (protocol_state_data *)sess->proxy_con->protocol_data;
+		connection *con = sess->remote_con;
+
+		http_chunk_decoder_reset(&(data->chunked));
+
+		/* mod_chunked might send the content on as we get it */
+		if (con->request.http_version == HTTP_VERSION_1_1 &&
+		    con->request.http_method != HTTP_METHOD_HEAD) {
+			con->response.chunked_passthrough = HTTP_CHUNKED_PASSTHROUGH_OFFERED;
+		}
+	}
 	/* finished parsing response headers. */
 	sess->have_response_headers = 1;
 
@@ -116,116 +113,32 @@ static handler_t proxy_http_parse_response_headers(proxy_session *sess, chunkque
 
 static handler_t proxy_http_parse_chunked_stream(server *srv, proxy_session *sess, chunkqueue *in, chunkqueue *out) {
 	protocol_state_data *data = (protocol_state_data *)sess->proxy_con->protocol_data;
-	char *err = NULL;
-	off_t we_have = 0, we_want = 0;
-	off_t chunk_len = 0;
-	off_t offset = 0;
-	buffer *b;
-	chunk *c;
-	char ch = '\0';
-	int finished = 0;
+	connection *con = sess->remote_con;
 
 	UNUSED(srv);
 
-	for (c = in->first; c && !finished;) {
-		if(c->mem->used == 0) {
-			c = c->next;
-			continue;
-		}
-		switch(data->chunk_parse_state) {
-		case HTTP_CHUNK_LEN:
-			/* parse chunk len. */
-			for(offset = c->offset; (size_t)(offset) < (c->mem->used - 1) ; offset++) {
-				ch = c->mem->ptr[offset];
-				if(!light_isxdigit(ch)) break;
-			}
-			if(offset > c->offset) {
-				buffer_append_string_len(data->buf, (c->mem->ptr + c->offset), offset - c->offset);
-				in->bytes_out += (offset - c->offset);
-				c->offset = offset;
-			}
-			if ( (size_t)offset == c->mem->used - 1) {
-				break; /* get next chunk from queue */
-			}
-			/* now ch is the last character, and it wasn't an xdigit */
-			if (!(ch == ' ' || ch == '\r' || ch == ';')) {
-				/* protocol error.  bad http-chunk len */
-				return HANDLER_ERROR;
-			}
-			data->chunk_len = strtol(BUF_STR(data->buf), &err, 16);
-			data->chunk_offset = 0;
-			buffer_reset(data->buf);
-			data->chunk_parse_state = HTTP_CHUNK_EXTENSION;
-		case HTTP_CHUNK_EXTENSION:
-			/* find CRLF.  discard chunk-extension */
-			for(ch = 0; (size_t)(c->offset) < (c->mem->used - 1) && ch != '\n' ;) {
-				ch = c->mem->ptr[c->offset];
-				c->offset++;
-				in->bytes_out++;
-			}
-			if(ch != '\n') {
-				/* get next chunk from queue */
-				break;
-			}
-			if(data->chunk_len > 0) {
-				data->chunk_parse_state = HTTP_CHUNK_DATA;
-			} else {
-				data->chunk_parse_state = HTTP_CHUNK_END;
-			}
-		case HTTP_CHUNK_DATA:
-			chunk_len = data->chunk_len - data->chunk_offset;
-			/* copy chunk_len bytes from in queue to out queue. */
-			we_have = c->mem->used - c->offset - 1;
-			we_want = chunk_len > we_have ? we_have : chunk_len;
-
-			if (c->offset == 0 && we_want == we_have) {
-				/* we are copying the whole buffer, just steal it */
-				chunkqueue_steal_chunk(out, c);
-				/* c is an empty chunk now */
-			} else {
-				b = chunkqueue_get_append_buffer(out);
-				buffer_copy_string_len(b, c->mem->ptr + c->offset, we_want);
-				c->offset += we_want;
-			}
-
-			chunk_len -= we_want;
-			out->bytes_in += we_want;
-			in->bytes_out += we_want;
-			data->chunk_offset += we_want;
-			if(chunk_len > 0) {
-				/* get next chunk from queue */
-				break;
-			}
-			data->chunk_offset = 0;
-			data->chunk_parse_state = HTTP_CHUNK_END;
-		case HTTP_CHUNK_END:
-			/* discard CRLF.*/
-			for(ch = 0; c->mem->used > 0 && (size_t)(c->offset) < (c->mem->used - 1) && ch != '\n' ;) {
-				ch = c->mem->ptr[c->offset];
-				c->offset++;
-				in->bytes_out++;
-			}
-			if(ch != '\n') {
-				/* get next chunk from queue */
-				break;
-			}
-			/* final chunk */
-			if(data->chunk_len == 0) {
-				finished = 1;
-			}
-			/* finished http-chunk.  reset and parse next chunk. */
-			protocol_state_data_reset(data);
-			break;
-		}
-		if((size_t)(c->offset) == c->mem->used - 1) {
-			c = c->next;
-		}
+	/* leave the content alone until the response headers are handled,
+	 * mod_chunked decides then if it is passed through or decoded */
+	if (con->response.chunked_passthrough == HTTP_CHUNKED_PASSTHROUGH_OFFERED &&
+	    con->state < CON_STATE_WRITE_RESPONSE_HEADER) {
+		return HANDLER_GO_ON;
 	}
-	chunkqueue_remove_finished_chunks(in);
-	if (finished) {
+
+	switch (http_chunk_decode(&(data->chunked), in, out,
+				  con->response.chunked_passthrough == HTTP_CHUNKED_PASSTHROUGH_ACTIVE)) {
+	case -1:
+		/* protocol error.  bad http-chunk */
+		return HANDLER_ERROR;
+	case 1:
+		chunkqueue_remove_finished_chunks(in);
 		sess->is_request_finished = 1;
 		return HANDLER_FINISHED;
+	default:
+		break;
 	}
+
+	chunkqueue_remove_finished_chunks(in);
+
 	/* ran out of data. */
 	return HANDLER_GO_ON;
 }
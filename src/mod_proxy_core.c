@@ -23,9 +23,11 @@
 #include "array.h"
 #include "log.h"
 #include "status_counter.h"
+#include "response.h"
 
 #include "mod_proxy_core.h"
 #include "mod_proxy_core_protocol.h"
+#include "http_header.h"
 
 #define PROXY_CORE "proxy-core"
 #define CONFIG_PROXY_CORE_BALANCER         PROXY_CORE ".balancer"
@@ -642,22 +644,20 @@ static handler_t proxy_handle_response_headers(server *srv, connection *con, plu
 
 	/* copy the http-headers */
 	for (i = 0; i < sess->resp->headers->used; i++) {
-		const char *ign[] = { "Status", NULL };
-		size_t j, k;
+		size_t k;
 		data_string *ds;
 
 		data_string *header = (data_string *)sess->resp->headers->data[i];
 
-		/* some headers are ignored by default */
-		for (j = 0; ign[j]; j++) {
-			if (0 == strcasecmp(ign[j], header->key->ptr)) break;
-		}
-		if (ign[j]) continue;
-
-		if (0 == buffer_caseless_compare(CONST_BUF_LEN(header->key), CONST_STR_LEN("Location"))) {
+		switch (http_header_id(header)) {
+		case HTTP_HEADER_STATUS:
+			/* some headers are ignored by default */
+			continue;
+		case HTTP_HEADER_LOCATION:
 			/* CGI/1.1 rev 03 - 7.2.1.2 */
 			if (con->http_status == 0) con->http_status = 302;
-		} else if (0 == buffer_caseless_compare(CONST_BUF_LEN(header->key), CONST_STR_LEN("Content-Length"))) {
+			break;
+		case HTTP_HEADER_CONTENT_LENGTH:
 			have_content_length = 1;
 
 			sess->content_length = strtol(header->value->ptr, NULL, 10);
@@ -668,8 +668,8 @@ static handler_t proxy_handle_response_headers(server *srv, connection *con, plu
 			con->response.content_length = sess->content_length;
 			/* don't save this header, other modules might change the content length. */
 			continue;
-		} else if (0 == buffer_caseless_compare(CONST_BUF_LEN(header->key), CONST_STR_LEN("X-Sendfile")) ||
-			   0 == buffer_caseless_compare(CONST_BUF_LEN(header->key), CONST_STR_LEN("X-LIGHTTPD-send-file"))) {
+		case HTTP_HEADER_X_SENDFILE:
+		case HTTP_HEADER_X_LIGHTTPD_SEND_FILE:
 			if (p->conf.allow_x_sendfile) {
 				sess->send_response_content = 0;
 				sess->do_internal_redirect = 1;
@@ -684,7 +684,7 @@ static handler_t proxy_handle_response_headers(server *srv, connection *con, plu
 			}
 
 			continue;
-		} else if (0 == buffer_caseless_compare(CONST_BUF_LEN(header->key), CONST_STR_LEN("X-LIGHTTPD-send-tempfile"))) {
+		case HTTP_HEADER_X_LIGHTTPD_SEND_TEMPFILE:
 			if (p->conf.allow_x_sendfile && !buffer_is_empty(header->value)) {
 				stat_cache_entry *sce = NULL;
 
@@ -692,17 +692,36 @@ static handler_t proxy_handle_response_headers(server *srv, connection *con, plu
 					chunk *c;
 					sess->send_response_content = 0;
 
-					if(sce->st.st_size > 0) {
+					if (sce->st.st_size > 0 && con->http_status == 200 &&
+					    con->conf.range_requests &&
+					    NULL != http_header_get(con->request.headers, HTTP_HEADER_RANGE) &&
+					    NULL == http_header_get(con->request.headers, HTTP_HEADER_IF_RANGE) &&
+					    0 == http_response_range(srv, con, header->value, NULL, sce->st.st_size)) {
+						/* the last part removes the tempfile once it is sent */
+						chunk *last_file = NULL;
+
+						for (c = con->send->first; c; c = c->next) {
+							if (c->type == FILE_CHUNK) last_file = c;
+						}
+						if (last_file) last_file->file.is_temp = 1;
+					} else if (con->http_status == 416) {
+						/* none of the ranges is satisfiable */
+						if(unlink(BUF_STR(header->value)) < 0) {
+							ERROR("Failed to delete tempfile: file=%s, error: %s", SAFE_BUF_STR(header->value), strerror(errno));
+						}
+						con->response.content_length = 0;
+					} else if(sce->st.st_size > 0) {
 						chunkqueue_append_file(con->send, header->value, 0, sce->st.st_size);
 						con->send->bytes_in += sce->st.st_size;
 						c = con->send->last;
 						c->file.is_temp = 1;
+						con->response.content_length = sce->st.st_size;
 					} else {
 						if(unlink(BUF_STR(header->value)) < 0) {
 							ERROR("Failed to delete empty tempfile: file=%s, error: %s", SAFE_BUF_STR(header->value), strerror(errno));
 						}
+						con->response.content_length = 0;
 					}
-					con->response.content_length = sce->st.st_size;
 					have_content_length = 1;
 					con->send->is_closed = 1;
 				} else {
@@ -711,19 +730,19 @@ static handler_t proxy_handle_response_headers(server *srv, connection *con, plu
 			}
 
 			continue;
-		} else if (0 == buffer_caseless_compare(CONST_BUF_LEN(header->key), CONST_STR_LEN("X-Rewrite-URI"))) {
+		case HTTP_HEADER_X_REWRITE_URI:
 			if (p->conf.allow_x_rewrite) {
 				do_x_rewrite = 1;
 				buffer_copy_string_buffer(con->request.uri, header->value);
 			}
 
 			continue;
-		} else if (0 == buffer_caseless_compare(CONST_BUF_LEN(header->key), CONST_STR_LEN("X-Rewrite-Host"))) {
+		case HTTP_HEADER_X_REWRITE_HOST:
 			if (p->conf.allow_x_rewrite) {
 				do_x_rewrite = 1;
 				buffer_copy_string_buffer(con->request.http_host, header->value);
 				/* replace Host request header */
-				if (NULL != (ds = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("Host")))) {
+				if (NULL != (ds = (data_string *)http_header_get(con->request.headers, HTTP_HEADER_HOST))) {
 					buffer_copy_string_buffer(ds->value, header->value);
 				} else {
 					/* insert Host request header */
@@ -732,12 +751,13 @@ static handler_t proxy_handle_response_headers(server *srv, connection *con, plu
 					}
 					buffer_copy_string_len(ds->key, CONST_STR_LEN("Host"));
 					buffer_copy_string_buffer(ds->value, header->value);
+					ds->header_id = HTTP_HEADER_HOST;
 					array_insert_unique(con->request.headers, (data_unset *)ds);
 				}
 			}
 
 			continue;
-		} else if (0 == buffer_caseless_compare(CONST_BUF_LEN(header->key), CONST_STR_LEN("X-Rewrite-Backend"))) {
+		case HTTP_HEADER_X_REWRITE_BACKEND:
 			if (p->conf.allow_x_rewrite) {
 				do_x_rewrite = 1;
 				if (!sess->sticky_session) sess->sticky_session = buffer_init();
@@ -746,19 +766,20 @@ static handler_t proxy_handle_response_headers(server *srv, connection *con, plu
 			}
 
 			continue;
-		} else if (0 == buffer_caseless_compare(CONST_BUF_LEN(header->key), CONST_STR_LEN("Transfer-Encoding"))) {
+		case HTTP_HEADER_TRANSFER_ENCODING:
 			if (strstr(header->value->ptr, "chunked")) {
 				sess->is_chunked = 1;
 			}
 			/* ignore the header */
 			continue;
-		} else if (0 == buffer_caseless_compare(CONST_BUF_LEN(header->key), CONST_STR_LEN("Connection"))) {
+		case HTTP_HEADER_CONNECTION:
 			if (strstr(header->value->ptr, "close")) {
 				sess->is_closing = 1;
 			}
 			/* ignore the header */
 			continue;
-
+		default:
+			break;
 		}
 
 		if (NULL == (ds = (data_string *)array_get_unused_element(con->response.headers, TYPE_STRING))) {
@@ -767,6 +788,7 @@ static handler_t proxy_handle_response_headers(server *srv, connection *con, plu
 
 
 		buffer_copy_string_buffer(ds->key, header->key);
+		ds->header_id = header->header_id;
 
 #ifdef HAVE_PCRE_H
 		for (k = 0; k < p->conf.response_rewrites->used; k++) {
@@ -807,7 +829,6 @@ static handler_t proxy_handle_response_headers(server *srv, connection *con, plu
 		sess->send_response_content = 0;
 		sess->do_internal_redirect = 1;
 		sess->do_new_session = 1;
-		sess->is_chunked = 0;
 		con->http_status = 0;
 		sess->content_length = -1;
 		con->response.content_length = -1;
@@ -820,6 +841,11 @@ static handler_t proxy_handle_response_headers(server *srv, connection *con, plu
 		config_cond_cache_reset(srv, con);
 	}
 
+	/* the content of the backend isn't sent, the chunks of it can't be either */
+	if (!sess->send_response_content) {
+		con->response.chunked_passthrough = HTTP_CHUNKED_PASSTHROUGH_NONE;
+	}
+
 	/* we are finished decoding the response headers. */
 	if(!out->is_closed) {
 		/* We don't have all the response content try to enable chunked encoding. */
@@ -846,6 +872,33 @@ static int proxy_connection_enable_events(server *srv, proxy_connection *proxy_c
 	return fdevent_event_add(srv->ev, proxy_con->sock, events);
 }
 
+/**
+ * throw away the request content the backend didn't take
+ */
+static void proxy_discard_request_content(connection *con) {
+	chunk *c;
+
+	if (con->recv->bytes_out < con->recv->bytes_in) {
+		/* we have to consume all the request content data. */
+		for (c = con->recv->first; c; c = c->next) {
+			switch(c->type) {
+			case MEM_CHUNK:
+				c->offset = c->mem->used - 1;
+				break;
+			case FILE_CHUNK:
+				c->offset = c->file.length;
+				break;
+			default:
+				break;
+			}
+		}
+		con->recv->bytes_out = con->recv->bytes_in;
+	}
+
+	/* the content still in the socket isn't wanted either */
+	con->recv->is_closed = 1;
+}
+
 /**
  * encode/decode stream data from backend connection.
  *
@@ -874,22 +927,24 @@ static handler_t proxy_stream_encode_decode(server *srv, proxy_session *sess) {
 		}
 	}
 
-	/* encode request content. */
-	switch(proxy_stream_encoder(srv, sess, con->recv)) {
-	case HANDLER_FINISHED:
-		/* finished encoding request content. */
-		break;
-	case HANDLER_GO_ON:
-		break;
-	case HANDLER_ERROR:
-		ERROR("%s", "stream encoder failed.");
-		/* error */
-		return HANDLER_ERROR;
-	default:
-		TRACE("stream-encoder: %s", "foo");
-		break;
+	/* encode request content, but don't queue more than the backend takes */
+	if (sess->proxy_con->send->bytes_in - sess->proxy_con->send->bytes_out < REQUEST_CONTENT_STREAM_MAX) {
+		switch(proxy_stream_encoder(srv, sess, con->recv)) {
+		case HANDLER_FINISHED:
+			/* finished encoding request content. */
+			break;
+		case HANDLER_GO_ON:
+			break;
+		case HANDLER_ERROR:
+			ERROR("%s", "stream encoder failed.");
+			/* error */
+			return HANDLER_ERROR;
+		default:
+			TRACE("stream-encoder: %s", "foo");
+			break;
+		}
+		chunkqueue_remove_finished_chunks(con->recv);
 	}
-	chunkqueue_remove_finished_chunks(con->recv);
 
 	if (!sess->is_closed) {
 		/* enable FDEVENT_OUT if there is data to send. */
@@ -1268,9 +1323,15 @@ static int proxy_get_request_header(server *srv, connection *con, plugin_data *p
 
 		if (buffer_is_empty(ds->value) || buffer_is_empty(ds->key)) continue;
 
-		if (buffer_is_equal_string(ds->key, CONST_STR_LEN("Connection"))) continue;
-		if (buffer_is_equal_string(ds->key, CONST_STR_LEN("Keep-Alive"))) continue;
-		if (buffer_is_equal_string(ds->key, CONST_STR_LEN("Expect"))) continue;
+		switch (http_header_id(ds)) {
+		case HTTP_HEADER_CONNECTION:
+		case HTTP_HEADER_KEEP_ALIVE:
+		case HTTP_HEADER_EXPECT:
+			/* hop-by-hop */
+			continue;
+		default:
+			break;
+		}
 #ifdef HAVE_PCRE_H
 		for (k = 0; k < p->conf.request_rewrites->used; k++) {
 			proxy_rewrite *rw = p->conf.request_rewrites->ptr[k];
@@ -1580,27 +1641,10 @@ static handler_t proxy_state_engine(server *srv, connection *con, plugin_data *p
 		case HANDLER_GO_ON:
 			/* some backends will send a response before all the request content has been written. */
 			if (sess->is_closed || sess->have_response_headers) {
-				chunk *c;
 				if (sess->is_closed && !sess->have_response_headers) {
 					if (sess->p->conf.debug) TRACE("%s", "connection to backend closed when sending request headers/content.");
 				}
-				if (con->recv->bytes_out < con->recv->bytes_in) {
-					/* we have to consume all the request content data. */
-					for (c = con->recv->first; c; c = c->next) {
-						switch(c->type) {
-						case MEM_CHUNK:
-							c->offset = c->mem->used - 1;
-							break;
-						case FILE_CHUNK:
-							c->offset = c->file.length;
-							break;
-						default:
-							break;
-						}
-					}
-					con->recv->bytes_out = con->recv->bytes_in;
-					con->recv->is_closed = 1;
-				}
+				proxy_discard_request_content(con);
 				break;
 			}
 			return HANDLER_WAIT_FOR_EVENT;
@@ -2188,6 +2232,7 @@ static int mod_proxy_core_check_match(server *srv, connection *con, plugin_data
 
 	con->plugin_ctx[p->id] = sess;
 	con->mode = p->id;
+	con->stream_request_body = con->conf.stream_request_body;
 
 	if (con->conf.log_request_handling) {
 		TRACE("handling it in mod_proxy_core: %s.path=%s",
@@ -2438,6 +2483,8 @@ CONNECTION_FUNC(mod_proxy_core_start_backend) {
 		default:
 			TRACE("state: %d (error)", sess->state);
 			proxy_remove_backend_connection(srv, sess);
+			/* the response header is out already, all we can do is to close the connection */
+			if (con->file_started) return HANDLER_ERROR;
 			/* only set 500 if not another error code is already set (like 502) */
 			if (con->http_status < 500 || con->http_status > 599) {
 				con->http_status = 500; /* Internal Server Error */
@@ -2453,16 +2500,27 @@ CONNECTION_FUNC(mod_proxy_core_start_backend) {
 
 CONNECTION_FUNC(mod_proxy_send_request_content) {
 	plugin_data *p = p_d;
+	handler_t r;
 
 	if (p->id != con->mode) return HANDLER_GO_ON;
 
-	/* read all the content before we start our backend */
-	if (!con->recv->is_closed) {
+	/* read all the content before we start our backend, unless we stream it */
+	if (!con->recv->is_closed && !con->stream_request_body) {
 		return HANDLER_GO_ON;
 	}
 
 	/* copy the chunks to our queue and call the state-engine to send it out */
-	return mod_proxy_core_start_backend(srv, con, p_d);
+	switch (r = mod_proxy_core_start_backend(srv, con, p_d)) {
+	case HANDLER_FINISHED:
+		/* we gave up on the backends, the rest of the content isn't wanted anymore */
+		proxy_discard_request_content(con);
+		con->recv->is_closed = 1;
+		break;
+	default:
+		break;
+	}
+
+	return r;
 }
 
 /**
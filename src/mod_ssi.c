@@ -649,13 +649,17 @@ static int process_ssi_stmt(server *srv, connection *con, plugin_data *p,
 			}
 		}
 		break;
-	case SSI_PRINTENV:
+	case SSI_PRINTENV: {
+		data_unset **sorted;
+
 		if (p->if_is_false) break;
 
+		sorted = array_get_sorted(p->ssi_vars);
+
 		b = chunkqueue_get_append_buffer(con->send);
 		buffer_copy_string_len(b, CONST_STR_LEN("<pre>"));
 		for (i = 0; i < p->ssi_vars->used; i++) {
-			data_string *ds = (data_string *)p->ssi_vars->data[p->ssi_vars->sorted[i]];
+			data_string *ds = (data_string *)sorted[i];
 
 			buffer_append_string_buffer(b, ds->key);
 			buffer_append_string_len(b, CONST_STR_LEN(": "));
@@ -665,7 +669,10 @@ static int process_ssi_stmt(server *srv, connection *con, plugin_data *p,
 		}
 		buffer_append_string_len(b, CONST_STR_LEN("</pre>"));
 
+		free(sorted);
+
 		break;
+	}
 	case SSI_EXEC: {
 #ifndef _WIN32
 
@@ -17,6 +17,8 @@
 #include "sys-strings.h"
 
 #include "http_req_range.h"
+#include "http_header.h"
+
 /**
  * this is a staticfile for a lighttpd plugin
  *
@@ -33,10 +35,6 @@ typedef struct {
 typedef struct {
 	PLUGIN_DATA;
 
-	buffer *range_buf;
-
-	http_req_range *ranges;
-
 	plugin_config **config_storage;
 
 	plugin_config conf;
@@ -50,10 +48,6 @@ INIT_FUNC(mod_staticfile_init) {
 
 	p = calloc(1, sizeof(*p));
 
-	p->range_buf = buffer_init();
-
-	p->ranges = http_request_range_init();
-
 	return p;
 }
 
@@ -76,10 +70,6 @@ FREE_FUNC(mod_staticfile_free) {
 		}
 		free(p->config_storage);
 	}
-	buffer_free(p->range_buf);
-
-	http_request_range_free(p->ranges);
-
 	free(p);
 
 	return HANDLER_GO_ON;
@@ -145,176 +135,6 @@ static int mod_staticfile_patch_connection(server *srv, connection *con, plugin_
 	return 0;
 }
 
-static int http_response_parse_range(server *srv, connection *con, plugin_data *p) {
-	int multipart = 0;
-	char *boundary = "fkj49sn38dcn3";
-	data_string *ds;
-	stat_cache_entry *sce = NULL;
-	buffer *content_type = NULL;
-	buffer *range = NULL;
-	http_req_range *ranges, *r;
-
-	if (NULL != (ds = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("Range")))) {
-		range = ds->value;
-	} else {
-		/* we don't have a Range header */
-
-		return -1;
-	}
-
-	if (HANDLER_ERROR == stat_cache_get_entry(srv, con, con->physical.path, &sce)) {
-		SEGFAULT("stat_cache_get_entry(%s) returned %d", SAFE_BUF_STR(con->physical.path), HANDLER_ERROR);
-	}
-
-	con->response.content_length = 0;
-
-	if (NULL != (ds = (data_string *)array_get_element(con->response.headers, CONST_STR_LEN("Content-Type")))) {
-		content_type = ds->value;
-	}
-
-	/* start the range-header parser
-	 * bytes=<num>  */
-
-	ranges = p->ranges;
-	http_request_range_reset(ranges);
-	switch (http_request_range_parse(range, ranges)) {
-	case PARSE_ERROR:
-		return -1; /* no range valid Range Header */
-	case PARSE_SUCCESS:
-		break;
-	default:
-		TRACE("%s", "foobar");
-		return -1;
-	}
-
-	if (ranges->next) {
-		multipart = 1;
-	}
-
-	/* patch the '-1' */
-	for (r = ranges; r; r = r->next) {
-		if (r->start == -1) {
-			/* -<end>
-			 *
-			 * the last <end> bytes  */
-			r->start = sce->st.st_size - r->end;
-			r->end = sce->st.st_size - 1;
-		}
-		if (r->end == -1) {
-			/* <start>-
-			 * all but the first <start> bytes */
-
-			r->end = sce->st.st_size - 1;
-		}
-
-		if (r->end > sce->st.st_size - 1) {
-			/* RFC 2616 - 14.35.1
-			 *
-			 * if last-byte-pos not present or > size-of-file
-			 * take the size-of-file
-			 *
-			 *  */
-			r->end = sce->st.st_size - 1;
-		}
-
-		if (r->start > sce->st.st_size - 1) {
-			/* RFC 2616 - 14.35.1
-			 *
-			 * if first-byte-pos > file-size, 416
-			 */
-
-			con->http_status = 416;
-			return -1;
-		}
-
-		if (r->start > r->end) {
-			/* RFC 2616 - 14.35.1
-			 *
-			 * if last-byte-pos is present, it has to be >= first-byte-pos
-			 *
-			 * invalid ranges have to be handle as no Range specified
-			 *  */
-
-			return -1;
-		}
-	}
-
-	if (r) {
-		/* we ran into an range violation */
-		return -1;
-	}
-
-	if (multipart) {
-		buffer *b;
-		for (r = ranges; r; r = r->next) {
-			/* write boundary-header */
-
-			b = chunkqueue_get_append_buffer(con->send);
-
-			buffer_copy_string_len(b, CONST_STR_LEN("\r\n--"));
-			buffer_append_string(b, boundary);
-
-			/* write Content-Range */
-			buffer_append_string_len(b, CONST_STR_LEN("\r\nContent-Range: bytes "));
-			buffer_append_off_t(b, r->start);
-			buffer_append_string_len(b, CONST_STR_LEN("-"));
-			buffer_append_off_t(b, r->end);
-			buffer_append_string_len(b, CONST_STR_LEN("/"));
-			buffer_append_off_t(b, sce->st.st_size);
-
-			buffer_append_string_len(b, CONST_STR_LEN("\r\nContent-Type: "));
-			buffer_append_string_buffer(b, content_type);
-
-			/* write END-OF-HEADER */
-			buffer_append_string_len(b, CONST_STR_LEN("\r\n\r\n"));
-
-			con->response.content_length += b->used - 1;
-			con->send->bytes_in += b->used - 1;
-
-			chunkqueue_append_file(con->send, con->physical.path, r->start, r->end - r->start + 1);
-			con->response.content_length += r->end - r->start + 1;
-			con->send->bytes_in += r->end - r->start + 1;
-		}
-
-		/* add boundary end */
-		b = chunkqueue_get_append_buffer(con->send);
-
-		buffer_copy_string_len(b, "\r\n--", 4);
-		buffer_append_string(b, boundary);
-		buffer_append_string_len(b, "--\r\n", 4);
-
-		con->response.content_length += b->used - 1;
-		con->send->bytes_in += b->used - 1;
-
-		/* set header-fields */
-
-		buffer_copy_string_len(p->range_buf, CONST_STR_LEN("multipart/byteranges; boundary="));
-		buffer_append_string(p->range_buf, boundary);
-
-		/* overwrite content-type */
-		response_header_overwrite(srv, con, CONST_STR_LEN("Content-Type"), CONST_BUF_LEN(p->range_buf));
-
-	} else {
-		r = ranges;
-
-		chunkqueue_append_file(con->send, con->physical.path, r->start, r->end - r->start + 1);
-		con->response.content_length += r->end - r->start + 1;
-		con->send->bytes_in += r->end - r->start + 1;
-
-		buffer_copy_string_len(p->range_buf, CONST_STR_LEN("bytes "));
-		buffer_append_off_t(p->range_buf, r->start);
-		buffer_append_string_len(p->range_buf, CONST_STR_LEN("-"));
-		buffer_append_off_t(p->range_buf, r->end);
-		buffer_append_string_len(p->range_buf, CONST_STR_LEN("/"));
-		buffer_append_off_t(p->range_buf, sce->st.st_size);
-
-		response_header_insert(srv, con, CONST_STR_LEN("Content-Range"), CONST_BUF_LEN(p->range_buf));
-	}
-
-	/* ok, the file is set-up */
-	return 0;
-}
-
 URIHANDLER_FUNC(mod_staticfile_subrequest) {
 	plugin_data *p = p_d;
 	size_t k;
@@ -415,7 +235,7 @@ URIHANDLER_FUNC(mod_staticfile_subrequest) {
 
 	/* set response content-type, if not set already */
 
-	if (NULL == array_get_element(con->response.headers, CONST_STR_LEN("Content-Type"))) {
+	if (NULL == http_header_get(con->response.headers, HTTP_HEADER_CONTENT_TYPE)) {
 		if (buffer_is_empty(sce->content_type)) {
 			response_header_overwrite(srv, con, CONST_STR_LEN("Content-Type"), CONST_STR_LEN("application/octet-stream"));
 		} else {
@@ -423,7 +243,7 @@ URIHANDLER_FUNC(mod_staticfile_subrequest) {
 		}
 	}
 
-	if (NULL == array_get_element(con->response.headers, CONST_STR_LEN("ETag"))) {
+	if (NULL == http_header_get(con->response.headers, HTTP_HEADER_ETAG)) {
 		/* generate e-tag */
 		etag_mutate(con->physical.etag, sce->etag);
 
@@ -434,7 +254,7 @@ URIHANDLER_FUNC(mod_staticfile_subrequest) {
 	}
 
 	/* prepare header */
-	if (NULL == (ds = (data_string *)array_get_element(con->response.headers, CONST_STR_LEN("Last-Modified")))) {
+	if (NULL == (ds = (data_string *)http_header_get(con->response.headers, HTTP_HEADER_LAST_MODIFIED))) {
 		mtime = strftime_cache_get(srv, sce->st.st_mtime);
 		response_header_overwrite(srv, con, CONST_STR_LEN("Last-Modified"), CONST_BUF_LEN(mtime));
 	} else {
@@ -444,11 +264,11 @@ URIHANDLER_FUNC(mod_staticfile_subrequest) {
 	if (HANDLER_FINISHED == http_response_handle_cachable(srv, con, mtime, con->physical.etag)) {
 		return HANDLER_FINISHED;
 	} else if (con->conf.range_requests &&
-	           NULL != array_get_element(con->request.headers, CONST_STR_LEN("Range"))) {
+	           NULL != http_header_get(con->request.headers, HTTP_HEADER_RANGE)) {
 		int do_range_request = 1;
 		/* check if we have a conditional GET */
 
-		if (NULL != (ds = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("If-Range")))) {
+		if (NULL != (ds = (data_string *)http_header_get(con->request.headers, HTTP_HEADER_IF_RANGE))) {
 			/* if the value is the same as our ETag, we do a Range-request,
 			 * otherwise a full 200 */
 
@@ -457,13 +277,13 @@ URIHANDLER_FUNC(mod_staticfile_subrequest) {
 			}
 		}
 
-		if (do_range_request) {
+		/* if the Range header is invalid we send the full file */
+		if (do_range_request &&
+		    (0 == http_response_range(srv, con, con->physical.path, NULL, sce->st.st_size) ||
+		     con->http_status == 416)) {
 			/* content prepared, I'm done */
 			con->send->is_closed = 1;
 
-			if (0 == http_response_parse_range(srv, con, p)) {
-				con->http_status = 206;
-			}
 			return HANDLER_FINISHED;
 		}
 	}
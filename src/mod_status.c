@@ -633,9 +633,16 @@ static handler_t mod_status_handle_server_statistics(server *srv, connection *co
 	buffer *b;
 	size_t i;
 	array *st = status_counter_get_array();
+	data_unset **sorted;
+	size_t chunks, bytes;
 
 	UNUSED(p_d);
 
+	/* the chunkpool doesn't know about the counters, fetch them now */
+	chunkpool_get_stats(&chunks, &bytes);
+	status_counter_set(CONST_STR_LEN("chunkpool.chunks"), chunks);
+	status_counter_set(CONST_STR_LEN("chunkpool.bytes"), bytes);
+
 	if (0 == st->used) {
 		/* we have nothing to send */
 		con->http_status = 204;
@@ -646,15 +653,17 @@ static handler_t mod_status_handle_server_statistics(server *srv, connection *co
 
 	b = chunkqueue_get_append_buffer(con->send);
 
-	for (i = 0; i < st->used; i++) {
-		size_t ndx = st->sorted[i];
+	sorted = array_get_sorted(st);
 
-		buffer_append_string_buffer(b, st->data[ndx]->key);
+	for (i = 0; i < st->used; i++) {
+		buffer_append_string_buffer(b, sorted[i]->key);
 		buffer_append_string_len(b, CONST_STR_LEN(": "));
-		buffer_append_long(b, ((data_integer *)(st->data[ndx]))->value);
+		buffer_append_long(b, ((data_integer *)(sorted[i]))->value);
 		buffer_append_string_len(b, CONST_STR_LEN("\n"));
 	}
 
+	free(sorted);
+
 	response_header_overwrite(srv, con, CONST_STR_LEN("Content-Type"), CONST_STR_LEN("text/plain"));
 
 	con->http_status = 200;
@@ -7,6 +7,7 @@
 #include "buffer.h"
 
 #include "plugin.h"
+#include "http_header.h"
 
 #ifdef USE_OPENSSL
 # include <openssl/md5.h>
@@ -188,7 +189,7 @@ URIHANDLER_FUNC(mod_usertrack_uri_handler) {
 
 	mod_usertrack_patch_connection(srv, con, p);
 
-	if (NULL != (ds = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("Cookie")))) {
+	if (NULL != (ds = (data_string *)http_header_get(con->request.headers, HTTP_HEADER_COOKIE))) {
 		char *g;
 		/* we have a cookie, does it contain a valid name ? */
 
@@ -906,7 +906,6 @@ static int webdav_get_live_property(server *srv, connection *con, plugin_data *p
 	if (HANDLER_ERROR != (stat_cache_get_entry(srv, con, dst->path, &sce))) {
 		char ctime_buf[] = "2005-08-18T07:27:16Z";
 		char mtime_buf[] = "Thu, 18 Aug 2005 07:27:16 GMT";
-		size_t k;
 
 		if (0 == strcmp(prop_name, "resourcetype")) {
 			if (S_ISDIR(sce->st.st_mode)) {
@@ -918,19 +917,13 @@ static int webdav_get_live_property(server *srv, connection *con, plugin_data *p
 				buffer_append_string_len(b, CONST_STR_LEN("<D:getcontenttype>httpd/unix-directory</D:getcontenttype>"));
 				found = 1;
 			} else if(S_ISREG(sce->st.st_mode)) {
-				for (k = 0; k < con->conf.mimetypes->used; k++) {
-					data_string *ds = (data_string *)con->conf.mimetypes->data[k];
+				data_string *ds = mimetype_table_get(con->conf.mimetype_table, CONST_BUF_LEN(dst->path));
 
-					if (ds->key->used == 0) continue;
-
-					if (buffer_is_equal_right_len(dst->path, ds->key, ds->key->used - 1)) {
-						buffer_append_string_len(b,CONST_STR_LEN("<D:getcontenttype>"));
-						buffer_append_string_buffer(b, ds->value);
-						buffer_append_string_len(b, CONST_STR_LEN("</D:getcontenttype>"));
-						found = 1;
-
-						break;
-					}
+				if (ds) {
+					buffer_append_string_len(b,CONST_STR_LEN("<D:getcontenttype>"));
+					buffer_append_string_buffer(b, ds->value);
+					buffer_append_string_len(b, CONST_STR_LEN("</D:getcontenttype>"));
+					found = 1;
 				}
 			}
 		} else if (0 == strcmp(prop_name, "creationdate")) {
@@ -1089,7 +1082,11 @@ static int webdav_parse_chunkqueue(server *srv, connection *con, plugin_data *p,
 					return -1;
 				}
 
-				if (MAP_FAILED == (c->file.mmap.start = mmap(0, c->file.length, PROT_READ, MAP_SHARED, c->file.fd, 0))) {
+				/* the upload segments are ranges of one file, the map starts at a page */
+				c->file.mmap.offset = c->file.start & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+				c->file.mmap.length = c->file.start + c->file.length - c->file.mmap.offset;
+
+				if (MAP_FAILED == (c->file.mmap.start = mmap(0, c->file.mmap.length, PROT_READ, MAP_SHARED, c->file.fd, c->file.mmap.offset))) {
 					ERROR("mmap(%s) failed: %s", SAFE_BUF_STR(c->file.name), strerror(errno));
 
 					return -1;
@@ -1098,12 +1095,10 @@ static int webdav_parse_chunkqueue(server *srv, connection *con, plugin_data *p,
 				close(c->file.fd);
 				c->file.fd = -1;
 
-				c->file.mmap.length = c->file.length;
-
 				/* chunk_reset() or chunk_free() will cleanup for us */
 			}
 
-			if (XML_ERR_OK != (err = xmlParseChunk(ctxt, c->file.mmap.start + c->offset, weHave, 0))) {
+			if (XML_ERR_OK != (err = xmlParseChunk(ctxt, c->file.mmap.start + (c->file.start - c->file.mmap.offset) + c->offset, weHave, 0))) {
 				ERROR("xmlParseChunk() failed: %d", err);
 				log_error_write(srv, __FILE__, __LINE__, "sddd", "xmlParseChunk failed at:", cq->bytes_out, weHave, err);
 			}
@@ -1854,22 +1849,24 @@ URIHANDLER_FUNC(mod_webdav_subrequest_handler) {
 						return HANDLER_ERROR;
 					}
 
-					if (MAP_FAILED == (c->file.mmap.start = mmap(0, c->file.length, PROT_READ, MAP_SHARED, c->file.fd, 0))) {
+					/* the upload segments are ranges of one file, the map starts at a page */
+					c->file.mmap.offset = c->file.start & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+					c->file.mmap.length = c->file.start + c->file.length - c->file.mmap.offset;
+
+					if (MAP_FAILED == (c->file.mmap.start = mmap(0, c->file.mmap.length, PROT_READ, MAP_SHARED, c->file.fd, c->file.mmap.offset))) {
 						log_error_write(srv, __FILE__, __LINE__, "ssbd", "mmap failed: ",
 								strerror(errno), c->file.name,  c->file.fd);
 
 						return HANDLER_ERROR;
 					}
 
-					c->file.mmap.length = c->file.length;
-
 					close(c->file.fd);
 					c->file.fd = -1;
 
 					/* chunk_reset() or chunk_free() will cleanup for us */
 				}
 
-				if ((r = write(fd, c->file.mmap.start + c->offset, c->file.length - c->offset)) < 0) {
+				if ((r = write(fd, c->file.mmap.start + (c->file.start - c->file.mmap.offset) + c->offset, c->file.length - c->offset)) < 0) {
 					switch(errno) {
 					case ENOSPC:
 						con->http_status = 507;
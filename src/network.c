@@ -1,5 +1,6 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 
 #include <errno.h>
 #include <fcntl.h>
@@ -21,10 +22,35 @@
 #include "sys-socket.h"
 #include "sys-files.h"
 
+#include "status_counter.h"
+
+#ifdef HAVE_LINUX_FILTER_H
+# include <linux/filter.h>
+#endif
+
 #ifdef USE_OPENSSL
 # include <openssl/ssl.h>
 # include <openssl/err.h>
 # include <openssl/rand.h>
+# include <openssl/evp.h>
+# include <openssl/hmac.h>
+# if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#  include <openssl/core_names.h>
+# endif
+#endif
+
+static data_integer *network_write_syscalls = NULL;
+static data_integer *network_responses_written = NULL;
+static data_integer *network_read_buffers_pooled = NULL;
+static data_integer *network_read_buffers_reused = NULL;
+static data_integer *network_read_buffers_allocated = NULL;
+
+#ifdef USE_MSG_ZEROCOPY
+/* MSG_ZEROCOPY buffers of closed sockets: we get no completions for them
+ * anymore and free them after they aged through both generations */
+static buffer_ptr *zerocopy_orphans = NULL;
+static buffer_ptr *zerocopy_orphans_old = NULL;
+#define ZEROCOPY_ORPHAN_GENERATION 30 /* seconds */
 #endif
 
 #define BACKEND_HANDLERS(read, write) network_read_chunkqueue_##read, network_write_chunkqueue_##write
@@ -210,6 +236,7 @@ handler_t network_server_handle_fdevent(void *s, void *context, int revents) {
 	server_socket *srv_socket = (server_socket *)context;
 	connection *con;
 	int loops = 0;
+	int max_loops = srv->srvconf.max_accept ? srv->srvconf.max_accept : 1;
 
 	UNUSED(context);
 
@@ -221,10 +248,17 @@ handler_t network_server_handle_fdevent(void *s, void *context, int revents) {
 		return HANDLER_ERROR;
 	}
 
-	/* accept()s at most 100 connections directly
+	/* drain the listen queue, but accept()s at most server.max-accept-per-wakeup
+	 * connections directly
 	 *
-	 * we jump out after 100 to give the waiting connections a chance */
-	for (loops = 0; loops < 100 && NULL != (con = connection_accept(srv, srv_socket)); loops++) {
+	 * we jump out after that to give the waiting connections a chance and
+	 * stop early when we reach server.max-connections, the main-loop disables
+	 * the server-sockets then */
+	for (loops = 0;
+	     loops < max_loops &&
+	     srv->conns->used < srv->max_conns &&
+	     NULL != (con = connection_accept(srv, srv_socket));
+	     loops++) {
 		joblist_append(srv, con);
 	}
 	return HANDLER_GO_ON;
@@ -237,6 +271,22 @@ static int network_ssl_servername_callback(SSL *ssl, int *al, server *srv) {
 
 	UNUSED(al);
 
+#ifdef USE_GTHREAD
+	if (con->sock->ssl_handshake_job == SSL_HANDSHAKE_JOB_RUNNING) {
+		/* we are in a ssl.handshake-threads thread and can't touch the config,
+		 * only remember the name. network_init() made sure that no
+		 * $HTTP["host"] switches the certificate in this mode */
+		if (NULL != (servername = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name))) {
+			buffer_copy_string(con->sock->tlsext_server_name, servername);
+			buffer_to_lower(con->sock->tlsext_server_name);
+
+			return SSL_TLSEXT_ERR_OK;
+		}
+
+		return SSL_TLSEXT_ERR_NOACK;
+	}
+#endif
+
 	buffer_copy_string(con->uri.scheme, "https");
 
 	if (NULL == (servername = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name))) {
@@ -272,7 +322,329 @@ static int network_ssl_servername_callback(SSL *ssl, int *al, server *srv) {
 }
 #endif
 
-static int network_server_init(server *srv, buffer *host_token, specific_config *s) {
+#ifdef USE_OPENSSL
+/**
+ * session tickets
+ *
+ * the ticket keys are derived from a random master secret and the number of
+ * the current rotation period. The master secret is created before we fork()
+ * the workers, so all of them encrypt with the same key and accept each
+ * others tickets without sharing any memory.
+ *
+ * tickets of the previous period are still accepted but get renewed.
+ *
+ * the keys live in a ring of four slots: the current key and the previous
+ * one at (current + 3) % 4. A rotation writes the new keys into the two
+ * slots no reader uses and publishes them with a single store of
+ * ticket_key_current. That way handshakes running in a ssl.handshake-threads
+ * thread never see a half written key.
+ */
+typedef struct {
+	unsigned char name[16];
+	unsigned char aes_key[32];
+	unsigned char hmac_key[32];
+
+	time_t period;
+} network_ssl_ticket_key;
+
+static unsigned char ticket_master_secret[48];
+static int ticket_master_secret_is_init = 0;
+static network_ssl_ticket_key ticket_keys[4];
+static volatile int ticket_key_current = 0; /* the previous key is at (current + 3) % 4 */
+
+static data_integer *ssl_handshakes_full = NULL;
+static data_integer *ssl_handshakes_resumed = NULL;
+static data_integer *ssl_session_cache_entries = NULL;
+static data_integer *ssl_ticket_key_rotations = NULL;
+
+static void network_ssl_ticket_key_derive(network_ssl_ticket_key *key, time_t period) {
+	unsigned char msg[9];
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned int md_len;
+	size_t i;
+
+	/* msg = period (big-endian) + label */
+	for (i = 0; i < 8; i++) {
+		msg[i] = (unsigned char)(((unsigned long long)period) >> (56 - 8 * i));
+	}
+
+	msg[8] = 'n';
+	HMAC(EVP_sha256(), ticket_master_secret, sizeof(ticket_master_secret), msg, sizeof(msg), md, &md_len);
+	memcpy(key->name, md, sizeof(key->name));
+
+	msg[8] = 'a';
+	HMAC(EVP_sha256(), ticket_master_secret, sizeof(ticket_master_secret), msg, sizeof(msg), md, &md_len);
+	memcpy(key->aes_key, md, sizeof(key->aes_key));
+
+	msg[8] = 'h';
+	HMAC(EVP_sha256(), ticket_master_secret, sizeof(ticket_master_secret), msg, sizeof(msg), md, &md_len);
+	memcpy(key->hmac_key, md, sizeof(key->hmac_key));
+
+	key->period = period;
+}
+
+/**
+ * switch to the key of the current period, called once a second
+ */
+static void network_ssl_ticket_keys_rotate(server *srv) {
+	time_t period;
+	int current = ticket_key_current, next;
+
+	if (!ticket_master_secret_is_init) return;
+
+	period = srv->cur_ts / (srv->srvconf.ssl_ticket_key_rotate ? srv->srvconf.ssl_ticket_key_rotate : 3600);
+
+	if (period == ticket_keys[current].period) return;
+
+	if (period == ticket_keys[current].period + 1) {
+		/* the current key becomes the previous one */
+		next = (current + 1) % 4;
+	} else {
+		/* we slept for a while, the previous key has to be replaced too */
+		next = (current + 2) % 4;
+		network_ssl_ticket_key_derive(&ticket_keys[(next + 3) % 4], period - 1);
+	}
+	network_ssl_ticket_key_derive(&ticket_keys[next], period);
+
+#ifdef USE_GTHREAD
+	g_atomic_int_set(&ticket_key_current, next);
+#else
+	ticket_key_current = next;
+#endif
+
+	COUNTER_INC(ssl_ticket_key_rotations);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int network_ssl_ticket_hmac_init(EVP_MAC_CTX *hctx, unsigned char *hmac_key) {
+	OSSL_PARAM params[3];
+
+	params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, hmac_key, 32);
+	params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char *)"sha256", 0);
+	params[2] = OSSL_PARAM_construct_end();
+
+	return EVP_MAC_CTX_set_params(hctx, params);
+}
+
+static int network_ssl_ticket_key_cb(SSL *ssl, unsigned char key_name[16], unsigned char *iv,
+		EVP_CIPHER_CTX *ectx, EVP_MAC_CTX *hctx, int enc) {
+#else
+static int network_ssl_ticket_hmac_init(HMAC_CTX *hctx, unsigned char *hmac_key) {
+	return HMAC_Init_ex(hctx, hmac_key, 32, EVP_sha256(), NULL);
+}
+
+static int network_ssl_ticket_key_cb(SSL *ssl, unsigned char key_name[16], unsigned char *iv,
+		EVP_CIPHER_CTX *ectx, HMAC_CTX *hctx, int enc) {
+#endif
+	network_ssl_ticket_key *key;
+#ifdef USE_GTHREAD
+	int current = g_atomic_int_get(&ticket_key_current);
+#else
+	int current = ticket_key_current;
+#endif
+	int i;
+
+	UNUSED(ssl);
+
+	if (enc) {
+		/* new ticket: always use the current key */
+		key = &ticket_keys[current];
+
+		if (1 != RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc()))) return -1;
+
+		memcpy(key_name, key->name, sizeof(key->name));
+
+		if (1 != EVP_EncryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, key->aes_key, iv)) return -1;
+		if (1 != network_ssl_ticket_hmac_init(hctx, key->hmac_key)) return -1;
+
+		return 1;
+	}
+
+	/* the current and the previous key */
+	for (i = current; ; i = (current + 3) % 4) {
+		if (0 == memcmp(key_name, ticket_keys[i].name, sizeof(ticket_keys[i].name))) break;
+
+		/* unknown or expired key: do a full handshake */
+		if (i != current) return 0;
+	}
+
+	key = &ticket_keys[i];
+
+	if (1 != network_ssl_ticket_hmac_init(hctx, key->hmac_key)) return -1;
+	if (1 != EVP_DecryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, key->aes_key, iv)) return -1;
+
+	/* ask for a new ticket if it was encrypted with the previous key */
+	return (i == current) ? 1 : 2;
+}
+
+/**
+ * count a finished handshake, in the main-loop only
+ */
+void network_ssl_handshake_count(iosocket *sock) {
+	if (sock->ssl_handshake_done != SSL_HANDSHAKE_DONE_UNCOUNTED) return;
+	sock->ssl_handshake_done = SSL_HANDSHAKE_DONE_COUNTED;
+
+	if (SSL_session_reused(sock->ssl)) {
+		COUNTER_INC(ssl_handshakes_resumed);
+	} else {
+		COUNTER_INC(ssl_handshakes_full);
+	}
+}
+
+static void network_ssl_info_callback(const SSL *ssl, int where, int ret) {
+	connection *con;
+
+	UNUSED(ret);
+
+	if (0 == (where & SSL_CB_HANDSHAKE_DONE)) return;
+
+	/* TLS 1.3 might report more than one handshake-done, count the first */
+	if (NULL == (con = (connection *) SSL_get_app_data(ssl))) return;
+	if (con->sock->ssl_handshake_done != SSL_HANDSHAKE_DONE_NO) return;
+	con->sock->ssl_handshake_done = SSL_HANDSHAKE_DONE_UNCOUNTED;
+
+#ifdef USE_GTHREAD
+	/* the counters aren't thread-safe, the main-loop counts it when the job is done */
+	if (con->sock->ssl_handshake_job == SSL_HANDSHAKE_JOB_RUNNING) return;
+#endif
+
+	network_ssl_handshake_count(con->sock);
+}
+
+/**
+ * setup the session-cache and session-tickets of a SSL_CTX
+ */
+static int network_ssl_ctx_init_sessions(server *srv, specific_config *s) {
+	if (s->ssl_session_cache_size) {
+		SSL_CTX_set_session_cache_mode(s->ssl_ctx, SSL_SESS_CACHE_SERVER);
+		SSL_CTX_sess_set_cache_size(s->ssl_ctx, s->ssl_session_cache_size);
+	} else {
+		SSL_CTX_set_session_cache_mode(s->ssl_ctx, SSL_SESS_CACHE_OFF);
+	}
+
+	if (s->ssl_session_timeout) {
+		SSL_CTX_set_timeout(s->ssl_ctx, s->ssl_session_timeout);
+	}
+
+	if (!s->ssl_session_tickets) {
+		SSL_CTX_set_options(s->ssl_ctx, SSL_OP_NO_TICKET);
+	} else {
+		if (!ticket_master_secret_is_init) {
+			if (1 != RAND_bytes(ticket_master_secret, sizeof(ticket_master_secret))) {
+				log_error_write(srv, __FILE__, __LINE__, "ss", "SSL:",
+						ERR_error_string(ERR_get_error(), NULL));
+				return -1;
+			}
+			ticket_master_secret_is_init = 1;
+
+			network_ssl_ticket_keys_rotate(srv);
+		}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		if (1 != SSL_CTX_set_tlsext_ticket_key_evp_cb(s->ssl_ctx, network_ssl_ticket_key_cb)) {
+#else
+		if (1 != SSL_CTX_set_tlsext_ticket_key_cb(s->ssl_ctx, network_ssl_ticket_key_cb)) {
+#endif
+			log_error_write(srv, __FILE__, __LINE__, "ss", "SSL:",
+					"failed to set the session ticket callback");
+			return -1;
+		}
+	}
+
+	SSL_CTX_set_info_callback(s->ssl_ctx, network_ssl_info_callback);
+
+	return 0;
+}
+#endif
+
+/**
+ * called once a second
+ */
+void network_trigger(server *srv) {
+#ifdef USE_OPENSSL
+	size_t i;
+	long entries = 0;
+#endif
+
+#ifdef USE_MSG_ZEROCOPY
+	if (zerocopy_orphans && 0 == srv->cur_ts % ZEROCOPY_ORPHAN_GENERATION) {
+		buffer_ptr *b = zerocopy_orphans_old;
+
+		buffer_ptr_clear(b);
+		zerocopy_orphans_old = zerocopy_orphans;
+		zerocopy_orphans = b;
+	}
+#endif
+
+#ifdef USE_OPENSSL
+	if (!srv->ssl_is_init) return;
+
+	network_ssl_ticket_keys_rotate(srv);
+
+	for (i = 0; i < srv->config_context->used; i++) {
+		specific_config *s = srv->config_storage[i];
+
+		if (NULL == s->ssl_ctx) continue;
+
+		/* openssl only expires sessions every 255 new sessions, keep the cache clean if we are idle */
+		if (0 == srv->cur_ts % 30) SSL_CTX_flush_sessions(s->ssl_ctx, srv->cur_ts);
+
+		entries += SSL_CTX_sess_number(s->ssl_ctx);
+	}
+
+	COUNTER_SET(ssl_session_cache_entries, entries);
+#elif !defined USE_MSG_ZEROCOPY
+	UNUSED(srv);
+#endif
+}
+
+#ifdef SO_REUSEPORT
+/**
+ * let the kernel pick the listening socket of a reuseport group by the CPU
+ * which received the connection (the RSS queue of the NIC)
+ *
+ * The sockets join the group in the order of the worker slots, socket N
+ * belongs to worker N. The classic BPF program "return cpu % max-worker" on
+ * the first socket steers the whole group. Without it SO_INCOMING_CPU is
+ * only a hint which newer kernels use to prefer the socket of that CPU.
+ */
+static void network_server_steer_by_cpu(server *srv, server_socket *srv_socket) {
+	int val = srv_socket->worker_ndx;
+
+#if defined(HAVE_LINUX_FILTER_H) && defined(SO_ATTACH_REUSEPORT_CBPF)
+	if (srv_socket->worker_ndx == 0) {
+		struct sock_filter code[] = {
+			{ BPF_LD  | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU }, /* A = current cpu */
+			{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, srv->srvconf.max_worker },  /* A = A % max-worker */
+			{ BPF_RET | BPF_A, 0, 0, 0 },                                   /* return A */
+		};
+		struct sock_fprog prog;
+
+		prog.len = sizeof(code) / sizeof(code[0]);
+		prog.filter = code;
+
+		if (0 == setsockopt(srv_socket->sock->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog))) return;
+
+		log_error_write(srv, __FILE__, __LINE__, "ss",
+				"server.worker-reuseport: can't attach the cpu filter, falling back to SO_INCOMING_CPU:", strerror(errno));
+	}
+#endif
+#ifdef SO_INCOMING_CPU
+	/* only a hint, an attached filter takes precedence */
+	if (0 != setsockopt(srv_socket->sock->fd, SOL_SOCKET, SO_INCOMING_CPU, &val, sizeof(val))) {
+		log_error_write(srv, __FILE__, __LINE__, "ss",
+				"server.worker-reuseport: setting SO_INCOMING_CPU failed:", strerror(errno));
+	}
+#else
+	UNUSED(val);
+#endif
+}
+#endif
+
+/**
+ * @param worker_ndx the worker owning the socket for server.worker-reuseport, -1 if it is shared
+ */
+static int network_server_init(server *srv, buffer *host_token, specific_config *s, int worker_ndx) {
 	int val;
 	socklen_t addr_len;
 	server_socket *srv_socket;
@@ -304,6 +676,7 @@ static int network_server_init(server *srv, buffer *host_token, specific_config
 
 	srv_socket = calloc(1, sizeof(*srv_socket));
 	srv_socket->sock = iosocket_init();
+	srv_socket->worker_ndx = worker_ndx;
 
 	srv_socket->srv_token = buffer_init();
 	buffer_copy_string_buffer(srv_socket->srv_token, host_token);
@@ -387,6 +760,19 @@ static int network_server_init(server *srv, buffer *host_token, specific_config
 		goto error_free_socket;
 	}
 
+#ifdef SO_REUSEPORT
+	if (worker_ndx != -1) {
+		/* each worker gets its own socket and accept queue on the same address */
+		val = 1;
+		if (setsockopt(srv_socket->sock->fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val)) < 0) {
+			log_error_write(srv, __FILE__, __LINE__, "ss", "setting SO_REUSEPORT failed:", strerror(errno));
+			goto error_free_socket;
+		}
+
+		network_server_steer_by_cpu(srv, srv_socket);
+	}
+#endif
+
 	switch(srv_socket->addr.plain.sa_family) {
 #ifdef HAVE_IPV6
 	case AF_INET6:
@@ -582,6 +968,52 @@ error_free_socket:
 	return -1;
 }
 
+/**
+ * bind a socket per worker if server.worker-reuseport is set
+ */
+static int network_server_init_workers(server *srv, buffer *host_token, specific_config *s) {
+	int ndx;
+
+	/* unix-domain sockets can't be shared this way */
+	if (!srv->srvconf.worker_reuseport || host_token->ptr[0] == '/') {
+		return network_server_init(srv, host_token, s, -1);
+	}
+
+	for (ndx = 0; ndx < srv->srvconf.max_worker; ndx++) {
+		if (0 != network_server_init(srv, host_token, s, ndx)) return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * called in a worker right after the fork(): close the listening sockets
+ * of the other workers
+ *
+ * the parent keeps them open, they stay in the reuseport group and queue
+ * the connections of a worker until it is restarted
+ */
+int network_worker_init(server *srv) {
+	size_t i, j;
+
+	for (i = 0, j = 0; i < srv->srv_sockets.used; i++) {
+		server_socket *srv_socket = srv->srv_sockets.ptr[i];
+
+		if (srv_socket->worker_ndx == -1 ||
+		    srv_socket->worker_ndx == srv->worker_ndx) {
+			srv->srv_sockets.ptr[j++] = srv_socket;
+			continue;
+		}
+
+		iosocket_free(srv_socket->sock);
+		buffer_free(srv_socket->srv_token);
+		free(srv_socket);
+	}
+	srv->srv_sockets.used = j;
+
+	return 0;
+}
+
 int network_close(server *srv) {
 	size_t i;
 	for (i = 0; i < srv->srv_sockets.used; i++) {
@@ -607,6 +1039,12 @@ int network_close(server *srv) {
 #endif
 	free(srv->srv_sockets.ptr);
 
+#ifdef USE_MSG_ZEROCOPY
+	buffer_ptr_free(zerocopy_orphans);
+	buffer_ptr_free(zerocopy_orphans_old);
+	zerocopy_orphans = zerocopy_orphans_old = NULL;
+#endif
+
 	return 0;
 }
 
@@ -633,6 +1071,23 @@ int network_init(server *srv) {
 		}
 #endif
 
+		if (srv->srvconf.max_ssl_handshake_threads) {
+#ifdef USE_GTHREAD
+			data_config *dc = (data_config *)srv->config_context->data[i];
+
+			/* the servername callback can't switch the SSL_CTX from a thread */
+			if (COMP_HTTP_HOST == dc->comp) {
+				log_error_write(srv, __FILE__, __LINE__, "ss", "SSL:",
+						"ssl.handshake-threads is disabled as ssl.pemfile is used in a $HTTP[\"host\"] condition");
+				srv->srvconf.max_ssl_handshake_threads = 0;
+			}
+#else
+			log_error_write(srv, __FILE__, __LINE__, "ss", "SSL:",
+					"ssl.handshake-threads is ignored, lighttpd was built without gthread support");
+			srv->srvconf.max_ssl_handshake_threads = 0;
+#endif
+		}
+
 		if (srv->ssl_is_init == 0) {
 			SSL_load_error_strings();
 			SSL_library_init();
@@ -651,6 +1106,17 @@ int network_init(server *srv) {
 			return -1;
 		}
 
+		if (NULL == ssl_handshakes_full) {
+			ssl_handshakes_full = status_counter_get_counter(CONST_STR_LEN("ssl.handshakes-full"));
+			ssl_handshakes_resumed = status_counter_get_counter(CONST_STR_LEN("ssl.handshakes-resumed"));
+			ssl_session_cache_entries = status_counter_get_counter(CONST_STR_LEN("ssl.session-cache-entries"));
+			ssl_ticket_key_rotations = status_counter_get_counter(CONST_STR_LEN("ssl.ticket-key-rotations"));
+		}
+
+		if (0 != network_ssl_ctx_init_sessions(srv, s)) {
+			return -1;
+		}
+
 		if (!s->ssl_use_sslv2) {
 			/* disable SSLv2 */
 			if (!(SSL_OP_NO_SSLv2 & SSL_CTX_set_options(s->ssl_ctx, SSL_OP_NO_SSLv2))) {
@@ -660,6 +1126,18 @@ int network_init(server *srv) {
 			}
 		}
 
+		if (s->ssl_use_ktls) {
+#ifdef SSL_OP_ENABLE_KTLS
+			/* let openssl hand the keys to the kernel (TLS_TX/TLS_RX) after
+			 * the handshake. If the kernel or the cipher doesn't support it
+			 * openssl silently stays in userspace. */
+			SSL_CTX_set_options(s->ssl_ctx, SSL_OP_ENABLE_KTLS);
+#else
+			log_error_write(srv, __FILE__, __LINE__, "ss", "SSL:",
+					"ssl.use-ktls is ignored, openssl library does not support kernel TLS");
+#endif
+		}
+
 		if (!buffer_is_empty(s->ssl_cipher_list)) {
 			if (SSL_CTX_set_cipher_list(s->ssl_ctx, s->ssl_cipher_list->ptr) != 1) {
 				log_error_write(srv, __FILE__, __LINE__, "ss", "SSL:",
@@ -737,7 +1215,21 @@ int network_init(server *srv) {
 	buffer_append_string_len(b, CONST_STR_LEN(":"));
 	buffer_append_long(b, srv->srvconf.port);
 
-	if (0 != network_server_init(srv, b, srv->config_storage[0])) {
+	if (srv->srvconf.worker_reuseport) {
+#ifdef SO_REUSEPORT
+		if (srv->srvconf.max_worker == 0) {
+			log_error_write(srv, __FILE__, __LINE__, "s",
+					"server.worker-reuseport is ignored, it needs server.max-worker");
+			srv->srvconf.worker_reuseport = 0;
+		}
+#else
+		log_error_write(srv, __FILE__, __LINE__, "s",
+				"server.worker-reuseport is ignored, the platform has no SO_REUSEPORT");
+		srv->srvconf.worker_reuseport = 0;
+#endif
+	}
+
+	if (0 != network_server_init_workers(srv, b, srv->config_storage[0])) {
 		return -1;
 	}
 	buffer_free(b);
@@ -756,6 +1248,18 @@ int network_init(server *srv) {
 	srv->network_ssl_backend_read  = network_read_chunkqueue_openssl;
 #endif
 
+#ifdef MSG_MORE
+	/* these backends send the FILE_CHUNK in the same call right after the MEM_CHUNKs */
+	srv->network_backend_msg_more = (srv->network_backend == NETWORK_BACKEND_LINUX_SENDFILE ||
+					 srv->network_backend == NETWORK_BACKEND_WRITEV);
+#endif
+
+	network_write_syscalls = status_counter_get_counter(CONST_STR_LEN("network.write-syscalls"));
+	network_responses_written = status_counter_get_counter(CONST_STR_LEN("network.responses-written"));
+	network_read_buffers_pooled = status_counter_get_counter(CONST_STR_LEN("network.read-buffers-pooled"));
+	network_read_buffers_reused = status_counter_get_counter(CONST_STR_LEN("network.read-buffers-reused"));
+	network_read_buffers_allocated = status_counter_get_counter(CONST_STR_LEN("network.read-buffers-allocated"));
+
 	/* check for $SERVER["socket"] */
 	for (i = 1; i < srv->config_context->used; i++) {
 		data_config *dc = (data_config *)srv->config_context->data[i];
@@ -776,7 +1280,7 @@ int network_init(server *srv) {
 		}
 
 		if (j == srv->srv_sockets.used) {
-			if (0 != network_server_init(srv, dc->string, s)) return -1;
+			if (0 != network_server_init_workers(srv, dc->string, s)) return -1;
 		}
 	}
 
@@ -812,38 +1316,392 @@ network_status_t network_read(server *srv, connection *con, iosocket *sock, chun
 		ret =  srv->network_backend_read(srv, con, sock, cq);
 	}
 
+	/* the backends only ask to wait after a EAGAIN */
+	if (ret == NETWORK_STATUS_WAIT_FOR_EVENT) fdevent_event_drained(srv->ev, sock, FDEVENT_IN);
+
 	con->bytes_read += cq->bytes_in - start_bytes_in;
 
+	if (network_read_buffers_pooled) {
+		size_t pooled, hits, misses;
+
+		chunkpool_get_read_buffer_stats(&pooled, &hits, &misses);
+
+		network_read_buffers_pooled->value = pooled;
+		network_read_buffers_reused->value = hits;
+		network_read_buffers_allocated->value = misses;
+	}
+
 	return ret;
 }
 
+#ifdef TCP_CORK
+/**
+ * check if we have to cork the socket to get the header and the first
+ * bytes of the file into the same segment
+ *
+ * MEM_CHUNKs in a row are gathered into one writev() anyway and backends
+ * which set network_backend_msg_more send the header with MSG_MORE. What is
+ * left are the backends which send MEM_CHUNK and FILE_CHUNK with
+ * syscalls that can't tell the kernel that more is coming.
+ */
+static int network_write_needs_cork(server *srv, connection *con, chunkqueue *cq) {
+	server_socket *srv_socket = con->srv_socket;
+	chunk *c;
+	int have_mem = 0;
+
+	/* the openssl backend combines everything into records itself */
+	if (srv_socket->is_ssl) return 0;
+
+	if (srv->network_backend_msg_more) return 0;
+
+	for (c = cq->first; c; c = c->next) {
+		if (c->type == FILE_CHUNK) return have_mem;
+
+		if (c->type == MEM_CHUNK && !chunk_is_done(c)) have_mem = 1;
+	}
+
+	return 0;
+}
+#endif
+
+/**
+ * traffic-shaper
+ *
+ * connection.kbytes-per-second, server.kbytes-per-second of the context
+ * and server.kbytes-per-second of the global context each have a token
+ * bucket. A write may send as many bytes as the emptiest of them allows,
+ * the shared buckets are split between the connections which wait for
+ * them. Without tokens the connection moves to srv->throttled and
+ * network_shaper_run() retries it round-robin once the buckets refilled.
+ */
+static void network_shaper_now(time_t *sec, int *msec) {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	*sec = tv.tv_sec;
+	*msec = tv.tv_usec / 1000;
+}
+
+static off_t traffic_bucket_refill(traffic_bucket *b, unsigned short kbytes_per_second, time_t sec, int msec) {
+	off_t rate = (off_t)kbytes_per_second * 1024;
+	off_t burst = rate * NETWORK_SHAPER_BURST_MS / 1000;
+	off_t ms;
+
+	if (b->refill_sec == 0) {
+		b->tokens = burst;
+	} else {
+		ms = (sec - b->refill_sec) * 1000 + (msec - b->refill_msec);
+
+		if (ms < 0) {
+			/* the clock was set back */
+			ms = 0;
+		} else if (ms * rate < 1000) {
+			/* keep the fraction of a byte for the next round */
+			return b->tokens;
+		}
+
+		b->tokens += ms * rate / 1000;
+		if (b->tokens > burst) b->tokens = burst;
+	}
+
+	b->refill_sec = sec;
+	b->refill_msec = msec;
+
+	return b->tokens;
+}
+
+/**
+ * how many bytes we may write, -1 if there is no limit
+ */
+static off_t network_shaper_allowance(server *srv, connection *con, time_t sec, int msec) {
+	specific_config *global = srv->config_storage[0];
+	off_t max = -1, t;
+	/* the waiters: still throttled, not woken up yet in this round and us */
+	off_t sharing = srv->throttled->used + srv->throttled_waking + 1;
+
+	if (con->conf.kbytes_per_second) {
+		max = traffic_bucket_refill(&(con->traffic_bucket), con->conf.kbytes_per_second, sec, msec);
+	}
+
+#define SHARED_BUCKET(kbytes, bucket) \
+	t = traffic_bucket_refill(bucket, kbytes, sec, msec); \
+	/* fair share, but don't go below a packet */ \
+	if (t > 0) t = (t / sharing > 1460) ? t / sharing : (t < 1460 ? t : 1460); \
+	if (max == -1 || t < max) max = t;
+
+	if (con->conf.global_kbytes_per_second) {
+		SHARED_BUCKET(con->conf.global_kbytes_per_second, con->conf.global_bucket_ptr);
+	}
+
+	if (global->global_kbytes_per_second && con->conf.global_bucket_ptr != &(global->global_bucket)) {
+		SHARED_BUCKET(global->global_kbytes_per_second, &(global->global_bucket));
+	}
+#undef SHARED_BUCKET
+
+	return max;
+}
+
+static void network_shaper_charge(server *srv, connection *con, off_t written) {
+	specific_config *global = srv->config_storage[0];
+
+	/* backends without write-budget support may overshoot, the debt is paid by waiting longer */
+	if (con->conf.kbytes_per_second) con->traffic_bucket.tokens -= written;
+	if (con->conf.global_kbytes_per_second) con->conf.global_bucket_ptr->tokens -= written;
+	if (global->global_kbytes_per_second && con->conf.global_bucket_ptr != &(global->global_bucket)) {
+		global->global_bucket.tokens -= written;
+	}
+}
+
+static void network_shaper_throttle(server *srv, connection *con) {
+	connections *throttled = srv->throttled;
+
+	if (con->traffic_limit_reached) return;
+	con->traffic_limit_reached = 1;
+
+	if (throttled->size == 0) {
+		throttled->size = 16;
+		throttled->ptr = malloc(sizeof(*throttled->ptr) * throttled->size);
+	} else if (throttled->used == throttled->size) {
+		throttled->size += 16;
+		throttled->ptr = realloc(throttled->ptr, sizeof(*throttled->ptr) * throttled->size);
+	}
+
+	throttled->ptr[throttled->used++] = con;
+}
+
+off_t network_write_budget(iosocket *sock, chunkqueue *cq, off_t len) {
+	if (0 == sock->write_max_out) return len;
+	if (cq->bytes_out >= sock->write_max_out) return 0;
+
+	return (sock->write_max_out - cq->bytes_out < len) ? sock->write_max_out - cq->bytes_out : len;
+}
+
+/**
+ * give the throttled connections another try
+ *
+ * called from the main-loop, at most every NETWORK_SHAPER_TICK_MS
+ */
+void network_shaper_run(server *srv) {
+	connections *throttled = srv->throttled;
+	connection **cons;
+	size_t i, n, start;
+	time_t sec;
+	int msec;
+
+	if (0 == throttled->used) return;
+
+	network_shaper_now(&sec, &msec);
+	if ((sec - srv->throttled_sec) * 1000 + (msec - srv->throttled_msec) < NETWORK_SHAPER_TICK_MS) return;
+	srv->throttled_sec = sec;
+	srv->throttled_msec = msec;
+
+	/* the connections add themself again if they run out of tokens */
+	n = throttled->used;
+	cons = malloc(n * sizeof(*cons));
+	memcpy(cons, throttled->ptr, n * sizeof(*cons));
+	throttled->used = 0;
+
+	/* don't let the same connection get the first pick at the shared buckets every time */
+	start = srv->throttled_rr++ % n;
+
+	for (i = 0; i < n; i++) {
+		connection *con = cons[(start + i) % n];
+
+		/* closed in the meantime */
+		if (!con->traffic_limit_reached) continue;
+
+		con->traffic_limit_reached = 0;
+		srv->throttled_waking = n - i - 1;
+		connection_state_machine(srv, con);
+	}
+	srv->throttled_waking = 0;
+
+	free(cons);
+}
+
+#ifdef USE_MSG_ZEROCOPY
+/**
+ * MSG_ZEROCOPY: the kernel sends big MEM_CHUNKs from our pages instead of
+ * copying them
+ *
+ * The memory has to stay untouched until the kernel reports on the
+ * error-queue of the socket that it is done with the send. A finished
+ * chunk hands its buffer over to the socket (network_zerocopy_hold()) and
+ * network_zerocopy_reap() frees it when the completion arrives.
+ */
+int network_zerocopy_want(server *srv, iosocket *sock, size_t len) {
+	int val = 1;
+
+	if (0 == srv->srvconf.zerocopy_min_size) return 0;
+	if (len < (size_t)srv->srvconf.zerocopy_min_size * 1024) return 0;
+	if (sock->zerocopy == -1) return 0;
+
+	if (sock->zerocopy == 0) {
+		if (0 != setsockopt(sock->fd, SOL_SOCKET, SO_ZEROCOPY, &val, sizeof(val))) {
+			sock->zerocopy = -1;
+			return 0;
+		}
+		sock->zerocopy = 1;
+	}
+
+	return 1;
+}
+
+void network_zerocopy_hold(iosocket *sock, chunk *c) {
+	iosocket_zerocopy_hold *h;
+
+	if (sock->zerocopy_held_size == sock->zerocopy_held_used) {
+		sock->zerocopy_held_size += 16;
+		sock->zerocopy_held = realloc(sock->zerocopy_held, sock->zerocopy_held_size * sizeof(*sock->zerocopy_held));
+	}
+
+	h = sock->zerocopy_held + sock->zerocopy_held_used++;
+	h->mem = c->mem;
+	h->seq = c->zerocopy.seq;
+
+	/* the chunk goes back to the chunkpool with a fresh buffer */
+	c->mem = buffer_init();
+	c->zerocopy.used = 0;
+}
+
+/**
+ * free the buffers of all sends up to (and including) seq
+ *
+ * TCP completes the sends in order, but a buffer might have been handed
+ * over after a younger one
+ */
+static void network_zerocopy_complete(iosocket *sock, unsigned int seq) {
+	size_t i, j;
+
+	for (i = 0, j = 0; i < sock->zerocopy_held_used; i++) {
+		iosocket_zerocopy_hold *h = sock->zerocopy_held + i;
+
+		if ((int)(h->seq - seq) <= 0) {
+			buffer_free(h->mem);
+		} else {
+			sock->zerocopy_held[j++] = *h;
+		}
+	}
+
+	sock->zerocopy_held_used = j;
+}
+
+/**
+ * read the completions from the error-queue
+ *
+ * @return 0 if the socket has no other error pending, -1 otherwise
+ */
+int network_zerocopy_reap(server *srv, iosocket *sock) {
+	char control[128];
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	int err = 0;
+	socklen_t err_len = sizeof(err);
+
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		/* EAGAIN: the queue is empty */
+		if (-1 == recvmsg(sock->fd, &msg, MSG_ERRQUEUE)) break;
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			struct sock_extended_err *serr;
+
+			if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+			    !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) continue;
+
+			serr = (struct sock_extended_err *)CMSG_DATA(cm);
+
+			if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+
+			/* the kernel had to copy anyway (e.g. loopback), don't pay for the notifications */
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) sock->zerocopy = -1;
+
+			/* ee_info .. ee_data is the range of completed sends */
+			network_zerocopy_complete(sock, serr->ee_data);
+		}
+	}
+
+	fdevent_event_drained(srv->ev, sock, FDEVENT_ERR);
+
+	if (0 != getsockopt(sock->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) || err != 0) return -1;
+
+	return 0;
+}
+
+/**
+ * the socket is about to be closed: collect the last completions and
+ * keep the rest until the kernel can't send from them anymore
+ *
+ * the chunks of @cq which were partly sent when the connection broke go
+ * back to the chunkpool on the reset, their buffers are kept as well
+ */
+void network_zerocopy_release(server *srv, iosocket *sock, chunkqueue *cq) {
+	size_t i;
+	chunk *c;
+
+	if (sock->zerocopy == 0) return;
+
+	for (c = cq->first; c; c = c->next) {
+		if (c->zerocopy.used) network_zerocopy_hold(sock, c);
+	}
+
+	network_zerocopy_reap(srv, sock);
+
+	if (sock->zerocopy_held_used && NULL == zerocopy_orphans) {
+		zerocopy_orphans = buffer_ptr_init((buffer_ptr_free_t)buffer_free);
+		zerocopy_orphans_old = buffer_ptr_init((buffer_ptr_free_t)buffer_free);
+	}
+
+	for (i = 0; i < sock->zerocopy_held_used; i++) {
+		buffer_ptr_append(zerocopy_orphans, sock->zerocopy_held[i].mem);
+	}
+
+	sock->zerocopy_held_used = 0;
+	sock->zerocopy_seq = 0;
+	sock->zerocopy = 0;
+}
+#endif
+
 network_status_t network_write_chunkqueue(server *srv, connection *con, chunkqueue *cq) {
 	network_status_t ret = NETWORK_STATUS_UNSET;
 	off_t written = 0;
+	unsigned int syscalls;
 #ifdef TCP_CORK
 	int corked = 0;
 #endif
 	server_socket *srv_socket = con->srv_socket;
+	off_t allowance = -1;
 
-	if (con->conf.global_kbytes_per_second &&
-	    *(con->conf.global_bytes_per_second_cnt_ptr) > con->conf.global_kbytes_per_second * 1024) {
-		/* we reached the global traffic limit */
+	if (con->conf.kbytes_per_second || con->conf.global_kbytes_per_second ||
+	    srv->config_storage[0]->global_kbytes_per_second) {
+		time_t sec;
+		int msec;
 
-		con->traffic_limit_reached = 1;
-		joblist_append(srv, con);
+		network_shaper_now(&sec, &msec);
+
+		if (0 >= (allowance = network_shaper_allowance(srv, con, sec, msec))) {
+			/* we reached the traffic limit */
+			network_shaper_throttle(srv, con);
 
-		return NETWORK_STATUS_WAIT_FOR_AIO_EVENT;
+			return NETWORK_STATUS_WAIT_FOR_AIO_EVENT;
+		}
+
+		con->sock->write_max_out = cq->bytes_out + allowance;
 	}
 
 	written = cq->bytes_out;
+	syscalls = con->sock->write_syscalls;
 
 #ifdef TCP_CORK
-	/* Linux: put a cork into the socket as we want to combine the write() calls
-	 * but only if we really have multiple chunks
-	 */
-	if (cq->first && cq->first->next) {
+	/* Linux: put a cork into the socket as we want to combine the write() calls */
+	if (network_write_needs_cork(srv, con, cq)) {
 		corked = 1;
 		setsockopt(con->sock->fd, IPPROTO_TCP, TCP_CORK, &corked, sizeof(corked));
+		con->sock->write_syscalls++;
 	}
 #endif
 
@@ -855,6 +1713,19 @@ network_status_t network_write_chunkqueue(server *srv, connection *con, chunkque
 		ret = srv->network_backend_write(srv, con, con->sock, cq);
 	}
 
+	if (allowance != -1) {
+		con->sock->write_max_out = 0;
+
+		/* the backend stopped as the tokens are used up, the socket is still writable */
+		if (ret == NETWORK_STATUS_WAIT_FOR_EVENT && cq->bytes_out - written >= allowance) {
+			network_shaper_throttle(srv, con);
+			ret = NETWORK_STATUS_WAIT_FOR_AIO_EVENT;
+		}
+	}
+
+	/* EAGAIN or a short write, the socket-buffer is full either way */
+	if (ret == NETWORK_STATUS_WAIT_FOR_EVENT) fdevent_event_drained(srv->ev, con->sock, FDEVENT_OUT);
+
 	switch (ret) {
 	case NETWORK_STATUS_WAIT_FOR_FD:
 	case NETWORK_STATUS_WAIT_FOR_AIO_EVENT:
@@ -871,21 +1742,22 @@ network_status_t network_write_chunkqueue(server *srv, connection *con, chunkque
 	if (corked) {
 		corked = 0;
 		setsockopt(con->sock->fd, IPPROTO_TCP, TCP_CORK, &corked, sizeof(corked));
+		con->sock->write_syscalls++;
 	}
 #endif
 
+	/* network.write-syscalls / network.responses-written is the number of
+	 * syscalls we need per response */
+	if (network_write_syscalls) network_write_syscalls->value += con->sock->write_syscalls - syscalls;
+	if (ret == NETWORK_STATUS_SUCCESS && cq->is_closed) {
+		COUNTER_INC(network_responses_written);
+	}
+
 	written = cq->bytes_out - written;
 	con->bytes_written += written;
 	con->bytes_written_cur_second += written;
 
-	*(con->conf.global_bytes_per_second_cnt_ptr) += written;
-
-	if (con->conf.kbytes_per_second &&
-	    (con->bytes_written_cur_second > con->conf.kbytes_per_second * 1024)) {
-		/* we reached the traffic limit */
+	if (allowance != -1) network_shaper_charge(srv, con, written);
 
-		con->traffic_limit_reached = 1;
-		joblist_append(srv, con);
-	}
 	return ret;
 }
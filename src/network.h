@@ -4,13 +4,28 @@
 #include "settings.h"
 #include "server.h"
 
+/* traffic-shaper: interval for the throttled connections and the bucket size in ms of traffic */
+#define NETWORK_SHAPER_TICK_MS 50
+#define NETWORK_SHAPER_BURST_MS 200
+
 LI_API network_status_t network_write_chunkqueue(server *srv, connection *con, chunkqueue *c);
 LI_API network_status_t network_read(server *srv, connection *con, iosocket *sock, chunkqueue *c);
 
 LI_API int network_init(server *srv);
 LI_API int network_close(server *srv);
+LI_API int network_worker_init(server *srv);
 
 LI_API int network_register_fdevents(server *srv);
+LI_API void network_trigger(server *srv);
+LI_API void network_shaper_run(server *srv);
+
+#ifdef USE_MSG_ZEROCOPY
+LI_API int network_zerocopy_reap(server *srv, iosocket *sock);
+LI_API void network_zerocopy_release(server *srv, iosocket *sock, chunkqueue *cq);
+#endif
+#ifdef USE_OPENSSL
+LI_API void network_ssl_handshake_count(iosocket *sock);
+#endif
 LI_API handler_t network_server_handle_fdevent(void *s, void *context, int revents);
 
 #endif
@@ -21,6 +21,16 @@
 
 LI_API NETWORK_BACKEND_WRITE_CHUNK(writev_mem);
 
+/* how much of len the traffic-shaper lets us write in this call */
+LI_API off_t network_write_budget(iosocket *sock, chunkqueue *cq, off_t len);
+
+#ifdef USE_MSG_ZEROCOPY
+/* send len bytes with MSG_ZEROCOPY ? */
+LI_API int network_zerocopy_want(server *srv, iosocket *sock, size_t len);
+/* the chunk is finished, keep its buffer until the kernel is done with it */
+LI_API void network_zerocopy_hold(iosocket *sock, chunk *c);
+#endif
+
 LI_API NETWORK_BACKEND_WRITE(write);
 LI_API NETWORK_BACKEND_WRITE(writev);
 LI_API NETWORK_BACKEND_WRITE(linuxsendfile);
@@ -41,6 +51,9 @@ LI_API NETWORK_BACKEND_READ(win32recv);
 #ifdef USE_OPENSSL
 LI_API NETWORK_BACKEND_WRITE(openssl);
 LI_API NETWORK_BACKEND_READ(openssl);
+#ifdef USE_GTHREAD
+LI_API gpointer network_openssl_handshake_thread(gpointer _srv);
+#endif
 #endif
 
 typedef struct {
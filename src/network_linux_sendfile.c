@@ -69,6 +69,8 @@ NETWORK_BACKEND_WRITE(linuxsendfile) {
 			toSend = c->file.length - c->offset > ((1 << 30) - 1) ?
 				((1 << 30) - 1) : c->file.length - c->offset;
 
+			if (0 == (toSend = network_write_budget(sock, cq, toSend))) return NETWORK_STATUS_WAIT_FOR_EVENT;
+
 			/* open file if not already opened */
 			if (-1 == c->file.fd) {
 				if (-1 == (c->file.fd = open(c->file.name->ptr, O_RDONLY | (srv->srvconf.use_noatime ? O_NOATIME : 0)))) {
@@ -97,6 +99,8 @@ NETWORK_BACKEND_WRITE(linuxsendfile) {
 #endif
 			}
 
+			sock->write_syscalls++;
+
 			if (-1 == (r = sendfile(sock->fd, c->file.fd, &offset, toSend))) {
 				switch (errno) {
 				case EAGAIN:
@@ -26,10 +26,112 @@
 #include "fdevent.h"
 #include "log.h"
 #include "stat_cache.h"
+#include "joblist.h"
 
 # include <openssl/ssl.h>
 # include <openssl/err.h>
 
+#ifdef USE_GTHREAD
+/**
+ * ssl.handshake-threads
+ *
+ * the public-key operations of a handshake can take milliseconds, a burst of
+ * new clients would stall all the other connections. The handshake steps run
+ * in a thread instead: while the job is running the thread owns the SSL, we
+ * don't touch it and wait for the joblist to bring the connection back.
+ *
+ * returns NETWORK_STATUS_SUCCESS if SSL_read() can go on
+ */
+static network_status_t network_openssl_handshake_async(server *srv, connection *con, iosocket *sock) {
+	char c;
+	ssize_t r;
+
+	switch (sock->ssl_handshake_job) {
+	case SSL_HANDSHAKE_JOB_RUNNING:
+		return NETWORK_STATUS_WAIT_FOR_AIO_EVENT;
+	case SSL_HANDSHAKE_JOB_DONE:
+		sock->ssl_handshake_job = SSL_HANDSHAKE_JOB_NONE;
+		network_ssl_handshake_count(sock);
+
+		switch (sock->ssl_handshake_err) {
+		case SSL_ERROR_NONE:
+		case SSL_ERROR_WANT_WRITE:
+			/* SSL_read() takes the data or continues to write the handshake */
+			return NETWORK_STATUS_SUCCESS;
+		case SSL_ERROR_WANT_READ:
+			/* the thread saw the EAGAIN, the next data might have arrived since then */
+			break;
+		default:
+			if (con->conf.log_ssl_noise && sock->ssl_handshake_errcode) {
+				ERROR("SSL handshake failed: %s", ERR_error_string(sock->ssl_handshake_errcode, NULL));
+			}
+
+			return NETWORK_STATUS_CONNECTION_CLOSE;
+		}
+		break;
+	case SSL_HANDSHAKE_JOB_NONE:
+		break;
+	}
+
+	if (SSL_is_init_finished(sock->ssl)) return NETWORK_STATUS_SUCCESS;
+
+	/* don't bother a thread if the client hasn't sent anything yet */
+	if (-1 == (r = recv(sock->fd, &c, 1, MSG_PEEK))) {
+		switch (errno) {
+		case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+		case EWOULDBLOCK:
+#endif
+		case EINTR:
+			return NETWORK_STATUS_WAIT_FOR_EVENT;
+		default:
+			/* let SSL_read() report it */
+			return NETWORK_STATUS_SUCCESS;
+		}
+	} else if (0 == r) {
+		return NETWORK_STATUS_CONNECTION_CLOSE;
+	}
+
+	sock->ssl_handshake_job = SSL_HANDSHAKE_JOB_RUNNING;
+	g_async_queue_push(srv->ssl_handshake_queue, con);
+
+	return NETWORK_STATUS_WAIT_FOR_AIO_EVENT;
+}
+
+gpointer network_openssl_handshake_thread(gpointer _srv) {
+	server *srv = (server *)_srv;
+	connection *con;
+
+	g_async_queue_ref(srv->ssl_handshake_queue);
+
+	while (!srv->is_shutdown) {
+		iosocket *sock;
+		int r;
+
+		if (NULL == (con = g_async_queue_pop(srv->ssl_handshake_queue))) continue;
+		if (con == (connection *) 1) continue; /* just notifying us that srv->is_shutdown changed */
+
+		sock = con->sock;
+
+		ERR_clear_error();
+		r = SSL_do_handshake(sock->ssl);
+
+		sock->ssl_handshake_err = (r == 1) ? SSL_ERROR_NONE : SSL_get_error(sock->ssl, r);
+		/* the error-queue belongs to this thread, keep the reason for the log */
+		sock->ssl_handshake_errcode = ERR_get_error();
+		ERR_clear_error();
+
+		sock->ssl_handshake_job = SSL_HANDSHAKE_JOB_DONE;
+
+		joblist_async_append(srv, con);
+	}
+
+	g_async_queue_unref(srv->ssl_handshake_queue);
+
+	return NULL;
+}
+#endif
+
 NETWORK_BACKEND_READ(openssl) {
 	buffer *b;
 	off_t len;
@@ -42,18 +144,19 @@ NETWORK_BACKEND_READ(openssl) {
 	UNUSED(srv);
 	UNUSED(con);
 
-	/* use a chunk-size of 4k, append to last buffer if it has >= 1kb free */
-#define TOREAD 4096
+#ifdef USE_GTHREAD
+	if (NULL != srv->ssl_handshake_queue &&
+	    NETWORK_STATUS_SUCCESS != (res = network_openssl_handshake_async(srv, con, sock))) {
+		return res;
+	}
+#endif
+
+	/* read into page-sized buffers from the read-pool, append to the last one if it has >= 1kb free */
 
 	do {
 		int oerrno;
 
-		b = (cq->last) ? cq->last->mem : NULL;
-
-		if (NULL == b || b->size - b->used < 1024) {
-			b = chunkqueue_get_append_buffer(cq);
-			buffer_prepare_copy(b, TOREAD+1);
-		}
+		b = chunkqueue_get_read_buffer(cq);
 
 		read_offset = (b->used == 0) ? 0 : b->used - 1;
 		toread = b->size - 1 - read_offset;
@@ -152,245 +255,247 @@ NETWORK_BACKEND_READ(openssl) {
 }
 
 
-NETWORK_BACKEND_WRITE(openssl) {
-	int ssl_r;
+/**
+ * TLS record sizing
+ *
+ * a TLS record can only be decrypted once it is received completely. While
+ * the TCP window is still small (new or idle connection) we keep the records
+ * small enough to fit into a single TCP segment so the client can start
+ * parsing the response headers right away. After SSL_SMALL_RECORDS records we
+ * switch to full 16k records and pass up to SSL_STAGING_SIZE to each
+ * SSL_write().
+ */
+#define SSL_SMALL_RECORD_SIZE 1369
+#define SSL_SMALL_RECORDS     16
+#define SSL_SMALL_RECORDS_IDLE 1 /* seconds */
+#define SSL_STAGING_SIZE      (64 * 1024)
+
+/**
+ * copy the next bytes from the chunkqueue into the staging buffer
+ *
+ * the chunks are not marked as sent yet, that happens when SSL_write() took
+ * the staged data
+ */
+static network_status_t network_openssl_stage(iosocket *sock, chunkqueue *cq, size_t want) {
+	buffer *b = sock->ssl_staging;
 	chunk *c;
 
-	/* this is a 64k sendbuffer
-	 *
-	 * it has to stay at the same location all the time to satisfy the needs
-	 * of SSL_write to pass the SAME parameter in case of a _WANT_WRITE
-	 *
-	 * the buffer is allocated once, is NOT realloced and is NOT freed at shutdown
-	 * -> we expect a 64k block to 'leak' in valgrind
-	 *
-	 *
-	 * In reality we would like to use mmap() but we don't have a guarantee that
-	 * we get the same mmap() address for each call. On openbsd the mmap() address
-	 * even randomized.
-	 *   That means either we keep the mmap() open or we do a read() into a
-	 * constant buffer
-	 * */
-#define LOCAL_SEND_BUFSIZE (64 * 1024)
-	static char *local_send_buffer = NULL;
+	for (c = cq->first; c && b->used < want; c = c->next) {
+		off_t we_have = chunk_length(c);
+		size_t toSend;
 
-	/* the remote side closed the connection before without shutdown request
-	 * - IE
-	 * - wget
-	 * if keep-alive is disabled */
-
-	if (con->keep_alive == 0) {
-		SSL_set_shutdown(sock->ssl, SSL_RECEIVED_SHUTDOWN);
-	}
+		if (we_have == 0) continue;
 
-	for(c = cq->first; c; c = c->next) {
-		int chunk_finished = 0;
+		toSend = want - b->used;
+		if ((off_t)toSend > we_have) toSend = we_have;
 
-		switch(c->type) {
-		case MEM_CHUNK: {
-			char * offset;
-			size_t toSend;
-			ssize_t r = 0;
+		switch (c->type) {
+		case MEM_CHUNK:
+			memcpy(b->ptr + b->used, c->mem->ptr + c->offset, toSend);
+			b->used += toSend;
 
-			if (c->mem->used == 0) {
-				chunk_finished = 1;
-				break;
-			}
-
-			offset = c->mem->ptr + c->offset;
-			toSend = c->mem->used - 1 - c->offset;
-
-			/**
-			 * SSL_write man-page
-			 *
-			 * WARNING
-			 *        When an SSL_write() operation has to be repeated because of
-			 *        SSL_ERROR_WANT_READ or SSL_ERROR_WANT_WRITE, it must be
-			 *        repeated with the same arguments.
-			 *
-			 * SSL_write(..., 0) return 0 which is handle as an error (Success)
-			 * checking toSend and not calling SSL_write() is simpler
-			 */
-
-			ERR_clear_error();
-			if (toSend != 0 && (r = SSL_write(sock->ssl, offset, toSend)) <= 0) {
-				unsigned long err;
-
-				switch ((ssl_r = SSL_get_error(sock->ssl, r))) {
-				case SSL_ERROR_WANT_WRITE:
-					break;
-				case SSL_ERROR_SYSCALL:
-					/* perhaps we have error waiting in our error-queue */
-					if (0 != (err = ERR_get_error())) {
-						do {
-							ERROR("SSL_write(): SSL_get_error() = %d,  SSL_write() = %zd, msg = %s",
-									ssl_r, r,
-									ERR_error_string(err, NULL));
-						} while((err = ERR_get_error()));
-					} else if (r == -1) {
-						/* no, but we have errno */
-						switch(errno) {
-						case EPIPE:
-						case ECONNRESET:
-							return NETWORK_STATUS_CONNECTION_CLOSE;
-						default:
-							ERROR("SSL_write(): SSL_get_error() = %d,  SSL_write() = %zd, errmsg = %s (%d)",
-									ssl_r, r,
-									strerror(errno), errno);
-							break;
-						}
-					} else {
-						/* neither error-queue nor errno ? */
-						ERROR("SSL_write(): SSL_get_error() = %d,  SSL_write() = %zd, errmsg = %s (%d)",
-									ssl_r, r,
-									strerror(errno), errno);
-					}
-
-					return  NETWORK_STATUS_FATAL_ERROR;
-				case SSL_ERROR_ZERO_RETURN:
-					/* clean shutdown on the remote side */
+			break;
+		case FILE_CHUNK: {
+			ssize_t r;
 
-					if (r == 0) return NETWORK_STATUS_CONNECTION_CLOSE;
+			/* keep the file open until the chunk is sent */
+			if (-1 == c->file.fd) {
+				if (-1 == (c->file.fd = open(BUF_STR(c->file.name), O_RDONLY))) {
+					switch (errno) {
+					case EMFILE:
+						return NETWORK_STATUS_WAIT_FOR_FD;
+					default:
+						ERROR("open(%s) failed: %s", SAFE_BUF_STR(c->file.name), strerror(errno));
 
-					/* fall through */
-				default:
-					while((err = ERR_get_error())) {
-						ERROR("SSL_write(): SSL_get_error() = %d,  SSL_write() = %zd, msg = %s",
-								ssl_r, r,
-								ERR_error_string(err, NULL));
+						return NETWORK_STATUS_FATAL_ERROR;
 					}
-
-					return  NETWORK_STATUS_FATAL_ERROR;
 				}
+#ifdef FD_CLOEXEC
+				fcntl(c->file.fd, F_SETFD, FD_CLOEXEC);
+#endif
+			}
+
+#ifdef HAVE_PREAD
+			r = pread(c->file.fd, b->ptr + b->used, toSend, c->file.start + c->offset);
+#else
+			if (-1 == lseek(c->file.fd, c->file.start + c->offset, SEEK_SET)) {
+				r = -1;
 			} else {
-				c->offset += r;
-				cq->bytes_out += r;
+				r = read(c->file.fd, b->ptr + b->used, toSend);
 			}
+#endif
+			if (-1 == r) {
+				ERROR("read(%s) failed: %s", SAFE_BUF_STR(c->file.name), strerror(errno));
+
+				return NETWORK_STATUS_FATAL_ERROR;
+			} else if (0 == r) {
+				/* the file shrunk */
+				ERROR("read(%s) failed: file is shorter than expected", SAFE_BUF_STR(c->file.name));
 
-			if (c->offset == (off_t)c->mem->used - 1) {
-				chunk_finished = 1;
+				return NETWORK_STATUS_FATAL_ERROR;
 			}
 
+			b->used += r;
+
+			/* short read, take what we have */
+			if ((size_t)r < toSend) return NETWORK_STATUS_SUCCESS;
+
 			break;
 		}
-		case FILE_CHUNK: {
-			char *s;
-			ssize_t r;
-			stat_cache_entry *sce = NULL;
-			int ifd;
-			int write_wait = 0;
+		default:
+			ERROR("type not known: %d", c->type);
 
-			if (HANDLER_ERROR == stat_cache_get_entry(srv, con, c->file.name, &sce)) {
-				ERROR("stat_cache_get_entry(%s) failed: %s", SAFE_BUF_STR(c->file.name), strerror(errno));
+			return NETWORK_STATUS_FATAL_ERROR;
+		}
+	}
 
-				return NETWORK_STATUS_FATAL_ERROR;
-			}
+	return NETWORK_STATUS_SUCCESS;
+}
 
-			if (NULL == local_send_buffer) {
-				local_send_buffer = malloc(LOCAL_SEND_BUFSIZE);
-				assert(local_send_buffer);
-			}
+NETWORK_BACKEND_WRITE(openssl) {
+	int ssl_r;
+	network_status_t ret;
 
-			do {
-				off_t offset = c->file.start + c->offset;
-				off_t toSend = c->file.length - c->offset;
+	/* the remote side closed the connection before without shutdown request
+	 * - IE
+	 * - wget
+	 * if keep-alive is disabled */
 
-				if (toSend > LOCAL_SEND_BUFSIZE) toSend = LOCAL_SEND_BUFSIZE;
+	if (con->keep_alive == 0) {
+		SSL_set_shutdown(sock->ssl, SSL_RECEIVED_SHUTDOWN);
+	}
 
-				if (-1 == (ifd = open(BUF_STR(c->file.name), O_RDONLY))) {
-					ERROR("open(%s) failed: %s", SAFE_BUF_STR(c->file.name), strerror(errno));
+#ifdef BIO_get_ktls_send
+	/* ssl.use-ktls: the kernel encrypts everything we write to the socket.
+	 *
+	 * use the plain network-backend which gives us sendfile() for the FILE_CHUNKs
+	 * instead of copying them through the staging buffer. Reads stay with
+	 * SSL_read() as it handles the non-data records for us.
+	 */
+	if (BIO_get_ktls_send(SSL_get_wbio(sock->ssl)) &&
+	    (NULL == sock->ssl_staging || 0 == sock->ssl_staging->used)) {
+		return srv->network_backend_write(srv, con, sock, cq);
+	}
+#endif
 
-					return NETWORK_STATUS_FATAL_ERROR;
-				}
+	/**
+	 * the chunks are collected into the per-connection staging buffer
+	 * which gives us
+	 * - the response header and the first bytes of the content in one record
+	 * - a stable buffer for the SSL_write() retry after SSL_ERROR_WANT_WRITE
+	 *   which has to be called with the SAME arguments
+	 *
+	 * the buffer is released as soon as everything is sent, idle keep-alive
+	 * connections don't hold on to it
+	 */
+	if (NULL == sock->ssl_staging) {
+		sock->ssl_staging = buffer_init();
+		buffer_prepare_copy(sock->ssl_staging, SSL_STAGING_SIZE);
+	}
 
+	while (1) {
+		buffer *b = sock->ssl_staging;
+		ssize_t r;
 
-				lseek(ifd, offset, SEEK_SET);
-				if (-1 == (toSend = read(ifd, local_send_buffer, toSend))) {
-					close(ifd);
-					
-					ERROR("read(%s) failed: %s", SAFE_BUF_STR(c->file.name), strerror(errno));
+		if (b->used == 0) {
+			size_t want = SSL_STAGING_SIZE;
 
-					return NETWORK_STATUS_FATAL_ERROR;
-				}
+			/* start small again after a pause, the congestion window shrinks too */
+			if (srv->cur_ts - sock->ssl_last_write > SSL_SMALL_RECORDS_IDLE) {
+				sock->ssl_records_out = 0;
+			}
 
-				s = local_send_buffer;
+			if (sock->ssl_records_out < SSL_SMALL_RECORDS) {
+				want = SSL_SMALL_RECORD_SIZE;
+			}
 
-				close(ifd);
+			if (0 == (want = network_write_budget(sock, cq, want))) return NETWORK_STATUS_WAIT_FOR_EVENT;
 
-				ERR_clear_error();
-				if ((r = SSL_write(sock->ssl, s, toSend)) <= 0) {
-					unsigned long err;
+			if (NETWORK_STATUS_SUCCESS != (ret = network_openssl_stage(sock, cq, want))) {
+				return ret;
+			}
 
-					switch ((ssl_r = SSL_get_error(sock->ssl, r))) {
-					case SSL_ERROR_WANT_WRITE:
-						write_wait = 1;
-						break;
-					case SSL_ERROR_SYSCALL:
-						/* perhaps we have error waiting in our error-queue */
-						if (0 != (err = ERR_get_error())) {
-							do {
-								ERROR("SSL_write(): ssl-error: %d (ret = %zd): %s",
-										ssl_r, r,
-										ERR_error_string(err, NULL));
-							} while((err = ERR_get_error()));
-						} else if (r == -1) {
-							/* no, but we have errno */
-							switch(errno) {
-							case EPIPE:
-							case ECONNRESET:
-								return NETWORK_STATUS_CONNECTION_CLOSE;
-							default:
-								ERROR("SSL_write(): ssl-error: %d (ret = %zd). errno=%d, %s",
-										ssl_r, r, errno,
-										strerror(errno));
-								break;
-							}
-						} else {
-							ERROR("SSL_write(): ssl-error: %d (ret = %zd). errno=%d, %s",
-										ssl_r, r, errno,
-										strerror(errno));
-						}
-
-						return  NETWORK_STATUS_FATAL_ERROR;
-					case SSL_ERROR_ZERO_RETURN:
-						/* clean shutdown on the remote side */
-
-						if (r == 0)  return NETWORK_STATUS_CONNECTION_CLOSE;
-
-						/* fall thourgh */
-					default:
-						while((err = ERR_get_error())) {
-							ERROR("SSL_write(): ssl-error: %d (ret = %zd), %s",
-									ssl_r, r,
-									ERR_error_string(err, NULL));
-						}
+			if (b->used == 0) {
+				/* all sent */
+				break;
+			}
+		}
 
-						return NETWORK_STATUS_FATAL_ERROR;
+		/**
+		 * SSL_write man-page
+		 *
+		 * WARNING
+		 *        When an SSL_write() operation has to be repeated because of
+		 *        SSL_ERROR_WANT_READ or SSL_ERROR_WANT_WRITE, it must be
+		 *        repeated with the same arguments.
+		 */
+
+		ERR_clear_error();
+		sock->write_syscalls++; /* one record, one write() to the BIO */
+		if ((r = SSL_write(sock->ssl, b->ptr, b->used)) <= 0) {
+			unsigned long err;
+
+			switch ((ssl_r = SSL_get_error(sock->ssl, r))) {
+			case SSL_ERROR_WANT_WRITE:
+				return NETWORK_STATUS_WAIT_FOR_EVENT;
+			case SSL_ERROR_SYSCALL:
+				/* perhaps we have error waiting in our error-queue */
+				if (0 != (err = ERR_get_error())) {
+					do {
+						ERROR("SSL_write(): SSL_get_error() = %d,  SSL_write() = %zd, msg = %s",
+								ssl_r, r,
+								ERR_error_string(err, NULL));
+					} while((err = ERR_get_error()));
+				} else if (r == -1) {
+					/* no, but we have errno */
+					switch(errno) {
+					case EPIPE:
+					case ECONNRESET:
+						return NETWORK_STATUS_CONNECTION_CLOSE;
+					default:
+						ERROR("SSL_write(): SSL_get_error() = %d,  SSL_write() = %zd, errmsg = %s (%d)",
+								ssl_r, r,
+								strerror(errno), errno);
+						break;
 					}
 				} else {
-					c->offset += r;
-					cq->bytes_out += r;
+					/* neither error-queue nor errno ? */
+					ERROR("SSL_write(): SSL_get_error() = %d,  SSL_write() = %zd, errmsg = %s (%d)",
+								ssl_r, r,
+								strerror(errno), errno);
 				}
 
-				if (c->offset == c->file.length) {
-					chunk_finished = 1;
+				return  NETWORK_STATUS_FATAL_ERROR;
+			case SSL_ERROR_ZERO_RETURN:
+				/* clean shutdown on the remote side */
+
+				if (r == 0) return NETWORK_STATUS_CONNECTION_CLOSE;
+
+				/* fall through */
+			default:
+				while((err = ERR_get_error())) {
+					ERROR("SSL_write(): SSL_get_error() = %d,  SSL_write() = %zd, msg = %s",
+							ssl_r, r,
+							ERR_error_string(err, NULL));
 				}
-			} while(!chunk_finished && !write_wait);
 
-			break;
+				return  NETWORK_STATUS_FATAL_ERROR;
+			}
 		}
-		default:
-			ERROR("type not known: %d", c->type);
 
-			return NETWORK_STATUS_FATAL_ERROR;
-		}
+		/* without SSL_MODE_ENABLE_PARTIAL_WRITE SSL_write() takes all or nothing */
+		chunkqueue_skip(cq, r);
+		cq->bytes_out += r;
 
-		if (!chunk_finished) {
-			/* not finished yet */
-			return NETWORK_STATUS_WAIT_FOR_EVENT;
-		}
+		sock->ssl_records_out += (r + SSL3_RT_MAX_PLAIN_LENGTH - 1) / SSL3_RT_MAX_PLAIN_LENGTH;
+		sock->ssl_last_write = srv->cur_ts;
+
+		b->used = 0;
 	}
 
+	buffer_free(sock->ssl_staging);
+	sock->ssl_staging = NULL;
+
 	return NETWORK_STATUS_SUCCESS;
 }
 #endif
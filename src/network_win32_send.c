@@ -45,16 +45,10 @@ NETWORK_BACKEND_READ(win32recv)
 
 	start_bytes_in = cq->bytes_in;
 
-	/* use a chunk-size of 4k, append to last buffer if it has >= 1kb free */
-#define TOREAD 4096
+	/* read into page-sized buffers from the read-pool, append to the last one if it has >= 1kb free */
 
 	do {
-		b = (cq->last) ? cq->last->mem : NULL;
-
-		if (NULL == b || b->size - b->used < 1024) {
-			b = chunkqueue_get_append_buffer(cq);
-			buffer_prepare_copy(b, TOREAD+1);
-		}
+		b = chunkqueue_get_read_buffer(cq);
 
 		read_offset = (b->used == 0) ? 0 : b->used - 1;
 		toread = b->size - 1 - read_offset;
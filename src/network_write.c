@@ -50,16 +50,10 @@ NETWORK_BACKEND_READ(read) {
 
 	start_bytes_in = cq->bytes_in;
 
-	/* use a chunk-size of 4k, append to last buffer if it has >= 1kb free */
-#define TOREAD 4096
+	/* read into page-sized buffers from the read-pool, append to the last one if it has >= 1kb free */
 
 	do {
-		b = (cq->last) ? cq->last->mem : NULL;
-
-		if (NULL == b || b->size - b->used < 1024) {
-			b = chunkqueue_get_append_buffer(cq);
-			buffer_prepare_copy(b, TOREAD+1);
-		}
+		b = chunkqueue_get_read_buffer(cq);
 
 		read_offset = (b->used == 0) ? 0 : b->used - 1;
 		toread = b->size - 1 - read_offset;
@@ -118,10 +112,22 @@ NETWORK_BACKEND_WRITE(write) {
 			offset = c->mem->ptr + c->offset;
 			toSend = c->mem->used - 1 - c->offset;
 
-			if ((r = write(sock->fd, offset, toSend)) < 0) {
-				log_error_write(srv, __FILE__, __LINE__, "ssd", "write failed: ", strerror(errno), sock->fd);
+			if (0 == (toSend = network_write_budget(sock, cq, toSend))) return NETWORK_STATUS_WAIT_FOR_EVENT;
 
-				return NETWORK_STATUS_FATAL_ERROR;
+			if ((r = write(sock->fd, offset, toSend)) < 0) {
+				switch (errno) {
+				case EAGAIN:
+					return NETWORK_STATUS_WAIT_FOR_EVENT;
+				case EINTR:
+					return NETWORK_STATUS_INTERRUPTED;
+				case EPIPE:
+				case ECONNRESET:
+					return NETWORK_STATUS_CONNECTION_CLOSE;
+				default:
+					log_error_write(srv, __FILE__, __LINE__, "ssd", "write failed: ", strerror(errno), sock->fd);
+
+					return NETWORK_STATUS_FATAL_ERROR;
+				}
 			}
 
 			c->offset += r;
@@ -152,6 +158,8 @@ NETWORK_BACKEND_WRITE(write) {
 			offset = c->file.start + c->offset;
 			toSend = c->file.length - c->offset;
 
+			if (0 == (toSend = network_write_budget(sock, cq, toSend))) return NETWORK_STATUS_WAIT_FOR_EVENT;
+
 			if (offset > sce->st.st_size) {
 				log_error_write(srv, __FILE__, __LINE__, "sb", "file was shrinked:", c->file.name);
 
@@ -175,9 +183,22 @@ NETWORK_BACKEND_WRITE(write) {
 			close(ifd);
 
 			if ((r = write(sock->fd, p + offset, toSend)) <= 0) {
-				log_error_write(srv, __FILE__, __LINE__, "ss", "write failed: ", strerror(errno));
+				int err = errno;
+
 				munmap(p, sce->st.st_size);
-				return NETWORK_STATUS_FATAL_ERROR;
+
+				switch (r == 0 ? 0 : err) {
+				case EAGAIN:
+					return NETWORK_STATUS_WAIT_FOR_EVENT;
+				case EINTR:
+					return NETWORK_STATUS_INTERRUPTED;
+				case EPIPE:
+				case ECONNRESET:
+					return NETWORK_STATUS_CONNECTION_CLOSE;
+				default:
+					log_error_write(srv, __FILE__, __LINE__, "ss", "write failed: ", strerror(err));
+					return NETWORK_STATUS_FATAL_ERROR;
+				}
 			}
 
 			munmap(p, sce->st.st_size);
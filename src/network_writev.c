@@ -64,10 +64,14 @@ NETWORK_BACKEND_WRITE_CHUNK(writev_mem) {
 	size_t num_chunks, i;
 	struct iovec chunks[UIO_MAXIOV];
 	chunk *tc; /* transfer chunks */
+	chunk *last = c;
 	size_t num_bytes = 0;
+	size_t max_bytes;
+	int flags = 0;
 
 	UNUSED(con);
 	/* we can't send more then SSIZE_MAX bytes in one chunk */
+	if (0 == (max_bytes = network_write_budget(sock, cq, SSIZE_MAX))) return NETWORK_STATUS_WAIT_FOR_EVENT;
 
 	/* build writev list
 	 *
@@ -77,6 +81,8 @@ NETWORK_BACKEND_WRITE_CHUNK(writev_mem) {
 	for(num_chunks = 0, tc = c; tc && tc->type == MEM_CHUNK && num_chunks < UIO_MAXIOV; num_chunks++, tc = tc->next);
 
 	for(tc = c, i = 0; i < num_chunks; tc = tc->next, i++) {
+		last = tc;
+
 		if (tc->mem->used == 0) {
 			chunks[i].iov_base = tc->mem->ptr;
 			chunks[i].iov_len  = 0;
@@ -86,10 +92,11 @@ NETWORK_BACKEND_WRITE_CHUNK(writev_mem) {
 
 			chunks[i].iov_base = offset;
 
-			/* protect the return value of writev() */
-			if (toSend > SSIZE_MAX ||
-			    num_bytes + toSend > SSIZE_MAX) {
-				chunks[i].iov_len = SSIZE_MAX - num_bytes;
+			/* protect the return value of writev() and stay in the traffic-shaper budget */
+			if (toSend > max_bytes ||
+			    num_bytes + toSend > max_bytes) {
+				chunks[i].iov_len = max_bytes - num_bytes;
+				num_bytes = max_bytes;
 
 				num_chunks = i + 1;
 				break;
@@ -101,7 +108,41 @@ NETWORK_BACKEND_WRITE_CHUNK(writev_mem) {
 		}
 	}
 
-	if ((r = writev(sock->fd, chunks, num_chunks)) < 0) {
+#ifdef MSG_MORE
+	/* the backend sends the file right after us: keep the header in the
+	 * socket until the file-data joins it instead of corking the socket */
+	if (tc && tc->type == FILE_CHUNK && srv->network_backend_msg_more) flags |= MSG_MORE;
+#endif
+#ifdef USE_MSG_ZEROCOPY
+	/* the last chunk of an open queue might still grow (and realloc()) */
+	if ((last->next || cq->is_closed) &&
+	    network_zerocopy_want(srv, sock, num_bytes)) flags |= MSG_ZEROCOPY;
+#endif
+
+	if (flags) {
+		struct msghdr msg;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = chunks;
+		msg.msg_iovlen = num_chunks;
+
+		r = sendmsg(sock->fd, &msg, flags);
+#ifdef USE_MSG_ZEROCOPY
+		if (r < 0 && errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+			/* too many completions pending (optmem_max), collect them and copy this time */
+			network_zerocopy_reap(srv, sock);
+			flags &= ~MSG_ZEROCOPY;
+
+			r = sendmsg(sock->fd, &msg, flags);
+		}
+#endif
+	} else {
+		r = writev(sock->fd, chunks, num_chunks);
+	}
+
+	sock->write_syscalls++;
+
+	if (r < 0) {
 		switch (errno) {
 		case EAGAIN:
 			return NETWORK_STATUS_WAIT_FOR_EVENT;
@@ -120,6 +161,20 @@ NETWORK_BACKEND_WRITE_CHUNK(writev_mem) {
 
 	cq->bytes_out += r;
 
+#ifdef USE_MSG_ZEROCOPY
+	if (flags & MSG_ZEROCOPY) {
+		/* the kernel numbers the successful sends the same way */
+		unsigned int seq = sock->zerocopy_seq++;
+
+		for(i = 0, tc = c; i < num_chunks; i++, tc = tc->next) {
+			if (chunks[i].iov_len == 0) continue;
+
+			tc->zerocopy.used = 1;
+			tc->zerocopy.seq = seq;
+		}
+	}
+#endif
+
 	/* check which chunks have been written */
 
 	for(i = 0, tc = c; i < num_chunks; i++, tc = tc->next) {
@@ -127,6 +182,9 @@ NETWORK_BACKEND_WRITE_CHUNK(writev_mem) {
 			/* written */
 			r -= chunks[i].iov_len;
 			tc->offset += chunks[i].iov_len;
+#ifdef USE_MSG_ZEROCOPY
+			if (tc->zerocopy.used && chunk_is_done(tc)) network_zerocopy_hold(sock, tc);
+#endif
 		} else {
 			/* partially written */
 
@@ -166,7 +224,8 @@ NETWORK_BACKEND_WRITE(writev) {
 			}
 
 			break;
-		case FILE_CHUNK: {
+		case FILE_CHUNK:
+		next_window: {
 			ssize_t r;
 			off_t abs_offset;
 			off_t toSend;
@@ -299,12 +358,16 @@ NETWORK_BACKEND_WRITE(writev) {
 				assert(toSend < 0);
 			}
 
+			if (0 == (toSend = network_write_budget(sock, cq, toSend))) return NETWORK_STATUS_WAIT_FOR_EVENT;
+
 #ifdef LOCAL_BUFFERING
 			start = c->mem->ptr;
 #else
 			start = c->file.mmap.start;
 #endif
 
+			sock->write_syscalls++;
+
 			if ((r = write(sock->fd, start + (abs_offset - c->file.mmap.offset), toSend)) < 0) {
 				switch (errno) {
 				case EAGAIN:
@@ -332,6 +395,10 @@ NETWORK_BACKEND_WRITE(writev) {
 					munmap(c->file.mmap.start, c->file.mmap.length);
 					c->file.mmap.start = MAP_FAILED;
 				}
+			} else if (r == toSend) {
+				/* only the mmap()ed window is done, the socket didn't say EAGAIN yet:
+				 * returning now would report it drained to the edge-triggered event-handler */
+				goto next_window;
 			}
 
 			break;
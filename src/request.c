@@ -13,6 +13,7 @@
 #include "http_req.h"
 
 #include "sys-strings.h"
+#include "http_header.h"
 
 static int request_check_hostname(buffer *host) {
 	enum { DOMAINLABEL, TOPLABEL } stage = TOPLABEL;
@@ -344,10 +345,9 @@ int http_request_parse(server *srv, connection *con, http_req *req) {
 	for (i = 0; i < req->headers->used; i++) {
 		data_string *ds = (data_string *)req->headers->data[i];
 		data_string *hdr;
-		int cmp;
 
-		/* this list is sorted */
-		if (0 == (cmp = buffer_caseless_compare(CONST_BUF_LEN(ds->key), CONST_STR_LEN("Connection")))) {
+		switch (http_header_id(ds)) {
+		case HTTP_HEADER_CONNECTION: {
 			array *vals;
 			size_t vi;
 			/* Connection: Keep-Alive, ... */
@@ -370,7 +370,9 @@ int http_request_parse(server *srv, connection *con, http_req *req) {
 					break;
 				}
 			}
-		} else if (cmp > 0 && 0 == (cmp = buffer_caseless_compare(CONST_BUF_LEN(ds->key), CONST_STR_LEN("Content-Length")))) {
+			break;
+		}
+		case HTTP_HEADER_CONTENT_LENGTH: {
 			char *err;
 			off_t r;
 
@@ -419,7 +421,9 @@ int http_request_parse(server *srv, connection *con, http_req *req) {
 			}
 
 			con->request.content_length = r;
-		} else if (cmp > 0 && 0 == (cmp = buffer_caseless_compare(CONST_BUF_LEN(ds->key), CONST_STR_LEN("Expect")))) {
+			break;
+		}
+		case HTTP_HEADER_EXPECT:
 			/* HTTP 2616 8.2.3
 			 * Expect: 100-continue
 			 *
@@ -440,7 +444,8 @@ int http_request_parse(server *srv, connection *con, http_req *req) {
 				con->http_status = 417;
 				return 0;
 			}
-		} else if (cmp > 0 && 0 == (cmp = buffer_caseless_compare(CONST_BUF_LEN(ds->key), CONST_STR_LEN("Host")))) {
+			break;
+		case HTTP_HEADER_HOST:
 			if (request_check_hostname(ds->value)) {
 				TRACE("Host header is invalid (Status: 400), was %s", SAFE_BUF_STR(ds->value));
 				con->http_status = 400;
@@ -457,36 +462,15 @@ int http_request_parse(server *srv, connection *con, http_req *req) {
 			}
 
 			buffer_copy_string_buffer(con->request.http_host, ds->value);
-		} else if (cmp > 0 && 0 == (cmp = buffer_caseless_compare(CONST_BUF_LEN(ds->key), CONST_STR_LEN("If-Modified-Since")))) {
-			data_string *old;
-
-			if (NULL != (old = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("If-Modified-Since")))) {
-				if (0 != buffer_caseless_compare(CONST_BUF_LEN(old->value), CONST_BUF_LEN(ds->value))) {
-					/* duplicate header and different timestamps */
-					con->http_status = 400;
-
-					TRACE("%s", "If-Modified-Since is duplicate (Status: 400)");
-
-					return 0;
-				}
-			}
-		} else if (cmp > 0 && 0 == (cmp = buffer_caseless_compare(CONST_BUF_LEN(ds->key), CONST_STR_LEN("If-None-Match")))) {
-			data_string *old;
+			break;
+		case HTTP_HEADER_IF_NONE_MATCH:
 			/* if dup, only the first one will survive */
-			if (NULL != (old = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("If-None-Match")))) {
+			if (NULL != http_header_get(con->request.headers, HTTP_HEADER_IF_NONE_MATCH)) {
 				continue;
 			}
-		} else if (cmp > 0 && 0 == (cmp = buffer_caseless_compare(CONST_BUF_LEN(ds->key), CONST_STR_LEN("Range")))) {
-			if (NULL != array_get_element(con->request.headers, CONST_STR_LEN("Range"))) { 
-				/* duplicate Range header */
-
-				TRACE("%s", "Range: header is duplicate (Status: 400)");
-
-				con->http_status = 400;
-				con->keep_alive = 0;
-
-				return 0;
-			}
+			break;
+		default:
+			break;
 		}
 
 		if (NULL == (hdr = (data_string *)array_get_unused_element(con->request.headers, TYPE_STRING))) {
@@ -495,6 +479,7 @@ int http_request_parse(server *srv, connection *con, http_req *req) {
 
 		buffer_copy_string_buffer(hdr->key, ds->key);
 		buffer_copy_string_buffer(hdr->value, ds->value);
+		hdr->header_id = ds->header_id;
 
 		array_insert_unique(con->request.headers, (data_unset *)hdr);
 	}
@@ -19,6 +19,7 @@
 #include "log.h"
 #include "stat_cache.h"
 #include "chunk.h"
+#include "http_header.h"
 
 #include "connections.h"
 
@@ -28,24 +29,62 @@
 #include "sys-files.h"
 #include "sys-strings.h"
 
+/* "<code> <reason-phrase>" of the status-line, built on first use */
+typedef struct {
+	char ptr[48];
+	size_t len;
+} http_status_line;
+
+static http_status_line http_status_lines[500]; /* 100 - 599 */
+
+static size_t http_status_line_build(char *dst, size_t size, int status) {
+	const char *name = get_http_status_name(status);
+	int n;
+
+	n = snprintf(dst, size, "%d %s", status, name ? name : "");
+
+	if (n < 0) return 0;
+
+	return (size_t)n < size ? (size_t)n : size - 1;
+}
+
+/**
+ * the headers which are for lighttpd only are not sent to the client
+ */
+static int http_response_header_is_sent(data_string *ds) {
+	if (ds->value->used == 0 || ds->key->used == 0) return 0;
+
+	switch (http_header_id(ds)) {
+	case HTTP_HEADER_X_SENDFILE:
+	case HTTP_HEADER_X_LIGHTTPD_SEND_FILE:
+	case HTTP_HEADER_X_LIGHTTPD_SEND_TEMPFILE:
+		return 0;
+	case HTTP_HEADER_OTHER:
+		return 0 != strncasecmp(ds->key->ptr, CONST_STR_LEN("X-LIGHTTPD-"));
+	default:
+		return 1;
+	}
+}
+
+/**
+ * serialize the response header into a chunk in front of @raw
+ *
+ * the size of the header block is summed up first, the block is then
+ * written into a buffer of exactly that size without any reallocation.
+ * The status-line, the Date: and the Server: line come from caches.
+ */
 int http_response_write_header(server *srv, connection *con, chunkqueue *raw) {
 	buffer *b;
-	size_t i;
+	array *hdrs = con->response.headers;
+	size_t i, size;
+	const char *status;
+	size_t status_len;
+	char status_buf[64];
+	char *p;
 	int have_date = 0;
 	int have_server = 0;
 	int allow_keep_alive = 0;
 
-	b = chunkqueue_get_prepend_buffer(raw);
-
-	if (con->request.http_version == HTTP_VERSION_1_1) {
-		buffer_copy_string_len(b, CONST_STR_LEN("HTTP/1.1 "));
-	} else {
-		buffer_copy_string_len(b, CONST_STR_LEN("HTTP/1.0 "));
-	}
-	buffer_append_long(b, con->http_status);
-	buffer_append_string_len(b, CONST_STR_LEN(" "));
-	buffer_append_string(b, get_http_status_name(con->http_status));
-
 	if (con->response.transfer_encoding & HTTP_TRANSFER_ENCODING_CHUNKED) {
 		response_header_overwrite(srv, con, CONST_STR_LEN("Transfer-Encoding"), CONST_STR_LEN("chunked"));
 		allow_keep_alive = 1;
@@ -82,34 +121,35 @@ int http_response_write_header(server *srv, connection *con, chunkqueue *raw) {
 		}
 	}
 
+	if (con->http_status >= 100 && con->http_status < 600) {
+		http_status_line *sl = &http_status_lines[con->http_status - 100];
 
-	/* add all headers */
-	for (i = 0; i < con->response.headers->used; i++) {
-		data_string *ds;
+		if (sl->len == 0) {
+			sl->len = http_status_line_build(sl->ptr, sizeof(sl->ptr), con->http_status);
+		}
+		status = sl->ptr;
+		status_len = sl->len;
+	} else {
+		status_len = http_status_line_build(status_buf, sizeof(status_buf), con->http_status);
+		status = status_buf;
+	}
 
-		ds = (data_string *)con->response.headers->data[i];
+	/* the size of the header block */
+	size = sizeof("HTTP/1.1 ") - 1 + status_len;
 
-		if (ds->value->used && ds->key->used &&
-		    0 != strncasecmp(ds->key->ptr, CONST_STR_LEN("X-LIGHTTPD-")) &&
-		    0 != strcasecmp(ds->key->ptr, "X-Sendfile")) {
-			if (0 == strcasecmp(ds->key->ptr, "Date")) have_date = 1;
-			if (0 == strcasecmp(ds->key->ptr, "Server")) have_server = 1;
+	for (i = 0; i < hdrs->used; i++) {
+		data_string *ds = (data_string *)hdrs->data[i];
 
-			buffer_append_string_len(b, CONST_STR_LEN("\r\n"));
-			buffer_append_string_buffer(b, ds->key);
-			buffer_append_string_len(b, CONST_STR_LEN(": "));
-			buffer_append_string_buffer(b, ds->value);
-#if 0
-			log_error_write(srv, __FILE__, __LINE__, "bb",
-					ds->key, ds->value);
-#endif
-		}
+		if (!http_response_header_is_sent(ds)) continue;
+
+		if (ds->header_id == HTTP_HEADER_DATE) have_date = 1;
+		if (ds->header_id == HTTP_HEADER_SERVER) have_server = 1;
+
+		/* CRLF, key, ": ", value */
+		size += ds->key->used - 1 + ds->value->used - 1 + 4;
 	}
 
 	if (!have_date) {
-		/* HTTP/1.1 requires a Date: header */
-		buffer_append_string_len(b, CONST_STR_LEN("\r\nDate: "));
-
 		/* cache the generated timestamp */
 		if (srv->cur_ts != srv->last_generated_date_ts) {
 			buffer_prepare_copy(srv->ts_date_str, 255);
@@ -122,20 +162,62 @@ int http_response_write_header(server *srv, connection *con, chunkqueue *raw) {
 			srv->last_generated_date_ts = srv->cur_ts;
 		}
 
-		buffer_append_string_buffer(b, srv->ts_date_str);
+		size += sizeof("\r\nDate: ") - 1 + srv->ts_date_str->used - 1;
+	}
+
+	if (!have_server) size += con->conf.server_tag_line->used - 1;
+
+	size += sizeof("\r\n\r\n") - 1;
+
+	/* write it */
+	b = chunkqueue_get_prepend_buffer(raw);
+	buffer_prepare_copy(b, size + 1);
+	p = b->ptr;
+
+	if (con->request.http_version == HTTP_VERSION_1_1) {
+		memcpy(p, "HTTP/1.1 ", sizeof("HTTP/1.1 ") - 1);
+	} else {
+		memcpy(p, "HTTP/1.0 ", sizeof("HTTP/1.0 ") - 1);
+	}
+	p += sizeof("HTTP/1.1 ") - 1;
+	memcpy(p, status, status_len);
+	p += status_len;
+
+	for (i = 0; i < hdrs->used; i++) {
+		data_string *ds = (data_string *)hdrs->data[i];
+
+		if (!http_response_header_is_sent(ds)) continue;
+
+		*p++ = '\r';
+		*p++ = '\n';
+		memcpy(p, ds->key->ptr, ds->key->used - 1);
+		p += ds->key->used - 1;
+		*p++ = ':';
+		*p++ = ' ';
+		memcpy(p, ds->value->ptr, ds->value->used - 1);
+		p += ds->value->used - 1;
+	}
+
+	if (!have_date) {
+		/* HTTP/1.1 requires a Date: header */
+		memcpy(p, "\r\nDate: ", sizeof("\r\nDate: ") - 1);
+		p += sizeof("\r\nDate: ") - 1;
+		memcpy(p, srv->ts_date_str->ptr, srv->ts_date_str->used - 1);
+		p += srv->ts_date_str->used - 1;
 	}
 
 	if (!have_server) {
-		if (buffer_is_empty(con->conf.server_tag)) {
-			buffer_append_string_len(b, CONST_STR_LEN("\r\nServer: " PACKAGE_NAME "/" PACKAGE_VERSION));
-		} else {
-			buffer_append_string_len(b, CONST_STR_LEN("\r\nServer: "));
-			buffer_append_string_buffer(b, con->conf.server_tag);
-		}
+		memcpy(p, con->conf.server_tag_line->ptr, con->conf.server_tag_line->used - 1);
+		p += con->conf.server_tag_line->used - 1;
 	}
 
-	buffer_append_string_len(b, CONST_STR_LEN("\r\n\r\n"));
+	memcpy(p, "\r\n\r\n", 4);
+	p += 4;
+
+	assert((size_t)(p - b->ptr) == size);
 
+	*p = '\0';
+	b->used = size + 1;
 
 	con->bytes_header = b->used - 1;
 	raw->bytes_in += b->used - 1;
@@ -17,6 +17,8 @@ LI_API int response_header_append(server *srv, connection *con, const char *key,
 LI_API handler_t handle_get_backend(server *srv, connection *con);
 LI_API int http_response_redirect_to_directory(server *srv, connection *con);
 LI_API int http_response_handle_cachable(server *srv, connection *con, buffer * mtime, buffer * etag);
+LI_API int http_response_range(server *srv, connection *con, buffer *path, buffer *mem, off_t size);
+LI_API void http_accept_encoding_get_qvalues(const char *value, const char * const names[], int qvalues[]);
 
 LI_API buffer * strftime_cache_get(server *srv, time_t last_mod);
 #endif
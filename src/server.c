@@ -1,3 +1,14 @@
+/**
+ * make sure _GNU_SOURCE is defined (for sched_setaffinity())
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -74,6 +85,10 @@
 #include <sys/prctl.h>
 #endif
 
+#ifdef HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#endif
+
 #ifdef USE_OPENSSL
 #include <openssl/err.h>
 #endif
@@ -182,6 +197,38 @@ static void daemonize(void) {
 }
 #endif
 
+/**
+ * server.worker-cpu-affinity: pin the event-loop of worker N to CPU N
+ *
+ * called after the stat- and aio-threads are started, only the calling
+ * thread is pinned and the helper threads keep running on all CPUs
+ */
+static void server_worker_set_affinity(server *srv) {
+#ifdef HAVE_SCHED_SETAFFINITY
+	cpu_set_t cpus;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (ncpus < 1) return;
+
+	if (srv->srvconf.max_worker > ncpus && srv->worker_ndx == 0) {
+		log_error_write(srv, __FILE__, __LINE__, "sdsd",
+				"server.max-worker =", srv->srvconf.max_worker,
+				"is larger than the number of cpus:", (int)ncpus);
+	}
+
+	CPU_ZERO(&cpus);
+	CPU_SET(srv->worker_ndx % ncpus, &cpus);
+
+	if (0 != sched_setaffinity(0, sizeof(cpus), &cpus)) {
+		log_error_write(srv, __FILE__, __LINE__, "sds",
+				"sched_setaffinity() to cpu", (int)(srv->worker_ndx % ncpus), strerror(errno));
+	}
+#else
+	log_error_write(srv, __FILE__, __LINE__, "s",
+			"server.worker-cpu-affinity is ignored, the platform has no sched_setaffinity()");
+#endif
+}
+
 static server *server_init(void) {
 	int i;
 	FILE *frandom = NULL;
@@ -190,6 +237,7 @@ static server *server_init(void) {
 	assert(srv);
 
 	srv->max_fds = 1024;
+	srv->worker_ndx = -1;
 #define CLEAN(x) \
 	srv->x = buffer_init();
 
@@ -254,6 +302,9 @@ static server *server_init(void) {
 	srv->fdwaitqueue = calloc(1, sizeof(*srv->fdwaitqueue));
 	assert(srv->fdwaitqueue);
 
+	srv->throttled = calloc(1, sizeof(*srv->throttled));
+	assert(srv->throttled);
+
 	srv->srvconf.modules = array_init();
 	srv->srvconf.modules_dir = buffer_init_string(LIBRARY_DIR);
 	srv->srvconf.network_backend = buffer_init();
@@ -332,11 +383,13 @@ static void server_free(server *srv) {
 			buffer_free(s->document_root);
 			buffer_free(s->server_name);
 			buffer_free(s->server_tag);
+			buffer_free(s->server_tag_line);
 			buffer_free(s->ssl_pemfile);
 			buffer_free(s->ssl_ca_file);
 			buffer_free(s->error_handler);
 			buffer_free(s->errorfile_prefix);
 			array_free(s->mimetypes);
+			mimetype_table_free(s->mimetype_table);
 			buffer_free(s->ssl_cipher_list);
 			buffer_free(s->ssl_verifyclient_username);
 #ifdef USE_OPENSSL
@@ -360,6 +413,7 @@ static void server_free(server *srv) {
 	joblist_free(srv, srv->joblist);
 	joblist_free(srv, srv->joblist_prev);
 	fdwaitqueue_free(srv, srv->fdwaitqueue);
+	joblist_free(srv, srv->throttled);
 
 	if (srv->stat_cache) {
 		stat_cache_free(srv->stat_cache);
@@ -416,6 +470,16 @@ static void show_features (void) {
 #else
       "\t- bzip2 support\n"
 #endif
+#if defined HAVE_BROTLI_ENCODE_H && defined HAVE_LIBBROTLIENC
+      "\t+ brotli support\n"
+#else
+      "\t- brotli support\n"
+#endif
+#if defined HAVE_ZSTD_H && defined HAVE_LIBZSTD
+      "\t+ zstd support\n"
+#else
+      "\t- zstd support\n"
+#endif
 #ifdef HAVE_LIBCRYPT
       "\t+ crypt support\n"
 #else
@@ -549,10 +613,19 @@ int server_out_of_fds(server *srv, connection *con) {
 	return 0;
 }
 
+static uint64_t server_wall_usec(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
 static int lighty_mainloop(server *srv) {
 	fdevent_revents *revents = fdevent_revents_init();
 	int poll_errno;
 	size_t conns_user_at_sockets_disabled = 0;
+	uint64_t busy_start = server_wall_usec(), busy_end;
 
 	/* the getevents and the poll() have to run in parallel
 	 * as soon as one has data, it has to interrupt the otherone */
@@ -648,6 +721,9 @@ static int lighty_mainloop(server *srv) {
 
 				/* cleanup stat-cache */
 				stat_cache_trigger_cleanup(srv);
+
+				/* rotate the ssl session ticket keys */
+				network_trigger(srv);
 				/**
 				 * check all connections for timeouts
 				 *
@@ -655,18 +731,21 @@ static int lighty_mainloop(server *srv) {
 				for (ndx = 0; ndx < conns->used; ndx++) {
 					int changed = 0;
 					connection *con;
-					int t_diff;
 
 					con = conns->ptr[ndx];
 
 					switch (con->state) {
 					case CON_STATE_READ_REQUEST_HEADER:
 					case CON_STATE_READ_REQUEST_CONTENT:
+#ifdef USE_OPENSSL
+						/* a handshake thread owns the connection, it will come back soon */
+						if (con->sock->ssl && con->sock->ssl_handshake_job == SSL_HANDSHAKE_JOB_RUNNING) break;
+#endif
 						if (con->recv->is_closed) {
 							if (srv->cur_ts - con->read_idle_ts > con->conf.max_connection_idle) {
 								/* time - out */
 #if 0
-								TRACE("(connection process timeout) [%s]", SAFE_BUF_STR(con->dst_addr_buf));
+								TRACE("(connection process timeout) [%s]", SAFE_BUF_STR(connection_get_dst_addr_buf(srv, con)));
 #endif
 								connection_set_state(srv, con, CON_STATE_ERROR);
 								changed = 1;
@@ -677,7 +756,7 @@ static int lighty_mainloop(server *srv) {
 							if (srv->cur_ts - con->read_idle_ts > con->conf.max_read_idle) {
 								/* time - out */
 #if 0
-								TRACE("(initial read timeout) [%s]", SAFE_BUF_STR(con->dst_addr_buf));
+								TRACE("(initial read timeout) [%s]", SAFE_BUF_STR(connection_get_dst_addr_buf(srv, con)));
 #endif
 								connection_set_state(srv, con, CON_STATE_ERROR);
 								changed = 1;
@@ -686,7 +765,7 @@ static int lighty_mainloop(server *srv) {
 							if (srv->cur_ts - con->read_idle_ts > con->keep_alive_idle) {
 								/* time - out */
 #if 0
-								TRACE("(keep-alive read timeout) [%s]", SAFE_BUF_STR(con->dst_addr_buf));
+								TRACE("(keep-alive read timeout) [%s]", SAFE_BUF_STR(connection_get_dst_addr_buf(srv, con)));
 #endif
 								connection_set_state(srv, con, CON_STATE_ERROR);
 								changed = 1;
@@ -718,23 +797,10 @@ static int lighty_mainloop(server *srv) {
 						/* the other ones are uninteresting */
 						break;
 					}
-					/* we don't like div by zero */
-					if (0 == (t_diff = srv->cur_ts - con->connection_start)) t_diff = 1;
-
-					if (con->traffic_limit_reached &&
-					    (con->conf.kbytes_per_second == 0 ||
-					     ((con->bytes_written / t_diff) < con->conf.kbytes_per_second * 1024))) {
-						/* enable connection again */
-						con->traffic_limit_reached = 0;
-
-						changed = 1;
-					}
-
 					if (changed) {
 						connection_state_machine(srv, con);
 					}
 					con->bytes_written_cur_second = 0;
-					*(con->conf.global_bytes_per_second_cnt_ptr) = 0;
 
 #if 0
 					if (cs == 0) {
@@ -866,8 +932,15 @@ static int lighty_mainloop(server *srv) {
 				connection_state_machine(srv, con);
 			}
 		}
-		n = fdevent_poll(srv->ev, 1000);
+		network_shaper_run(srv);
+
+		/* the load of the main-loop, the other threads don't count (mod_deflate's auto-tune) */
+		busy_end = server_wall_usec();
+		if (busy_end > busy_start) srv->loop_busy_usec += busy_end - busy_start;
+
+		n = fdevent_poll(srv->ev, srv->throttled->used ? NETWORK_SHAPER_TICK_MS : 1000);
 		poll_errno = errno;
+		busy_start = server_wall_usec();
 #ifdef USE_GTHREAD
 		g_atomic_int_set(&srv->did_wakeup, 0);
 #endif
@@ -1007,6 +1080,9 @@ int main (int argc, char **argv, char **envp) {
 #ifdef USE_GTHREAD
 	GThread **stat_cache_threads;
 	GThread **aio_write_threads = NULL;
+#ifdef USE_OPENSSL
+	GThread **ssl_handshake_threads = NULL;
+#endif
 #ifdef USE_LINUX_AIO_SENDFILE
 	GThread *linux_aio_read_thread_id = NULL;
 #endif
@@ -1054,6 +1130,9 @@ int main (int argc, char **argv, char **envp) {
 	srv->srvconf.daemonize_on_shutdown = 0;
 	srv->srvconf.max_stat_threads = 4;
 	srv->srvconf.max_read_threads = 8;
+	srv->srvconf.max_accept = 100;
+	srv->srvconf.ssl_ticket_key_rotate = 3600;
+	srv->srvconf.upload_segment_size = 1024;
 
 	while(-1 != (o = getopt(argc, argv, "f:m:hvVDIpt"))) {
 		switch(o) {
@@ -1518,29 +1597,46 @@ int main (int argc, char **argv, char **envp) {
 	getitimer(ITIMER_REAL, &interval);
 #endif
 
+	if (srv->srvconf.worker_cpu_affinity && srv->srvconf.max_worker == 0) {
+		log_error_write(srv, __FILE__, __LINE__, "s",
+				"server.worker-cpu-affinity is ignored, it needs server.max-worker");
+	}
+
 #ifdef HAVE_FORK
 	/* start watcher and workers */
 	num_childs = srv->srvconf.max_worker;
 	if (num_childs > 0) {
+		/* the pid of each worker slot, a restarted worker takes over the slot (and the sockets) of the dead one */
+		pid_t *workers = calloc(num_childs, sizeof(*workers));
 		int child = 0;
 		while (!child && !srv_shutdown) {
-			if (num_childs > 0) {
-				switch (fork()) {
+			int ndx;
+
+			for (ndx = 0; ndx < num_childs && workers[ndx] != 0; ndx++);
+
+			if (ndx < num_childs) {
+				pid_t pid;
+
+				switch (pid = fork()) {
 				case -1:
 					return -1;
 				case 0:
 					child = 1;
+					srv->worker_ndx = ndx;
 					break;
 				default:
-					num_childs--;
+					workers[ndx] = pid;
 					break;
 				}
 			} else {
 				int status;
+				pid_t pid;
 
-				if (-1 != wait(&status)) {
+				if (-1 != (pid = wait(&status))) {
 					/* a child terminated, restart it */
-					num_childs++;
+					for (ndx = 0; ndx < num_childs; ndx++) {
+						if (workers[ndx] == pid) workers[ndx] = 0;
+					}
 				} else {
 					/* we got interrupted */
 
@@ -1565,6 +1661,8 @@ int main (int argc, char **argv, char **envp) {
 			}
 		}
 
+		free(workers);
+
 		if (srv_shutdown) {
 			/* kill all childs */
 			kill(0, SIGTERM);
@@ -1572,6 +1670,8 @@ int main (int argc, char **argv, char **envp) {
 
 		/* if we are the parent, leave here */
 		if (!child) return 0;
+
+		network_worker_init(srv);
 	}
 #endif
 
@@ -1644,6 +1744,22 @@ int main (int argc, char **argv, char **envp) {
 		}
 	}
 
+#ifdef USE_OPENSSL
+	if (srv->srvconf.max_ssl_handshake_threads) {
+		srv->ssl_handshake_queue = g_async_queue_new();
+		ssl_handshake_threads = calloc(srv->srvconf.max_ssl_handshake_threads, sizeof(*ssl_handshake_threads));
+
+		for (i = 0; i < srv->srvconf.max_ssl_handshake_threads; i++) {
+			ssl_handshake_threads[i] = g_thread_create(network_openssl_handshake_thread, srv, 1, &gerr);
+			if (gerr) {
+				ERROR("g_thread_create failed: %s", gerr->message);
+
+				return -1;
+			}
+		}
+	}
+#endif
+
 #ifndef _WIN32
 	switch (srv->network_backend) {
 	case NETWORK_BACKEND_GTHREAD_AIO:
@@ -1712,6 +1828,10 @@ int main (int argc, char **argv, char **envp) {
 
 #endif /* USE_GTHREAD */
 
+	if (srv->worker_ndx != -1 && srv->srvconf.worker_cpu_affinity) {
+		server_worker_set_affinity(srv);
+	}
+
 	for (i = 0; i < srv->srv_sockets.used; i++) {
 		server_socket *srv_socket = srv->srv_sockets.ptr[i];
 		if (-1 == fdevent_fcntl_set(srv->ev, srv_socket->sock)) {
@@ -1766,6 +1886,21 @@ int main (int argc, char **argv, char **envp) {
 		g_thread_join(stat_cache_threads[i]);
 	}
 
+#ifdef USE_OPENSSL
+	if (ssl_handshake_threads != NULL) {
+		for (i = 0; i < srv->srvconf.max_ssl_handshake_threads; i++) {
+			g_async_queue_push(srv->ssl_handshake_queue, (void *) 1);
+		}
+
+		for (i = 0; i < srv->srvconf.max_ssl_handshake_threads; i++) {
+			g_thread_join(ssl_handshake_threads[i]);
+		}
+		free(ssl_handshake_threads);
+
+		g_async_queue_unref(srv->ssl_handshake_queue);
+	}
+#endif
+
 	/* the ref-count should be 0 now */
 	g_async_queue_unref(srv->stat_queue);
 	g_async_queue_unref(srv->joblist_queue);
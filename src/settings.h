@@ -18,6 +18,27 @@
  */
 #define BUFFER_MAX_REUSE_SIZE  (4 * 1024)
 
+/**
+ * size of the buffers the network backends read into
+ *
+ * a page minus the malloc() overhead. It is not a multiple of the
+ * buffer allocation steps, a buffer of that size came from the read-pool.
+ */
+#define READ_BUFFER_SIZE  (4 * 1024 - 16)
+
+/**
+ * max number of unused read buffers kept in the read-pool
+ */
+#define READ_BUFFER_POOL_MAX  256
+
+/**
+ * limits of the pool of unused chunks
+ *
+ * chunks over the limit are freed, their memory over the limit too
+ */
+#define CHUNKPOOL_MAX_CHUNKS  256
+#define CHUNKPOOL_MAX_BYTES   (256 * 1024)
+
 /**
  * max size of the HTTP request header
  *
@@ -26,6 +47,13 @@
  */
 #define MAX_HTTP_REQUEST_HEADER  (32 * 1024)
 
+/**
+ * max size of the request content waiting for a streaming handler
+ *
+ * if the handler doesn't keep up, we stop reading from the client
+ */
+#define REQUEST_CONTENT_STREAM_MAX  (256 * 1024)
+
 #ifdef HAVE_GLIB_H
 #include <glib.h>
 #endif
@@ -88,6 +116,15 @@
 # include <sys/uio.h>
 #endif
 
+/* linux 4.14+: send MEM_CHUNKs without copying them, see server.zerocopy-min-size */
+#if defined USE_WRITEV && defined HAVE_LINUX_ERRQUEUE_H && defined(__linux__)
+# include <sys/socket.h>
+# include <linux/errqueue.h>
+# if defined MSG_ZEROCOPY && defined SO_ZEROCOPY && defined SO_EE_ORIGIN_ZEROCOPY
+#  define USE_MSG_ZEROCOPY
+# endif
+#endif
+
 #if defined HAVE_SYS_MMAN_H && defined HAVE_MMAP
 # define USE_MMAP
 # include <sys/mman.h>
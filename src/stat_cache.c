@@ -309,7 +309,6 @@ static handler_t stat_cache_get_entry_internal(server *srv, connection *con, buf
 	stat_cache_entry *sce = NULL;
 	stat_cache *sc;
 	struct stat st;
-	size_t k;
 	int fd;
 	struct stat lst;
 
@@ -487,20 +486,9 @@ static handler_t stat_cache_get_entry_internal(server *srv, connection *con, buf
 #endif
 		/* xattr did not set a content-type. ask the config */
 		if (buffer_is_empty(sce->content_type)) {
-			for (k = 0; k < con->conf.mimetypes->used; k++) {
-				data_string *ds = (data_string *)con->conf.mimetypes->data[k];
-				buffer *type = ds->key;
-	
-				if (type->used == 0) continue;
-	
-				/* check if the right side is the same */
-				if (type->used > name->used) continue;
-	
-				if (0 == strncasecmp(name->ptr + name->used - type->used, type->ptr, type->used - 1)) {
-					buffer_copy_string_buffer(sce->content_type, ds->value);
-					break;
-				}
-			}
+			data_string *ds = mimetype_table_get(con->conf.mimetype_table, CONST_BUF_LEN(name));
+
+			if (ds) buffer_copy_string_buffer(sce->content_type, ds->value);
 		}
 		etag_create(sce->etag, &(sce->st), con->etag_flags);
 	} else if (S_ISDIR(st.st_mode)) {
@@ -513,6 +501,32 @@ static handler_t stat_cache_get_entry_internal(server *srv, connection *con, buf
 }
 
 
+/**
+ * forget the entries of @name, e.g. after the file was removed
+ *
+ * entries with a stat() still running in a stat-thread are left alone
+ */
+void stat_cache_invalidate_entry(server *srv, buffer *name) {
+#ifdef HAVE_GLIB_H
+	stat_cache *sc = srv->stat_cache;
+	stat_cache_entry *sce;
+	int follow_symlink;
+
+	for (follow_symlink = 0; follow_symlink <= 1; follow_symlink++) {
+		buffer_copy_string_buffer(sc->hash_key, name);
+		buffer_append_long(sc->hash_key, follow_symlink);
+
+		if (NULL == (sce = (stat_cache_entry *)g_hash_table_lookup(sc->files, sc->hash_key))) continue;
+		if (sce->state != STAT_CACHE_ENTRY_STAT_FINISHED) continue;
+
+		stat_cache_remove_entry(sc, sc->hash_key, sce);
+	}
+#else
+	UNUSED(srv);
+	UNUSED(name);
+#endif
+}
+
 handler_t stat_cache_get_entry_async(server *srv, connection *con, buffer *name, stat_cache_entry **ret_sce) {
 	return stat_cache_get_entry_internal(srv, con, name, ret_sce, 1);
 }
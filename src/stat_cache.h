@@ -9,6 +9,7 @@ LI_EXPORT void stat_cache_free(stat_cache *fc);
 LI_EXPORT handler_t stat_cache_get_entry(server *srv, connection *con, buffer *name, stat_cache_entry **fce);
 LI_EXPORT handler_t stat_cache_get_entry_async(server *srv, connection *con, buffer *name, stat_cache_entry **fce);
 LI_EXPORT handler_t stat_cache_handle_fdevent(void *_srv, void *_fce, int revent);
+LI_EXPORT void stat_cache_invalidate_entry(server *srv, buffer *name);
 
 LI_EXPORT int stat_cache_trigger_cleanup(server *srv);
 #endif
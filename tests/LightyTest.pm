@@ -266,7 +266,12 @@ sub handle_http {
 
 		if (defined $href->{'HTTP-Content'}) {
 			$resp_body = "" unless defined $resp_body;
-			if ($href->{'HTTP-Content'} ne $resp_body) {
+			if (ref($href->{'HTTP-Content'}) eq 'Regexp') {
+				if ($resp_body !~ $href->{'HTTP-Content'}) {
+					diag(sprintf("body failed: expected to match '%s', got '%s'\n", $href->{'HTTP-Content'}, $resp_body));
+					return -1;
+				}
+			} elsif ($href->{'HTTP-Content'} ne $resp_body) {
 				diag(sprintf("body failed: expected '%s', got '%s'\n", $href->{'HTTP-Content'}, $resp_body));
 				return -1;
 			}
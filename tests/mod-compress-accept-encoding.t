@@ -0,0 +1,142 @@
+#!/usr/bin/env perl
+BEGIN {
+	# add current source dir to the include-path
+	# we need this for make distcheck
+	(my $srcdir = $0) =~ s,/[^/]+$,/,;
+	unshift @INC, $srcdir;
+}
+
+use strict;
+use IO::Socket;
+use Test::More tests => 15;
+use LightyTest;
+
+my $tf = LightyTest->new();
+my $t;
+
+## which encodings are built in
+my $features = `$tf->{BINDIR}/lighttpd -V`;
+my $has_bzip2 = ($features =~ /\+ bzip2 support/);
+my $has_br = ($features =~ /\+ brotli support/);
+my $has_zstd = ($features =~ /\+ zstd support/);
+
+## the encoding we like most, see encoding_preference in mod_compress.c
+my $favourite = $has_br ? 'br' : $has_zstd ? 'zstd' : $has_bzip2 ? 'bzip2' : 'gzip';
+
+$tf->{CONFIGFILE} = 'accept-encoding.conf';
+
+ok($tf->start_proc == 0, "Starting lighttpd") or die();
+
+$t->{REQUEST}  = ( <<EOF
+GET /index.txt HTTP/1.0
+Accept-Encoding: gzip;q=0, deflate
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Vary' => 'Accept-Encoding', 'Content-Encoding' => 'deflate' } ];
+ok($tf->handle_http($t) == 0, 'q=0 refuses gzip');
+
+$t->{REQUEST}  = ( <<EOF
+GET /index.txt HTTP/1.0
+Accept-Encoding: gzip;q=0.000, deflate;q=0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Vary' => 'Accept-Encoding', '-Content-Encoding' => '' } ];
+ok($tf->handle_http($t) == 0, 'q=0 refuses everything, identity is sent');
+
+$t->{REQUEST}  = ( <<EOF
+GET /index.txt HTTP/1.0
+Accept-Encoding: *
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Vary' => 'Accept-Encoding', 'Content-Encoding' => $favourite } ];
+ok($tf->handle_http($t) == 0, '* matches all encodings');
+
+$t->{REQUEST}  = ( <<EOF
+GET /index.txt HTTP/1.0
+Accept-Encoding: deflate;q=0.5, *;q=0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Vary' => 'Accept-Encoding', 'Content-Encoding' => 'deflate' } ];
+ok($tf->handle_http($t) == 0, '*;q=0 refuses the encodings which are not listed');
+
+$t->{REQUEST}  = ( <<EOF
+GET /index.txt HTTP/1.0
+Accept-Encoding: $favourite;q=0, *
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Vary' => 'Accept-Encoding', 'Content-Encoding' => '/^(?!'.$favourite.'$)/' } ];
+ok($tf->handle_http($t) == 0, '* doesn\'t override a listed q=0');
+
+$t->{REQUEST}  = ( <<EOF
+GET /index.txt HTTP/1.0
+Accept-Encoding: x-gzip
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Vary' => 'Accept-Encoding', 'Content-Encoding' => 'gzip' } ];
+ok($tf->handle_http($t) == 0, 'x-gzip is gzip');
+
+$t->{REQUEST}  = ( <<EOF
+GET /index.txt HTTP/1.0
+Accept-Encoding: X-GZIP;q=0, deflate
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Vary' => 'Accept-Encoding', 'Content-Encoding' => 'deflate' } ];
+ok($tf->handle_http($t) == 0, 'x-gzip;q=0 refuses gzip');
+
+$t->{REQUEST}  = ( <<EOF
+GET /index.txt HTTP/1.0
+Accept-Encoding: deflate, gzip
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Vary' => 'Accept-Encoding', 'Content-Encoding' => 'gzip' } ];
+ok($tf->handle_http($t) == 0, 'equal q-values, our preference decides');
+
+$t->{REQUEST}  = ( <<EOF
+GET /index.txt HTTP/1.0
+Accept-Encoding: gzip;q=0.8, deflate;q=0.9
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Vary' => 'Accept-Encoding', 'Content-Encoding' => 'deflate' } ];
+ok($tf->handle_http($t) == 0, 'the higher q-value wins over our preference');
+
+SKIP: {
+	skip "no brotli support built in", 2 unless $has_br;
+
+$t->{REQUEST}  = ( <<EOF
+GET /index.txt HTTP/1.0
+Accept-Encoding: gzip, br
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Vary' => 'Accept-Encoding', 'Content-Encoding' => 'br' } ];
+ok($tf->handle_http($t) == 0, 'br');
+
+$t->{REQUEST}  = ( <<EOF
+GET /index.txt HTTP/1.0
+Accept-Encoding: gzip, br;q=0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Vary' => 'Accept-Encoding', 'Content-Encoding' => 'gzip' } ];
+ok($tf->handle_http($t) == 0, 'br refused by q=0');
+}
+
+SKIP: {
+	skip "no zstd support built in", 2 unless $has_zstd;
+
+$t->{REQUEST}  = ( <<EOF
+GET /index.txt HTTP/1.0
+Accept-Encoding: gzip, zstd
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Vary' => 'Accept-Encoding', 'Content-Encoding' => 'zstd' } ];
+ok($tf->handle_http($t) == 0, 'zstd');
+
+$t->{REQUEST}  = ( <<EOF
+GET /index.txt HTTP/1.0
+Accept-Encoding: gzip, zstd;q=0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Vary' => 'Accept-Encoding', 'Content-Encoding' => 'gzip' } ];
+ok($tf->handle_http($t) == 0, 'zstd refused by q=0');
+}
+
+ok($tf->stop_proc == 0, "Stopping lighttpd");
@@ -0,0 +1,117 @@
+#!/usr/bin/env perl
+BEGIN {
+	# add current source dir to the include-path
+	# we need this for make distcheck
+	(my $srcdir = $0) =~ s,/[^/]+$,/,;
+	unshift @INC, $srcdir;
+}
+
+use strict;
+use IO::Socket;
+use Test::More tests => 9;
+use LightyTest;
+
+my $tf = LightyTest->new();
+my $t;
+
+## a backend which answers with hand-written chunked responses,
+## the parts of a response are sent with a pause in between to split the reads
+my %responses = (
+	'/multi'    => [ "3\r\nabc\r\n4\r\ndefg\r\n", "a\r\nhijklmnopq\r\n0\r\n\r\n" ],
+	'/split'    => [ "1", "0;foo=bar\r\n0123456789", "abcdef\r", "\n0\r\n\r\n" ],
+	'/trailer'  => [ "5\r\nhello\r\n0\r\nX-Sum: 1\r\n", "X-Foo: bar\r\n\r\n" ],
+	'/bare-lf'  => [ "5\nhello\n0\n\n" ],
+	'/bad-crlf' => [ "5\r\nhello", "XX\r\n0\r\n\r\n" ],
+);
+
+my $backend = fork();
+die "fork failed" unless defined $backend;
+
+if ($backend == 0) {
+	# the port-check of LightyTest closes without reading
+	$SIG{PIPE} = 'IGNORE';
+
+	my $server = IO::Socket::INET->new(LocalAddr => '127.0.0.1',
+					   LocalPort => 2052,
+					   Proto => 'tcp',
+					   ReuseAddr => 1,
+					   Listen => 16) or die "listen: $!";
+
+	while (my $client = $server->accept()) {
+		my $path = '';
+
+		$client->autoflush(1);
+
+		while (<$client>) {
+			$path = $1 if (/^GET (\S+) HTTP/);
+			last if (/^\r?\n$/);
+		}
+
+		print $client "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n";
+
+		foreach my $part (@{ $responses{$path} || [ "0\r\n\r\n" ] }) {
+			print $client $part;
+			select(undef, undef, undef, 0.1);
+		}
+		close $client;
+	}
+	exit 0;
+}
+
+ok($tf->wait_for_port_with_proc(2052, $backend) == 0, 'Starting the chunked backend');
+
+$tf->{CONFIGFILE} = 'proxy-chunked.conf';
+
+ok($tf->start_proc == 0, "Starting lighttpd") or die();
+
+$t->{REQUEST}  = ( <<EOF
+GET /multi HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => 'abcdefghijklmnopq' } ];
+ok($tf->handle_http($t) == 0, 'chunked response, several chunks in several reads');
+
+$t->{REQUEST}  = ( <<EOF
+GET /split HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => '0123456789abcdef' } ];
+ok($tf->handle_http($t) == 0, 'chunked response, chunk-size and CRLF split across reads');
+
+$t->{REQUEST}  = ( <<EOF
+GET /trailer HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => 'hello' } ];
+ok($tf->handle_http($t) == 0, 'chunked response with trailer');
+
+$t->{REQUEST}  = ( <<EOF
+GET /trailer HTTP/1.1
+Host: www.example.org
+Connection: close
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.1', 'HTTP-Status' => 200, 'Transfer-Encoding' => 'chunked', 'HTTP-Content' => "5\r\nhello\r\n0\r\nX-Sum: 1\r\nX-Foo: bar\r\n\r\n" } ];
+ok($tf->handle_http($t) == 0, 'chunked response with trailer, passed through');
+
+$t->{REQUEST}  = ( <<EOF
+GET /bare-lf HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => 'hello' } ];
+ok($tf->handle_http($t) == 0, 'chunked response with bare LFs');
+
+## the response header is out already, the stream has to end at the bad octets
+$t->{REQUEST}  = ( <<EOF
+GET /bad-crlf HTTP/1.1
+Host: www.example.org
+Connection: close
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.1', 'HTTP-Status' => 200, 'HTTP-Content' => "5\r\nhello" } ];
+ok($tf->handle_http($t) == 0, 'chunked response without CRLF behind the chunk-data');
+
+ok($tf->stop_proc == 0, "Stopping lighttpd");
+
+kill('TERM', $backend);
+waitpid($backend, 0);
@@ -0,0 +1,105 @@
+#!/usr/bin/env perl
+BEGIN {
+	# add current source dir to the include-path
+	# we need this for make distcheck
+	(my $srcdir = $0) =~ s,/[^/]+$,/,;
+	unshift @INC, $srcdir;
+}
+
+use strict;
+use IO::Socket;
+use Test::More tests => 13;
+use LightyTest;
+
+my $tf = LightyTest->new();
+my $t;
+
+$tf->{CONFIGFILE} = 'mimetype.conf';
+
+ok($tf->start_proc == 0, "Starting lighttpd") or die();
+
+$t->{REQUEST}  = ( <<EOF
+GET /image.JPG HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'image/jpeg' } ];
+ok($tf->handle_http($t) == 0, 'the suffix is matched case-insensitive');
+
+$t->{REQUEST}  = ( <<EOF
+GET /archive.tar.gz HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'application/x-tgz' } ];
+ok($tf->handle_http($t) == 0, '.tar.gz is listed before .gz');
+
+$t->{REQUEST}  = ( <<EOF
+GET /archive.gz HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'application/x-gzip' } ];
+ok($tf->handle_http($t) == 0, '.gz without .tar');
+
+$t->{REQUEST}  = ( <<EOF
+GET /a HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'text/x-catch-all' } ];
+ok($tf->handle_http($t) == 0, 'the empty suffix matches a file without suffix');
+
+$t->{REQUEST}  = ( <<EOF
+GET /index.html HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'text/x-catch-all' } ];
+ok($tf->handle_http($t) == 0, 'the empty suffix matches an unknown suffix');
+
+$t->{REQUEST}  = ( <<EOF
+GET /index.txt HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'text/plain' } ];
+ok($tf->handle_http($t) == 0, 'the empty suffix is listed last and doesn\'t hide .txt');
+
+## the inherited and the copied table are shared with the global context
+$t->{REQUEST}  = ( <<EOF
+GET /archive.tar.gz HTTP/1.0
+Host: inherit.example.org
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'application/x-tgz' } ];
+ok($tf->handle_http($t) == 0, 'inherited table, .tar.gz');
+
+$t->{REQUEST}  = ( <<EOF
+GET /a HTTP/1.0
+Host: inherit.example.org
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'text/x-catch-all' } ];
+ok($tf->handle_http($t) == 0, 'inherited table, empty suffix');
+
+$t->{REQUEST}  = ( <<EOF
+GET /image.JPG HTTP/1.0
+Host: copy.example.org
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'image/jpeg' } ];
+ok($tf->handle_http($t) == 0, 'copied table, case-insensitive suffix');
+
+$t->{REQUEST}  = ( <<EOF
+GET /archive.gz HTTP/1.0
+Host: copy.example.org
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'application/x-gzip' } ];
+ok($tf->handle_http($t) == 0, 'copied table, .gz');
+
+## a table of its own
+$t->{REQUEST}  = ( <<EOF
+GET /archive.tar.gz HTTP/1.0
+Host: gz-first.example.org
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'application/x-gzip' } ];
+ok($tf->handle_http($t) == 0, '.gz is listed before .tar.gz and wins');
+
+ok($tf->stop_proc == 0, "Stopping lighttpd");
@@ -42,7 +42,9 @@ cp $srcdir/var-include-sub.conf $tmpdir/../
 touch $tmpdir/servers/www.example.org/pages/image.jpg \
       $tmpdir/servers/www.example.org/pages/image.JPG \
       $tmpdir/servers/www.example.org/pages/Foo.txt \
-      $tmpdir/servers/www.example.org/pages/a 
+      $tmpdir/servers/www.example.org/pages/a \
+      $tmpdir/servers/www.example.org/pages/archive.tar.gz \
+      $tmpdir/servers/www.example.org/pages/archive.gz
 echo "12345" > $tmpdir/servers/www.example.org/pages/range.pdf
 
 printf "%-40s" "preparing infrastructure"
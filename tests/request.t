@@ -8,7 +8,7 @@ BEGIN {
 
 use strict;
 use IO::Socket;
-use Test::More tests => 43;
+use Test::More tests => 51;
 use LightyTest;
 
 my $tf = LightyTest->new();
@@ -160,23 +160,30 @@ Host: 123.example.org
 Range: bytes=0-1,3-4
 EOF
  );
-$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 206, 'HTTP-Content' => <<EOF
-\r
---fkj49sn38dcn3\r
-Content-Range: bytes 0-1/6\r
-Content-Type: text/plain\r
-\r
-12\r
---fkj49sn38dcn3\r
-Content-Range: bytes 3-4/6\r
-Content-Type: text/plain\r
-\r
-45\r
---fkj49sn38dcn3--\r
-EOF
- } ];
+## the boundary is new for each response
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 206,
+	'Content-Type' => '/^multipart\/byteranges; boundary=[0-9a-f]{16}$/',
+	'HTTP-Content' => qr/^\r\n--([0-9a-f]{16})\r\nContent-Range: bytes 0-1\/6\r\nContent-Type: text\/plain\r\n\r\n12\r\n--\1\r\nContent-Range: bytes 3-4\/6\r\nContent-Type: text\/plain\r\n\r\n45\r\n--\1--\r\n$/ } ];
 ok($tf->handle_http($t) == 0, 'GET, Range 0-1,3-4');
 
+$t->{REQUEST}  = ( <<EOF
+GET /12345.txt HTTP/1.0
+Host: 123.example.org
+Range: bytes=2-3,0-1
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 206, 'HTTP-Content' => '1234', 'Content-Range' => 'bytes 0-3/6' } ];
+ok($tf->handle_http($t) == 0, 'GET, Range 2-3,0-1 (adjacent ranges are merged)');
+
+$t->{REQUEST}  = ( <<EOF
+GET /12345.txt HTTP/1.0
+Host: 123.example.org
+Range: bytes=1-3,0-2,-2
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 206, 'HTTP-Content' => '12345'."\n", 'Content-Range' => 'bytes 0-5/6' } ];
+ok($tf->handle_http($t) == 0, 'GET, Range 1-3,0-2,-2 (overlapping ranges are merged)');
+
 $t->{REQUEST}  = ( <<EOF
 GET /12345.txt HTTP/1.0
 Host: 123.example.org
@@ -295,6 +302,7 @@ EOF
  );
 $t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 400 } ];
 ok($tf->handle_http($t) == 0, 'Duplicate Content-Type headers');
+}
 
 $t->{REQUEST}  = ( <<EOF
 GET / HTTP/1.0
@@ -305,6 +313,15 @@ EOF
 $t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 400 } ];
 ok($tf->handle_http($t) == 0, 'Duplicate Range headers');
 
+$t->{REQUEST}  = ( <<EOF
+GET / HTTP/1.0
+Range: bytes=5-6
+range: bytes=5-6
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 400 } ];
+ok($tf->handle_http($t) == 0, 'Duplicate Range headers, different case');
+
 $t->{REQUEST}  = ( <<EOF
 GET / HTTP/1.0
 If-Modified-Since: 5
@@ -313,7 +330,6 @@ EOF
  );
 $t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 400 } ];
 ok($tf->handle_http($t) == 0, 'Duplicate If-Modified-Since headers');
-}
 $t->{REQUEST}  = ( <<EOF
 GET /range.pdf HTTP/1.0
 Range: bytes=0-
@@ -360,17 +376,87 @@ EOF
 $t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 400 } ];
 ok($tf->handle_http($t) == 0, 'HEAD with Content-Length');
 
-TODO: {
-  local $TODO = "to be fixed later";
 $t->{REQUEST}  = ( <<EOF
-GET / HTTP/1.0
+GET /index.html HTTP/1.0
 If-Modified-Since: Sun, 01 Jan 2036 00:00:02 GMT
 If-Modified-Since: Sun, 01 Jan 2036 00:00:02 GMT
 EOF
  );
 $t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 304} ];
 ok($tf->handle_http($t) == 0, 'Duplicate If-Mod-Since, with equal timestamps');
-}
+
+## the header names are looked up without case
+$t->{REQUEST}  = ( <<EOF
+GET /12345.txt HTTP/1.0
+hOsT: 123.example.org
+rAnGe: bytes=0-3
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 206, 'HTTP-Content' => '1234' } ];
+ok($tf->handle_http($t) == 0, 'mixed-case Host and Range');
+
+$t->{REQUEST}  = ( <<EOF
+GET /index.html HTTP/1.0
+IF-MODIFIED-SINCE: Sun, 01 Jan 2036 00:00:02 GMT
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 304 } ];
+ok($tf->handle_http($t) == 0, 'upper-case If-Modified-Since');
+
+## more than 8 headers, they are found through the hash-index of the array
+$t->{REQUEST}  = ( <<EOF
+GET /12345.txt HTTP/1.0
+X-Filler-1: 1
+X-Filler-2: 2
+X-Filler-3: 3
+X-Filler-4: 4
+X-Filler-5: 5
+X-Filler-6: 6
+X-Filler-7: 7
+X-Filler-8: 8
+X-Filler-9: 9
+HOST: 123.example.org
+range: bytes=0-3
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 206, 'HTTP-Content' => '1234' } ];
+ok($tf->handle_http($t) == 0, 'Host and Range behind 9 other headers');
+
+$t->{REQUEST}  = ( <<EOF
+GET /12345.txt HTTP/1.0
+X-Filler-1: 1
+X-Filler-2: 2
+X-Filler-3: 3
+X-Filler-4: 4
+X-Filler-5: 5
+X-Filler-6: 6
+X-Filler-7: 7
+X-Filler-8: 8
+X-Filler-9: 9
+Range: bytes=0-3
+RANGE: bytes=1-2
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 400 } ];
+ok($tf->handle_http($t) == 0, 'Duplicate Range headers behind 9 other headers');
+
+$t->{REQUEST}  = ( <<EOF
+GET /index.html HTTP/1.0
+X-Filler-1: 1
+X-Filler-2: 2
+X-Filler-3: 3
+X-Filler-4: 4
+X-Filler-5: 5
+X-Filler-6: 6
+X-Filler-7: 7
+X-Filler-8: 8
+X-Filler-9: 9
+If-Modified-Since: Sun, 01 Jan 2036 00:00:02 GMT
+if-modified-since: Sun, 01 Jan 2036 00:00:03 GMT
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 400 } ];
+ok($tf->handle_http($t) == 0, 'Duplicate If-Modified-Since headers behind 9 other headers');
 
 $t->{REQUEST}  = ( "GET / HTTP/1.0\r\nIf-Modified-Since: \0\r\n\r\n" );
 $t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 400 } ];